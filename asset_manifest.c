@@ -0,0 +1,384 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "asset_manifest.h"
+#include "file_cache.h"
+#include "static_bundle.h"
+#include "url_path.h"
+#include "utils.h"
+
+#define ASSET_PATH_SIZE 1024
+#define ASSET_ETAG_SIZE 24
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_CREATE | IN_DELETE)
+
+typedef struct {
+    char *logical;                   // Below the static directory, e.g. "/app.js"
+    char etag[ASSET_ETAG_SIZE];      // Quoted hash of the contents, as http_pack writes it
+} asset_t;
+
+typedef struct {
+    asset_t *items;
+    size_t count;
+    size_t capacity;
+} asset_list_t;
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+    int failed;
+} json_buffer_t;
+
+// One published manifest. A rebuild publishes a new one instead of
+// changing it, so responses can keep pointing into an old one.
+typedef struct {
+    int refcount;
+    char etag[ASSET_ETAG_SIZE];
+    size_t length;
+    char json[];
+} manifest_t;
+
+static manifest_t *current = NULL;
+static pthread_mutex_t manifest_lock = PTHREAD_MUTEX_INITIALIZER;
+static char static_root[ASSET_PATH_SIZE];
+static size_t max_file_size = 0;
+static int built = 0;
+static int watch_fd = -1;
+
+static int is_fingerprint(const char *text, size_t length) {
+    if (length != ASSET_FINGERPRINT_LENGTH) {
+        return 0;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (!((text[i] >= '0' && text[i] <= '9') || (text[i] >= 'a' && text[i] <= 'f'))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int asset_fingerprint_split(const char *path, char *logical, size_t logical_size,
+                            char fingerprint[ASSET_FINGERPRINT_LENGTH + 1]) {
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    const char *extension = strrchr(name, '.');
+    if (!extension || extension == name) {
+        return -1;
+    }
+
+    // "name.<fingerprint>.ext", or "name.<fingerprint>" for a file without an extension
+    const char *start;
+    const char *end;
+    if (extension - name > ASSET_FINGERPRINT_LENGTH + 1 &&
+        extension[-ASSET_FINGERPRINT_LENGTH - 1] == '.' &&
+        is_fingerprint(extension - ASSET_FINGERPRINT_LENGTH, ASSET_FINGERPRINT_LENGTH)) {
+        start = extension - ASSET_FINGERPRINT_LENGTH - 1;
+        end = extension;
+    } else if (is_fingerprint(extension + 1, strlen(extension + 1))) {
+        start = extension;
+        end = extension + 1 + ASSET_FINGERPRINT_LENGTH;
+    } else {
+        return -1;
+    }
+
+    size_t before = start - path;
+    size_t after = strlen(end);
+    if (before + after >= logical_size) {
+        return -1;
+    }
+    memcpy(logical, path, before);
+    memcpy(logical + before, end, after + 1);
+    memcpy(fingerprint, start + 1, ASSET_FINGERPRINT_LENGTH);
+    fingerprint[ASSET_FINGERPRINT_LENGTH] = '\0';
+    return 0;
+}
+
+int asset_fingerprint_matches(const char *etag, const char *fingerprint) {
+    return etag && etag[0] == '"' && strlen(etag) == ASSET_FINGERPRINT_LENGTH + 2 &&
+           etag[ASSET_FINGERPRINT_LENGTH + 1] == '"' &&
+           strncmp(etag + 1, fingerprint, ASSET_FINGERPRINT_LENGTH) == 0;
+}
+
+// "/app.js" becomes "/app.<fingerprint>.js"
+static int format_alias(const char *logical, const char *etag, char *alias, size_t alias_size) {
+    const char *name = strrchr(logical, '/');
+    name = name ? name + 1 : logical;
+    const char *extension = strrchr(name, '.');
+    if (!extension || extension == name) {
+        extension = logical + strlen(logical);
+    }
+    int written = snprintf(alias, alias_size, "%.*s.%.*s%s", (int)(extension - logical), logical,
+                           ASSET_FINGERPRINT_LENGTH, etag + 1, extension);
+    return written > 0 && (size_t)written < alias_size ? 0 : -1;
+}
+
+static void add_asset(asset_list_t *list, const char *logical, const char *etag) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 64;
+        asset_t *items = realloc(list->items, capacity * sizeof(asset_t));
+        if (!items) {
+            return;
+        }
+        list->items = items;
+        list->capacity = capacity;
+    }
+    asset_t *asset = &list->items[list->count];
+    asset->logical = strdup(logical);
+    if (!asset->logical) {
+        return;
+    }
+    snprintf(asset->etag, sizeof(asset->etag), "%s", etag);
+    list->count++;
+}
+
+static void free_assets(asset_list_t *list) {
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->items[i].logical);
+    }
+    free(list->items);
+}
+
+// Hash the files below directory through the file cache, so serving them
+// afterwards reads nothing again. Hidden files, which include the
+// temporary files of most editors, are left out.
+static void scan_directory(const char *directory, const char *relative, int depth, asset_list_t *list) {
+    DIR *dir = opendir(directory);
+    if (!dir) {
+        return;
+    }
+    if (watch_fd >= 0) {
+        inotify_add_watch(watch_fd, directory, WATCH_EVENTS);
+    }
+
+    struct dirent *item;
+    while ((item = readdir(dir)) != NULL) {
+        if (item->d_name[0] == '.') {
+            continue;
+        }
+        char full_path[ASSET_PATH_SIZE];
+        char logical[ASSET_PATH_SIZE];
+        if ((size_t)snprintf(full_path, sizeof(full_path), "%s/%s", directory, item->d_name) >= sizeof(full_path) ||
+            (size_t)snprintf(logical, sizeof(logical), "%s/%s", relative, item->d_name) >= sizeof(logical)) {
+            continue;
+        }
+
+        struct stat st;
+        if (stat(full_path, &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            if (depth < ASSET_MAX_DEPTH) {
+                scan_directory(full_path, logical, depth + 1, list);
+            }
+            continue;
+        }
+
+        file_cache_entry_t *entry = NULL;
+        if (!S_ISREG(st.st_mode) || file_cache_acquire(full_path, max_file_size, &entry) != FILE_CACHE_OK) {
+            continue;
+        }
+        char etag[ASSET_ETAG_SIZE];
+        snprintf(etag, sizeof(etag), "\"%016llx\"", file_cache_entry_hash(entry));
+        file_cache_release(entry);
+        add_asset(list, logical, etag);
+    }
+    closedir(dir);
+}
+
+static int compare_assets(const void *a, const void *b) {
+    return strcmp(((const asset_t *)a)->logical, ((const asset_t *)b)->logical);
+}
+
+static void append(json_buffer_t *json, const char *text) {
+    size_t length = strlen(text);
+    if (json->failed) {
+        return;
+    }
+    if (json->length + length >= json->capacity) {
+        size_t capacity = json->capacity * 2 + length;
+        char *data = realloc(json->data, capacity);
+        if (!data) {
+            json->failed = 1;
+            return;
+        }
+        json->data = data;
+        json->capacity = capacity;
+    }
+    memcpy(json->data + json->length, text, length + 1);
+    json->length += length;
+}
+
+// Escaped paths hold no quotes or backslashes, so they need no JSON escaping
+static void append_url(json_buffer_t *json, const char *path) {
+    char url[ASSET_PATH_SIZE * 3 + 8];
+    memcpy(url, "/static", 7);
+    if (encode_url_path(path, url + 7, sizeof(url) - 7) < 0) {
+        json->failed = 1;
+        return;
+    }
+    append(json, "\"");
+    append(json, url);
+    append(json, "\"");
+}
+
+// Render the list and make it the current manifest
+static int publish(asset_list_t *list) {
+    qsort(list->items, list->count, sizeof(asset_t), compare_assets);
+
+    json_buffer_t json = { malloc(4096), 0, 4096, 0 };
+    if (!json.data) {
+        return -1;
+    }
+    json.data[0] = '\0';
+    append(&json, "{");
+    for (size_t i = 0; i < list->count; i++) {
+        char alias[ASSET_PATH_SIZE + ASSET_FINGERPRINT_LENGTH + 2];
+        if (format_alias(list->items[i].logical, list->items[i].etag, alias, sizeof(alias)) != 0) {
+            continue;
+        }
+        append(&json, i > 0 ? ",\n  " : "\n  ");
+        append_url(&json, list->items[i].logical);
+        append(&json, ": ");
+        append_url(&json, alias);
+    }
+    append(&json, "\n}\n");
+
+    manifest_t *manifest = json.failed ? NULL : malloc(sizeof(manifest_t) + json.length + 1);
+    if (!manifest) {
+        free(json.data);
+        return -1;
+    }
+    manifest->refcount = 1;
+    manifest->length = json.length;
+    memcpy(manifest->json, json.data, json.length + 1);
+    free(json.data);
+
+    // The manifest's own ETag lets clients revalidate it cheaply
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < manifest->length; i++) {
+        hash ^= (unsigned char)manifest->json[i];
+        hash *= 1099511628211ULL;
+    }
+    snprintf(manifest->etag, sizeof(manifest->etag), "\"%016llx\"", hash);
+
+    pthread_mutex_lock(&manifest_lock);
+    manifest_t *previous = current;
+    current = manifest;
+    pthread_mutex_unlock(&manifest_lock);
+    asset_manifest_release(previous);
+    return 0;
+}
+
+static int rebuild(void) {
+    asset_list_t list = { NULL, 0, 0 };
+    if (static_bundle_loaded()) {
+        // Bundled files were hashed by http_pack already
+        for (int i = 0; i < static_bundle_count(); i++) {
+            static_asset_t asset;
+            if (static_bundle_get(i, &asset) == 0 && strlen(asset.path) < ASSET_PATH_SIZE) {
+                add_asset(&list, asset.path, asset.etag);
+            }
+        }
+    } else {
+        scan_directory(static_root, "", 0, &list);
+    }
+
+    int count = (int)list.count;
+    int result = publish(&list);
+    free_assets(&list);
+    return result == 0 ? count : -1;
+}
+
+int asset_manifest_build(const char *static_dir, size_t max_size) {
+    if (strlen(static_dir) >= sizeof(static_root)) {
+        return -1;
+    }
+    strcpy(static_root, static_dir);
+    max_file_size = max_size;
+    built = 1;
+    return rebuild();
+}
+
+static void *watch_thread(void *arg) {
+    (void)arg;
+    char events[4096];
+    for (;;) {
+        ssize_t length = read(watch_fd, events, sizeof(events));
+        if (length < 0 && errno == EINTR) {
+            continue;
+        }
+        if (length <= 0) {
+            break;
+        }
+
+        // A deploy or an editor saving comes as a burst of events; rebuild
+        // once it is over. Which files changed does not matter: the scan
+        // only reads files the file cache finds changed.
+        struct pollfd poll_fd = { watch_fd, POLLIN, 0 };
+        while (poll(&poll_fd, 1, ASSET_SETTLE_MS) > 0 && read(watch_fd, events, sizeof(events)) > 0) {
+        }
+        if (rebuild() < 0) {
+            fprintf(stderr, "Failed to rebuild the asset manifest\n");
+        }
+    }
+    return NULL;
+}
+
+int asset_manifest_watch(void) {
+    struct stat st;
+    if (!built || static_bundle_loaded() || stat(static_root, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return 0;
+    }
+
+    watch_fd = inotify_init1(IN_CLOEXEC);
+    if (watch_fd < 0) {
+        perror("Failed to watch the static directory");
+        return -1;
+    }
+
+    // Scan again to put a watch on every directory, which also picks up
+    // anything that changed since the first build
+    if (rebuild() < 0 || start_detached_thread(watch_thread, NULL, 0) != 0) {
+        close(watch_fd);
+        watch_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+const char *asset_manifest_acquire(size_t *length, const char **etag, void **owner) {
+    pthread_mutex_lock(&manifest_lock);
+    manifest_t *manifest = current;
+    if (manifest) {
+        manifest->refcount++;
+    }
+    pthread_mutex_unlock(&manifest_lock);
+
+    *owner = manifest;
+    if (!manifest) {
+        return NULL;
+    }
+    *length = manifest->length;
+    *etag = manifest->etag;
+    return manifest->json;
+}
+
+void asset_manifest_release(void *owner) {
+    manifest_t *manifest = owner;
+    if (!manifest) {
+        return;
+    }
+    pthread_mutex_lock(&manifest_lock);
+    int unused = --manifest->refcount == 0;
+    pthread_mutex_unlock(&manifest_lock);
+    if (unused) {
+        free(manifest);
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef ASSET_MANIFEST_H
+#define ASSET_MANIFEST_H
+
+#include <stddef.h>
+
+// Fingerprinted static file URLs. Every static file is also served as
+// /static/name.<fingerprint>.ext, the fingerprint being the whole 64-bit
+// FNV-1a hash of its contents (the hash http_pack writes into ETags). The
+// file is only served under it while its hash matches in full, so such a
+// URL names one version of the file, barring two versions that collide on
+// all 64 bits; it is sent with ASSET_IMMUTABLE_CACHE_CONTROL and clients
+// do not ask for it again. The
+// manifest maps each logical URL to its current fingerprinted one; it is
+// built at startup and, for a static directory, rebuilt whenever inotify
+// reports a change.
+#define ASSET_FINGERPRINT_LENGTH 16     // Hex digits of the hash in a URL, all of it
+#define ASSET_IMMUTABLE_CACHE_CONTROL "public, max-age=31536000, immutable"
+#define ASSET_MANIFEST_PATH "/asset-manifest.json"
+#define ASSET_SETTLE_MS 100             // Quiet time after a change before rebuilding
+#define ASSET_MAX_DEPTH 16              // Directory levels scanned below the static directory
+
+// Hash every file below static_dir, or every bundled file when a bundle is
+// loaded; files over max_size are left out. Call before forking workers.
+// Returns the number of files in the manifest, or -1 on failure.
+int asset_manifest_build(const char *static_dir, size_t max_size);
+
+// Rebuild the manifest from a thread whenever a file below the static
+// directory changes. Called by every process that serves requests, after
+// any fork. Returns 0, also when there is nothing to watch.
+int asset_manifest_watch(void);
+
+// Split a path below the static directory such as "/app.3f9a1c0d5e7b2468.js" into
+// the logical path "/app.js" and its fingerprint. Returns -1 when the name
+// carries no fingerprint.
+int asset_fingerprint_split(const char *path, char *logical, size_t logical_size,
+                            char fingerprint[ASSET_FINGERPRINT_LENGTH + 1]);
+
+// Whether content with a quoted ETag as http_pack writes them has the
+// given fingerprint, comparing the whole hash
+int asset_fingerprint_matches(const char *etag, const char *fingerprint);
+
+// The current manifest as JSON, with its ETag. The caller holds a reference
+// and drops it with asset_manifest_release(*owner), which also suits
+// set_response_body_shared(). Returns NULL before the first build.
+const char *asset_manifest_acquire(size_t *length, const char **etag, void **owner);
+void asset_manifest_release(void *owner);
+
+#endif
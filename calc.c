@@ -0,0 +1,430 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "calc.h"
+
+// Longest text one result takes: "error division_by_zero" or
+// {"error":"division_by_zero"}, and a separator
+#define CALC_RESULT_TEXT_SIZE 40
+
+static const char *const operation_names[CALC_OPERATION_COUNT] = { "add", "sub", "mul", "div" };
+
+// The kernels below work on whole lanes. Wrapping arithmetic is done on
+// unsigned values, where it is defined, and the overflow test is a sign-bit
+// expression rather than a branch, so the loops vectorize.
+
+static void add_kernel(const long long *restrict a, const long long *restrict b,
+                       long long *restrict results, unsigned char *restrict flags, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        unsigned long long x = (unsigned long long)a[i];
+        unsigned long long y = (unsigned long long)b[i];
+        unsigned long long sum = x + y;
+        results[i] = (long long)sum;
+        // Overflow when both operands have the sign the sum does not
+        flags[i] = (unsigned char)(((x ^ sum) & (y ^ sum)) >> 63);
+    }
+}
+
+static void sub_kernel(const long long *restrict a, const long long *restrict b,
+                       long long *restrict results, unsigned char *restrict flags, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        unsigned long long x = (unsigned long long)a[i];
+        unsigned long long y = (unsigned long long)b[i];
+        unsigned long long difference = x - y;
+        results[i] = (long long)difference;
+        // Overflow when the operands differ in sign and the result has the second's
+        flags[i] = (unsigned char)(((x ^ y) & (x ^ difference)) >> 63);
+    }
+}
+
+// No vector instruction multiplies 64-bit lanes with an overflow check, so
+// this one stays a scalar loop around the compiler's checked multiply
+static void mul_kernel(const long long *restrict a, const long long *restrict b,
+                       long long *restrict results, unsigned char *restrict flags, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        flags[i] = __builtin_mul_overflow(a[i], b[i], &results[i]) ? CALC_FLAG_OVERFLOW : 0;
+    }
+}
+
+// Division has no vector form either; the divisor is made safe instead of
+// branching around the two undefined cases
+static void div_kernel(const long long *restrict a, const long long *restrict b,
+                       long long *restrict results, unsigned char *restrict flags, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int by_zero = b[i] == 0;
+        int overflow = a[i] == LLONG_MIN && b[i] == -1;
+        results[i] = a[i] / (by_zero | overflow ? 1 : b[i]);
+        flags[i] = (unsigned char)((by_zero ? CALC_FLAG_DIVIDE_BY_ZERO : 0) | (overflow ? CALC_FLAG_OVERFLOW : 0));
+    }
+}
+
+typedef void (*calc_kernel_t)(const long long *restrict a, const long long *restrict b,
+                              long long *restrict results, unsigned char *restrict flags, size_t count);
+
+static const calc_kernel_t kernels[CALC_OPERATION_COUNT] = { add_kernel, sub_kernel, mul_kernel, div_kernel };
+
+int calc_operation_from_name(const char *name, size_t length) {
+    for (int i = 0; i < CALC_OPERATION_COUNT; i++) {
+        if (strlen(operation_names[i]) == length && memcmp(operation_names[i], name, length) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int calc_parse_operand(const char *text, size_t length, long long *value) {
+    size_t i = 0;
+    int negative = 0;
+    if (i < length && (text[i] == '-' || text[i] == '+')) {
+        negative = text[i] == '-';
+        i++;
+    }
+    if (i == length) {
+        return -1;
+    }
+
+    // Accumulate towards the negative end, which has room for LLONG_MIN
+    long long result = 0;
+    for (; i < length; i++) {
+        if (text[i] < '0' || text[i] > '9') {
+            return -1;
+        }
+        int digit = text[i] - '0';
+        if (result < (LLONG_MIN + digit) / 10) {
+            return -1;
+        }
+        result = result * 10 - digit;
+    }
+    if (!negative) {
+        if (result == LLONG_MIN) {
+            return -1;
+        }
+        result = -result;
+    }
+    *value = result;
+    return 0;
+}
+
+int calc_evaluate(int operation, long long a, long long b, long long *result) {
+    unsigned char flags = 0;
+    kernels[operation](&a, &b, result, &flags, 1);
+    return flags;
+}
+
+void calc_batch_init(calc_batch_t *batch) {
+    memset(batch, 0, sizeof(calc_batch_t));
+}
+
+void calc_batch_free(calc_batch_t *batch) {
+    for (int i = 0; i < CALC_OPERATION_COUNT; i++) {
+        calc_lane_t *lane = &batch->lanes[i];
+        free(lane->a);
+        free(lane->b);
+        free(lane->results);
+        free(lane->flags);
+    }
+    free(batch->operations);
+    free(batch->positions);
+    calc_batch_init(batch);
+}
+
+// Grow an allocation to bytes, keeping its contents. On failure the old
+// block is returned unchanged and *failed is set.
+static void *resize(void *array, size_t bytes, int *failed) {
+    void *grown = realloc(array, bytes);
+    if (!grown) {
+        *failed = 1;
+        return array;
+    }
+    return grown;
+}
+
+static int append(calc_batch_t *batch, int operation, long long a, long long b) {
+    int failed = 0;
+    if (batch->count == batch->capacity) {
+        size_t capacity = batch->capacity ? batch->capacity * 2 : 64;
+        batch->operations = resize(batch->operations, capacity * sizeof(unsigned char), &failed);
+        batch->positions = resize(batch->positions, capacity * sizeof(size_t), &failed);
+        if (failed) {
+            return -1;
+        }
+        batch->capacity = capacity;
+    }
+
+    calc_lane_t *lane = &batch->lanes[operation];
+    if (lane->count == lane->capacity) {
+        size_t capacity = lane->capacity ? lane->capacity * 2 : 64;
+        lane->a = resize(lane->a, capacity * sizeof(long long), &failed);
+        lane->b = resize(lane->b, capacity * sizeof(long long), &failed);
+        lane->results = resize(lane->results, capacity * sizeof(long long), &failed);
+        lane->flags = resize(lane->flags, capacity * sizeof(unsigned char), &failed);
+        if (failed) {
+            return -1;
+        }
+        lane->capacity = capacity;
+    }
+
+    lane->a[lane->count] = a;
+    lane->b[lane->count] = b;
+    batch->operations[batch->count] = (unsigned char)operation;
+    batch->positions[batch->count] = lane->count;
+    lane->count++;
+    batch->count++;
+    return 0;
+}
+
+static int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Text batches: one "op a b" per line, blank lines ignored
+static int parse_text(calc_batch_t *batch, const char *text, size_t length, char *error, size_t error_size) {
+    size_t position = 0;
+    while (position < length) {
+        size_t line_end = position;
+        while (line_end < length && text[line_end] != '\n') {
+            line_end++;
+        }
+
+        // Split the line into at most four words to notice extra ones
+        const char *words[4];
+        size_t word_lengths[4];
+        int word_count = 0;
+        size_t i = position;
+        while (i < line_end && word_count < 4) {
+            while (i < line_end && is_space(text[i])) {
+                i++;
+            }
+            if (i == line_end) {
+                break;
+            }
+            words[word_count] = text + i;
+            while (i < line_end && !is_space(text[i])) {
+                i++;
+            }
+            word_lengths[word_count] = text + i - words[word_count];
+            word_count++;
+        }
+        position = line_end + 1;
+        if (word_count == 0) {
+            continue;
+        }
+
+        int operation = word_count == 3 ? calc_operation_from_name(words[0], word_lengths[0]) : -1;
+        long long a, b;
+        if (operation < 0 || calc_parse_operand(words[1], word_lengths[1], &a) != 0 ||
+            calc_parse_operand(words[2], word_lengths[2], &b) != 0) {
+            snprintf(error, error_size, "operation %zu: expected \"add|sub|mul|div a b\" with 64-bit integers",
+                     batch->count + 1);
+            return -1;
+        }
+        if (append(batch, operation, a, b) != 0) {
+            snprintf(error, error_size, "out of memory");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    const char *text;
+    size_t length;
+    size_t position;
+} json_cursor_t;
+
+static void skip_json_space(json_cursor_t *cursor) {
+    while (cursor->position < cursor->length && is_space(cursor->text[cursor->position])) {
+        cursor->position++;
+    }
+}
+
+// Consume c (after any whitespace) if it is next
+static int accept_json(json_cursor_t *cursor, char c) {
+    skip_json_space(cursor);
+    if (cursor->position < cursor->length && cursor->text[cursor->position] == c) {
+        cursor->position++;
+        return 1;
+    }
+    return 0;
+}
+
+// A string without escapes; the keys and operation names never need any
+static int parse_json_string(json_cursor_t *cursor, const char **string, size_t *string_length) {
+    if (!accept_json(cursor, '"')) {
+        return -1;
+    }
+    size_t start = cursor->position;
+    while (cursor->position < cursor->length && cursor->text[cursor->position] != '"') {
+        if (cursor->text[cursor->position] == '\\') {
+            return -1;
+        }
+        cursor->position++;
+    }
+    if (cursor->position == cursor->length) {
+        return -1;
+    }
+    *string = cursor->text + start;
+    *string_length = cursor->position - start;
+    cursor->position++;
+    return 0;
+}
+
+static int parse_json_integer(json_cursor_t *cursor, long long *value) {
+    skip_json_space(cursor);
+    size_t start = cursor->position;
+    while (cursor->position < cursor->length &&
+           (cursor->text[cursor->position] == '-' ||
+            (cursor->text[cursor->position] >= '0' && cursor->text[cursor->position] <= '9'))) {
+        cursor->position++;
+    }
+    return calc_parse_operand(cursor->text + start, cursor->position - start, value);
+}
+
+// One {"op":"add","a":1,"b":2} object, keys in any order
+static int parse_json_operation(json_cursor_t *cursor, int *operation, long long *a, long long *b) {
+    int seen = 0;
+    if (!accept_json(cursor, '{')) {
+        return -1;
+    }
+    do {
+        const char *key;
+        size_t key_length;
+        if (parse_json_string(cursor, &key, &key_length) != 0 || !accept_json(cursor, ':')) {
+            return -1;
+        }
+        if (key_length == 2 && memcmp(key, "op", 2) == 0) {
+            const char *name;
+            size_t name_length;
+            if (parse_json_string(cursor, &name, &name_length) != 0 ||
+                (*operation = calc_operation_from_name(name, name_length)) < 0) {
+                return -1;
+            }
+            seen |= 1;
+        } else if (key_length == 1 && (key[0] == 'a' || key[0] == 'b')) {
+            if (parse_json_integer(cursor, key[0] == 'a' ? a : b) != 0) {
+                return -1;
+            }
+            seen |= key[0] == 'a' ? 2 : 4;
+        } else {
+            return -1;
+        }
+    } while (accept_json(cursor, ','));
+    return accept_json(cursor, '}') && seen == 7 ? 0 : -1;
+}
+
+static int parse_json(calc_batch_t *batch, const char *text, size_t length, char *error, size_t error_size) {
+    json_cursor_t cursor = { text, length, 0 };
+    if (!accept_json(&cursor, '[')) {
+        snprintf(error, error_size, "expected a JSON array");
+        return -1;
+    }
+    if (!accept_json(&cursor, ']')) {
+        do {
+            int operation = -1;
+            long long a = 0, b = 0;
+            if (parse_json_operation(&cursor, &operation, &a, &b) != 0) {
+                snprintf(error, error_size,
+                         "operation %zu: expected {\"op\":\"add|sub|mul|div\",\"a\":integer,\"b\":integer}",
+                         batch->count + 1);
+                return -1;
+            }
+            if (append(batch, operation, a, b) != 0) {
+                snprintf(error, error_size, "out of memory");
+                return -1;
+            }
+        } while (accept_json(&cursor, ','));
+        if (!accept_json(&cursor, ']')) {
+            snprintf(error, error_size, "operation %zu: expected ',' or ']'", batch->count + 1);
+            return -1;
+        }
+    }
+    skip_json_space(&cursor);
+    if (cursor.position != length) {
+        snprintf(error, error_size, "unexpected data after the JSON array");
+        return -1;
+    }
+    return 0;
+}
+
+int calc_batch_parse(calc_batch_t *batch, const char *text, size_t length, char *error, size_t error_size) {
+    size_t first = 0;
+    while (first < length && is_space(text[first])) {
+        first++;
+    }
+    batch->format = first < length && text[first] == '[' ? CALC_FORMAT_JSON : CALC_FORMAT_TEXT;
+    return batch->format == CALC_FORMAT_JSON ? parse_json(batch, text, length, error, error_size) :
+                                               parse_text(batch, text, length, error, error_size);
+}
+
+void calc_batch_evaluate(calc_batch_t *batch) {
+    for (int i = 0; i < CALC_OPERATION_COUNT; i++) {
+        calc_lane_t *lane = &batch->lanes[i];
+        kernels[i](lane->a, lane->b, lane->results, lane->flags, lane->count);
+    }
+}
+
+// Decimal text of value at out, returning its length; snprintf would cost
+// more than the arithmetic it reports
+static size_t format_integer(char *out, long long value) {
+    char digits[24];
+    size_t count = 0;
+    unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    do {
+        digits[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+
+    size_t length = 0;
+    if (value < 0) {
+        out[length++] = '-';
+    }
+    while (count > 0) {
+        out[length++] = digits[--count];
+    }
+    return length;
+}
+
+static size_t append_text(char *out, const char *text) {
+    size_t length = strlen(text);
+    memcpy(out, text, length);
+    return length;
+}
+
+char *calc_batch_format(const calc_batch_t *batch, size_t *length) {
+    char *out = malloc(batch->count * CALC_RESULT_TEXT_SIZE + 4);
+    if (!out) {
+        return NULL;
+    }
+    int json = batch->format == CALC_FORMAT_JSON;
+
+    size_t used = 0;
+    if (json) {
+        out[used++] = '[';
+    }
+    for (size_t i = 0; i < batch->count; i++) {
+        const calc_lane_t *lane = &batch->lanes[batch->operations[i]];
+        size_t position = batch->positions[i];
+        unsigned char flags = lane->flags[position];
+        const char *failure = (flags & CALC_FLAG_DIVIDE_BY_ZERO) ? "division_by_zero" :
+                              (flags & CALC_FLAG_OVERFLOW) ? "overflow" : NULL;
+
+        if (json && i > 0) {
+            out[used++] = ',';
+        }
+        if (failure) {
+            used += append_text(out + used, json ? "{\"error\":\"" : "error ");
+            used += append_text(out + used, failure);
+            used += append_text(out + used, json ? "\"}" : "\n");
+        } else {
+            used += append_text(out + used, json ? "{\"result\":" : "");
+            used += format_integer(out + used, lane->results[position]);
+            used += append_text(out + used, json ? "}" : "\n");
+        }
+    }
+    if (json) {
+        used += append_text(out + used, "]\n");
+    }
+    *length = used;
+    return out;
+}
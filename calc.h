@@ -0,0 +1,67 @@
+#ifndef CALC_H
+#define CALC_H
+
+#include <stddef.h>
+
+#define CALC_BATCH_MAX_BODY (4 * 1024 * 1024)   // Largest batch body accepted
+
+// Operations the calculator knows
+#define CALC_ADD 0
+#define CALC_SUB 1
+#define CALC_MUL 2
+#define CALC_DIV 3
+#define CALC_OPERATION_COUNT 4
+
+// Per-result flags; a flagged result is not meaningful
+#define CALC_FLAG_OVERFLOW       0x1
+#define CALC_FLAG_DIVIDE_BY_ZERO 0x2
+
+// Output format of a batch, chosen by the format of its input
+#define CALC_FORMAT_TEXT 0    // One "op a b" per line in, one result per line out
+#define CALC_FORMAT_JSON 1    // [{"op":"add","a":1,"b":2},...] in, [{"result":3},...] out
+
+// Operands of one operation kind, packed contiguously so that a kernel runs
+// over plain arrays the compiler can vectorize
+typedef struct {
+    long long *a;
+    long long *b;
+    long long *results;
+    unsigned char *flags;
+    size_t count;
+    size_t capacity;
+} calc_lane_t;
+
+typedef struct {
+    calc_lane_t lanes[CALC_OPERATION_COUNT];
+    unsigned char *operations;   // In batch order
+    size_t *positions;           // Where each operation sits in its lane
+    size_t count;
+    size_t capacity;
+    int format;                  // CALC_FORMAT_ of the input, used for the output
+} calc_batch_t;
+
+// Operation for a name such as "add", or -1 if unknown
+int calc_operation_from_name(const char *name, size_t length);
+
+// Parse a whole decimal 64-bit integer. Returns -1 when the text is not a
+// number or does not fit.
+int calc_parse_operand(const char *text, size_t length, long long *value);
+
+// Evaluate one operation, returning its CALC_FLAG_ flags
+int calc_evaluate(int operation, long long a, long long b, long long *result);
+
+void calc_batch_init(calc_batch_t *batch);
+void calc_batch_free(calc_batch_t *batch);
+
+// Parse a text or JSON batch. Returns 0 on success, or -1 with a message
+// naming the offending operation in error.
+int calc_batch_parse(calc_batch_t *batch, const char *text, size_t length, char *error, size_t error_size);
+
+// Run every operation of the batch
+void calc_batch_evaluate(calc_batch_t *batch);
+
+// Format the results in batch order into a malloc'ed buffer. Returns NULL
+// when out of memory.
+char *calc_batch_format(const calc_batch_t *batch, size_t *length);
+
+#endif
@@ -0,0 +1,255 @@
+#define _GNU_SOURCE // MAP_ANONYMOUS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "capture.h"
+
+static int capture_fd = -1;
+static unsigned long long start_us = 0;
+
+// In a shared mapping made before the workers are forked, so that their
+// connection numbers do not collide and their records do not interleave
+typedef struct {
+    pthread_mutex_t lock;              // Held while a record is appended
+    unsigned int connections;          // Connection numbers handed out
+    unsigned long long dropped;        // Records that could not be written
+    int broken;                        // A torn record could not be cut off, so nothing more is appended
+} capture_shared_t;
+
+static capture_shared_t *shared = NULL;
+
+static unsigned long long clock_us(clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (unsigned long long)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+static void put_u32(unsigned char *out, unsigned int value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static void put_u64(unsigned char *out, unsigned long long value) {
+    for (int i = 0; i < 8; i++) {
+        out[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static unsigned int get_u32(const unsigned char *in) {
+    unsigned int value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= (unsigned int)in[i] << (8 * i);
+    }
+    return value;
+}
+
+static unsigned long long get_u64(const unsigned char *in) {
+    unsigned long long value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= (unsigned long long)in[i] << (8 * i);
+    }
+    return value;
+}
+
+static void lock_shared(void) {
+    // A worker that died holding the lock had either finished its record
+    // or left one that the next writer cannot tell from a whole one; the
+    // lock is usable either way
+    if (pthread_mutex_lock(&shared->lock) == EOWNERDEAD) {
+        pthread_mutex_consistent(&shared->lock);
+    }
+}
+
+// Append a record under the lock shared with every worker process, so
+// records never interleave even when a write comes up short and has to be
+// continued. A record the file cannot take whole is cut off again and
+// counted as dropped, leaving the file readable; if even that fails, the
+// capture stops there.
+static void write_record(int kind, unsigned int connection, unsigned long long offset,
+                         const void *data, size_t length) {
+    unsigned char header[CAPTURE_HEADER_SIZE];
+    put_u64(header, clock_us(CLOCK_MONOTONIC) - start_us);
+    put_u64(header + 8, offset);
+    put_u32(header + 16, connection);
+    put_u32(header + 20, (unsigned int)length);
+    header[24] = (unsigned char)kind;
+
+    struct iovec parts[2] = {
+        { header, sizeof(header) },
+        { (void *)data, length },
+    };
+    int part = 0;
+    int part_count = length > 0 ? 2 : 1;
+
+    lock_shared();
+    if (shared->broken) {
+        shared->dropped++;
+        pthread_mutex_unlock(&shared->lock);
+        return;
+    }
+    off_t record_start = lseek(capture_fd, 0, SEEK_END);
+    while (part < part_count) {
+        ssize_t written = writev(capture_fd, parts + part, part_count - part);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            break;
+        }
+        while (part < part_count && (size_t)written >= parts[part].iov_len) {
+            written -= parts[part].iov_len;
+            part++;
+        }
+        if (part < part_count) {
+            parts[part].iov_base = (char *)parts[part].iov_base + written;
+            parts[part].iov_len -= written;
+        }
+    }
+    if (part < part_count) {
+        if (record_start < 0 || ftruncate(capture_fd, record_start) != 0) {
+            shared->broken = 1;
+        }
+        if (shared->dropped++ == 0) {
+            fprintf(stderr, "Warning: capture records are being dropped: %s\n", strerror(errno));
+        }
+    }
+    pthread_mutex_unlock(&shared->lock);
+}
+
+int capture_open(const char *path) {
+    // The capture holds request bodies and credentials as received, after
+    // any TLS decryption, so it is only for the server's own user
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    struct stat file_status;
+    if (fd < 0 || fstat(fd, &file_status) != 0) {
+        fprintf(stderr, "Failed to open capture file %s: %s\n", path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    // A new file gets the magic; an existing one must already have it
+    char magic[CAPTURE_MAGIC_SIZE];
+    int valid = file_status.st_size == 0 ?
+                write(fd, CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE) == CAPTURE_MAGIC_SIZE :
+                pread(fd, magic, sizeof(magic), 0) == CAPTURE_MAGIC_SIZE &&
+                memcmp(magic, CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE) == 0;
+    if (!valid) {
+        fprintf(stderr, "Capture file %s is not a capture\n", path);
+        close(fd);
+        return -1;
+    }
+
+    if (file_status.st_mode & (S_IRWXG | S_IRWXO)) {
+        fprintf(stderr, "Warning: capture file %s can be read by other users\n", path);
+    }
+
+    void *mapping = mmap(NULL, sizeof(capture_shared_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    pthread_mutexattr_t attributes;
+    if (mapping == MAP_FAILED || pthread_mutexattr_init(&attributes) != 0) {
+        perror("Failed to map the shared capture state");
+        close(fd);
+        return -1;
+    }
+    shared = mapping;
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&shared->lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+    capture_fd = fd;
+    start_us = clock_us(CLOCK_MONOTONIC);
+    write_record(CAPTURE_START, 0, clock_us(CLOCK_REALTIME), NULL, 0);
+    return 0;
+}
+
+int capture_enabled(void) {
+    return capture_fd >= 0;
+}
+
+unsigned long long capture_dropped(void) {
+    return shared ? __atomic_load_n(&shared->dropped, __ATOMIC_RELAXED) : 0;
+}
+
+void capture_connection_open(capture_connection_t *connection) {
+    memset(connection, 0, sizeof(capture_connection_t));
+    if (capture_fd < 0) {
+        return;
+    }
+    connection->id = __atomic_add_fetch(&shared->connections, 1, __ATOMIC_RELAXED);
+    write_record(CAPTURE_OPEN, connection->id, 0, NULL, 0);
+}
+
+void capture_data(capture_connection_t *connection, const void *data, size_t length) {
+    if (!connection || connection->id == 0 || length == 0) {
+        return;
+    }
+    write_record(CAPTURE_DATA, connection->id, connection->received, data, length);
+    connection->received += length;
+}
+
+void capture_request(capture_connection_t *connection, unsigned long long consumed) {
+    if (connection->id != 0) {
+        write_record(CAPTURE_REQUEST, connection->id, consumed, NULL, 0);
+    }
+}
+
+void capture_http2(capture_connection_t *connection) {
+    if (connection->id != 0) {
+        write_record(CAPTURE_HTTP2, connection->id, connection->received, NULL, 0);
+        connection->id = 0;
+    }
+}
+
+void capture_connection_close(capture_connection_t *connection) {
+    if (connection->id != 0) {
+        write_record(CAPTURE_CLOSE, connection->id, connection->received, NULL, 0);
+        connection->id = 0;
+    }
+}
+
+int capture_read_header(FILE *file) {
+    char magic[CAPTURE_MAGIC_SIZE];
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+        memcmp(magic, CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int capture_read_record(FILE *file, capture_record_t *record) {
+    unsigned char header[CAPTURE_HEADER_SIZE];
+    size_t header_read = fread(header, 1, sizeof(header), file);
+    if (header_read == 0 && feof(file)) {
+        return 0;
+    }
+    if (header_read != sizeof(header) || header[24] > CAPTURE_CLOSE) {
+        return -1;
+    }
+
+    record->time_us = get_u64(header);
+    record->offset = get_u64(header + 8);
+    record->connection = get_u32(header + 16);
+    record->length = get_u32(header + 20);
+    record->kind = header[24];
+    record->data = NULL;
+    if (record->length == 0) {
+        return 1;
+    }
+    record->data = malloc(record->length);
+    if (!record->data || fread(record->data, 1, record->length, file) != record->length) {
+        free(record->data);
+        record->data = NULL;
+        return -1;
+    }
+    return 1;
+}
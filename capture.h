@@ -0,0 +1,81 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+// Traffic capture (--capture file). Every byte an HTTP/1.1 connection
+// receives is appended to the file with its time and connection, along
+// with where each request ended, so http_replay can send the same traffic
+// again. TLS connections are captured after decryption.
+//
+// The file is the 8 byte magic followed by records, each a little-endian
+// header of CAPTURE_HEADER_SIZE bytes and then length bytes of data:
+//     u64 time_us     since the capture was opened
+//     u64 offset      DATA: bytes the connection received before these;
+//                     REQUEST: bytes up to the end of the request;
+//                     START: wall clock time in microseconds
+//     u32 connection  numbered from 1, unique over every worker process
+//     u32 length
+//     u8  kind
+// A server started again with the same file appends a new START record,
+// and the times and connection numbers after it begin again.
+#define CAPTURE_MAGIC "HTTPCAP1"
+#define CAPTURE_MAGIC_SIZE 8
+#define CAPTURE_HEADER_SIZE 25
+
+// Record kinds
+#define CAPTURE_START   0   // The capture was opened
+#define CAPTURE_OPEN    1   // A connection was accepted
+#define CAPTURE_DATA    2   // Bytes received on a connection
+#define CAPTURE_REQUEST 3   // A request was answered; written once its response is sent
+#define CAPTURE_HTTP2   4   // The connection switched to HTTP/2 and is not captured further
+#define CAPTURE_CLOSE   5
+
+typedef struct capture_connection {
+    unsigned int id;                   // 0 when not capturing
+    unsigned long long received;       // Bytes captured so far
+} capture_connection_t;
+
+typedef struct {
+    unsigned long long time_us;
+    unsigned long long offset;
+    unsigned int connection;
+    unsigned int length;
+    int kind;
+    char *data;                        // length bytes, from malloc(); NULL when empty
+} capture_record_t;
+
+// Server side
+
+// Start appending to path; call before forking workers so that they share
+// the file and connection numbers. Returns -1 on failure.
+int capture_open(const char *path);
+
+int capture_enabled(void);
+
+// Records that could not be written whole and were left out, over every
+// worker process
+unsigned long long capture_dropped(void);
+
+void capture_connection_open(capture_connection_t *connection);
+
+void capture_data(capture_connection_t *connection, const void *data, size_t length);
+
+// A request ended consumed bytes into the connection and has been answered
+void capture_request(capture_connection_t *connection, unsigned long long consumed);
+
+void capture_http2(capture_connection_t *connection);
+
+void capture_connection_close(capture_connection_t *connection);
+
+// Reading side, for http_replay
+
+// Check the magic at the start of a capture file. Returns 0 when it matches.
+int capture_read_header(FILE *file);
+
+// Read the next record. Returns 1 for a record, 0 at the end of the file
+// and -1 when the file is cut short or damaged.
+int capture_read_record(FILE *file, capture_record_t *record);
+
+#endif
@@ -5,145 +5,463 @@
 #include <unistd.h>
 #include <errno.h>
 #include <pthread.h>
-#include <arpa/inet.h>
+#include <poll.h>
 #include "client_handler.h"
 #include "echo_server.h"
 #include "http_request.h"
 #include "http_response.h"
 #include "route_handler.h"
+#include "http_stream.h"
+#include "http_body.h"
+#include "conn_manager.h"
+#include "metrics.h"
+#include "rate_limiter.h"
+#include "http2.h"
+#include "tls.h"
+#include "listener.h"
+#include "socket_options.h"
+#include "utils.h"
+#include "pool.h"
+#include "response_cache.h"
+#include "constant_response.h"
+#include "trace.h"
+#include "capture.h"
 
-// Define buffer for HTTP responses
-#define HTTP_BUFFER_SIZE (10 * 1024 * 1024) // 10MB max response size
+// Unread request bodies up to this size are skipped to keep the connection alive
+#define MAX_DISCARD_BODY (64 * 1024)
+
+// Bodies up to this size are copied next to the response head
+#define INLINE_BODY_LIMIT (16 * 1024)
+
+// Room for a response head: status line, content type and extra headers
+#define RESPONSE_HEAD_SIZE 2048
+
+// A response buffer holds a head and at most an inline body; anything
+// larger is sent straight from where the handler left it
+#define RESPONSE_BUFFER_SIZE (RESPONSE_HEAD_SIZE + INLINE_BODY_LIMIT)
+
+// Connections and their buffers are recycled instead of going back to malloc
+static pool_t *connection_pool = NULL;
+static pool_t *request_buffer_pool = NULL;
+static pool_t *response_buffer_pool = NULL;
+
+static const char switching_protocols_response[] =
+    "HTTP/1.1 101 Switching Protocols\r\n"
+    "Connection: Upgrade\r\n"
+    "Upgrade: h2c\r\n"
+    "\r\n";
+
+// Refuse a request from a client over its rate limit. Only the request
+// line has been looked at, so the refusal costs no parsing or handler time.
+static void send_too_many_requests(int client_socket, int retry_after) {
+    char response[256];
+    int length = snprintf(response, sizeof(response),
+                          "HTTP/1.1 429 Too Many Requests\r\n"
+                          "Content-Type: text/plain\r\n"
+                          "Content-Length: 17\r\n"
+                          "Retry-After: %d\r\n"
+                          "Connection: close\r\n"
+                          "\r\n"
+                          "Too Many Requests", retry_after);
+    send_all(client_socket, response, length);
+}
+
+int client_handler_init(void) {
+    connection_pool = pool_create("connection", sizeof(client_connection_t));
+    request_buffer_pool = pool_create("request_buffer", BUFFER_SIZE);
+    response_buffer_pool = pool_create("response_buffer", RESPONSE_BUFFER_SIZE);
+    if (!connection_pool || !request_buffer_pool || !response_buffer_pool) {
+        fprintf(stderr, "Failed to create the connection pools\n");
+        return -1;
+    }
+    return 0;
+}
+
+client_connection_t *client_connection_new(void) {
+    return pool_get(connection_pool);
+}
+
+void client_connection_free(client_connection_t *client_info) {
+    pool_put(connection_pool, client_info);
+}
+
+// Wait for a kept-alive client to send its next request. A connection that
+// is not readable right away gives its request buffer back while it waits,
+// so an idle connection costs little more than its thread. Returns -1 when
+// no buffer could be had again.
+static int park_until_readable(int client_socket, char **http_buffer) {
+    struct pollfd readable = { .fd = client_socket, .events = POLLIN };
+    if (poll(&readable, 1, 0) > 0) {
+        return 0;
+    }
+    
+    pool_put(request_buffer_pool, *http_buffer);
+    *http_buffer = NULL;
+    pool_flush_thread();
+    
+    // The idle deadline shuts the socket down, which ends the wait too
+    while (poll(&readable, 1, -1) < 0 && errno == EINTR) {
+    }
+    
+    *http_buffer = pool_get(request_buffer_pool);
+    return *http_buffer ? 0 : -1;
+}
+
+// Read until the buffer holds a complete request head. Bytes of a pipelined
+// request may already be in the buffer. Returns 1 when the head is complete
+// (or the buffer is full), 0 when the client went away between requests,
+// and -1 when the connection failed or timed out part way through a request.
+static int read_request_head(int client_socket, conn_timer_t *timer, char **buffer,
+                             size_t *total_bytes, int first_request, trace_request_t *trace,
+                             capture_connection_t *capture) {
+    // A new connection gets the header deadline right away; a kept-alive one
+    // idles until the next request starts arriving
+    conn_timer_set(timer, first_request || *total_bytes > 0 ? CONN_PHASE_HEADER : CONN_PHASE_IDLE);
+    if (timer->phase == CONN_PHASE_HEADER) {
+        trace_mark(trace, TRACE_MARK_READ);
+    }
+    
+    // TLS may hold decrypted bytes the socket no longer shows as readable
+    if (timer->phase == CONN_PHASE_IDLE && !tls_active(client_socket) &&
+        park_until_readable(client_socket, buffer) != 0) {
+        return -1;
+    }
+    
+    char *http_buffer = *buffer;
+    http_buffer[*total_bytes] = '\0';
+    
+    while (1) {
+        // Check if we've received the end of the HTTP headers
+        if (strstr(http_buffer, "\r\n\r\n") != NULL) {
+            return 1;
+        }
+        
+        // Check if buffer is full
+        if (*total_bytes >= BUFFER_SIZE - 1) {
+            return 1;
+        }
+        
+        ssize_t bytes_read = recv_some(client_socket, http_buffer + *total_bytes, BUFFER_SIZE - *total_bytes - 1);
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            return *total_bytes == 0 && !first_request ? 0 : -1;
+        }
+        
+        // The header deadline starts with the first byte of a request
+        if (*total_bytes == 0 && timer->phase == CONN_PHASE_IDLE) {
+            conn_timer_set(timer, CONN_PHASE_HEADER);
+            trace_mark(trace, TRACE_MARK_READ);
+        }
+        
+        capture_data(capture, http_buffer + *total_bytes, bytes_read);
+        *total_bytes += bytes_read;
+        http_buffer[*total_bytes] = '\0';
+    }
+}
 
 // Function that handles client connections via different threads
 void* handle_client_connection(void* arg) {
     client_connection_t* client_info = (client_connection_t*)arg;
     int client_socket = client_info->client_socket;
-    struct sockaddr_in client_address = client_info->client_address;
-    free(client_info);  // Free the allocated structure
+    struct sockaddr_storage client_address = client_info->client_address;
+    socklen_t client_address_length = client_info->client_address_length;
+    trace_connection_t trace_connection;
+    trace_connection_begin(&trace_connection, client_info->accepted_ns);
+    client_connection_free(client_info);  // Return the structure to its pool
     
-    char client_ip[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &(client_address.sin_addr), client_ip, INET_ADDRSTRLEN);
-    int client_port = ntohs(client_address.sin_port);
+    // With --capture, every byte received is recorded for http_replay
+    capture_connection_t capture;
+    capture_connection_open(&capture);
+    
+    char client_name[SOCKET_ADDRESS_TEXT_SIZE];
+    socket_address_format((const struct sockaddr *)&client_address, client_address_length,
+                          client_name, sizeof(client_name));
     
     if (verbose_mode) {
-        printf("Connection established with %s:%d\n", client_ip, client_port);
+        printf("Connection established with %s\n", client_name);
     }
     
     // Buffer for receiving HTTP request
-    char *http_buffer = malloc(BUFFER_SIZE);
+    char *http_buffer = pool_get(request_buffer_pool);
     if (!http_buffer) {
         if (verbose_mode) {
             printf("Failed to allocate memory for HTTP buffer\n");
         }
         close(client_socket);
+        conn_manager_release();
         pthread_exit(NULL);
     }
     
-    // Buffer for sending HTTP response
-    char *response_buffer = malloc(HTTP_BUFFER_SIZE);
-    if (!response_buffer) {
-        if (verbose_mode) {
-            printf("Failed to allocate memory for response buffer\n");
-        }
-        free(http_buffer);
-        close(client_socket);
-        pthread_exit(NULL);
-    }
+    // Deadlines for every phase of the connection
+    conn_timer_t timer;
+    conn_timer_init(&timer, client_socket);
     
-    // Read data from client
-    ssize_t bytes_read = 0;
     size_t total_bytes = 0;
+    int keep_alive = 1;
+    int requests_served = 0;
     
-    // Read until we have the complete HTTP request
-    while (1) {
-        bytes_read = recv(client_socket, http_buffer + total_bytes, BUFFER_SIZE - total_bytes - 1, 0);
+    // The TLS handshake has the same deadline as a request head
+    if (tls_enabled()) {
+        conn_timer_set(&timer, CONN_PHASE_HEADER);
+        int handshake = tls_accept(client_socket);
+        conn_timer_clear(&timer);
+        if (handshake != 0) {
+            keep_alive = 0;
+            if (verbose_mode) {
+                printf("TLS handshake with %s failed\n", client_name);
+            }
+        } else if (tls_negotiated_h2(client_socket)) {
+            // ALPN chose HTTP/2, so the client starts with the preface
+            capture_http2(&capture);
+            http2_serve_connection(client_socket, (const struct sockaddr *)&client_address, &timer, NULL, 0, NULL);
+            keep_alive = 0;
+        }
+    }
+    
+    while (keep_alive) {
+        // Phase boundaries of this request, kept if it is sampled
+        trace_request_t trace;
+        trace_request_begin(&trace_connection, &trace);
         
-        if (bytes_read <= 0) {
+        // Read until we have the complete HTTP request
+        int head_status = read_request_head(client_socket, &timer, &http_buffer, &total_bytes,
+                                            requests_served == 0, &trace, &capture);
+        if (head_status <= 0) {
+            int expired_phase = conn_timer_expired(&timer);
+            if (expired_phase == CONN_PHASE_HEADER && total_bytes > 0) {
+                // A client that is too slow with its headers gets told so
+                send_constant_response(client_socket, constant_response(CONSTANT_RESPONSE_REQUEST_TIMEOUT), 0);
+            }
             if (verbose_mode) {
-                if (bytes_read == 0) {
-                    printf("Connection with %s:%d closed by client\n", client_ip, client_port);
+                if (expired_phase != CONN_PHASE_NONE) {
+                    printf("Connection with %s timed out\n", client_name);
                 } else {
-                    printf("Error reading from client %s:%d: %s\n", 
-                           client_ip, client_port, strerror(errno));
+                    printf("Connection with %s closed by client\n", client_name);
                 }
             }
-            free(http_buffer);
-            free(response_buffer);
-            close(client_socket);
-            pthread_exit(NULL);
+            break;
         }
+        conn_timer_clear(&timer);
+        unsigned long long request_start_ns = metrics_now_ns();
+        trace_mark(&trace, TRACE_MARK_HEAD);
         
-        total_bytes += bytes_read;
-        http_buffer[total_bytes] = '\0';
+        if (verbose_mode) {
+            printf("Received HTTP request from %s:\n%s\n", client_name, http_buffer);
+        }
         
-        // Check if we've received the end of the HTTP headers
-        if (strstr(http_buffer, "\r\n\r\n") != NULL) {
+        // Clients with prior knowledge start HTTP/2 with its preface right away
+        if (requests_served == 0 && http2_is_preface(http_buffer, total_bytes)) {
+            capture_http2(&capture);
+            http2_serve_connection(client_socket, (const struct sockaddr *)&client_address, &timer,
+                                   http_buffer, total_bytes, NULL);
             break;
         }
         
-        // Check if buffer is full
-        if (total_bytes >= BUFFER_SIZE - 1) {
+        // Rate limits are checked on the request line alone, before any parsing
+        if (rate_limiter_enabled()) {
+            const char *line_end = strstr(http_buffer, "\r\n");
+            size_t line_length = line_end ? (size_t)(line_end - http_buffer) : total_bytes;
+            int retry_after = rate_limiter_check((const struct sockaddr *)&client_address, http_buffer, line_length);
+            if (retry_after > 0) {
+                send_too_many_requests(client_socket, retry_after);
+                if (verbose_mode) {
+                    printf("Rate limited request from %s\n", client_name);
+                }
+                break;
+            }
+        }
+        
+        // Parse the HTTP request
+        http_request_t request;
+        if (parse_http_request(http_buffer, total_bytes, &request) != 0) {
+            // Invalid request format
+            send_constant_response(client_socket, constant_response(CONSTANT_RESPONSE_BAD_REQUEST), 0);
             break;
         }
-    }
-    
-    if (verbose_mode) {
-        printf("Received HTTP request from %s:%d:\n%s\n", client_ip, client_port, http_buffer);
-    }
-    
-    // Parse the HTTP request
-    http_request_t request;
-    if (parse_http_request(http_buffer, total_bytes, &request) != 0) {
-        // Invalid request format
-        const char *error_response = 
-            "HTTP/1.1 400 Bad Request\r\n"
-            "Content-Type: text/plain\r\n"
-            "Content-Length: 15\r\n"
-            "Connection: close\r\n"
-            "\r\n"
-            "Invalid request";
-        
-        send(client_socket, error_response, strlen(error_response), 0);
-        free(http_buffer);
-        free(response_buffer);
-        close(client_socket);
-        pthread_exit(NULL);
-    }
-    
-    // Process the request and generate a response
-    http_response_t response;
-    init_http_response(&response);
-    
-    handle_request(&request, &response);
-    
-    // Write the response to the buffer
-    size_t response_size = write_http_response(&response, response_buffer, HTTP_BUFFER_SIZE);
-    
-    // Send the response
-    if (response_size > 0) {
-        ssize_t bytes_sent = send(client_socket, response_buffer, response_size, 0);
-        if (bytes_sent < 0) {
-            if (verbose_mode) {
-                printf("Error sending response to client %s:%d: %s\n", 
-                       client_ip, client_port, strerror(errno));
+        trace_mark(&trace, TRACE_MARK_PARSED);
+        
+        // Switch to HTTP/2 when asked to; the request is answered as stream 1.
+        // Requests with a body stay on HTTP/1.1 rather than buffering it first.
+        size_t header_bytes = request.header_length < total_bytes ? request.header_length : total_bytes;
+        if (request.upgrade_h2c && request.http2_settings[0] != '\0' && !request.chunked &&
+            request.content_length == 0 && strstr(http_buffer, "\r\n\r\n") != NULL) {
+            capture_http2(&capture);
+            if (send_all(client_socket, switching_protocols_response, sizeof(switching_protocols_response) - 1) == 0) {
+                http2_serve_connection(client_socket, (const struct sockaddr *)&client_address, &timer,
+                                       http_buffer + header_bytes, total_bytes - header_bytes, &request);
+            }
+            free_http_request(&request);
+            break;
+        }
+        
+        // Process the request and generate a response
+        http_response_t response;
+        init_http_response(&response);
+        
+        // The body is not read yet; handlers pull it from the socket as they need it
+        http_body_reader_t body_reader;
+        http_body_reader_init(&body_reader, client_socket, &request,
+                              http_buffer + header_bytes, total_bytes - header_bytes, max_body_size);
+        body_reader.timer = &timer;
+        body_reader.capture = &capture;
+        request.body_reader = &body_reader;
+        
+        // Only a fully received head leaves the connection in a known state
+        int head_complete = strstr(http_buffer, "\r\n\r\n") != NULL;
+        response.keep_alive = request.keep_alive && head_complete;
+        
+        // A cached route answers repeats of a GET without running its handler
+        response_cache_entry_t *cached = NULL;
+        int cache_status = RESPONSE_CACHE_BYPASS;
+        
+        if (body_reader.error_status == HTTP_STATUS_PAYLOAD_TOO_LARGE) {
+            // Declared length is over the limit: refuse before the client sends it
+            set_response_constant(&response, CONSTANT_RESPONSE_PAYLOAD_TOO_LARGE);
+            response.keep_alive = 0;
+        } else if ((cache_status = response_cache_lookup(&request, &cached)) != RESPONSE_CACHE_HIT) {
+            handle_request(&request, &response);
+            if (cache_status == RESPONSE_CACHE_MISS) {
+                response_cache_store(&request, &response);
             }
-        } else if (verbose_mode) {
-            printf("Sent HTTP response to %s:%d (%zu bytes)\n", client_ip, client_port, bytes_sent);
         }
+        conn_timer_clear(&timer);
+        trace_mark(&trace, TRACE_MARK_HANDLED);
+        
+        // A draining server answers what it has and lets the client reconnect
+        if (conn_manager_draining()) {
+            response.keep_alive = 0;
+        }
+        
+        // Skip a small unread body so the next request can be read; anything
+        // else means the connection cannot be reused
+        if (response.keep_alive && !http_body_complete(&body_reader)) {
+            if (body_reader.error_status != 0 || body_reader.expect_continue ||
+                request.chunked || request.content_length > MAX_DISCARD_BODY ||
+                http_body_discard(&body_reader) != 0) {
+                response.keep_alive = 0;
+            }
+        }
+        
+        // Streamed bodies go straight to the socket as the handler produces them
+        if (response.stream_producer) {
+            if (strcmp(request.version, "HTTP/1.0") == 0) {
+                response.keep_alive = 0; // The body ends when the connection closes
+            }
+            if (http_stream_send_response(client_socket, request.version, &response, &timer) != 0) {
+                response.keep_alive = 0;
+                if (verbose_mode) {
+                    printf("Streamed response to %s ended early\n", client_name);
+                }
+            } else if (verbose_mode) {
+                printf("Streamed HTTP response to %s\n", client_name);
+            }
+        }
+        
+        // Small bodies are copied in behind the head and go out in one send.
+        // Larger ones are sent from where they are, with the head held back
+        // (MSG_MORE) so the two still fill whole segments. The buffer is only
+        // held while the response goes out; cached and constant responses
+        // are sent as already serialized.
+        const char *body = NULL;
+        size_t body_size = 0;
+        size_t response_size = 0;
+        char *response_buffer = NULL;
+        size_t response_buffer_size = RESPONSE_BUFFER_SIZE;
+        if (!cached && !response.constant && !response.stream_producer) {
+            // Heads with more headers than a pooled buffer has room for,
+            // such as some proxied ones, get a buffer of their own
+            if (response.headers_length > RESPONSE_HEAD_SIZE / 2) {
+                response_buffer_size += response.headers_length;
+                response_buffer = malloc(response_buffer_size);
+            } else {
+                response_buffer = pool_get(response_buffer_pool);
+            }
+            if (!response_buffer) {
+                response.keep_alive = 0;
+                if (verbose_mode) {
+                    printf("Failed to allocate memory for response buffer\n");
+                }
+            } else if (response.content_length <= INLINE_BODY_LIMIT || !response.body ||
+                       response_status_bodiless(&response)) {
+                response_size = write_http_response(&response, response_buffer, response_buffer_size);
+            } else {
+                response_size = write_http_response_head(&response, response_buffer, response_buffer_size);
+                body = response.body;
+                body_size = response.content_length;
+            }
+        }
+        
+        // Send the response
+        if (response_size > 0 || cached || response.constant) {
+            conn_timer_set(&timer, CONN_PHASE_WRITE);
+            int sent;
+            if (cached) {
+                sent = response_cache_send(client_socket, cached, response.keep_alive) == 0;
+                response_size = response_cache_entry_size(cached);
+            } else if (response.constant) {
+                sent = send_constant_response(client_socket, response.constant, response.keep_alive) == 0;
+                response_size = response.constant->wire_length[response.keep_alive ? 1 : 0];
+            } else {
+                sent = body ? send_all_flags(client_socket, response_buffer, response_size, socket_options_more_flag()) == 0 &&
+                              send_all(client_socket, body, body_size) == 0 :
+                              send_all(client_socket, response_buffer, response_size) == 0;
+                response_size += body_size;
+            }
+            if (!sent) {
+                response.keep_alive = 0;
+                if (verbose_mode) {
+                    printf("Error sending response to client %s: %s\n",
+                           client_name, strerror(errno));
+                }
+            } else if (verbose_mode) {
+                printf("Sent HTTP response to %s (%zu bytes)\n", client_name, response_size);
+            }
+            conn_timer_clear(&timer);
+        }
+        response_cache_release(cached);
+        if (response_buffer_size > RESPONSE_BUFFER_SIZE) {
+            free(response_buffer);
+        } else {
+            pool_put(response_buffer_pool, response_buffer);
+        }
+        
+        trace_mark(&trace, TRACE_MARK_SENT);
+        trace_request_end(&trace_connection, &trace, &request, response.status_code);
+        capture_request(&capture, capture.received - body_reader.buffered_length);
+        metrics_count_request(response.status_code, body_reader.total_read, response_size,
+                              metrics_now_ns() - request_start_ns);
+        keep_alive = response.keep_alive;
+        requests_served++;
+        
+        // Keep any pipelined bytes that followed this request
+        if (keep_alive) {
+            memmove(http_buffer, body_reader.buffered, body_reader.buffered_length);
+            total_bytes = body_reader.buffered_length;
+        }
+        
+        // Clean up
+        free_http_request(&request);
+        free_http_response(&response);
     }
     
-    // Clean up
-    free_http_request(&request);
-    free_http_response(&response);
-    free(http_buffer);
-    free(response_buffer);
+    // No deadline may fire once the socket is closed and its number reused
+    conn_timer_clear(&timer);
+    
+    pool_put(request_buffer_pool, http_buffer);
+    
+    // Round trip time and retransmits, for connections that had a request traced
+    trace_connection_end(&trace_connection, client_socket);
+    capture_connection_close(&capture);
     
     // Close the client socket
+    tls_close(client_socket);
     close(client_socket);
+    conn_manager_release();
     if (verbose_mode) {
-        printf("Connection with %s:%d closed\n", client_ip, client_port);
+        printf("Connection with %s closed\n", client_name);
     }
     
     pthread_exit(NULL);
-}
\ No newline at end of file
+}
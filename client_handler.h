@@ -3,6 +3,14 @@
 
 #include "echo_server.h"
 
+// Create the pools connections and their buffers come from; called once
+// before the first connection is accepted
+int client_handler_init(void);
+
+// Take and return the structure handed to a connection's thread
+client_connection_t *client_connection_new(void);
+void client_connection_free(client_connection_t *client_info);
+
 // Handle client connections in separate threads
 void* handle_client_connection(void* arg);
 
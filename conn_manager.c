@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "conn_manager.h"
+#include "tls.h"
+
+// Hashed timer wheel: deadlines are rounded up to TICK_MS and hashed into
+// a bucket by tick. Arming, re-arming and clearing are O(1) list
+// operations; the timer thread only looks at the buckets for ticks that
+// have passed.
+#define TICK_MS 100
+#define WHEEL_BUCKETS 1024
+
+// Once draining, an idle keep-alive connection is closed after this long.
+// A client already sending its next request gets it answered with
+// "Connection: close" rather than racing a close of the socket.
+#define DRAIN_IDLE_GRACE_MS 1000
+
+static conn_timer_t *wheel[WHEEL_BUCKETS];
+static pthread_mutex_t wheel_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long processed_tick = 0;
+
+static int max_connections = DEFAULT_MAX_CONNECTIONS;
+static int active_connections = 0;
+static int draining = 0;
+
+static unsigned int phase_timeouts_ms[CONN_PHASE_COUNT] = {
+    [CONN_PHASE_HEADER] = DEFAULT_HEADER_TIMEOUT_MS,
+    [CONN_PHASE_BODY] = DEFAULT_BODY_TIMEOUT_MS,
+    [CONN_PHASE_IDLE] = DEFAULT_IDLE_TIMEOUT_MS,
+    [CONN_PHASE_WRITE] = DEFAULT_WRITE_TIMEOUT_MS,
+};
+
+static unsigned long long current_tick(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((unsigned long long)now.tv_sec * 1000ULL + now.tv_nsec / 1000000) / TICK_MS;
+}
+
+// Must be called with wheel_mutex held
+static void unlink_timer(conn_timer_t *timer) {
+    if (timer->bucket < 0) {
+        return;
+    }
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    } else {
+        wheel[timer->bucket] = timer->next;
+    }
+    if (timer->next) {
+        timer->next->prev = timer->prev;
+    }
+    timer->prev = NULL;
+    timer->next = NULL;
+    timer->bucket = -1;
+}
+
+// Must be called with wheel_mutex held
+static void link_timer(conn_timer_t *timer, unsigned long long deadline_tick) {
+    timer->deadline_tick = deadline_tick;
+    timer->bucket = timer->deadline_tick % WHEEL_BUCKETS;
+    timer->next = wheel[timer->bucket];
+    if (timer->next) {
+        timer->next->prev = timer;
+    }
+    wheel[timer->bucket] = timer;
+}
+
+static void *timer_thread(void *arg) {
+    (void)arg;
+
+    while (1) {
+        struct timespec tick = { 0, TICK_MS * 1000000L };
+        nanosleep(&tick, NULL);
+
+        pthread_mutex_lock(&wheel_mutex);
+        unsigned long long now = current_tick();
+        while (processed_tick < now) {
+            processed_tick++;
+            conn_timer_t *timer = wheel[processed_tick % WHEEL_BUCKETS];
+            while (timer) {
+                conn_timer_t *next = timer->next;
+                // Deadlines more than one lap away share the bucket and stay put
+                if (timer->deadline_tick <= processed_tick) {
+                    unlink_timer(timer);
+                    __atomic_store_n(&timer->expired_phase, timer->phase, __ATOMIC_RELEASE);
+                    // Shutting down the read side lets the connection still answer
+                    // (e.g. 408); a stalled write gets no such courtesy
+                    shutdown(timer->socket, timer->phase == CONN_PHASE_WRITE ? SHUT_RDWR : SHUT_RD);
+                }
+                timer = next;
+            }
+        }
+        pthread_mutex_unlock(&wheel_mutex);
+    }
+
+    return NULL;
+}
+
+void conn_manager_configure(int max, const unsigned int timeouts_ms[CONN_PHASE_COUNT]) {
+    if (max > 0) {
+        max_connections = max;
+    }
+    for (int phase = CONN_PHASE_HEADER; timeouts_ms && phase < CONN_PHASE_COUNT; phase++) {
+        if (timeouts_ms[phase] > 0) {
+            phase_timeouts_ms[phase] = timeouts_ms[phase];
+        }
+    }
+}
+
+int conn_manager_start(void) {
+    processed_tick = current_tick();
+
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, NULL, timer_thread, NULL) != 0) {
+        perror("Failed to create timer thread");
+        return -1;
+    }
+    pthread_detach(thread_id);
+
+    printf("Connections: max %d, timeouts header %ums, body %ums, idle %ums, write %ums\n",
+           max_connections, phase_timeouts_ms[CONN_PHASE_HEADER], phase_timeouts_ms[CONN_PHASE_BODY],
+           phase_timeouts_ms[CONN_PHASE_IDLE], phase_timeouts_ms[CONN_PHASE_WRITE]);
+    return 0;
+}
+
+int conn_manager_admit(void) {
+    if (__atomic_add_fetch(&active_connections, 1, __ATOMIC_ACQ_REL) > max_connections) {
+        __atomic_sub_fetch(&active_connections, 1, __ATOMIC_ACQ_REL);
+        return -1;
+    }
+    return 0;
+}
+
+void conn_manager_release(void) {
+    __atomic_sub_fetch(&active_connections, 1, __ATOMIC_ACQ_REL);
+}
+
+int conn_manager_active(void) {
+    return __atomic_load_n(&active_connections, __ATOMIC_ACQUIRE);
+}
+
+void conn_manager_drain(void) {
+    // Collect first: moving a timer while walking could revisit it
+    conn_timer_t *idle = NULL;
+    unsigned long long deadline = current_tick() + DRAIN_IDLE_GRACE_MS / TICK_MS;
+
+    pthread_mutex_lock(&wheel_mutex);
+    __atomic_store_n(&draining, 1, __ATOMIC_RELEASE);
+    for (int bucket = 0; bucket < WHEEL_BUCKETS; bucket++) {
+        conn_timer_t *timer = wheel[bucket];
+        while (timer) {
+            conn_timer_t *next = timer->next;
+            if (timer->phase == CONN_PHASE_IDLE && timer->deadline_tick > deadline) {
+                unlink_timer(timer);
+                timer->next = idle;
+                idle = timer;
+            }
+            timer = next;
+        }
+    }
+    while (idle) {
+        conn_timer_t *next = idle->next;
+        link_timer(idle, deadline);
+        idle = next;
+    }
+    pthread_mutex_unlock(&wheel_mutex);
+}
+
+int conn_manager_draining(void) {
+    return __atomic_load_n(&draining, __ATOMIC_ACQUIRE);
+}
+
+int conn_manager_wait_idle(unsigned int timeout_ms) {
+    struct timespec pause = { 0, TICK_MS * 1000000L };
+    for (unsigned int waited = 0; conn_manager_active() > 0 && waited < timeout_ms; waited += TICK_MS) {
+        nanosleep(&pause, NULL);
+    }
+    return conn_manager_active();
+}
+
+unsigned int conn_manager_timeout(int phase) {
+    if (phase <= CONN_PHASE_NONE || phase >= CONN_PHASE_COUNT) {
+        return 0;
+    }
+    return phase_timeouts_ms[phase];
+}
+
+void conn_manager_reject(int client_socket) {
+    static const char overloaded_response[] =
+        "HTTP/1.1 503 Service Unavailable\r\n"
+        "Content-Type: text/plain\r\n"
+        "Content-Length: 20\r\n"
+        "Retry-After: 1\r\n"
+        "Connection: close\r\n"
+        "\r\n"
+        "Server is overloaded";
+
+    // Never wait on a client we are turning away. A TLS client could not
+    // read a plaintext response, so it only sees the connection close.
+    if (!tls_enabled()) {
+        send(client_socket, overloaded_response, sizeof(overloaded_response) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+    close(client_socket);
+}
+
+void conn_timer_init(conn_timer_t *timer, int client_socket) {
+    memset(timer, 0, sizeof(conn_timer_t));
+    timer->socket = client_socket;
+    timer->bucket = -1;
+}
+
+void conn_timer_set(conn_timer_t *timer, int phase) {
+    if (phase <= CONN_PHASE_NONE || phase >= CONN_PHASE_COUNT) {
+        conn_timer_clear(timer);
+        return;
+    }
+
+    unsigned long long ticks = (phase_timeouts_ms[phase] + TICK_MS - 1) / TICK_MS;
+
+    pthread_mutex_lock(&wheel_mutex);
+    // Checked under the lock so no idle timer slips past conn_manager_drain()
+    if (phase == CONN_PHASE_IDLE && draining && ticks > DRAIN_IDLE_GRACE_MS / TICK_MS) {
+        ticks = DRAIN_IDLE_GRACE_MS / TICK_MS;
+    }
+    unlink_timer(timer);
+    timer->phase = phase;
+    link_timer(timer, current_tick() + (ticks > 0 ? ticks : 1));
+    pthread_mutex_unlock(&wheel_mutex);
+}
+
+void conn_timer_clear(conn_timer_t *timer) {
+    pthread_mutex_lock(&wheel_mutex);
+    unlink_timer(timer);
+    timer->phase = CONN_PHASE_NONE;
+    pthread_mutex_unlock(&wheel_mutex);
+}
+
+int conn_timer_expired(const conn_timer_t *timer) {
+    return __atomic_load_n(&timer->expired_phase, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,81 @@
+#ifndef CONN_MANAGER_H
+#define CONN_MANAGER_H
+
+#define DEFAULT_MAX_CONNECTIONS 1024
+
+// Deadlines, in milliseconds
+#define DEFAULT_HEADER_TIMEOUT_MS 10000  // Whole request head, from its first byte
+#define DEFAULT_BODY_TIMEOUT_MS   30000  // Longest wait for more request body
+#define DEFAULT_IDLE_TIMEOUT_MS    5000  // Keep-alive wait for the next request
+#define DEFAULT_WRITE_TIMEOUT_MS  30000  // Longest wait for the client to take more response
+#define DEFAULT_DRAIN_TIMEOUT_MS  30000  // Longest wait for open connections when shutting down
+
+// Phases a connection can be timed in
+#define CONN_PHASE_NONE   0
+#define CONN_PHASE_HEADER 1
+#define CONN_PHASE_BODY   2
+#define CONN_PHASE_IDLE   3
+#define CONN_PHASE_WRITE  4
+#define CONN_PHASE_COUNT  5
+
+// Per-connection deadline, linked into the timer wheel while armed.
+// Lives in the connection thread's stack frame.
+typedef struct conn_timer {
+    int socket;
+    int phase;                   // Phase currently being timed
+    int expired_phase;           // Phase that ran out, or CONN_PHASE_NONE
+    unsigned long long deadline_tick;
+    struct conn_timer *prev;
+    struct conn_timer *next;
+    int bucket;                  // Wheel bucket, -1 when not armed
+} conn_timer_t;
+
+// Set the connection limit and timeouts before conn_manager_start().
+// A timeout of 0 keeps the default.
+void conn_manager_configure(int max_connections, const unsigned int timeouts_ms[CONN_PHASE_COUNT]);
+
+// Start the timer thread
+int conn_manager_start(void);
+
+// Take a connection slot. Returns 0, or -1 when the server is at its limit.
+int conn_manager_admit(void);
+
+// Give back a connection slot
+void conn_manager_release(void);
+
+// Number of connections currently admitted
+int conn_manager_active(void);
+
+// Stop keeping connections open: idle keep-alive connections are closed
+// after a short grace period and busy ones once they next go idle (HTTP/2
+// ones with a GOAWAY). Requests already being served run to completion.
+void conn_manager_drain(void);
+
+// Whether conn_manager_drain() was called
+int conn_manager_draining(void);
+
+// Wait until no connections are left or timeout_ms passes. Returns the
+// number still open.
+int conn_manager_wait_idle(unsigned int timeout_ms);
+
+// Configured timeout of a phase in milliseconds, for waits that cannot use
+// a connection timer
+unsigned int conn_manager_timeout(int phase);
+
+// Fast rejection used when a connection cannot be served: 503 with Retry-After
+void conn_manager_reject(int client_socket);
+
+// Attach a timer to a connection
+void conn_timer_init(conn_timer_t *timer, int client_socket);
+
+// Arm the timer for a phase using that phase's configured timeout. When it
+// runs out the socket is shut down, which wakes any blocked recv()/send().
+void conn_timer_set(conn_timer_t *timer, int phase);
+
+// Disarm the timer
+void conn_timer_clear(conn_timer_t *timer);
+
+// Phase whose deadline passed, or CONN_PHASE_NONE
+int conn_timer_expired(const conn_timer_t *timer);
+
+#endif
@@ -0,0 +1,123 @@
+#include <stdlib.h>
+#include <string.h>
+#include "constant_response.h"
+#include "utils.h"
+
+// Room for the head of a constant response
+#define CONSTANT_HEAD_SIZE 512
+
+#define BODY(text) text, sizeof(text) - 1
+
+static constant_response_t constants[CONSTANT_RESPONSE_COUNT] = {
+    [CONSTANT_RESPONSE_INDEX] = { HTTP_STATUS_OK, "text/html", NULL, NULL, BODY(
+        "<html>"
+        "<head><title>HTTP Server</title></head>"
+        "<body>"
+        "<h1>Welcome to the HTTP Server</h1>"
+        "<p>Available routes:</p>"
+        "<ul>"
+        "<li>/static/[filename] - Serves static files</li>"
+        "<li>/calc/add/[num1]/[num2] - Addition</li>"
+        "<li>/calc/mul/[num1]/[num2] - Multiplication</li>"
+        "<li>/calc/div/[num1]/[num2] - Division</li>"
+        "<li>POST /calc/batch - Many calculations in one request</li>"
+        "<li>/sleep/[seconds] - Sleep for testing pipelining</li>"
+        "<li>/stream/[lines] - Streamed response</li>"
+        "<li>POST|PUT /upload - Upload a request body</li>"
+        "<li>/stats - Server statistics</li>"
+        "<li>/asset-manifest.json - Fingerprinted URLs of the static files</li>"
+        "<li>/debug/trace - Traced requests as Chrome trace-event JSON</li>"
+        "</ul>"
+        "</body>"
+        "</html>"), { NULL, NULL }, { 0, 0 } },
+    [CONSTANT_RESPONSE_NOT_FOUND] = { HTTP_STATUS_NOT_FOUND, "text/html", NULL, NULL, BODY(
+        "<html>"
+        "<head><title>404 Not Found</title></head>"
+        "<body>"
+        "<h1>404 Not Found</h1>"
+        "<p>The requested resource was not found on this server.</p>"
+        "</body>"
+        "</html>"), { NULL, NULL }, { 0, 0 } },
+    [CONSTANT_RESPONSE_BAD_REQUEST] = { HTTP_STATUS_BAD_REQUEST, "text/plain", NULL, NULL,
+        BODY("Invalid request"), { NULL, NULL }, { 0, 0 } },
+    [CONSTANT_RESPONSE_REQUEST_TIMEOUT] = { HTTP_STATUS_REQUEST_TIMEOUT, "text/plain", NULL, NULL,
+        BODY("Request Timeout"), { NULL, NULL }, { 0, 0 } },
+    [CONSTANT_RESPONSE_PAYLOAD_TOO_LARGE] = { HTTP_STATUS_PAYLOAD_TOO_LARGE, "text/plain", NULL, NULL,
+        BODY("Payload Too Large"), { NULL, NULL }, { 0, 0 } },
+    [CONSTANT_RESPONSE_METHOD_UNSUPPORTED] = { HTTP_STATUS_METHOD_NOT_ALLOWED, "text/plain", NULL, NULL,
+        BODY("Method Not Allowed. Only GET, POST and PUT are supported."), { NULL, NULL }, { 0, 0 } },
+    [CONSTANT_RESPONSE_NOT_ALLOWED + 0] = { HTTP_STATUS_METHOD_NOT_ALLOWED, "text/plain", "Allow", "GET",
+        BODY("Method Not Allowed"), { NULL, NULL }, { 0, 0 } },
+    [CONSTANT_RESPONSE_NOT_ALLOWED + 1] = { HTTP_STATUS_METHOD_NOT_ALLOWED, "text/plain", "Allow", "POST",
+        BODY("Method Not Allowed"), { NULL, NULL }, { 0, 0 } },
+    [CONSTANT_RESPONSE_NOT_ALLOWED + 2] = { HTTP_STATUS_METHOD_NOT_ALLOWED, "text/plain", "Allow", "GET, POST",
+        BODY("Method Not Allowed"), { NULL, NULL }, { 0, 0 } },
+    [CONSTANT_RESPONSE_NOT_ALLOWED + 3] = { HTTP_STATUS_METHOD_NOT_ALLOWED, "text/plain", "Allow", "PUT",
+        BODY("Method Not Allowed"), { NULL, NULL }, { 0, 0 } },
+    [CONSTANT_RESPONSE_NOT_ALLOWED + 4] = { HTTP_STATUS_METHOD_NOT_ALLOWED, "text/plain", "Allow", "GET, PUT",
+        BODY("Method Not Allowed"), { NULL, NULL }, { 0, 0 } },
+    [CONSTANT_RESPONSE_NOT_ALLOWED + 5] = { HTTP_STATUS_METHOD_NOT_ALLOWED, "text/plain", "Allow", "POST, PUT",
+        BODY("Method Not Allowed"), { NULL, NULL }, { 0, 0 } },
+    [CONSTANT_RESPONSE_OVERLOADED] = { HTTP_STATUS_SERVICE_UNAVAILABLE, "text/plain", "Retry-After", "1",
+        BODY("Service Unavailable: server is overloaded"), { NULL, NULL }, { 0, 0 } },
+};
+
+// Constant bodies are never freed
+static void keep_constant_body(void *owner) {
+    (void)owner;
+}
+
+// The fields of a constant response, without its serialized form
+static void fill_response(http_response_t *response, const constant_response_t *constant) {
+    set_response_status(response, constant->status_code);
+    set_response_content_type(response, constant->content_type);
+    if (constant->header_name) {
+        add_response_header(response, constant->header_name, constant->header_value);
+    }
+    set_response_body_shared(response, constant->body, constant->body_length, keep_constant_body, NULL);
+}
+
+int constant_responses_render(void) {
+    for (int i = 0; i < CONSTANT_RESPONSE_COUNT; i++) {
+        constant_response_t *constant = &constants[i];
+        http_response_t response;
+        init_http_response(&response);
+        fill_response(&response, constant);
+
+        for (int keep_alive = 0; keep_alive <= 1; keep_alive++) {
+            response.keep_alive = keep_alive;
+            size_t capacity = CONSTANT_HEAD_SIZE + constant->body_length;
+            char *wire = malloc(capacity);
+            size_t length = wire ? write_http_response(&response, wire, capacity) : 0;
+            if (length == 0) {
+                free(wire);
+                return -1;
+            }
+            free(constant->wire[keep_alive]);
+            constant->wire[keep_alive] = wire;
+            constant->wire_length[keep_alive] = length;
+        }
+        free_http_response(&response);
+    }
+    return 0;
+}
+
+const constant_response_t *constant_response(int id) {
+    return id >= 0 && id < CONSTANT_RESPONSE_COUNT ? &constants[id] : NULL;
+}
+
+void set_response_constant(http_response_t *response, int id) {
+    const constant_response_t *constant = constant_response(id);
+    if (!response || !constant) {
+        return;
+    }
+    // Headers some earlier step added would be missing from the stored bytes
+    int fresh = response->headers_length == 0;
+    fill_response(response, constant);
+    response->constant = fresh && constant->wire[0] ? constant : NULL;
+}
+
+int send_constant_response(int socket, const constant_response_t *constant, int keep_alive) {
+    keep_alive = keep_alive ? 1 : 0;
+    return send_all(socket, constant->wire[keep_alive], constant->wire_length[keep_alive]);
+}
@@ -0,0 +1,49 @@
+#ifndef CONSTANT_RESPONSE_H
+#define CONSTANT_RESPONSE_H
+
+#include <stddef.h>
+#include "http_response.h"
+
+// Responses whose content never changes. They are serialized once, at
+// startup, and sent from there without allocating or formatting anything.
+#define CONSTANT_RESPONSE_INDEX                   0
+#define CONSTANT_RESPONSE_NOT_FOUND               1
+#define CONSTANT_RESPONSE_BAD_REQUEST             2
+#define CONSTANT_RESPONSE_REQUEST_TIMEOUT         3
+#define CONSTANT_RESPONSE_PAYLOAD_TOO_LARGE       4
+#define CONSTANT_RESPONSE_METHOD_UNSUPPORTED      5   // A method no route takes
+#define CONSTANT_RESPONSE_NOT_ALLOWED             6   // 405s, one per route method mask (6 to 11)
+#define CONSTANT_RESPONSE_OVERLOADED              12
+#define CONSTANT_RESPONSE_COUNT                   13
+
+// The 405 whose Allow header lists the ROUTE_METHOD_ flags in methods, for
+// a route that takes some but not all of GET, POST and PUT
+#define CONSTANT_RESPONSE_NOT_ALLOWED_FOR(methods) (CONSTANT_RESPONSE_NOT_ALLOWED + (methods) - 1)
+
+struct constant_response {
+    int status_code;
+    const char *content_type;
+    const char *header_name;     // One extra header, or NULL
+    const char *header_value;
+    const char *body;
+    size_t body_length;
+    char *wire[2];               // The whole response for a closing [0] and a kept-alive [1] connection
+    size_t wire_length[2];
+};
+typedef struct constant_response constant_response_t;
+
+// Serialize every constant response; call again after anything they
+// depend on changes. Returns -1 when out of memory.
+int constant_responses_render(void);
+
+const constant_response_t *constant_response(int id);
+
+// Make response the constant one. Its body is shared rather than copied,
+// and unless something changes the response afterwards it goes out as
+// the pre-serialized bytes.
+void set_response_constant(http_response_t *response, int id);
+
+// Send a constant response as is. Returns 0 on success.
+int send_constant_response(int socket, const constant_response_t *constant, int keep_alive);
+
+#endif
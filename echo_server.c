@@ -11,63 +11,77 @@
 #include "echo_server.h"
 #include "client_handler.h"
 #include "utils.h"
+#include "static_bundle.h"
+#include "http_body.h"
+#include "executor.h"
+#include "route_handler.h"
+#include "conn_manager.h"
+#include "rate_limiter.h"
+#include "tls.h"
+#include "listener.h"
+#include "socket_options.h"
+#include "supervisor.h"
+#include "upgrade.h"
+#include "metrics.h"
+#include "worker_stats.h"
+#include "response_cache.h"
+#include "constant_response.h"
+#include "trace.h"
+#include "capture.h"
+#include "proxy.h"
+#include "asset_manifest.h"
+#include "module.h"
+#include "module_api.h"
 #include <sys/stat.h>
 
 // Global variables
-int server_socket = -1;
 int verbose_mode = 0;
+size_t max_body_size = DEFAULT_MAX_BODY_SIZE;
+size_t spool_threshold = DEFAULT_SPOOL_THRESHOLD;
+size_t thread_stack_size = DEFAULT_THREAD_STACK_SIZE;
 
-// Function to handle ctrl+c
+// Socket tuning for listeners that do not set their own (-O)
+static socket_options_t socket_defaults;
+
+// Longest wait for open connections once the server stops accepting
+static unsigned int drain_timeout_ms = DEFAULT_DRAIN_TIMEOUT_MS;
+
+// Set by signal handlers and acted on by the accept loop
+static volatile sig_atomic_t stop_requested = 0;
+static volatile sig_atomic_t upgrade_requested = 0;
+static volatile sig_atomic_t trace_dump_requested = 0;
+
+// Function to handle ctrl+c and SIGTERM
 void handle_interrupt_signal(int signal_number) {
     (void)signal_number; // Unused parameter, avoid compiler warning
     
-    if (server_socket != -1) {
-        close(server_socket);
-    }
-    printf("\nServer shutting down...\n");
-    exit(EXIT_SUCCESS);
+    // Exiting from here would cut off every request in flight; the accept
+    // loop stops and drains them instead
+    stop_requested = 1;
+    listener_interrupt();
 }
 
-// Initialize server to port number
+// SIGUSR2: hand the listeners to a freshly started copy of the binary
+static void handle_upgrade_signal(int signal_number) {
+    (void)signal_number;
+    upgrade_requested = 1;
+    listener_interrupt();
+}
+
+// SIGUSR1: write the kept request traces to a file
+static void handle_trace_signal(int signal_number) {
+    (void)signal_number;
+    trace_dump_requested = 1;
+    listener_interrupt();
+}
+
+// Open every --listen endpoint, or the -p port when none was given
 int initialize_server(int server_port) {
-    // Create socket
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket < 0) {
-        perror("Failed to create socket");
-        return -1;
-    }
-    
-    // Set socket options to allow address reuse
-    int reuse_address_flag = 1;
-    if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &reuse_address_flag, sizeof(reuse_address_flag)) < 0) {
-        perror("Failed to set socket options");
-        close(server_socket);
-        return -1;
-    }
-    
-    // Set up server address
-    struct sockaddr_in server_address;
-    memset(&server_address, 0, sizeof(server_address));
-    server_address.sin_family = AF_INET;
-    server_address.sin_addr.s_addr = INADDR_ANY;
-    server_address.sin_port = htons(server_port);
-    
-    // Bind socket to address
-    if (bind(server_socket, (struct sockaddr*)&server_address, sizeof(server_address)) < 0) {
-        perror("Failed to bind socket");
-        close(server_socket);
+    if (listener_count() == 0 && listener_add_port(server_port) != 0) {
+        fprintf(stderr, "Failed to set up a listener on port %d\n", server_port);
         return -1;
     }
-    
-    // Listen for connections
-    if (listen(server_socket, MAX_PENDING_CONNECTIONS) < 0) {
-        perror("Failed to listen");
-        close(server_socket);
-        return -1;
-    }
-    
-    printf("HTTP server listening on port %d\n", server_port);
-    return 0;
+    return listener_open_all(&socket_defaults);
 }
 
 // Main server loop to accept and handle client connections
@@ -81,50 +95,216 @@ void run_server_loop(void) {
         }
     }
     
-    // Main loop to accept connections
-    while (1) {
-        struct sockaddr_in client_address;
-        socklen_t client_address_length = sizeof(client_address);
+    if (listener_wakeup_init() != 0) {
+        perror("Warning: Failed to create the accept loop wake-up pipe");
+    }
+    
+    // Main loop to accept connections, until told to stop or upgraded
+    while (!stop_requested) {
+        struct sockaddr_storage client_address;
+        socklen_t client_address_length;
+        
+        if (upgrade_requested) {
+            upgrade_requested = 0;
+            if (upgrade_handoff() == 0) {
+                // The new binary accepts from now on and keeps the socket files
+                listener_detach();
+                break;
+            }
+            continue;
+        }
         
-        // Accept a new client connection
-        int client_socket = accept(server_socket, (struct sockaddr*)&client_address, &client_address_length);
+        if (trace_dump_requested) {
+            trace_dump_requested = 0;
+            trace_dump();
+        }
+        
+        // Accept a new client connection from whichever endpoint has one
+        int client_socket = listener_accept(&client_address, &client_address_length);
         
         if (client_socket < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
             perror("Failed to accept connection");
             continue;  // Continue to next iteration to accept new connections
         }
+        metrics_count_connection();
+        
+        // Turn the connection away right here when the server is full
+        if (conn_manager_admit() != 0) {
+            conn_manager_reject(client_socket);
+            continue;
+        }
         
-        // Allocate memory for client info
-        client_connection_t* client_info = malloc(sizeof(client_connection_t));
+        // Take a structure for the client info from its pool
+        client_connection_t* client_info = client_connection_new();
         if (!client_info) {
             perror("Failed to allocate memory");
             close(client_socket);
+            conn_manager_release();
             continue;
         }
         
         client_info->client_socket = client_socket;
         client_info->client_address = client_address;
+        client_info->client_address_length = client_address_length;
+        client_info->accepted_ns = metrics_now_ns();
         
-        // Create a new thread to handle the client
-        pthread_t thread_id;
-        if (pthread_create(&thread_id, NULL, handle_client_connection, (void*)client_info) != 0) {
+        // Create a detached thread to handle the client, so its resources are
+        // released when it terminates
+        if (start_detached_thread(handle_client_connection, (void*)client_info, thread_stack_size) != 0) {
             perror("Failed to create thread");
-            free(client_info);
-            close(client_socket);
+            client_connection_free(client_info);
+            conn_manager_reject(client_socket);
+            conn_manager_release();
             continue;
         }
-        
-        // Detach the thread so its resources are automatically released when it terminates
-        pthread_detach(thread_id);
+    }
+    
+    // Stop accepting and let the requests in flight finish
+    listener_close_all();
+    conn_manager_drain();
+    int remaining = conn_manager_wait_idle(drain_timeout_ms);
+    if (remaining > 0) {
+        fprintf(stderr, "Closing %d connections still open after %ums\n", remaining, drain_timeout_ms);
     }
 }
 
+// Parse "class=workers[:queue]" for -W
+static int parse_executor_option(const char *option) {
+    char name[32];
+    const char *equals = strchr(option, '=');
+    if (!equals || (size_t)(equals - option) >= sizeof(name)) {
+        return -1;
+    }
+    memcpy(name, option, equals - option);
+    name[equals - option] = '\0';
+    
+    int workers = string_to_int(equals + 1);
+    const char *colon = strchr(equals + 1, ':');
+    if (colon) {
+        // string_to_int rejects trailing characters, so parse the worker count up to the colon
+        char count[16];
+        size_t count_length = colon - (equals + 1);
+        if (count_length >= sizeof(count)) {
+            return -1;
+        }
+        memcpy(count, equals + 1, count_length);
+        count[count_length] = '\0';
+        workers = string_to_int(count);
+    }
+    int queue = colon ? string_to_int(colon + 1) : 0;
+    
+    if (workers <= 0 || queue < 0) {
+        return -1;
+    }
+    return executor_configure(executor_class_from_name(name), workers, queue);
+}
+
+// Parse comma-separated socket options for -O
+static int parse_socket_options(const char *option_list) {
+    char options[256];
+    if (strlen(option_list) >= sizeof(options)) {
+        return -1;
+    }
+    strcpy(options, option_list);
+    
+    for (char *option = strtok(options, ","); option; option = strtok(NULL, ",")) {
+        if (socket_options_parse(&socket_defaults, option) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Parse "pattern=class" for -R
+static int parse_route_class_option(const char *option) {
+    char pattern[128];
+    const char *equals = strchr(option, '=');
+    if (!equals || (size_t)(equals - option) >= sizeof(pattern)) {
+        return -1;
+    }
+    memcpy(pattern, option, equals - option);
+    pattern[equals - option] = '\0';
+    return set_route_class(pattern, executor_class_from_name(equals + 1));
+}
+
+// Parse "/route/=milliseconds" for --cache
+static int parse_route_cache_option(const char *option) {
+    char pattern[128];
+    const char *equals = strchr(option, '=');
+    if (!equals || (size_t)(equals - option) >= sizeof(pattern) || string_to_int(equals + 1) < 0) {
+        return -1;
+    }
+    memcpy(pattern, option, equals - option);
+    pattern[equals - option] = '\0';
+    return set_route_cache_ttl(pattern, string_to_int(equals + 1));
+}
+
+// Parse "phase=milliseconds" for -t
+static int parse_timeout_option(const char *option, unsigned int timeouts_ms[CONN_PHASE_COUNT]) {
+    static const char *phase_names[CONN_PHASE_COUNT] = {
+        [CONN_PHASE_HEADER] = "header",
+        [CONN_PHASE_BODY] = "body",
+        [CONN_PHASE_IDLE] = "idle",
+        [CONN_PHASE_WRITE] = "write",
+    };
+    
+    const char *equals = strchr(option, '=');
+    int timeout = equals ? string_to_int(equals + 1) : 0;
+    if (!equals || timeout <= 0) {
+        return -1;
+    }
+    
+    for (int phase = CONN_PHASE_HEADER; phase < CONN_PHASE_COUNT; phase++) {
+        if (strlen(phase_names[phase]) == (size_t)(equals - option) &&
+            strncmp(option, phase_names[phase], equals - option) == 0) {
+            timeouts_ms[phase] = timeout;
+            return 0;
+        }
+    }
+    return -1;
+}
+
 int main(int argc, char* argv[]) {
     int server_port = DEFAULT_PORT;
+    int port_given = 0;
+    int worker_processes = 0;
+    const char *bundle_path = NULL;
+    int max_connections = DEFAULT_MAX_CONNECTIONS;
+    unsigned int timeouts_ms[CONN_PHASE_COUNT] = {0};
+    int shed_target_ms = DEFAULT_SHED_TARGET_MS;
+    size_t cache_memory = DEFAULT_RESPONSE_CACHE_BYTES;
+    const char *certificate_file = NULL;
+    const char *key_file = NULL;
+    const char *capture_path = NULL;
     int option;
     
+    static const struct option long_options[] = {
+        {"listen", required_argument, NULL, 'l'},
+        {"workers", required_argument, NULL, 'w'},
+        {"drain-timeout", required_argument, NULL, 'D'},
+        {"stack-size", required_argument, NULL, 'S'},
+        {"cache", required_argument, NULL, 'M'},
+        {"cache-memory", required_argument, NULL, 'm'},
+        {"trace", required_argument, NULL, 'x'},
+        {"capture", required_argument, NULL, 'k'},
+        {"proxy", required_argument, NULL, 'P'},
+        {"module", required_argument, NULL, 'H'},
+        {NULL, 0, NULL, 0}
+    };
+    
+    // Responses do not wait on Nagle's algorithm; heads and bodies are
+    // coalesced with MSG_MORE instead
+    socket_options_init(&socket_defaults);
+    socket_defaults.nodelay = 1;
+    
+    // Routes are registered first so that -R can reclassify them
+    register_default_routes();
+    
     // Parse command line arguments
-    while ((option = getopt(argc, argv, "p:v")) != -1) {
+    while ((option = getopt_long(argc, argv, "p:va:b:T:W:R:c:t:L:r:C:K:l:O:w:D:S:M:m:x:k:P:H:", long_options, NULL)) != -1) {
         switch (option) {
             case 'p':
                 server_port = string_to_int(optarg);
@@ -132,18 +312,230 @@ int main(int argc, char* argv[]) {
                     fprintf(stderr, "Invalid port number. Using default port %d.\n", DEFAULT_PORT);
                     server_port = DEFAULT_PORT;
                 }
+                port_given = 1;
+                break;
+            case 'l':
+                if (listener_add(optarg) != 0) {
+                    fprintf(stderr, "Invalid listen address '%s'. Expected tcp4:[host:]port, tcp6:[[host]:]port,\n"
+                                    "unix:/path or abstract:name, optionally followed by ,backlog=N ,mode=0660 ,v6only ,reuseport.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'w':
+                worker_processes = string_to_int(optarg);
+                if (worker_processes < 0 || worker_processes > MAX_WORKER_PROCESSES) {
+                    fprintf(stderr, "Invalid number of worker processes. Expected 0 to %d.\n", MAX_WORKER_PROCESSES);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'D':
+                if (string_to_int(optarg) < 0) {
+                    fprintf(stderr, "Invalid drain timeout. Using default %dms.\n", DEFAULT_DRAIN_TIMEOUT_MS);
+                } else {
+                    drain_timeout_ms = string_to_int(optarg);
+                }
+                break;
+            case 'S':
+                if (string_to_int(optarg) < MIN_THREAD_STACK_SIZE / 1024) {
+                    fprintf(stderr, "Invalid thread stack size. Expected at least %dKB.\n", MIN_THREAD_STACK_SIZE / 1024);
+                    exit(EXIT_FAILURE);
+                }
+                thread_stack_size = (size_t)string_to_int(optarg) * 1024;
+                break;
+            case 'M':
+                if (parse_route_cache_option(optarg) != 0) {
+                    fprintf(stderr, "Invalid response cache setting '%s'. Expected /route/=milliseconds.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'm':
+                if (string_to_int(optarg) < 0) {
+                    fprintf(stderr, "Invalid response cache size. Using default %d bytes.\n", DEFAULT_RESPONSE_CACHE_BYTES);
+                } else {
+                    cache_memory = string_to_int(optarg);
+                }
+                break;
+            case 'x':
+                if (string_to_int(optarg) < 0) {
+                    fprintf(stderr, "Invalid trace sampling '%s'. Expected N to trace one request in N,\n"
+                                    "or 0 for only requests sent with X-Trace: 1.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                trace_configure(string_to_int(optarg));
+                break;
+            case 'k':
+                capture_path = optarg;
+                break;
+            case 'P':
+                if (proxy_add(optarg) != 0) {
+                    fprintf(stderr, "Invalid proxy route '%s'. Expected /prefix/=upstream[,upstream...] with up to %d\n"
+                                    "upstreams written tcp4:host:port, tcp6:[host]:port, unix:/path or abstract:name,\n"
+                                    "for a prefix no other route has.\n", optarg, PROXY_MAX_UPSTREAMS);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'H':
+                if (module_load(optarg) != 0) {
+                    fprintf(stderr, "Invalid module '%s'. Expected path.so[=arguments] built against module_api.h\n"
+                                    "version %d, registering routes no other route has.\n", optarg, HTTP_MODULE_ABI_VERSION);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'O':
+                if (parse_socket_options(optarg) != 0) {
+                    fprintf(stderr, "Invalid socket options '%s'. Expected a list of nodelay[=0|1], cork[=0|1],\n"
+                                    "defer_accept=seconds, fastopen=queue, rcvbuf=bytes, sndbuf=bytes, busy_poll=microseconds.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
                 break;
             case 'v':
                 verbose_mode = 1;
                 break;
+            case 'a':
+                bundle_path = optarg;
+                break;
+            case 'b':
+                if (string_to_int(optarg) <= 0) {
+                    fprintf(stderr, "Invalid body size limit. Using default %d bytes.\n", DEFAULT_MAX_BODY_SIZE);
+                } else {
+                    max_body_size = string_to_int(optarg);
+                }
+                break;
+            case 'T':
+                if (string_to_int(optarg) < 0) {
+                    fprintf(stderr, "Invalid spool threshold. Using default %d bytes.\n", DEFAULT_SPOOL_THRESHOLD);
+                } else {
+                    spool_threshold = string_to_int(optarg);
+                }
+                break;
+            case 'W':
+                if (parse_executor_option(optarg) != 0) {
+                    fprintf(stderr, "Invalid executor setting '%s'. Expected blocking|cpu=workers[:queue].\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'R':
+                if (parse_route_class_option(optarg) != 0) {
+                    fprintf(stderr, "Invalid route class '%s'. Expected /route/=inline|blocking|cpu.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'c':
+                max_connections = string_to_int(optarg);
+                if (max_connections <= 0) {
+                    fprintf(stderr, "Invalid connection limit. Using default %d.\n", DEFAULT_MAX_CONNECTIONS);
+                    max_connections = DEFAULT_MAX_CONNECTIONS;
+                }
+                break;
+            case 't':
+                if (parse_timeout_option(optarg, timeouts_ms) != 0) {
+                    fprintf(stderr, "Invalid timeout '%s'. Expected header|body|idle|write=milliseconds.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'L':
+                shed_target_ms = string_to_int(optarg);
+                if (shed_target_ms < 0) {
+                    fprintf(stderr, "Invalid queue latency target. Using default %dms.\n", DEFAULT_SHED_TARGET_MS);
+                    shed_target_ms = DEFAULT_SHED_TARGET_MS;
+                }
+                break;
+            case 'r':
+                if (rate_limiter_parse_rule(optarg) != 0) {
+                    fprintf(stderr, "Invalid rate limit '%s'. Expected /prefix=requests_per_second[:burst].\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'C':
+                certificate_file = optarg;
+                break;
+            case 'K':
+                key_file = optarg;
+                break;
             default:
-                fprintf(stderr, "Usage: %s [-p port] [-v]\n", argv[0]);
+                fprintf(stderr, "Usage: %s [-p port] [-v] [-a static_bundle] [-b max_body_bytes] [-T spool_threshold_bytes]\n"
+                                "          [-W blocking|cpu=workers[:queue]] [-R /route/=inline|blocking|cpu]\n"
+                                "          [-c max_connections] [-t header|body|idle|write=ms] [-L queue_latency_target_ms]\n"
+                                "          [-r /prefix=requests_per_second[:burst]] [-C certificate.pem -K key.pem]\n"
+                                "          [--listen tcp4:[host:]port|tcp6:[[host]:]port|unix:/path|abstract:name[,option...]]...\n"
+                                "          [-O socket_option[,socket_option...]] [--workers processes]\n"
+                                "          [--drain-timeout ms] [--stack-size KB]\n"
+                                "          [--cache /route/=ttl_ms] [--cache-memory bytes] [--trace sample_every]\n"
+                                "          [--capture file] [--proxy /prefix/=upstream[,upstream...]]...\n"
+                                "          [--module path.so[=arguments]]...\n", argv[0]);
                 exit(EXIT_FAILURE);
         }
     }
     
-    // Set up signal handler for Ctrl+C
+    socket_options_set_cork(socket_defaults.cork != 0);
+    
+    // Set up signal handlers for Ctrl+C, a service manager stopping us and
+    // hot upgrades
     signal(SIGINT, handle_interrupt_signal);
+    signal(SIGTERM, handle_interrupt_signal);
+    signal(SIGUSR2, handle_upgrade_signal);
+    
+    // Trace dumps can be asked for any number of times, so the handler must
+    // stay installed after the first one
+    struct sigaction trace_action;
+    memset(&trace_action, 0, sizeof(trace_action));
+    trace_action.sa_handler = handle_trace_signal;
+    trace_action.sa_flags = SA_RESTART;
+    sigemptyset(&trace_action.sa_mask);
+    sigaction(SIGUSR1, &trace_action, NULL);
+    
+    // Started by an upgrade: pick up the listening sockets of the old binary
+    if (upgrade_init(argv) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    
+    // A client closing mid-response must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+    
+    // Terminate TLS here instead of in a separate proxy
+    if (certificate_file || key_file) {
+        if (!certificate_file || !key_file) {
+            fprintf(stderr, "TLS needs both a certificate (-C) and a private key (-K).\n");
+            exit(EXIT_FAILURE);
+        }
+        if (tls_configure(certificate_file, key_file) < 0) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    // Map the packed static assets before accepting any connections
+    if (bundle_path && static_bundle_open(bundle_path) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    
+    // Hash the static files for their fingerprinted URLs; workers inherit the manifest
+    int fingerprinted = asset_manifest_build(STATIC_DIR, MAX_FILE_SIZE);
+    if (fingerprinted > 0) {
+        printf("Fingerprinted %d static files, listed at %s\n", fingerprinted, ASSET_MANIFEST_PATH);
+    }
+    
+    // Pools for connections and their buffers, shared by every worker's threads
+    if (client_handler_init() < 0) {
+        exit(EXIT_FAILURE);
+    }
+    response_cache_configure(cache_memory);
+    
+    // Fixed pages and errors are serialized once instead of per request
+    if (constant_responses_render() < 0) {
+        fprintf(stderr, "Failed to render the constant responses\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    // Opened before any fork, so every worker appends to the same file
+    if (capture_path && capture_open(capture_path) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    
+    // An explicit -p still listens next to any --listen endpoints
+    if (port_given && listener_add_port(server_port) != 0) {
+        fprintf(stderr, "Too many listeners.\n");
+        exit(EXIT_FAILURE);
+    }
     
     // Initialize server
     if (initialize_server(server_port) < 0) {
@@ -156,13 +548,57 @@ int main(int argc, char* argv[]) {
     printf("  /calc/add/[num1]/[num2] - Addition\n");
     printf("  /calc/mul/[num1]/[num2] - Multiplication\n");
     printf("  /calc/div/[num1]/[num2] - Division\n");
+    printf("  POST /calc/batch        - Many calculations in one request\n");
     printf("  /sleep/[seconds]        - Sleep (for testing pipelining)\n");
+    printf("  /stream/[lines]         - Streamed (chunked) response\n");
+    printf("  POST|PUT /upload        - Upload a request body (up to %zu bytes)\n", max_body_size);
+    printf("  /stats                  - Server statistics\n");
+    printf("  /asset-manifest.json    - Fingerprinted URLs of the static files\n");
+    printf("  /debug/trace            - Traced requests as Chrome trace-event JSON (--trace)\n");
+    for (int i = 0; i < proxy_upstream_count(); i++) {
+        proxy_upstream_stats_t upstream;
+        proxy_get_upstream_stats(i, &upstream);
+        printf("  %-23s - Forwarded to %s\n", upstream.route, upstream.address);
+    }
+    for (int i = 0; i < module_count(); i++) {
+        printf("  Module %-16s - %d routes\n", module_name(i), module_route_count(i));
+    }
     
-    // Run the server main loop
-    run_server_loop();
+    // In pre-fork mode this process stays the supervisor and only its
+    // workers return here; threads are started after the fork, per worker
+    if (worker_processes > 0 && supervisor_run(worker_processes) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    
+    // Keep the manifest current as static files change, from each worker
+    if (asset_manifest_watch() < 0) {
+        fprintf(stderr, "Warning: static files are not being watched for changes\n");
+    }
     
-    // Close the server socket (though we should never reach this point)
-    close(server_socket);
+    // Start the per-class handler pools, shedding load once queueing delay stays over target
+    executor_set_shed_target((unsigned long long)shed_target_ms * 1000000ULL);
+    if (executor_start() < 0) {
+        exit(EXIT_FAILURE);
+    }
     
+    // Start enforcing connection limits and deadlines
+    conn_manager_configure(max_connections, timeouts_ms);
+    if (conn_manager_start() < 0) {
+        exit(EXIT_FAILURE);
+    }
+    
+    // A single process publishes its counters like a worker would
+    if (worker_processes == 0 && (worker_stats_create(0) != 0 || worker_stats_attach(0) != 0)) {
+        fprintf(stderr, "Warning: stats are not being published\n");
+    }
+    
+    // Everything is up: an old binary being upgraded can stop accepting
+    upgrade_ready();
+    
+    // Run the server main loop until stopped, then drain
+    run_server_loop();
+    
+    worker_stats_remove();
+    printf("\nServer shutting down...\n");
     return 0;
 }
\ No newline at end of file
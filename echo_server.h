@@ -1,19 +1,27 @@
 #ifndef ECHO_SERVER_H
 #define ECHO_SERVER_H
 
+#include <sys/socket.h>
 #include <netinet/in.h>
 
 #define DEFAULT_PORT 80  // Changed from 8080 to 80 as per requirements
 #define BUFFER_SIZE 8192  // Increased for HTTP requests
 #define MAX_PENDING_CONNECTIONS 10  // Increased for better handling of concurrent connections
+#define DEFAULT_SHED_TARGET_MS 100  // Shed load when handler queues stay slower than this
+#define DEFAULT_THREAD_STACK_SIZE (256 * 1024)  // Connection and handler threads need far less than the 8MB default
+#define MIN_THREAD_STACK_SIZE (64 * 1024)
 
-extern int server_socket;
 extern int verbose_mode;
+extern size_t max_body_size;     // Largest request body accepted
+extern size_t spool_threshold;   // Bodies larger than this are spooled to a temp file
+extern size_t thread_stack_size; // Stack of every connection, stream and handler thread
 
 // Helps pass data to client handler threads
 typedef struct {
     int client_socket;
-    struct sockaddr_in client_address;
+    struct sockaddr_storage client_address;   // IPv4, IPv6 or Unix peer
+    socklen_t client_address_length;
+    unsigned long long accepted_ns;           // When accept() returned, for tracing
 } client_connection_t;
 
 void* handle_client_connection(void* arg);
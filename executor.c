@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "executor.h"
+#include "echo_server.h"
+#include "utils.h"
+
+#define SHED_INTERVAL_NS 100000000ULL // Window over which the minimum queue wait is taken
+
+// A job submitted by a connection thread, which waits for it on done_cond
+typedef struct {
+    void (*function)(void *arg);
+    void *arg;
+    unsigned long long enqueued_ns;
+    int done;
+    pthread_mutex_t done_mutex;
+    pthread_cond_t done_cond;
+} executor_job_t;
+
+typedef struct {
+    const char *name;
+    int workers;
+    size_t capacity;
+    executor_job_t **queue;     // Ring buffer of pending jobs
+    size_t head;
+    size_t count;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    unsigned long long submitted;
+    unsigned long long completed;
+    unsigned long long rejected;
+    unsigned long long total_wait_ns;
+    unsigned long long max_wait_ns;
+    unsigned long long shed;
+    // Load shedding state: the shortest queue wait seen in the current interval
+    unsigned long long interval_start_ns;
+    unsigned long long interval_min_wait_ns;
+    int interval_samples;
+    int overloaded;
+} executor_t;
+
+static executor_t executors[EXECUTOR_CLASS_COUNT] = {
+    { .name = "inline" },
+    { .name = "blocking", .workers = DEFAULT_BLOCKING_WORKERS, .capacity = DEFAULT_BLOCKING_QUEUE },
+    { .name = "cpu", .workers = 0, .capacity = DEFAULT_CPU_QUEUE },   // Defaults to one worker per core
+};
+
+static unsigned long long shed_target_ns = 0;
+
+static unsigned long long monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Close the current interval if it is over. A queue whose shortest wait
+// stayed above target for a whole interval is a standing queue, not a burst.
+// Must be called with executor->mutex held.
+static void update_overload(executor_t *executor, unsigned long long now) {
+    if (now - executor->interval_start_ns < SHED_INTERVAL_NS) {
+        return;
+    }
+    // With slow jobs nothing may leave the queue for a whole interval; the
+    // job at the head has waited at least this long already
+    if (executor->interval_samples == 0 && executor->count > 0) {
+        executor->interval_min_wait_ns = now - executor->queue[executor->head]->enqueued_ns;
+        executor->interval_samples = 1;
+    }
+    executor->overloaded = shed_target_ns > 0 && executor->interval_samples > 0 &&
+                           executor->interval_min_wait_ns > shed_target_ns;
+    executor->interval_start_ns = now;
+    executor->interval_min_wait_ns = ~0ULL;
+    executor->interval_samples = 0;
+}
+
+static void *executor_worker(void *arg) {
+    executor_t *executor = arg;
+
+    while (1) {
+        pthread_mutex_lock(&executor->mutex);
+        while (executor->count == 0) {
+            pthread_cond_wait(&executor->not_empty, &executor->mutex);
+        }
+
+        executor_job_t *job = executor->queue[executor->head];
+        executor->head = (executor->head + 1) % executor->capacity;
+        executor->count--;
+
+        unsigned long long now = monotonic_ns();
+        unsigned long long wait_ns = now - job->enqueued_ns;
+        executor->total_wait_ns += wait_ns;
+        if (wait_ns > executor->max_wait_ns) {
+            executor->max_wait_ns = wait_ns;
+        }
+        if (wait_ns < executor->interval_min_wait_ns) {
+            executor->interval_min_wait_ns = wait_ns;
+        }
+        executor->interval_samples++;
+        update_overload(executor, now);
+        pthread_mutex_unlock(&executor->mutex);
+
+        job->function(job->arg);
+
+        pthread_mutex_lock(&executor->mutex);
+        executor->completed++;
+        pthread_mutex_unlock(&executor->mutex);
+
+        // Wake the connection thread waiting for this job
+        pthread_mutex_lock(&job->done_mutex);
+        job->done = 1;
+        pthread_cond_signal(&job->done_cond);
+        pthread_mutex_unlock(&job->done_mutex);
+    }
+
+    return NULL;
+}
+
+int executor_configure(int executor_class, int workers, size_t queue_capacity) {
+    if (executor_class <= EXECUTOR_INLINE || executor_class >= EXECUTOR_CLASS_COUNT) {
+        return -1;
+    }
+    if (workers > 0) {
+        executors[executor_class].workers = workers;
+    }
+    if (queue_capacity > 0) {
+        executors[executor_class].capacity = queue_capacity;
+    }
+    return 0;
+}
+
+void executor_set_shed_target(unsigned long long target_ns) {
+    shed_target_ns = target_ns;
+}
+
+int executor_start(void) {
+    if (executors[EXECUTOR_CPU].workers <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        executors[EXECUTOR_CPU].workers = cores > 0 ? cores : 1;
+    }
+
+    for (int i = EXECUTOR_INLINE + 1; i < EXECUTOR_CLASS_COUNT; i++) {
+        executor_t *executor = &executors[i];
+        executor->queue = calloc(executor->capacity, sizeof(executor_job_t *));
+        if (!executor->queue) {
+            perror("Failed to allocate executor queue");
+            return -1;
+        }
+        pthread_mutex_init(&executor->mutex, NULL);
+        pthread_cond_init(&executor->not_empty, NULL);
+        executor->interval_start_ns = monotonic_ns();
+        executor->interval_min_wait_ns = ~0ULL;
+
+        for (int w = 0; w < executor->workers; w++) {
+            if (start_detached_thread(executor_worker, executor, thread_stack_size) != 0) {
+                perror("Failed to create executor thread");
+                return -1;
+            }
+        }
+
+        printf("Executor %-8s: %d workers, queue of %zu\n", executor->name, executor->workers, executor->capacity);
+    }
+
+    return 0;
+}
+
+int executor_run(int executor_class, void (*function)(void *arg), void *arg) {
+    if (executor_class < 0 || executor_class >= EXECUTOR_CLASS_COUNT) {
+        executor_class = EXECUTOR_INLINE;
+    }
+    executor_t *executor = &executors[executor_class];
+
+    // Inline jobs, or pools that were never started, run on the caller's thread
+    if (executor_class == EXECUTOR_INLINE || !executor->queue) {
+        __atomic_fetch_add(&executor->submitted, 1, __ATOMIC_RELAXED);
+        function(arg);
+        __atomic_fetch_add(&executor->completed, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    executor_job_t job;
+    job.function = function;
+    job.arg = arg;
+    job.done = 0;
+    pthread_mutex_init(&job.done_mutex, NULL);
+    pthread_cond_init(&job.done_cond, NULL);
+
+    pthread_mutex_lock(&executor->mutex);
+    job.enqueued_ns = monotonic_ns();
+    update_overload(executor, job.enqueued_ns);
+    int shedding = executor->overloaded && executor->count > 0;
+    if (shedding || executor->count == executor->capacity) {
+        if (shedding) {
+            executor->shed++;
+        } else {
+            executor->rejected++;
+        }
+        pthread_mutex_unlock(&executor->mutex);
+        pthread_mutex_destroy(&job.done_mutex);
+        pthread_cond_destroy(&job.done_cond);
+        return -1;
+    }
+    executor->queue[(executor->head + executor->count) % executor->capacity] = &job;
+    executor->count++;
+    executor->submitted++;
+    pthread_cond_signal(&executor->not_empty);
+    pthread_mutex_unlock(&executor->mutex);
+
+    pthread_mutex_lock(&job.done_mutex);
+    while (!job.done) {
+        pthread_cond_wait(&job.done_cond, &job.done_mutex);
+    }
+    pthread_mutex_unlock(&job.done_mutex);
+
+    pthread_mutex_destroy(&job.done_mutex);
+    pthread_cond_destroy(&job.done_cond);
+    return 0;
+}
+
+int executor_class_from_name(const char *name) {
+    for (int i = 0; i < EXECUTOR_CLASS_COUNT; i++) {
+        if (name && strcmp(name, executors[i].name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void executor_get_stats(int executor_class, executor_stats_t *stats) {
+    if (!stats || executor_class < 0 || executor_class >= EXECUTOR_CLASS_COUNT) {
+        return;
+    }
+    executor_t *executor = &executors[executor_class];
+
+    if (executor->queue) {
+        pthread_mutex_lock(&executor->mutex);
+    }
+    stats->name = executor->name;
+    stats->workers = executor->workers;
+    stats->queue_capacity = executor->capacity;
+    stats->queue_depth = executor->count;
+    stats->submitted = __atomic_load_n(&executor->submitted, __ATOMIC_RELAXED);
+    stats->completed = __atomic_load_n(&executor->completed, __ATOMIC_RELAXED);
+    stats->rejected = executor->rejected;
+    stats->shed = executor->shed;
+    stats->total_wait_ns = executor->total_wait_ns;
+    stats->max_wait_ns = executor->max_wait_ns;
+    if (executor->queue) {
+        pthread_mutex_unlock(&executor->mutex);
+    }
+}
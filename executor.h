@@ -0,0 +1,54 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <stddef.h>
+
+// Execution classes assigned to routes at registration
+#define EXECUTOR_INLINE    0  // Fast handlers, run directly on the connection thread
+#define EXECUTOR_BLOCKING  1  // Handlers that sleep or wait on I/O
+#define EXECUTOR_CPU       2  // Handlers that burn CPU
+#define EXECUTOR_CLASS_COUNT 3
+
+#define DEFAULT_BLOCKING_WORKERS 16
+#define DEFAULT_BLOCKING_QUEUE   256
+#define DEFAULT_CPU_QUEUE        256
+
+// Snapshot of one executor's counters
+typedef struct {
+    const char *name;
+    int workers;
+    size_t queue_capacity;
+    size_t queue_depth;
+    unsigned long long submitted;
+    unsigned long long completed;
+    unsigned long long rejected;         // Turned away because the queue was full
+    unsigned long long shed;             // Turned away because queueing delay was over target
+    unsigned long long total_wait_ns;    // Time jobs spent queued before a worker took them
+    unsigned long long max_wait_ns;
+} executor_stats_t;
+
+// Set the size of a class's pool before executor_start(). workers <= 0 keeps
+// the default. Returns -1 for an unknown class.
+int executor_configure(int executor_class, int workers, size_t queue_capacity);
+
+// Shed load once jobs keep waiting longer than target_ns in a queue: if
+// even the shortest wait over a 100ms interval was above target, new jobs
+// for that class are refused until the queue recovers. 0 disables shedding.
+void executor_set_shed_target(unsigned long long target_ns);
+
+// Start the worker pools
+int executor_start(void);
+
+// Run job(arg) on the executor for the given class and wait for it to
+// finish. Each class has its own workers and queue, so a backlog of slow
+// jobs cannot delay jobs of another class. Returns 0 once the job has run,
+// or -1 if the queue was full or shedding load and the job was not run.
+int executor_run(int executor_class, void (*job)(void *arg), void *arg);
+
+// Map a class name ("inline", "blocking", "cpu") to its class, or -1
+int executor_class_from_name(const char *name);
+
+// Get the counters of one class
+void executor_get_stats(int executor_class, executor_stats_t *stats);
+
+#endif
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "file_cache.h"
+#include "metrics.h"
+
+#define FILE_CACHE_BUCKETS 256
+
+// Loading state of an entry
+#define ENTRY_LOADING 0
+#define ENTRY_READY   1
+#define ENTRY_FAILED  2
+
+struct file_cache_entry {
+    char path[1024];
+    void *data;
+    size_t size;
+    int state;
+    int error;              // FILE_CACHE_* code when state is ENTRY_FAILED
+    unsigned long long hash; // FNV-1a 64 of the data, the same hash http_pack puts in ETags
+    int refcount;
+    int in_table;           // Still reachable through the hash table
+    unsigned long last_used;
+    // Identity of the file the data was read from, used to detect changes
+    dev_t device;
+    ino_t inode;
+    off_t file_size;
+    struct timespec modified;
+    struct file_cache_entry *next;
+};
+
+static file_cache_entry_t *cache_buckets[FILE_CACHE_BUCKETS];
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cache_loaded = PTHREAD_COND_INITIALIZER;
+static size_t cache_bytes = 0;
+static unsigned long cache_clock = 0;
+
+// FNV-1a hash of the path
+static unsigned int hash_path(const char *path) {
+    unsigned int hash = 2166136261u;
+    while (*path) {
+        hash ^= (unsigned char)*path++;
+        hash *= 16777619u;
+    }
+    return hash % FILE_CACHE_BUCKETS;
+}
+
+static int same_file(const file_cache_entry_t *entry, const struct stat *st) {
+    return entry->device == st->st_dev &&
+           entry->inode == st->st_ino &&
+           entry->file_size == st->st_size &&
+           entry->modified.tv_sec == st->st_mtim.tv_sec &&
+           entry->modified.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static void free_entry(file_cache_entry_t *entry) {
+    free(entry->data);
+    free(entry);
+}
+
+// Remove an entry from the table. Must be called with cache_mutex held.
+static void unlink_entry(file_cache_entry_t *entry) {
+    file_cache_entry_t **link = &cache_buckets[hash_path(entry->path)];
+    while (*link && *link != entry) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = entry->next;
+    }
+    entry->next = NULL;
+    entry->in_table = 0;
+    if (entry->state == ENTRY_READY) {
+        cache_bytes -= entry->size;
+    }
+}
+
+// Evict least recently used unreferenced entries until the cache fits its
+// budget. Must be called with cache_mutex held.
+static void evict_entries(void) {
+    while (cache_bytes > FILE_CACHE_MAX_BYTES) {
+        file_cache_entry_t *oldest = NULL;
+        for (int i = 0; i < FILE_CACHE_BUCKETS; i++) {
+            for (file_cache_entry_t *e = cache_buckets[i]; e; e = e->next) {
+                if (e->state == ENTRY_READY && e->refcount == 0 &&
+                    (!oldest || e->last_used < oldest->last_used)) {
+                    oldest = e;
+                }
+            }
+        }
+        if (!oldest) {
+            return; // Everything left is in use
+        }
+        unlink_entry(oldest);
+        free_entry(oldest);
+    }
+}
+
+// Read the whole file into the entry. Called without cache_mutex held.
+static int load_entry(file_cache_entry_t *entry, size_t max_size) {
+    int fd = open(entry->path, O_RDONLY);
+    if (fd < 0) {
+        return FILE_CACHE_NOT_FOUND;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return FILE_CACHE_NOT_REGULAR;
+    }
+
+    if ((size_t)st.st_size > max_size) {
+        close(fd);
+        return FILE_CACHE_TOO_LARGE;
+    }
+
+    // Allocate at least one byte so empty files still get a valid buffer
+    void *data = malloc(st.st_size > 0 ? (size_t)st.st_size : 1);
+    if (!data) {
+        close(fd);
+        return FILE_CACHE_ERROR;
+    }
+
+    size_t total = 0;
+    while (total < (size_t)st.st_size) {
+        ssize_t bytes_read = read(fd, (char *)data + total, st.st_size - total);
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            break;
+        }
+        total += bytes_read;
+    }
+    close(fd);
+
+    if (total != (size_t)st.st_size) {
+        free(data);
+        return FILE_CACHE_ERROR;
+    }
+
+    // Hashed once per load, so fingerprints and ETags cost nothing per request
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < total; i++) {
+        hash ^= ((const unsigned char *)data)[i];
+        hash *= 1099511628211ULL;
+    }
+
+    entry->data = data;
+    entry->size = total;
+    entry->hash = hash;
+    entry->device = st.st_dev;
+    entry->inode = st.st_ino;
+    entry->file_size = st.st_size;
+    entry->modified = st.st_mtim;
+    return FILE_CACHE_OK;
+}
+
+int file_cache_acquire(const char *full_path, size_t max_size, file_cache_entry_t **entry_out) {
+    if (!full_path || !entry_out || strlen(full_path) >= sizeof(((file_cache_entry_t *)0)->path)) {
+        return FILE_CACHE_ERROR;
+    }
+    *entry_out = NULL;
+
+    // Stat outside the lock so that changed files are picked up
+    struct stat st;
+    if (stat(full_path, &st) < 0) {
+        return FILE_CACHE_NOT_FOUND;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        return FILE_CACHE_NOT_REGULAR;
+    }
+    if ((size_t)st.st_size > max_size) {
+        return FILE_CACHE_TOO_LARGE;
+    }
+
+    unsigned int bucket = hash_path(full_path);
+
+    pthread_mutex_lock(&cache_mutex);
+
+    file_cache_entry_t *entry = cache_buckets[bucket];
+    while (entry && strcmp(entry->path, full_path) != 0) {
+        entry = entry->next;
+    }
+
+    // Drop data that no longer matches the file on disk
+    if (entry && entry->state == ENTRY_READY && !same_file(entry, &st)) {
+        unlink_entry(entry);
+        if (entry->refcount == 0) {
+            free_entry(entry);
+        }
+        entry = NULL;
+    }
+
+    metrics_count_cache(METRICS_CACHE_FILE, entry != NULL);
+    if (entry) {
+        // Hit, or another thread is already loading this path: share its result
+        entry->refcount++;
+        while (entry->state == ENTRY_LOADING) {
+            pthread_cond_wait(&cache_loaded, &cache_mutex);
+        }
+    } else {
+        // First miss: publish a loading entry so concurrent requests wait on us
+        entry = calloc(1, sizeof(file_cache_entry_t));
+        if (!entry) {
+            pthread_mutex_unlock(&cache_mutex);
+            return FILE_CACHE_ERROR;
+        }
+        strcpy(entry->path, full_path);
+        entry->state = ENTRY_LOADING;
+        entry->refcount = 1;
+        entry->in_table = 1;
+        entry->next = cache_buckets[bucket];
+        cache_buckets[bucket] = entry;
+        pthread_mutex_unlock(&cache_mutex);
+
+        int result = load_entry(entry, max_size);
+
+        pthread_mutex_lock(&cache_mutex);
+        if (result == FILE_CACHE_OK) {
+            entry->state = ENTRY_READY;
+            cache_bytes += entry->size;
+        } else {
+            // Failures are handed to current waiters but never cached
+            entry->state = ENTRY_FAILED;
+            entry->error = result;
+            unlink_entry(entry);
+        }
+        pthread_cond_broadcast(&cache_loaded);
+    }
+
+    if (entry->state == ENTRY_FAILED) {
+        int error = entry->error;
+        if (--entry->refcount == 0) {
+            free_entry(entry);
+        }
+        pthread_mutex_unlock(&cache_mutex);
+        return error;
+    }
+
+    entry->last_used = ++cache_clock;
+    evict_entries();
+    pthread_mutex_unlock(&cache_mutex);
+
+    *entry_out = entry;
+    return FILE_CACHE_OK;
+}
+
+const void *file_cache_entry_data(const file_cache_entry_t *entry) {
+    return entry ? entry->data : NULL;
+}
+
+size_t file_cache_entry_size(const file_cache_entry_t *entry) {
+    return entry ? entry->size : 0;
+}
+
+unsigned long long file_cache_entry_hash(const file_cache_entry_t *entry) {
+    return entry ? entry->hash : 0;
+}
+
+void file_cache_release(file_cache_entry_t *entry) {
+    if (!entry) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache_mutex);
+    if (--entry->refcount == 0) {
+        if (!entry->in_table) {
+            // Replaced or evicted while in use, so nobody else can reach it
+            free_entry(entry);
+        } else {
+            evict_entries();
+        }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+void file_cache_release_body(void *entry) {
+    file_cache_release((file_cache_entry_t *)entry);
+}
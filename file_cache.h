@@ -0,0 +1,35 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <stddef.h>
+
+// Result codes for file_cache_acquire
+#define FILE_CACHE_OK            0
+#define FILE_CACHE_NOT_FOUND    -1
+#define FILE_CACHE_NOT_REGULAR  -2
+#define FILE_CACHE_TOO_LARGE    -3
+#define FILE_CACHE_ERROR        -4
+
+#define FILE_CACHE_MAX_BYTES (64 * 1024 * 1024) // Keep at most 64MB of unreferenced file data
+
+typedef struct file_cache_entry file_cache_entry_t;
+
+// Get the contents of a file, loading it at most once even when many threads
+// miss on the same path at the same time. On success the caller holds a
+// reference and must call file_cache_release() when done with the data.
+int file_cache_acquire(const char *full_path, size_t max_size, file_cache_entry_t **entry_out);
+
+// Access the loaded data of an entry
+const void *file_cache_entry_data(const file_cache_entry_t *entry);
+size_t file_cache_entry_size(const file_cache_entry_t *entry);
+
+// FNV-1a 64 hash of the data, as http_pack computes it for bundle ETags
+unsigned long long file_cache_entry_hash(const file_cache_entry_t *entry);
+
+// Drop a reference obtained from file_cache_acquire
+void file_cache_release(file_cache_entry_t *entry);
+
+// Release callback usable with set_response_body_shared
+void file_cache_release_body(void *entry);
+
+#endif
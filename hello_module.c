@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <string.h>
+#include "module_api.h"
+
+// Example handler module: "http_server --module ./hello_module.so[=greeting]"
+//   GET /hello          - A constant page, sent without copying
+//   GET /hello/[name]   - A greeting written straight into the response body,
+//                         addressed to ?from= when given
+
+static const http_module_api_t *server;
+static char greeting[64] = "Hello";
+
+static const char index_page[] = "Try /hello/world or /hello/world?from=me\n";
+
+static void handle_index(const http_module_request_t *request, http_module_response_t *response, void *context) {
+    (void)request;
+    (void)context;
+    server->static_body(response, index_page, sizeof(index_page) - 1);
+}
+
+static void handle_greeting(const http_module_request_t *request, http_module_response_t *response, void *context) {
+    (void)context;
+    // The path is at least the route, "/hello/"
+    const char *name = request->path.data + strlen("/hello/");
+    int name_length = (int)(request->path.length - strlen("/hello/"));
+
+    http_module_string_t from = { "", 0 };
+    server->param(request, "from", &from);
+    http_module_string_t agent = { "", 0 };
+    server->header(request, "User-Agent", &agent);
+
+    size_t capacity = strlen(greeting) + name_length + from.length + agent.length + 64;
+    char *body = server->body_buffer(response, capacity);
+    if (!body) {
+        server->set_status(response, 500);
+        return;
+    }
+    int length = snprintf(body, capacity, "%s, %.*s%s%.*s!\nSent with %.*s\n", greeting,
+                          name_length, name, from.length ? " from " : "", (int)from.length, from.data,
+                          (int)agent.length, agent.data);
+    server->commit_body(response, length);
+    server->add_header(response, "Cache-Control", "no-cache");
+}
+
+static int init(const http_module_api_t *api, const char *arguments) {
+    server = api;
+    if (arguments[0]) {
+        snprintf(greeting, sizeof(greeting), "%s", arguments);
+    }
+    if (api->register_route("/hello", HTTP_MODULE_METHOD_GET, HTTP_MODULE_RUN_INLINE, handle_index, NULL) != 0 ||
+        api->register_route("/hello/", HTTP_MODULE_METHOD_GET, HTTP_MODULE_RUN_INLINE, handle_greeting, NULL) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+const http_module_t http_module = { HTTP_MODULE_ABI_VERSION, "hello", init };
@@ -0,0 +1,535 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "hpack.h"
+
+#define HPACK_ENTRY_OVERHEAD 32     // Per-entry size added by HPACK
+#define HPACK_STATIC_COUNT 61
+#define HPACK_MAX_INTEGER (1u << 24)
+#define HUFFMAN_EOS 256
+#define HUFFMAN_MAX_BITS 30
+
+struct hpack_entry {
+    char *name;                     // name and value share one allocation
+    size_t name_length;
+    char *value;
+    size_t value_length;
+};
+
+static const struct {
+    const char *name;
+    const char *value;
+} static_table[HPACK_STATIC_COUNT + 1] = {
+    { NULL, NULL },
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" },
+};
+
+// Huffman code of every symbol (RFC 7541 Appendix B), right-aligned, and its length
+static const struct {
+    uint32_t code;
+    uint8_t bits;
+} huffman_table[257] = {
+    { 0x00001ff8, 13 }, { 0x007fffd8, 23 }, { 0x0fffffe2, 28 }, { 0x0fffffe3, 28 },
+    { 0x0fffffe4, 28 }, { 0x0fffffe5, 28 }, { 0x0fffffe6, 28 }, { 0x0fffffe7, 28 },
+    { 0x0fffffe8, 28 }, { 0x00ffffea, 24 }, { 0x3ffffffc, 30 }, { 0x0fffffe9, 28 },
+    { 0x0fffffea, 28 }, { 0x3ffffffd, 30 }, { 0x0fffffeb, 28 }, { 0x0fffffec, 28 },
+    { 0x0fffffed, 28 }, { 0x0fffffee, 28 }, { 0x0fffffef, 28 }, { 0x0ffffff0, 28 },
+    { 0x0ffffff1, 28 }, { 0x0ffffff2, 28 }, { 0x3ffffffe, 30 }, { 0x0ffffff3, 28 },
+    { 0x0ffffff4, 28 }, { 0x0ffffff5, 28 }, { 0x0ffffff6, 28 }, { 0x0ffffff7, 28 },
+    { 0x0ffffff8, 28 }, { 0x0ffffff9, 28 }, { 0x0ffffffa, 28 }, { 0x0ffffffb, 28 },
+    { 0x00000014,  6 }, { 0x000003f8, 10 }, { 0x000003f9, 10 }, { 0x00000ffa, 12 },
+    { 0x00001ff9, 13 }, { 0x00000015,  6 }, { 0x000000f8,  8 }, { 0x000007fa, 11 },
+    { 0x000003fa, 10 }, { 0x000003fb, 10 }, { 0x000000f9,  8 }, { 0x000007fb, 11 },
+    { 0x000000fa,  8 }, { 0x00000016,  6 }, { 0x00000017,  6 }, { 0x00000018,  6 },
+    { 0x00000000,  5 }, { 0x00000001,  5 }, { 0x00000002,  5 }, { 0x00000019,  6 },
+    { 0x0000001a,  6 }, { 0x0000001b,  6 }, { 0x0000001c,  6 }, { 0x0000001d,  6 },
+    { 0x0000001e,  6 }, { 0x0000001f,  6 }, { 0x0000005c,  7 }, { 0x000000fb,  8 },
+    { 0x00007ffc, 15 }, { 0x00000020,  6 }, { 0x00000ffb, 12 }, { 0x000003fc, 10 },
+    { 0x00001ffa, 13 }, { 0x00000021,  6 }, { 0x0000005d,  7 }, { 0x0000005e,  7 },
+    { 0x0000005f,  7 }, { 0x00000060,  7 }, { 0x00000061,  7 }, { 0x00000062,  7 },
+    { 0x00000063,  7 }, { 0x00000064,  7 }, { 0x00000065,  7 }, { 0x00000066,  7 },
+    { 0x00000067,  7 }, { 0x00000068,  7 }, { 0x00000069,  7 }, { 0x0000006a,  7 },
+    { 0x0000006b,  7 }, { 0x0000006c,  7 }, { 0x0000006d,  7 }, { 0x0000006e,  7 },
+    { 0x0000006f,  7 }, { 0x00000070,  7 }, { 0x00000071,  7 }, { 0x00000072,  7 },
+    { 0x000000fc,  8 }, { 0x00000073,  7 }, { 0x000000fd,  8 }, { 0x00001ffb, 13 },
+    { 0x0007fff0, 19 }, { 0x00001ffc, 13 }, { 0x00003ffc, 14 }, { 0x00000022,  6 },
+    { 0x00007ffd, 15 }, { 0x00000003,  5 }, { 0x00000023,  6 }, { 0x00000004,  5 },
+    { 0x00000024,  6 }, { 0x00000005,  5 }, { 0x00000025,  6 }, { 0x00000026,  6 },
+    { 0x00000027,  6 }, { 0x00000006,  5 }, { 0x00000074,  7 }, { 0x00000075,  7 },
+    { 0x00000028,  6 }, { 0x00000029,  6 }, { 0x0000002a,  6 }, { 0x00000007,  5 },
+    { 0x0000002b,  6 }, { 0x00000076,  7 }, { 0x0000002c,  6 }, { 0x00000008,  5 },
+    { 0x00000009,  5 }, { 0x0000002d,  6 }, { 0x00000077,  7 }, { 0x00000078,  7 },
+    { 0x00000079,  7 }, { 0x0000007a,  7 }, { 0x0000007b,  7 }, { 0x00007ffe, 15 },
+    { 0x000007fc, 11 }, { 0x00003ffd, 14 }, { 0x00001ffd, 13 }, { 0x0ffffffc, 28 },
+    { 0x000fffe6, 20 }, { 0x003fffd2, 22 }, { 0x000fffe7, 20 }, { 0x000fffe8, 20 },
+    { 0x003fffd3, 22 }, { 0x003fffd4, 22 }, { 0x003fffd5, 22 }, { 0x007fffd9, 23 },
+    { 0x003fffd6, 22 }, { 0x007fffda, 23 }, { 0x007fffdb, 23 }, { 0x007fffdc, 23 },
+    { 0x007fffdd, 23 }, { 0x007fffde, 23 }, { 0x00ffffeb, 24 }, { 0x007fffdf, 23 },
+    { 0x00ffffec, 24 }, { 0x00ffffed, 24 }, { 0x003fffd7, 22 }, { 0x007fffe0, 23 },
+    { 0x00ffffee, 24 }, { 0x007fffe1, 23 }, { 0x007fffe2, 23 }, { 0x007fffe3, 23 },
+    { 0x007fffe4, 23 }, { 0x001fffdc, 21 }, { 0x003fffd8, 22 }, { 0x007fffe5, 23 },
+    { 0x003fffd9, 22 }, { 0x007fffe6, 23 }, { 0x007fffe7, 23 }, { 0x00ffffef, 24 },
+    { 0x003fffda, 22 }, { 0x001fffdd, 21 }, { 0x000fffe9, 20 }, { 0x003fffdb, 22 },
+    { 0x003fffdc, 22 }, { 0x007fffe8, 23 }, { 0x007fffe9, 23 }, { 0x001fffde, 21 },
+    { 0x007fffea, 23 }, { 0x003fffdd, 22 }, { 0x003fffde, 22 }, { 0x00fffff0, 24 },
+    { 0x001fffdf, 21 }, { 0x003fffdf, 22 }, { 0x007fffeb, 23 }, { 0x007fffec, 23 },
+    { 0x001fffe0, 21 }, { 0x001fffe1, 21 }, { 0x003fffe0, 22 }, { 0x001fffe2, 21 },
+    { 0x007fffed, 23 }, { 0x003fffe1, 22 }, { 0x007fffee, 23 }, { 0x007fffef, 23 },
+    { 0x000fffea, 20 }, { 0x003fffe2, 22 }, { 0x003fffe3, 22 }, { 0x003fffe4, 22 },
+    { 0x007ffff0, 23 }, { 0x003fffe5, 22 }, { 0x003fffe6, 22 }, { 0x007ffff1, 23 },
+    { 0x03ffffe0, 26 }, { 0x03ffffe1, 26 }, { 0x000fffeb, 20 }, { 0x0007fff1, 19 },
+    { 0x003fffe7, 22 }, { 0x007ffff2, 23 }, { 0x003fffe8, 22 }, { 0x01ffffec, 25 },
+    { 0x03ffffe2, 26 }, { 0x03ffffe3, 26 }, { 0x03ffffe4, 26 }, { 0x07ffffde, 27 },
+    { 0x07ffffdf, 27 }, { 0x03ffffe5, 26 }, { 0x00fffff1, 24 }, { 0x01ffffed, 25 },
+    { 0x0007fff2, 19 }, { 0x001fffe3, 21 }, { 0x03ffffe6, 26 }, { 0x07ffffe0, 27 },
+    { 0x07ffffe1, 27 }, { 0x03ffffe7, 26 }, { 0x07ffffe2, 27 }, { 0x00fffff2, 24 },
+    { 0x001fffe4, 21 }, { 0x001fffe5, 21 }, { 0x03ffffe8, 26 }, { 0x03ffffe9, 26 },
+    { 0x0ffffffd, 28 }, { 0x07ffffe3, 27 }, { 0x07ffffe4, 27 }, { 0x07ffffe5, 27 },
+    { 0x000fffec, 20 }, { 0x00fffff3, 24 }, { 0x000fffed, 20 }, { 0x001fffe6, 21 },
+    { 0x003fffe9, 22 }, { 0x001fffe7, 21 }, { 0x001fffe8, 21 }, { 0x007ffff3, 23 },
+    { 0x003fffea, 22 }, { 0x003fffeb, 22 }, { 0x01ffffee, 25 }, { 0x01ffffef, 25 },
+    { 0x00fffff4, 24 }, { 0x00fffff5, 24 }, { 0x03ffffea, 26 }, { 0x007ffff4, 23 },
+    { 0x03ffffeb, 26 }, { 0x07ffffe6, 27 }, { 0x03ffffec, 26 }, { 0x03ffffed, 26 },
+    { 0x07ffffe7, 27 }, { 0x07ffffe8, 27 }, { 0x07ffffe9, 27 }, { 0x07ffffea, 27 },
+    { 0x07ffffeb, 27 }, { 0x0ffffffe, 28 }, { 0x07ffffec, 27 }, { 0x07ffffed, 27 },
+    { 0x07ffffee, 27 }, { 0x07ffffef, 27 }, { 0x07fffff0, 27 }, { 0x03ffffee, 26 },
+    { 0x3fffffff, 30 },
+};
+
+// The code is canonical: the codes of each length are consecutive and
+// ordered by symbol, so decoding only needs, per length, the first code and
+// where its symbols start in the symbol list sorted by (length, symbol)
+static uint32_t first_code[HUFFMAN_MAX_BITS + 1];
+static uint16_t length_count[HUFFMAN_MAX_BITS + 1];
+static uint16_t length_offset[HUFFMAN_MAX_BITS + 1];
+static uint16_t sorted_symbols[257];
+static pthread_once_t huffman_once = PTHREAD_ONCE_INIT;
+
+static void build_huffman_decoder(void) {
+    for (int symbol = 0; symbol <= HUFFMAN_EOS; symbol++) {
+        length_count[huffman_table[symbol].bits]++;
+    }
+
+    uint16_t next[HUFFMAN_MAX_BITS + 1];
+    uint16_t offset = 0;
+    for (int bits = 1; bits <= HUFFMAN_MAX_BITS; bits++) {
+        length_offset[bits] = offset;
+        next[bits] = offset;
+        offset += length_count[bits];
+    }
+    for (int symbol = 0; symbol <= HUFFMAN_EOS; symbol++) {
+        sorted_symbols[next[huffman_table[symbol].bits]++] = symbol;
+    }
+    for (int bits = 1; bits <= HUFFMAN_MAX_BITS; bits++) {
+        if (length_count[bits] > 0) {
+            first_code[bits] = huffman_table[sorted_symbols[length_offset[bits]]].code;
+        }
+    }
+}
+
+static int huffman_decode(const uint8_t *in, size_t length, char *out, size_t out_size, size_t *out_length) {
+    pthread_once(&huffman_once, build_huffman_decoder);
+
+    size_t produced = 0;
+    uint32_t code = 0;
+    int bits = 0;
+    for (size_t i = 0; i < length; i++) {
+        for (int shift = 7; shift >= 0; shift--) {
+            code = (code << 1) | ((in[i] >> shift) & 1);
+            bits++;
+            // Unsigned wrap-around makes codes below first_code fail the test too
+            if (code - first_code[bits] < length_count[bits]) {
+                uint16_t symbol = sorted_symbols[length_offset[bits] + code - first_code[bits]];
+                if (symbol == HUFFMAN_EOS || produced >= out_size) {
+                    return -1;
+                }
+                out[produced++] = (char)symbol;
+                code = 0;
+                bits = 0;
+            } else if (bits == HUFFMAN_MAX_BITS) {
+                return -1;
+            }
+        }
+    }
+
+    // Only a partial EOS code (all ones, under a byte) may pad the end
+    if (bits > 7 || code != (1u << bits) - 1) {
+        return -1;
+    }
+    *out_length = produced;
+    return 0;
+}
+
+static int decode_integer(const uint8_t **position, const uint8_t *end, int prefix_bits, size_t *value_out) {
+    if (*position >= end) {
+        return -1;
+    }
+    size_t max_prefix = (1u << prefix_bits) - 1;
+    size_t value = *(*position)++ & max_prefix;
+    if (value == max_prefix) {
+        int shift = 0;
+        uint8_t byte;
+        do {
+            if (*position >= end || shift > 21) {
+                return -1;
+            }
+            byte = *(*position)++;
+            value += (size_t)(byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+    }
+    if (value > HPACK_MAX_INTEGER) {
+        return -1;
+    }
+    *value_out = value;
+    return 0;
+}
+
+static int decode_string(const uint8_t **position, const uint8_t *end, char *scratch, size_t scratch_size,
+                         const char **string_out, size_t *length_out) {
+    if (*position >= end) {
+        return -1;
+    }
+    int huffman = **position & 0x80;
+    size_t length;
+    if (decode_integer(position, end, 7, &length) != 0 || length > (size_t)(end - *position)) {
+        return -1;
+    }
+
+    if (huffman) {
+        if (huffman_decode(*position, length, scratch, scratch_size, length_out) != 0) {
+            return -1;
+        }
+        *string_out = scratch;
+    } else {
+        *string_out = (const char *)*position;
+        *length_out = length;
+    }
+    *position += length;
+    return 0;
+}
+
+static void evict_oldest(hpack_decoder_t *decoder) {
+    struct hpack_entry *entry = &decoder->entries[(decoder->head + decoder->count - 1) % decoder->capacity];
+    decoder->size -= entry->name_length + entry->value_length + HPACK_ENTRY_OVERHEAD;
+    free(entry->name);
+    entry->name = NULL;
+    decoder->count--;
+}
+
+static void shrink_table(hpack_decoder_t *decoder, size_t limit) {
+    while (decoder->count > 0 && decoder->size > limit) {
+        evict_oldest(decoder);
+    }
+}
+
+static int add_entry(hpack_decoder_t *decoder, const char *name, size_t name_length,
+                     const char *value, size_t value_length) {
+    size_t entry_size = name_length + value_length + HPACK_ENTRY_OVERHEAD;
+
+    // Copy first: name may point into an entry that is about to be evicted
+    char *data = malloc(name_length + value_length + 2);
+    if (!data) {
+        return -1;
+    }
+    memcpy(data, name, name_length);
+    data[name_length] = '\0';
+    memcpy(data + name_length + 1, value, value_length);
+    data[name_length + 1 + value_length] = '\0';
+
+    if (entry_size > decoder->max_size) {
+        // An entry larger than the table empties it and is not added
+        shrink_table(decoder, 0);
+        free(data);
+        return 0;
+    }
+    shrink_table(decoder, decoder->max_size - entry_size);
+    if (decoder->count == decoder->capacity) {
+        evict_oldest(decoder);
+    }
+
+    decoder->head = (decoder->head + decoder->capacity - 1) % decoder->capacity;
+    struct hpack_entry *entry = &decoder->entries[decoder->head];
+    entry->name = data;
+    entry->name_length = name_length;
+    entry->value = data + name_length + 1;
+    entry->value_length = value_length;
+    decoder->count++;
+    decoder->size += entry_size;
+    return 0;
+}
+
+// Resolve an index into the static table followed by the dynamic table
+static int lookup_index(const hpack_decoder_t *decoder, size_t index, const char **name, size_t *name_length,
+                        const char **value, size_t *value_length) {
+    if (index == 0) {
+        return -1;
+    }
+    if (index <= HPACK_STATIC_COUNT) {
+        *name = static_table[index].name;
+        *name_length = strlen(*name);
+        *value = static_table[index].value;
+        *value_length = strlen(*value);
+        return 0;
+    }
+
+    index -= HPACK_STATIC_COUNT + 1;
+    if (index >= decoder->count) {
+        return -1;
+    }
+    const struct hpack_entry *entry = &decoder->entries[(decoder->head + index) % decoder->capacity];
+    *name = entry->name;
+    *name_length = entry->name_length;
+    *value = entry->value;
+    *value_length = entry->value_length;
+    return 0;
+}
+
+int hpack_decoder_init(hpack_decoder_t *decoder, size_t max_table_size) {
+    memset(decoder, 0, sizeof(hpack_decoder_t));
+    decoder->capacity = max_table_size / HPACK_ENTRY_OVERHEAD + 1;
+    decoder->entries = calloc(decoder->capacity, sizeof(struct hpack_entry));
+    if (!decoder->entries) {
+        return -1;
+    }
+    decoder->max_size = max_table_size;
+    decoder->settings_max_size = max_table_size;
+    return 0;
+}
+
+void hpack_decoder_free(hpack_decoder_t *decoder) {
+    if (decoder && decoder->entries) {
+        shrink_table(decoder, 0);
+        free(decoder->entries);
+        decoder->entries = NULL;
+    }
+}
+
+int hpack_decode(hpack_decoder_t *decoder, const uint8_t *block, size_t length,
+                 hpack_header_callback_t callback, void *context) {
+    // Huffman coding shrinks a symbol to no less than 5 bits
+    size_t scratch_size = length * 8 / 5 + 1;
+    char *scratch = malloc(scratch_size * 2);
+    if (!scratch) {
+        return -1;
+    }
+
+    const uint8_t *position = block;
+    const uint8_t *end = block + length;
+    int seen_field = 0;
+    int result = 0;
+
+    while (position < end && result == 0) {
+        uint8_t first = *position;
+        const char *name, *value;
+        size_t name_length, value_length, index;
+
+        if (first & 0x80) {
+            // Indexed header field
+            if (decode_integer(&position, end, 7, &index) != 0 ||
+                lookup_index(decoder, index, &name, &name_length, &value, &value_length) != 0 ||
+                callback(context, name, name_length, value, value_length) != 0) {
+                result = -1;
+            }
+            seen_field = 1;
+        } else if ((first & 0xe0) == 0x20) {
+            // Dynamic table size update, only allowed before the first field
+            if (seen_field || decode_integer(&position, end, 5, &index) != 0 ||
+                index > decoder->settings_max_size) {
+                result = -1;
+            } else {
+                decoder->max_size = index;
+                shrink_table(decoder, index);
+            }
+        } else {
+            // Literal, with incremental indexing (01), without indexing (0000) or never indexed (0001)
+            int indexing = (first & 0xc0) == 0x40;
+            if (decode_integer(&position, end, indexing ? 6 : 4, &index) != 0) {
+                result = -1;
+            } else if (index == 0) {
+                if (decode_string(&position, end, scratch, scratch_size, &name, &name_length) != 0) {
+                    result = -1;
+                }
+            } else if (lookup_index(decoder, index, &name, &name_length, &value, &value_length) != 0) {
+                result = -1;
+            }
+
+            if (result == 0 &&
+                (decode_string(&position, end, scratch + scratch_size, scratch_size, &value, &value_length) != 0 ||
+                 callback(context, name, name_length, value, value_length) != 0 ||
+                 (indexing && add_entry(decoder, name, name_length, value, value_length) != 0))) {
+                result = -1;
+            }
+            seen_field = 1;
+        }
+    }
+
+    free(scratch);
+    return result;
+}
+
+static size_t encode_integer(uint8_t *out, size_t out_size, uint8_t flags, int prefix_bits, size_t value) {
+    size_t max_prefix = (1u << prefix_bits) - 1;
+    if (out_size == 0) {
+        return 0;
+    }
+    if (value < max_prefix) {
+        out[0] = flags | value;
+        return 1;
+    }
+
+    out[0] = flags | max_prefix;
+    size_t written = 1;
+    value -= max_prefix;
+    while (value >= 0x80) {
+        if (written >= out_size) {
+            return 0;
+        }
+        out[written++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    if (written >= out_size) {
+        return 0;
+    }
+    out[written++] = value;
+    return written;
+}
+
+static size_t encode_string(uint8_t *out, size_t out_size, const char *string) {
+    size_t length = strlen(string);
+    size_t huffman_bits = 0;
+    for (size_t i = 0; i < length; i++) {
+        huffman_bits += huffman_table[(uint8_t)string[i]].bits;
+    }
+    size_t huffman_length = (huffman_bits + 7) / 8;
+
+    if (huffman_length >= length) {
+        size_t written = encode_integer(out, out_size, 0x00, 7, length);
+        if (written == 0 || out_size - written < length) {
+            return 0;
+        }
+        memcpy(out + written, string, length);
+        return written + length;
+    }
+
+    size_t written = encode_integer(out, out_size, 0x80, 7, huffman_length);
+    if (written == 0 || out_size - written < huffman_length) {
+        return 0;
+    }
+    uint8_t *output = out + written;
+    uint64_t pending = 0;
+    int pending_bits = 0;
+    for (size_t i = 0; i < length; i++) {
+        pending = (pending << huffman_table[(uint8_t)string[i]].bits) | huffman_table[(uint8_t)string[i]].code;
+        pending_bits += huffman_table[(uint8_t)string[i]].bits;
+        while (pending_bits >= 8) {
+            pending_bits -= 8;
+            *output++ = (uint8_t)(pending >> pending_bits);
+        }
+    }
+    if (pending_bits > 0) {
+        // Pad with the most significant bits of EOS, which are all ones
+        *output++ = (uint8_t)((pending << (8 - pending_bits)) | (0xff >> pending_bits));
+    }
+    return written + huffman_length;
+}
+
+size_t hpack_encode_status(uint8_t *out, size_t out_size, int status_code) {
+    char text[16];
+    snprintf(text, sizeof(text), "%d", status_code);
+    for (size_t index = 8; index <= 14; index++) {
+        if (strcmp(static_table[index].value, text) == 0) {
+            return encode_integer(out, out_size, 0x80, 7, index);
+        }
+    }
+    return hpack_encode_header(out, out_size, ":status", text);
+}
+
+size_t hpack_encode_header(uint8_t *out, size_t out_size, const char *name, const char *value) {
+    size_t name_index = 0;
+    for (size_t index = 1; index <= HPACK_STATIC_COUNT; index++) {
+        if (strcmp(static_table[index].name, name) == 0) {
+            name_index = index;
+            break;
+        }
+    }
+
+    size_t written;
+    if (name_index > 0) {
+        written = encode_integer(out, out_size, 0x00, 4, name_index);
+    } else {
+        written = out_size > 0 ? 1 : 0;
+        if (written) {
+            out[0] = 0x00;
+            size_t name_written = encode_string(out + 1, out_size - 1, name);
+            written = name_written ? 1 + name_written : 0;
+        }
+    }
+    if (written == 0) {
+        return 0;
+    }
+
+    size_t value_written = encode_string(out + written, out_size - written, value);
+    return value_written ? written + value_written : 0;
+}
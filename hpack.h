@@ -0,0 +1,48 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HPACK_DEFAULT_TABLE_SIZE 4096   // SETTINGS_HEADER_TABLE_SIZE unless the decoder says otherwise
+
+struct hpack_entry;
+
+// Decoder state for one connection. The dynamic table is shared by every
+// header block the peer sends, so blocks must be decoded in the order they
+// arrive, including those of streams that are refused.
+typedef struct {
+    struct hpack_entry *entries;    // Ring of dynamic table entries, newest at head
+    size_t capacity;
+    size_t head;
+    size_t count;
+    size_t size;                    // Sum of entry sizes as defined by HPACK
+    size_t max_size;                // Limit last set by the encoder
+    size_t settings_max_size;       // Limit the encoder may not exceed
+} hpack_decoder_t;
+
+// Called once per decoded header field. Strings are not NUL-terminated and
+// are only valid during the call. Returning non-zero stops decoding.
+typedef int (*hpack_header_callback_t)(void *context, const char *name, size_t name_length,
+                                       const char *value, size_t value_length);
+
+int hpack_decoder_init(hpack_decoder_t *decoder, size_t max_table_size);
+
+void hpack_decoder_free(hpack_decoder_t *decoder);
+
+// Decode a complete header block. Returns 0 on success or -1 when the block
+// is malformed or the callback stopped decoding; a malformed block leaves
+// the dynamic table unusable, which is a connection error.
+int hpack_decode(hpack_decoder_t *decoder, const uint8_t *block, size_t length,
+                 hpack_header_callback_t callback, void *context);
+
+// Append a ":status" field. Returns the bytes written, or 0 if out_size is too small.
+size_t hpack_encode_status(uint8_t *out, size_t out_size, int status_code);
+
+// Append a header field as a literal that is never added to the peer's
+// dynamic table, so encoding needs no per-connection state. Names found in
+// the static table are sent by index, values Huffman-coded when shorter.
+// name must be lowercase. Returns the bytes written, or 0 if out_size is too small.
+size_t hpack_encode_header(uint8_t *out, size_t out_size, const char *name, const char *value);
+
+#endif
@@ -0,0 +1,1367 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "http2.h"
+#include "hpack.h"
+#include "http_response.h"
+#include "http_body.h"
+#include "http_stream.h"
+#include "route_handler.h"
+#include "rate_limiter.h"
+#include "conn_manager.h"
+#include "metrics.h"
+#include "echo_server.h"
+#include "url_path.h"
+#include "utils.h"
+
+#define FRAME_HEADER_SIZE 9
+#define DEFAULT_FRAME_SIZE 16384            // We never advertise a larger SETTINGS_MAX_FRAME_SIZE
+#define DEFAULT_WINDOW_SIZE 65535
+#define MAX_WINDOW_SIZE 0x7fffffff
+#define CONNECTION_WINDOW (16 * 1024 * 1024) // Receive window for the whole connection, so also the
+                                            // most request body it can have buffered
+#define MAX_HEADER_BLOCK (64 * 1024)
+
+// Frame types
+#define FRAME_DATA          0x0
+#define FRAME_HEADERS       0x1
+#define FRAME_PRIORITY      0x2
+#define FRAME_RST_STREAM    0x3
+#define FRAME_SETTINGS      0x4
+#define FRAME_PUSH_PROMISE  0x5
+#define FRAME_PING          0x6
+#define FRAME_GOAWAY        0x7
+#define FRAME_WINDOW_UPDATE 0x8
+#define FRAME_CONTINUATION  0x9
+
+// Frame flags
+#define FLAG_END_STREAM  0x01
+#define FLAG_ACK         0x01
+#define FLAG_END_HEADERS 0x04
+#define FLAG_PADDED      0x08
+#define FLAG_PRIORITY    0x20
+
+// Error codes
+#define H2_NO_ERROR           0x0
+#define H2_PROTOCOL_ERROR     0x1
+#define H2_INTERNAL_ERROR     0x2
+#define H2_FLOW_CONTROL_ERROR 0x3
+#define H2_STREAM_CLOSED      0x5
+#define H2_FRAME_SIZE_ERROR   0x6
+#define H2_REFUSED_STREAM     0x7
+#define H2_CANCEL             0x8
+#define H2_COMPRESSION_ERROR  0x9
+#define H2_ENHANCE_YOUR_CALM  0xb
+
+// Ways a connection ends besides a connection error
+#define H2_CONNECTION_LOST  -1   // The socket failed or the client closed it
+#define H2_PEER_GOAWAY      -2   // The client is done; finish its streams and close
+
+// Settings
+#define SETTINGS_HEADER_TABLE_SIZE      0x1
+#define SETTINGS_ENABLE_PUSH            0x2
+#define SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define SETTINGS_INITIAL_WINDOW_SIZE    0x4
+#define SETTINGS_MAX_FRAME_SIZE         0x5
+
+// Stream states, as seen by the server
+#define STREAM_OPEN        0    // Receiving the headers; owned by the reading thread
+#define STREAM_DISPATCHED  1    // Request handed to a stream thread, which owns it from now on.
+                                // The reading thread only adds body data, with the mutex held.
+
+typedef struct h2_connection h2_connection_t;
+
+typedef struct h2_stream {
+    uint32_t id;
+    int state;
+    int reset;                  // Sending must stop: reset by the client or flow control stalled
+    int closed;                 // RST_STREAM was sent or received, so nothing more goes out
+    int request_complete;       // The client ended its side of the stream
+    long long send_window;
+    long long receive_window;   // Body bytes the client may still send on the stream
+    http_request_t request;
+    int has_content_length;
+    int seen_regular_header;    // Pseudo-headers must come before all others
+    int malformed;              // Headers break HTTP/2 rules; reset with PROTOCOL_ERROR
+    int error_status;           // Answer with this status instead of running a handler
+    char *body;                 // Body bytes received and not yet read by the handler
+    size_t body_start;          // First unread byte in body
+    size_t body_length;         // End of the received bytes in body
+    size_t body_capacity;
+    size_t body_received;       // Every body byte received on the stream
+    size_t credit;              // Bytes read by the handler but not yet given back as window
+    h2_connection_t *connection;
+    struct h2_stream *next;
+} h2_stream_t;
+
+struct h2_connection {
+    int client_socket;
+    const struct sockaddr *client_address;
+    struct conn_timer *timer;
+    pthread_mutex_t mutex;          // Guards the stream list, windows and peer settings
+    pthread_cond_t changed;         // A window grew, a stream was reset or finished, or the connection failed
+    pthread_mutex_t write_mutex;    // Keeps frames (and header block sequences) whole on the socket
+    h2_stream_t *streams;
+    int stream_count;
+    int workers;                    // Stream threads still running
+    int failed;
+    long long send_window;
+    long long receive_window;       // Body bytes the client may still send on the whole connection
+    int input_closed;               // No more frames will be read; bodies still arriving are cut short
+    uint32_t peer_initial_window;
+    uint32_t peer_max_frame_size;
+    // Reading state, only touched by the connection's own thread
+    hpack_decoder_t decoder;
+    const char *buffered;
+    size_t buffered_length;
+    uint32_t last_stream_id;
+    uint8_t *header_block;          // Header block being assembled from HEADERS and CONTINUATION frames
+    size_t header_block_length;
+    uint32_t header_stream;
+    int header_end_stream;
+    int expecting_continuation;
+};
+
+int http2_is_preface(const char *buffer, size_t length) {
+    // The preface contains "\r\n\r\n", so a request head read may end inside it
+    if (length < 16) {
+        return 0;
+    }
+    return memcmp(buffer, HTTP2_PREFACE, length < HTTP2_PREFACE_LENGTH ? length : HTTP2_PREFACE_LENGTH) == 0;
+}
+
+static void put_uint32(uint8_t *out, uint32_t value) {
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+static uint32_t get_uint32(const uint8_t *in) {
+    return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | in[3];
+}
+
+static void mark_failed(h2_connection_t *connection) {
+    pthread_mutex_lock(&connection->mutex);
+    connection->failed = 1;
+    pthread_cond_broadcast(&connection->changed);
+    pthread_mutex_unlock(&connection->mutex);
+}
+
+// Write one frame. Must be called with write_mutex held.
+static int write_frame_locked(h2_connection_t *connection, uint8_t type, uint8_t flags, uint32_t stream_id,
+                              const void *payload, size_t length) {
+    // Header and payload go out in a single send
+    uint8_t frame[FRAME_HEADER_SIZE + DEFAULT_FRAME_SIZE];
+    if (length > DEFAULT_FRAME_SIZE) {
+        return -1;
+    }
+    frame[0] = length >> 16;
+    frame[1] = length >> 8;
+    frame[2] = length;
+    frame[3] = type;
+    frame[4] = flags;
+    put_uint32(frame + 5, stream_id & MAX_WINDOW_SIZE);
+    if (length > 0) {
+        memcpy(frame + FRAME_HEADER_SIZE, payload, length);
+    }
+
+    if (send_all(connection->client_socket, frame, FRAME_HEADER_SIZE + length) != 0) {
+        mark_failed(connection);
+        return -1;
+    }
+    return 0;
+}
+
+static int send_frame(h2_connection_t *connection, uint8_t type, uint8_t flags, uint32_t stream_id,
+                      const void *payload, size_t length) {
+    pthread_mutex_lock(&connection->write_mutex);
+    int result = write_frame_locked(connection, type, flags, stream_id, payload, length);
+    pthread_mutex_unlock(&connection->write_mutex);
+    return result;
+}
+
+static void send_rst_stream(h2_connection_t *connection, uint32_t stream_id, uint32_t error_code) {
+    uint8_t payload[4];
+    put_uint32(payload, error_code);
+    send_frame(connection, FRAME_RST_STREAM, 0, stream_id, payload, sizeof(payload));
+}
+
+static void send_window_update(h2_connection_t *connection, uint32_t stream_id, uint32_t increment) {
+    uint8_t payload[4];
+    put_uint32(payload, increment);
+    send_frame(connection, FRAME_WINDOW_UPDATE, 0, stream_id, payload, sizeof(payload));
+}
+
+static void send_goaway(h2_connection_t *connection, uint32_t error_code) {
+    uint8_t payload[8];
+    put_uint32(payload, connection->last_stream_id);
+    put_uint32(payload + 4, error_code);
+    send_frame(connection, FRAME_GOAWAY, 0, 0, payload, sizeof(payload));
+}
+
+static int send_settings(h2_connection_t *connection) {
+    static const struct {
+        uint16_t id;
+        uint32_t value;
+    } settings[] = {
+        { SETTINGS_MAX_CONCURRENT_STREAMS, HTTP2_MAX_CONCURRENT_STREAMS },
+        { SETTINGS_INITIAL_WINDOW_SIZE, HTTP2_STREAM_WINDOW },
+    };
+
+    uint8_t payload[sizeof(settings) / sizeof(settings[0]) * 6];
+    for (size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); i++) {
+        payload[i * 6] = settings[i].id >> 8;
+        payload[i * 6 + 1] = settings[i].id;
+        put_uint32(payload + i * 6 + 2, settings[i].value);
+    }
+    if (send_frame(connection, FRAME_SETTINGS, 0, 0, payload, sizeof(payload)) != 0) {
+        return -1;
+    }
+
+    // The connection window can only be raised by WINDOW_UPDATE
+    send_window_update(connection, 0, CONNECTION_WINDOW - DEFAULT_WINDOW_SIZE);
+    return 0;
+}
+
+// Apply the peer's settings. Returns an error code.
+static int apply_settings(h2_connection_t *connection, const uint8_t *payload, size_t length) {
+    if (length % 6 != 0) {
+        return H2_FRAME_SIZE_ERROR;
+    }
+
+    for (size_t offset = 0; offset < length; offset += 6) {
+        uint16_t id = (payload[offset] << 8) | payload[offset + 1];
+        uint32_t value = get_uint32(payload + offset + 2);
+
+        if (id == SETTINGS_ENABLE_PUSH && value > 1) {
+            return H2_PROTOCOL_ERROR;
+        } else if (id == SETTINGS_INITIAL_WINDOW_SIZE) {
+            if (value > MAX_WINDOW_SIZE) {
+                return H2_FLOW_CONTROL_ERROR;
+            }
+            // Open streams' windows move by the change in the initial size
+            pthread_mutex_lock(&connection->mutex);
+            long long delta = (long long)value - connection->peer_initial_window;
+            for (h2_stream_t *stream = connection->streams; stream; stream = stream->next) {
+                stream->send_window += delta;
+            }
+            connection->peer_initial_window = value;
+            pthread_cond_broadcast(&connection->changed);
+            pthread_mutex_unlock(&connection->mutex);
+        } else if (id == SETTINGS_MAX_FRAME_SIZE) {
+            if (value < DEFAULT_FRAME_SIZE || value > 16777215) {
+                return H2_PROTOCOL_ERROR;
+            }
+            pthread_mutex_lock(&connection->mutex);
+            connection->peer_max_frame_size = value;
+            pthread_mutex_unlock(&connection->mutex);
+        }
+        // The rest do not affect us: responses are encoded without the
+        // dynamic table and the server never opens streams
+    }
+    return H2_NO_ERROR;
+}
+
+// Decode the base64url HTTP2-Settings header of an upgrade request
+static int apply_upgrade_settings(h2_connection_t *connection, const char *encoded) {
+    uint8_t payload[96];
+    size_t length = 0;
+    uint32_t bits = 0;
+    int bit_count = 0;
+
+    for (const char *p = encoded; *p && *p != '='; p++) {
+        int value;
+        if (*p >= 'A' && *p <= 'Z') {
+            value = *p - 'A';
+        } else if (*p >= 'a' && *p <= 'z') {
+            value = *p - 'a' + 26;
+        } else if (*p >= '0' && *p <= '9') {
+            value = *p - '0' + 52;
+        } else if (*p == '-') {
+            value = 62;
+        } else if (*p == '_') {
+            value = 63;
+        } else {
+            return -1;
+        }
+        bits = (bits << 6) | value;
+        bit_count += 6;
+        if (bit_count >= 8) {
+            bit_count -= 8;
+            if (length >= sizeof(payload)) {
+                return -1;
+            }
+            payload[length++] = (uint8_t)(bits >> bit_count);
+        }
+    }
+
+    return apply_settings(connection, payload, length) == H2_NO_ERROR ? 0 : -1;
+}
+
+// Read exactly length bytes: first those read before the switch to HTTP/2,
+// then from the socket
+static int read_exact(h2_connection_t *connection, void *buffer, size_t length) {
+    char *out = buffer;
+    while (length > 0) {
+        if (connection->buffered_length > 0) {
+            size_t amount = length < connection->buffered_length ? length : connection->buffered_length;
+            memcpy(out, connection->buffered, amount);
+            connection->buffered += amount;
+            connection->buffered_length -= amount;
+            out += amount;
+            length -= amount;
+            continue;
+        }
+
+        ssize_t bytes_read = recv_some(connection->client_socket, out, length);
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            return -1;
+        }
+        out += bytes_read;
+        length -= bytes_read;
+    }
+    return 0;
+}
+
+static h2_stream_t *find_stream(h2_connection_t *connection, uint32_t stream_id) {
+    for (h2_stream_t *stream = connection->streams; stream; stream = stream->next) {
+        if (stream->id == stream_id) {
+            return stream;
+        }
+    }
+    return NULL;
+}
+
+static void free_stream(h2_stream_t *stream) {
+    free(stream->body);
+    free(stream);
+}
+
+// Unlink a stream from its connection and free it
+static void release_stream(h2_stream_t *stream) {
+    h2_connection_t *connection = stream->connection;
+
+    pthread_mutex_lock(&connection->mutex);
+    for (h2_stream_t **link = &connection->streams; *link; link = &(*link)->next) {
+        if (*link == stream) {
+            *link = stream->next;
+            connection->stream_count--;
+            break;
+        }
+    }
+    if (stream->state == STREAM_DISPATCHED) {
+        connection->workers--;
+    }
+    // Body data the handler never read stops holding the connection's window
+    size_t unread = stream->body_length - stream->body_start + stream->credit;
+    connection->receive_window += unread;
+    int failed = connection->failed;
+    pthread_cond_broadcast(&connection->changed);
+    pthread_mutex_unlock(&connection->mutex);
+
+    if (unread > 0 && !failed) {
+        send_window_update(connection, 0, unread);
+    }
+    free_stream(stream);
+}
+
+// Add received body data for the handler to read. Called with the mutex held.
+static int append_body(h2_stream_t *stream, const uint8_t *data, size_t length) {
+    // What was read already is dropped first, so flow control bounds the buffer
+    if (stream->body_start > 0) {
+        memmove(stream->body, stream->body + stream->body_start, stream->body_length - stream->body_start);
+        stream->body_length -= stream->body_start;
+        stream->body_start = 0;
+    }
+    if (stream->body_length + length > stream->body_capacity) {
+        size_t capacity = stream->body_capacity ? stream->body_capacity : 16384;
+        while (capacity < stream->body_length + length) {
+            capacity *= 2;
+        }
+        char *body = realloc(stream->body, capacity);
+        if (!body) {
+            return -1;
+        }
+        stream->body = body;
+        stream->body_capacity = capacity;
+    }
+    memcpy(stream->body + stream->body_length, data, length);
+    stream->body_length += length;
+    stream->body_received += length;
+    return 0;
+}
+
+// Body source for a stream's handler. Waits for data from the reading
+// thread, and gives the client window back only once the handler has read
+// what it sent.
+static ssize_t read_stream_body(void *context, void *buffer, size_t length) {
+    h2_stream_t *stream = context;
+    h2_connection_t *connection = stream->connection;
+
+    pthread_mutex_lock(&connection->mutex);
+    while (stream->body_start == stream->body_length && !stream->request_complete && !stream->reset &&
+           !connection->failed && !connection->input_closed) {
+        pthread_cond_wait(&connection->changed, &connection->mutex);
+    }
+    size_t available = stream->body_length - stream->body_start;
+    if (stream->reset || connection->failed || available == 0) {
+        int ended = stream->request_complete && !stream->reset && !connection->failed;
+        pthread_mutex_unlock(&connection->mutex);
+        return ended ? 0 : -1;
+    }
+
+    size_t amount = length < available ? length : available;
+    memcpy(buffer, stream->body + stream->body_start, amount);
+    stream->body_start += amount;
+    stream->credit += amount;
+
+    // Credit goes back in frame-sized steps, or at once when the client may
+    // be waiting for it
+    size_t credit = 0;
+    if (stream->credit >= DEFAULT_FRAME_SIZE || stream->body_start == stream->body_length) {
+        credit = stream->credit;
+        stream->credit = 0;
+        stream->receive_window += credit;
+        connection->receive_window += credit;
+    }
+    int complete = stream->request_complete;
+    pthread_mutex_unlock(&connection->mutex);
+
+    if (credit > 0) {
+        send_window_update(connection, 0, credit);
+        if (!complete) {
+            send_window_update(connection, stream->id, credit);
+        }
+    }
+    return amount;
+}
+
+// Send a DATA payload as frames, waiting for flow-control window as needed
+static int send_data(h2_stream_t *stream, const uint8_t *data, size_t length, int end_stream) {
+    h2_connection_t *connection = stream->connection;
+
+    do {
+        size_t amount = 0;
+        if (length > 0) {
+            pthread_mutex_lock(&connection->mutex);
+
+            // A client that stops granting window is treated like one that stops reading
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            unsigned int timeout_ms = conn_manager_timeout(CONN_PHASE_WRITE);
+            deadline.tv_sec += timeout_ms / 1000;
+            deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+
+            while (!connection->failed && !stream->reset &&
+                   (connection->send_window <= 0 || stream->send_window <= 0)) {
+                if (pthread_cond_timedwait(&connection->changed, &connection->mutex, &deadline) == ETIMEDOUT) {
+                    stream->reset = 1;
+                }
+            }
+            if (connection->failed || stream->reset) {
+                pthread_mutex_unlock(&connection->mutex);
+                return -1;
+            }
+
+            amount = length;
+            if ((long long)amount > connection->send_window) {
+                amount = connection->send_window;
+            }
+            if ((long long)amount > stream->send_window) {
+                amount = stream->send_window;
+            }
+            if (amount > DEFAULT_FRAME_SIZE) {
+                amount = DEFAULT_FRAME_SIZE;
+            }
+            connection->send_window -= amount;
+            stream->send_window -= amount;
+            pthread_mutex_unlock(&connection->mutex);
+        }
+
+        int last = end_stream && amount == length;
+        if (send_frame(connection, FRAME_DATA, last ? FLAG_END_STREAM : 0, stream->id, data, amount) != 0) {
+            return -1;
+        }
+        data += amount;
+        length -= amount;
+    } while (length > 0);
+
+    return 0;
+}
+
+static int stream_sink(void *context, const void *data, size_t length) {
+    return send_data(context, data, length, 0);
+}
+
+// Send a header block, split into HEADERS and CONTINUATION frames that no
+// other frame may come between
+static int send_header_block(h2_stream_t *stream, const uint8_t *block, size_t length, int end_stream) {
+    h2_connection_t *connection = stream->connection;
+    int result = 0;
+
+    pthread_mutex_lock(&connection->write_mutex);
+    size_t offset = 0;
+    do {
+        size_t amount = length - offset < DEFAULT_FRAME_SIZE ? length - offset : DEFAULT_FRAME_SIZE;
+        uint8_t type = offset == 0 ? FRAME_HEADERS : FRAME_CONTINUATION;
+        uint8_t flags = offset + amount == length ? FLAG_END_HEADERS : 0;
+        if (offset == 0 && end_stream) {
+            flags |= FLAG_END_STREAM;
+        }
+        result = write_frame_locked(connection, type, flags, stream->id, block + offset, amount);
+        offset += amount;
+    } while (result == 0 && offset < length);
+    pthread_mutex_unlock(&connection->write_mutex);
+
+    return result;
+}
+
+// Encode the extra "Name: value\r\n" lines of a response. Names are
+// lowercased and connection-specific headers, which HTTP/2 forbids, dropped.
+static size_t encode_extra_headers(const http_response_t *response, uint8_t *out, size_t out_size) {
+    size_t written = 0;
+    const char *line = response->headers;
+
+    while (*line) {
+        const char *line_end = strstr(line, "\r\n");
+        const char *colon = strchr(line, ':');
+        if (!line_end || !colon || colon > line_end) {
+            break;
+        }
+
+        char name[128];
+        char small_value[512];
+        size_t name_length = colon - line;
+        const char *value_start = colon + 1;
+        while (*value_start == ' ') {
+            value_start++;
+        }
+        size_t value_length = line_end - value_start;
+
+        // Long values, such as large cookies from a proxied upstream, are
+        // copied out to the heap
+        char *value = value_length < sizeof(small_value) ? small_value : malloc(value_length + 1);
+        int failed = !value;
+        if (value && name_length < sizeof(name)) {
+            for (size_t i = 0; i < name_length; i++) {
+                name[i] = (line[i] >= 'A' && line[i] <= 'Z') ? line[i] + ('a' - 'A') : line[i];
+            }
+            name[name_length] = '\0';
+            memcpy(value, value_start, value_length);
+            value[value_length] = '\0';
+
+            if (strcmp(name, "connection") != 0 && strcmp(name, "keep-alive") != 0 &&
+                strcmp(name, "transfer-encoding") != 0 && strcmp(name, "upgrade") != 0) {
+                size_t encoded = hpack_encode_header(out + written, out_size - written, name, value);
+                failed = encoded == 0;
+                written += encoded;
+            }
+        }
+        if (value != small_value) {
+            free(value);
+        }
+        if (failed) {
+            return 0;
+        }
+        line = line_end + 2;
+    }
+    return written;
+}
+
+// Encode the status, content headers and extra headers of a response.
+// Returns the length of the block, or 0 if it does not fit in block_size.
+static size_t encode_response_head(const http_response_t *response, uint8_t *block, size_t block_size) {
+    size_t length = 0;
+    size_t encoded;
+
+    length += (encoded = hpack_encode_status(block, block_size, response->status_code));
+    if (encoded == 0) {
+        return 0;
+    }
+    int bodiless = response_status_bodiless(response);
+    if (!bodiless || response->content_type_set) {
+        length += (encoded = hpack_encode_header(block + length, block_size - length,
+                                                 "content-type", response->content_type));
+        if (encoded == 0) {
+            return 0;
+        }
+    }
+    if (!response->stream_producer && !bodiless) {
+        char content_length[32];
+        snprintf(content_length, sizeof(content_length), "%zu", response->content_length);
+        length += (encoded = hpack_encode_header(block + length, block_size - length,
+                                                 "content-length", content_length));
+        if (encoded == 0) {
+            return 0;
+        }
+    }
+    if (response->headers_length > 0) {
+        length += (encoded = encode_extra_headers(response, block + length, block_size - length));
+        if (encoded == 0) {
+            return 0;
+        }
+    }
+    return length;
+}
+
+static int send_response(h2_stream_t *stream, http_response_t *response) {
+    // Encoded fields are never longer than the header lines they come from
+    // by more than a few bytes each, so a block this size always fits them
+    uint8_t small_block[4096];
+    size_t block_size = response->headers_length + 1024;
+    uint8_t *block = block_size <= sizeof(small_block) ? small_block : malloc(block_size);
+    if (!block) {
+        return -1;
+    }
+    if (block == small_block) {
+        block_size = sizeof(small_block);
+    }
+    size_t length = encode_response_head(response, block, block_size);
+
+    // DATA frames already carry the length, so streamed bodies need no chunking
+    int has_body = !response_status_bodiless(response) &&
+                   (response->stream_producer || (response->body && response->content_length > 0));
+    int result = length > 0 ? send_header_block(stream, block, length, !has_body) : -1;
+    if (block != small_block) {
+        free(block);
+    }
+    if (result != 0) {
+        return -1;
+    }
+
+    if (has_body && response->stream_producer) {
+        if (http_stream_run_producer(response, stream_sink, stream) != 0) {
+            return -1;
+        }
+        return send_data(stream, NULL, 0, 1);
+    }
+    if (has_body) {
+        return send_data(stream, response->body, response->content_length, 1);
+    }
+    return 0;
+}
+
+// Thread that runs one request through the handlers and sends the response
+static void *stream_worker(void *arg) {
+    h2_stream_t *stream = arg;
+    h2_connection_t *connection = stream->connection;
+    http_request_t *request = &stream->request;
+
+    // The body, if any, is read from the stream's buffer as it arrives
+    http_body_reader_t body_reader;
+    pthread_mutex_lock(&connection->mutex);
+    int has_body = !stream->request_complete || stream->body_received > 0;
+    pthread_mutex_unlock(&connection->mutex);
+    if (has_body) {
+        request->chunked = !stream->has_content_length;
+        http_body_reader_init_source(&body_reader, request, read_stream_body, stream, max_body_size);
+    } else {
+        http_body_reader_init(&body_reader, -1, request, NULL, 0, max_body_size);
+    }
+    request->body_reader = &body_reader;
+
+    http_response_t response;
+    init_http_response(&response);
+    response.keep_alive = 1;
+    unsigned long long start_ns = metrics_now_ns();
+
+    if (verbose_mode) {
+        printf("HTTP/2 stream %u: %s %s\n", stream->id, request->method, request->path);
+    }
+
+    int retry_after = 0;
+    if (stream->error_status != 0) {
+        set_response_status(&response, stream->error_status);
+        set_response_body_string(&response, get_status_message(stream->error_status));
+    } else {
+        // Rate limits apply per request, so every stream is checked
+        char request_line[1200];
+        int line_length = snprintf(request_line, sizeof(request_line), "%s %s HTTP/2.0",
+                                   request->method, request->path);
+        retry_after = rate_limiter_check(connection->client_address, request_line, line_length);
+    }
+
+    if (retry_after > 0) {
+        char retry_text[16];
+        snprintf(retry_text, sizeof(retry_text), "%d", retry_after);
+        set_response_status(&response, HTTP_STATUS_TOO_MANY_REQUESTS);
+        add_response_header(&response, "Retry-After", retry_text);
+        set_response_body_string(&response, "Too Many Requests");
+    } else if (stream->error_status == 0) {
+        handle_request(request, &response);
+    }
+
+    int sent = send_response(stream, &response) == 0;
+    pthread_mutex_lock(&connection->mutex);
+    int closed = stream->closed;
+    int stalled = stream->reset;
+    int request_complete = stream->request_complete;
+    size_t body_received = stream->body_received;
+    pthread_mutex_unlock(&connection->mutex);
+    if (!sent) {
+        if (!closed) {
+            send_rst_stream(connection, stream->id, stalled ? H2_CANCEL : H2_INTERNAL_ERROR);
+        }
+    } else if (!request_complete) {
+        // Answered before the client finished sending; it can stop now
+        send_rst_stream(connection, stream->id, H2_NO_ERROR);
+    }
+
+    // Only the body is counted as sent; headers go out HPACK-compressed in frames
+    metrics_count_request(response.status_code, body_received, response.content_length,
+                          metrics_now_ns() - start_ns);
+    free_http_response(&response);
+    free_http_request(request);
+    release_stream(stream);
+    return NULL;
+}
+
+// Hand a stream whose request is ready to a thread of its own
+static void dispatch_stream(h2_connection_t *connection, h2_stream_t *stream) {
+    if (stream->has_content_length && stream->request_complete && stream->error_status == 0 &&
+        stream->request.content_length != stream->body_received) {
+        send_rst_stream(connection, stream->id, H2_PROTOCOL_ERROR);
+        release_stream(stream);
+        return;
+    }
+
+    pthread_mutex_lock(&connection->mutex);
+    stream->state = STREAM_DISPATCHED;
+    connection->workers++;
+    pthread_mutex_unlock(&connection->mutex);
+
+    if (start_detached_thread(stream_worker, stream, thread_stack_size) != 0) {
+        send_rst_stream(connection, stream->id, H2_REFUSED_STREAM);
+        release_stream(stream);
+        return;
+    }
+}
+
+static int header_name_is(const char *name, size_t name_length, const char *expected) {
+    return strlen(expected) == name_length && memcmp(name, expected, name_length) == 0;
+}
+
+// Copy a header value, truncating it like the HTTP/1.1 parser does
+static void copy_value(char *destination, size_t size, const char *value, size_t value_length) {
+    if (value_length >= size) {
+        value_length = size - 1;
+    }
+    memcpy(destination, value, value_length);
+    destination[value_length] = '\0';
+}
+
+// Fill in a stream's request from one decoded header field. Rule violations
+// mark the stream instead of stopping the decoder, which must see the whole
+// block to keep its table in step with the client's encoder.
+static int collect_request_header(void *context, const char *name, size_t name_length,
+                                  const char *value, size_t value_length) {
+    h2_stream_t *stream = context;
+    http_request_t *request = &stream->request;
+
+    if (name_length > 0 && name[0] == ':') {
+        if (stream->seen_regular_header) {
+            stream->malformed = 1;
+        } else if (header_name_is(name, name_length, ":method")) {
+            if (value_length == 0 || value_length >= sizeof(request->method)) {
+                stream->malformed = 1;
+            } else {
+                copy_value(request->method, sizeof(request->method), value, value_length);
+            }
+        } else if (header_name_is(name, name_length, ":path")) {
+            if (value_length == 0 || value_length >= sizeof(request->path)) {
+                stream->error_status = HTTP_STATUS_BAD_REQUEST;
+            } else {
+                copy_value(request->path, sizeof(request->path), value, value_length);
+            }
+        } else if (header_name_is(name, name_length, ":authority")) {
+            copy_value(request->host, sizeof(request->host), value, value_length);
+        } else if (!header_name_is(name, name_length, ":scheme")) {
+            stream->malformed = 1;
+        }
+        return 0;
+    }
+
+    stream->seen_regular_header = 1;
+    for (size_t i = 0; i < name_length; i++) {
+        if (name[i] >= 'A' && name[i] <= 'Z') {
+            stream->malformed = 1; // Field names must be lowercase
+        }
+    }
+
+    if (header_name_is(name, name_length, "content-length")) {
+        size_t length = 0;
+        for (size_t i = 0; i < value_length; i++) {
+            if (value[i] < '0' || value[i] > '9' || length > ((size_t)-1 - 9) / 10) {
+                stream->malformed = 1;
+                return 0;
+            }
+            length = length * 10 + (value[i] - '0');
+        }
+        request->content_length = length;
+        stream->has_content_length = value_length > 0;
+    } else if (header_name_is(name, name_length, "content-type")) {
+        copy_value(request->content_type, sizeof(request->content_type), value, value_length);
+    } else if (header_name_is(name, name_length, "accept-encoding")) {
+        copy_value(request->accept_encoding, sizeof(request->accept_encoding), value, value_length);
+    } else if (header_name_is(name, name_length, "if-none-match")) {
+        copy_value(request->if_none_match, sizeof(request->if_none_match), value, value_length);
+    } else if (header_name_is(name, name_length, "host")) {
+        if (request->host[0] == '\0') {
+            copy_value(request->host, sizeof(request->host), value, value_length);
+        }
+    } else if (header_name_is(name, name_length, "connection") ||
+               header_name_is(name, name_length, "keep-alive") ||
+               header_name_is(name, name_length, "proxy-connection") ||
+               header_name_is(name, name_length, "transfer-encoding") ||
+               header_name_is(name, name_length, "upgrade")) {
+        stream->malformed = 1; // Connection-specific headers have no meaning in HTTP/2
+    } else if (header_name_is(name, name_length, "te") && !(value_length == 8 && memcmp(value, "trailers", 8) == 0)) {
+        stream->malformed = 1;
+    }
+    return 0;
+}
+
+static int ignore_header(void *context, const char *name, size_t name_length, const char *value, size_t value_length) {
+    (void)context;
+    (void)name;
+    (void)name_length;
+    (void)value;
+    (void)value_length;
+    return 0;
+}
+
+// Act on a complete header block
+static int process_header_block(h2_connection_t *connection) {
+    uint32_t stream_id = connection->header_stream;
+
+    pthread_mutex_lock(&connection->mutex);
+    int exists = find_stream(connection, stream_id) != NULL;
+    int stream_count = connection->stream_count;
+    long long initial_window = connection->peer_initial_window;
+    pthread_mutex_unlock(&connection->mutex);
+
+    if (exists || stream_id <= connection->last_stream_id) {
+        // Trailers: decoded to keep the table in step, then ignored
+        if (hpack_decode(&connection->decoder, connection->header_block, connection->header_block_length,
+                         ignore_header, NULL) != 0) {
+            return H2_COMPRESSION_ERROR;
+        }
+        // The stream's thread may free it at any moment, so it is only
+        // touched with the mutex held
+        int stream_error = H2_STREAM_CLOSED;
+        pthread_mutex_lock(&connection->mutex);
+        h2_stream_t *stream = find_stream(connection, stream_id);
+        if (stream && !stream->request_complete && !stream->reset) {
+            stream->request_complete = 1;
+            if (!connection->header_end_stream ||
+                (stream->has_content_length && stream->body_received != stream->request.content_length)) {
+                stream_error = H2_PROTOCOL_ERROR;
+                stream->reset = 1;
+                stream->closed = 1;
+            } else {
+                stream_error = H2_NO_ERROR;
+            }
+            pthread_cond_broadcast(&connection->changed);
+        }
+        pthread_mutex_unlock(&connection->mutex);
+        if (stream_error != H2_NO_ERROR) {
+            send_rst_stream(connection, stream_id, stream_error);
+        }
+        return H2_NO_ERROR;
+    }
+
+    if (stream_id % 2 == 0) {
+        return H2_PROTOCOL_ERROR; // Client streams are odd-numbered
+    }
+    connection->last_stream_id = stream_id;
+
+    h2_stream_t *stream = calloc(1, sizeof(h2_stream_t));
+    if (!stream) {
+        return H2_INTERNAL_ERROR;
+    }
+    stream->id = stream_id;
+    stream->connection = connection;
+    stream->send_window = initial_window;
+    stream->receive_window = HTTP2_STREAM_WINDOW;
+    strcpy(stream->request.version, "HTTP/2.0");
+    stream->request.keep_alive = 1;
+
+    if (hpack_decode(&connection->decoder, connection->header_block, connection->header_block_length,
+                     collect_request_header, stream) != 0) {
+        free_stream(stream);
+        return H2_COMPRESSION_ERROR;
+    }
+
+    if (stream_count >= HTTP2_MAX_CONCURRENT_STREAMS) {
+        send_rst_stream(connection, stream_id, H2_REFUSED_STREAM);
+        free_stream(stream);
+        return H2_NO_ERROR;
+    }
+    if (stream->malformed || stream->request.method[0] == '\0' ||
+        (stream->request.path[0] == '\0' && stream->error_status == 0)) {
+        send_rst_stream(connection, stream_id, H2_PROTOCOL_ERROR);
+        free_stream(stream);
+        return H2_NO_ERROR;
+    }
+
+    // Route and cache lookups all key on the canonical form of the path
+    if (stream->error_status == 0 &&
+        normalize_url_path(stream->request.path, stream->request.query, sizeof(stream->request.query)) != 0) {
+        stream->error_status = HTTP_STATUS_BAD_REQUEST;
+    }
+    if (stream->error_status == 0 && stream->request.content_length > max_body_size) {
+        stream->error_status = HTTP_STATUS_PAYLOAD_TOO_LARGE;
+    }
+
+    stream->request_complete = connection->header_end_stream;
+    pthread_mutex_lock(&connection->mutex);
+    stream->next = connection->streams;
+    connection->streams = stream;
+    connection->stream_count++;
+    pthread_mutex_unlock(&connection->mutex);
+
+    // The handler starts right away and reads the body as it arrives;
+    // requests with an error are answered without reading it
+    dispatch_stream(connection, stream);
+    return H2_NO_ERROR;
+}
+
+static int append_header_fragment(h2_connection_t *connection, const uint8_t *fragment, size_t length) {
+    if (connection->header_block_length + length > MAX_HEADER_BLOCK) {
+        return H2_ENHANCE_YOUR_CALM;
+    }
+    memcpy(connection->header_block + connection->header_block_length, fragment, length);
+    connection->header_block_length += length;
+    return H2_NO_ERROR;
+}
+
+static int handle_headers_frame(h2_connection_t *connection, uint8_t flags, uint32_t stream_id,
+                                const uint8_t *payload, size_t length) {
+    if (stream_id == 0) {
+        return H2_PROTOCOL_ERROR;
+    }
+
+    size_t offset = 0;
+    size_t padding = 0;
+    if (flags & FLAG_PADDED) {
+        if (length < 1) {
+            return H2_PROTOCOL_ERROR;
+        }
+        padding = payload[0];
+        offset = 1;
+    }
+    if (flags & FLAG_PRIORITY) {
+        offset += 5; // Priorities are advisory and ignored
+    }
+    if (offset + padding > length) {
+        return H2_PROTOCOL_ERROR;
+    }
+
+    connection->header_block_length = 0;
+    connection->header_stream = stream_id;
+    connection->header_end_stream = flags & FLAG_END_STREAM;
+    int error = append_header_fragment(connection, payload + offset, length - offset - padding);
+    if (error != H2_NO_ERROR) {
+        return error;
+    }
+
+    if (!(flags & FLAG_END_HEADERS)) {
+        connection->expecting_continuation = 1;
+        return H2_NO_ERROR;
+    }
+    return process_header_block(connection);
+}
+
+static int handle_continuation_frame(h2_connection_t *connection, uint8_t flags, uint32_t stream_id,
+                                     const uint8_t *payload, size_t length) {
+    if (!connection->expecting_continuation || stream_id != connection->header_stream) {
+        return H2_PROTOCOL_ERROR;
+    }
+    int error = append_header_fragment(connection, payload, length);
+    if (error != H2_NO_ERROR) {
+        return error;
+    }
+    if (flags & FLAG_END_HEADERS) {
+        connection->expecting_continuation = 0;
+        return process_header_block(connection);
+    }
+    return H2_NO_ERROR;
+}
+
+static int handle_data_frame(h2_connection_t *connection, uint8_t flags, uint32_t stream_id,
+                             const uint8_t *payload, size_t length) {
+    if (stream_id == 0) {
+        return H2_PROTOCOL_ERROR;
+    }
+    if (stream_id > connection->last_stream_id) {
+        return H2_PROTOCOL_ERROR; // Stream was never opened
+    }
+
+    size_t offset = 0;
+    size_t padding = 0;
+    if (flags & FLAG_PADDED) {
+        if (length < 1) {
+            return H2_PROTOCOL_ERROR;
+        }
+        padding = payload[0];
+        offset = 1;
+    }
+    if (offset + padding > length) {
+        return H2_PROTOCOL_ERROR;
+    }
+
+    size_t data_length = length - offset - padding;
+    int error = H2_NO_ERROR;
+    int stream_error = H2_NO_ERROR;
+    size_t connection_credit = length;  // Given back at once unless a handler is to read the data
+    size_t stream_credit = 0;
+
+    // The stream's thread may free it at any moment, so it is only touched
+    // with the mutex held. Data is only accepted within the windows given to
+    // the client, which bounds what a connection can have buffered.
+    pthread_mutex_lock(&connection->mutex);
+    connection->receive_window -= length;
+    h2_stream_t *stream = find_stream(connection, stream_id);
+    if (connection->receive_window < 0) {
+        error = H2_FLOW_CONTROL_ERROR;
+    } else if (stream && !stream->request_complete && !stream->reset) {
+        stream->receive_window -= length;
+        if (stream->receive_window < 0) {
+            stream_error = H2_FLOW_CONTROL_ERROR;
+        } else if (stream->has_content_length &&
+                   stream->body_received + data_length > stream->request.content_length) {
+            stream_error = H2_PROTOCOL_ERROR;
+        } else if (append_body(stream, payload + offset, data_length) != 0) {
+            stream_error = H2_INTERNAL_ERROR;
+        } else {
+            // Padding is never read, so only the data waits for the handler
+            connection_credit = length - data_length;
+            stream_credit = length - data_length;
+            stream->receive_window += stream_credit;
+        }
+
+        if (stream_error == H2_NO_ERROR && (flags & FLAG_END_STREAM)) {
+            stream->request_complete = 1;
+            if (stream->has_content_length && stream->body_received != stream->request.content_length) {
+                stream_error = H2_PROTOCOL_ERROR;
+            }
+        }
+        if (stream_error != H2_NO_ERROR) {
+            stream->reset = 1;
+            stream->closed = 1;
+        }
+        pthread_cond_broadcast(&connection->changed);
+    }
+    // Otherwise the stream was already answered or reset and the data is dropped
+    connection->receive_window += connection_credit;
+    pthread_mutex_unlock(&connection->mutex);
+
+    if (error != H2_NO_ERROR) {
+        return error;
+    }
+    if (stream_error != H2_NO_ERROR) {
+        send_rst_stream(connection, stream_id, stream_error);
+    } else if (stream_credit > 0 && !(flags & FLAG_END_STREAM)) {
+        send_window_update(connection, stream_id, stream_credit);
+    }
+    if (connection_credit > 0) {
+        send_window_update(connection, 0, connection_credit);
+    }
+    return H2_NO_ERROR;
+}
+
+static int handle_window_update_frame(h2_connection_t *connection, uint32_t stream_id,
+                                      const uint8_t *payload, size_t length) {
+    if (length != 4) {
+        return H2_FRAME_SIZE_ERROR;
+    }
+    uint32_t increment = get_uint32(payload) & MAX_WINDOW_SIZE;
+    int error = H2_NO_ERROR;
+    int stream_error = H2_NO_ERROR;
+
+    pthread_mutex_lock(&connection->mutex);
+    if (stream_id == 0) {
+        connection->send_window += increment;
+        if (increment == 0) {
+            error = H2_PROTOCOL_ERROR;
+        } else if (connection->send_window > MAX_WINDOW_SIZE) {
+            error = H2_FLOW_CONTROL_ERROR;
+        }
+    } else {
+        h2_stream_t *stream = find_stream(connection, stream_id);
+        if (stream) {
+            stream->send_window += increment;
+            if (increment == 0) {
+                stream_error = H2_PROTOCOL_ERROR;
+            } else if (stream->send_window > MAX_WINDOW_SIZE) {
+                stream_error = H2_FLOW_CONTROL_ERROR;
+            }
+            if (stream_error != H2_NO_ERROR) {
+                stream->reset = 1;
+                stream->closed = 1;
+            }
+        }
+    }
+    pthread_cond_broadcast(&connection->changed);
+    pthread_mutex_unlock(&connection->mutex);
+
+    if (stream_error != H2_NO_ERROR) {
+        send_rst_stream(connection, stream_id, stream_error);
+    }
+    return error;
+}
+
+static int handle_rst_stream_frame(h2_connection_t *connection, uint32_t stream_id, size_t length) {
+    if (length != 4) {
+        return H2_FRAME_SIZE_ERROR;
+    }
+    if (stream_id == 0 || stream_id > connection->last_stream_id) {
+        return H2_PROTOCOL_ERROR;
+    }
+
+    pthread_mutex_lock(&connection->mutex);
+    h2_stream_t *stream = find_stream(connection, stream_id);
+    int owned = stream && stream->state == STREAM_OPEN;
+    if (stream) {
+        stream->reset = 1;
+        stream->closed = 1;
+        pthread_cond_broadcast(&connection->changed);
+    }
+    pthread_mutex_unlock(&connection->mutex);
+
+    // A stream still being received has no thread to clean it up
+    if (owned) {
+        release_stream(stream);
+    }
+    return H2_NO_ERROR;
+}
+
+// Read and act on frames until the connection ends. Returns the error code
+// to close the connection with, H2_PEER_GOAWAY or H2_CONNECTION_LOST.
+static int process_frames(h2_connection_t *connection) {
+    uint8_t *payload = malloc(DEFAULT_FRAME_SIZE);
+    if (!payload) {
+        return H2_INTERNAL_ERROR;
+    }
+
+    int result = H2_NO_ERROR;
+    while (result == H2_NO_ERROR) {
+        // The idle deadline applies while no request is in flight
+        pthread_mutex_lock(&connection->mutex);
+        int busy = connection->stream_count > 0;
+        pthread_mutex_unlock(&connection->mutex);
+        if (busy) {
+            conn_timer_clear(connection->timer);
+        } else {
+            conn_timer_set(connection->timer, CONN_PHASE_IDLE);
+        }
+
+        uint8_t header[FRAME_HEADER_SIZE];
+        if (read_exact(connection, header, sizeof(header)) != 0) {
+            result = H2_CONNECTION_LOST;
+            break;
+        }
+        size_t length = ((size_t)header[0] << 16) | (header[1] << 8) | header[2];
+        uint8_t type = header[3];
+        uint8_t flags = header[4];
+        uint32_t stream_id = get_uint32(header + 5) & MAX_WINDOW_SIZE;
+
+        if (length > DEFAULT_FRAME_SIZE) {
+            result = H2_FRAME_SIZE_ERROR;
+            break;
+        }
+        conn_timer_set(connection->timer, CONN_PHASE_BODY);
+        if (read_exact(connection, payload, length) != 0) {
+            result = H2_CONNECTION_LOST;
+            break;
+        }
+
+        // Nothing may come between a HEADERS frame and its CONTINUATION frames
+        if (connection->expecting_continuation && type != FRAME_CONTINUATION) {
+            result = H2_PROTOCOL_ERROR;
+            break;
+        }
+
+        switch (type) {
+            case FRAME_DATA:
+                result = handle_data_frame(connection, flags, stream_id, payload, length);
+                break;
+            case FRAME_HEADERS:
+                result = handle_headers_frame(connection, flags, stream_id, payload, length);
+                break;
+            case FRAME_CONTINUATION:
+                result = handle_continuation_frame(connection, flags, stream_id, payload, length);
+                break;
+            case FRAME_PRIORITY:
+                result = length == 5 ? H2_NO_ERROR : H2_FRAME_SIZE_ERROR;
+                break;
+            case FRAME_RST_STREAM:
+                result = handle_rst_stream_frame(connection, stream_id, length);
+                break;
+            case FRAME_SETTINGS:
+                if (stream_id != 0) {
+                    result = H2_PROTOCOL_ERROR;
+                } else if (flags & FLAG_ACK) {
+                    result = length == 0 ? H2_NO_ERROR : H2_FRAME_SIZE_ERROR;
+                } else if ((result = apply_settings(connection, payload, length)) == H2_NO_ERROR) {
+                    send_frame(connection, FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+                }
+                break;
+            case FRAME_PING:
+                if (length != 8) {
+                    result = H2_FRAME_SIZE_ERROR;
+                } else if (stream_id != 0) {
+                    result = H2_PROTOCOL_ERROR;
+                } else if (!(flags & FLAG_ACK)) {
+                    send_frame(connection, FRAME_PING, FLAG_ACK, 0, payload, length);
+                }
+                break;
+            case FRAME_GOAWAY:
+                result = stream_id == 0 ? H2_PEER_GOAWAY : H2_PROTOCOL_ERROR;
+                break;
+            case FRAME_WINDOW_UPDATE:
+                result = handle_window_update_frame(connection, stream_id, payload, length);
+                break;
+            case FRAME_PUSH_PROMISE:
+                result = H2_PROTOCOL_ERROR; // Clients cannot push
+                break;
+            default:
+                break; // Unknown frame types are ignored
+        }
+    }
+
+    free(payload);
+    return result;
+}
+
+void http2_serve_connection(int client_socket, const struct sockaddr *client_address, struct conn_timer *timer,
+                            const char *buffered, size_t buffered_length, const http_request_t *upgrade_request) {
+    h2_connection_t *connection = calloc(1, sizeof(h2_connection_t));
+    if (!connection) {
+        return;
+    }
+    connection->header_block = malloc(MAX_HEADER_BLOCK);
+    if (!connection->header_block || hpack_decoder_init(&connection->decoder, HPACK_DEFAULT_TABLE_SIZE) != 0) {
+        free(connection->header_block);
+        free(connection);
+        return;
+    }
+    connection->client_socket = client_socket;
+    connection->client_address = client_address;
+    connection->timer = timer;
+    connection->buffered = buffered;
+    connection->buffered_length = buffered_length;
+    connection->send_window = DEFAULT_WINDOW_SIZE;
+    connection->receive_window = CONNECTION_WINDOW;
+    connection->peer_initial_window = DEFAULT_WINDOW_SIZE;
+    connection->peer_max_frame_size = DEFAULT_FRAME_SIZE;
+    pthread_mutex_init(&connection->mutex, NULL);
+    pthread_cond_init(&connection->changed, NULL);
+    pthread_mutex_init(&connection->write_mutex, NULL);
+
+    int result = H2_NO_ERROR;
+
+    // The server's SETTINGS must be its first frame
+    if (send_settings(connection) != 0) {
+        result = H2_CONNECTION_LOST;
+    }
+
+    // An upgraded request becomes stream 1, whose request side is already complete
+    if (result == H2_NO_ERROR && upgrade_request) {
+        if (apply_upgrade_settings(connection, upgrade_request->http2_settings) != 0) {
+            result = H2_PROTOCOL_ERROR;
+        } else {
+            h2_stream_t *stream = calloc(1, sizeof(h2_stream_t));
+            if (stream) {
+                stream->id = 1;
+                stream->connection = connection;
+                stream->send_window = connection->peer_initial_window;
+                stream->receive_window = HTTP2_STREAM_WINDOW;
+                stream->request = *upgrade_request;
+                stream->request.body_reader = NULL;
+                strcpy(stream->request.version, "HTTP/2.0");
+                connection->streams = stream;
+                connection->stream_count = 1;
+                connection->last_stream_id = 1;
+                stream->request_complete = 1;
+                dispatch_stream(connection, stream);
+            }
+        }
+    }
+
+    // Then the client's preface, which prior-knowledge clients have started already
+    if (result == H2_NO_ERROR) {
+        char preface[HTTP2_PREFACE_LENGTH];
+        conn_timer_set(timer, CONN_PHASE_HEADER);
+        if (read_exact(connection, preface, sizeof(preface)) != 0) {
+            result = H2_CONNECTION_LOST;
+        } else if (memcmp(preface, HTTP2_PREFACE, HTTP2_PREFACE_LENGTH) != 0) {
+            result = H2_PROTOCOL_ERROR;
+        }
+    }
+
+    if (result == H2_NO_ERROR) {
+        result = process_frames(connection);
+    }
+    conn_timer_clear(timer);
+
+    // Handlers still waiting for body data will not get the rest
+    pthread_mutex_lock(&connection->mutex);
+    connection->input_closed = 1;
+    pthread_cond_broadcast(&connection->changed);
+    pthread_mutex_unlock(&connection->mutex);
+
+    // A client that went idle or said goodbye still gets the responses in flight
+    int graceful = result == H2_PEER_GOAWAY ||
+                   (result == H2_CONNECTION_LOST && conn_timer_expired(timer) == CONN_PHASE_IDLE);
+    if (graceful) {
+        pthread_mutex_lock(&connection->mutex);
+        while (connection->workers > 0) {
+            pthread_cond_wait(&connection->changed, &connection->mutex);
+        }
+        pthread_mutex_unlock(&connection->mutex);
+        send_goaway(connection, H2_NO_ERROR);
+    } else {
+        if (result != H2_CONNECTION_LOST) {
+            send_goaway(connection, result);
+        }
+        // Wake stream threads blocked on the socket or on flow control
+        mark_failed(connection);
+        shutdown(client_socket, SHUT_RDWR);
+        pthread_mutex_lock(&connection->mutex);
+        while (connection->workers > 0) {
+            pthread_cond_wait(&connection->changed, &connection->mutex);
+        }
+        pthread_mutex_unlock(&connection->mutex);
+    }
+
+    if (verbose_mode) {
+        printf("HTTP/2 connection ended after %u streams\n", (connection->last_stream_id + 1) / 2);
+    }
+
+    // Only streams that never reached a thread are left
+    while (connection->streams) {
+        h2_stream_t *stream = connection->streams;
+        connection->streams = stream->next;
+        free_stream(stream);
+    }
+    hpack_decoder_free(&connection->decoder);
+    free(connection->header_block);
+    pthread_mutex_destroy(&connection->mutex);
+    pthread_cond_destroy(&connection->changed);
+    pthread_mutex_destroy(&connection->write_mutex);
+    free(connection);
+}
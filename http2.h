@@ -0,0 +1,27 @@
+#ifndef HTTP2_H
+#define HTTP2_H
+
+#include <stddef.h>
+#include <sys/socket.h>
+#include "http_request.h"
+
+struct conn_timer;
+
+#define HTTP2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define HTTP2_PREFACE_LENGTH 24
+#define HTTP2_MAX_CONCURRENT_STREAMS 100    // Streams a client may have open at once
+#define HTTP2_STREAM_WINDOW (1024 * 1024)   // Receive window advertised for each stream
+
+// Whether a connection's first bytes are the start of the HTTP/2 preface
+// sent by a client with prior knowledge
+int http2_is_preface(const char *buffer, size_t length);
+
+// Serve HTTP/2 (h2c) on a connection until it ends. buffered holds bytes
+// already read from the socket that belong to the HTTP/2 connection. When
+// the client upgraded with "Upgrade: h2c", upgrade_request is its HTTP/1.1
+// request, which becomes stream 1 and has already been answered with 101.
+// Requests run concurrently, each on its own thread, through handle_request().
+void http2_serve_connection(int client_socket, const struct sockaddr *client_address, struct conn_timer *timer,
+                            const char *buffered, size_t buffered_length, const http_request_t *upgrade_request);
+
+#endif
@@ -0,0 +1,452 @@
+// http_bench.c - load generator for measuring the HTTP server's socket tuning
+#define _GNU_SOURCE // MSG_FASTOPEN
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <stddef.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_CONNECTIONS 8
+#define DEFAULT_REQUESTS 1000
+#define READ_BUFFER_SIZE 65536
+
+typedef struct {
+    struct sockaddr_storage address;
+    socklen_t address_length;
+    char request[1024];
+    size_t request_length;
+    int requests;           // Per connection
+    int reconnect;          // New connection for every request
+    int fastopen;           // Carry the request in the SYN (with reconnect)
+    int nodelay;
+} bench_config_t;
+
+typedef struct {
+    const bench_config_t *config;
+    pthread_t thread;
+    unsigned long long *latencies_us;
+    int completed;
+    int failed;
+    unsigned long long bytes;
+} bench_worker_t;
+
+// Buffered reader over one connection
+typedef struct {
+    int fd;
+    size_t start;
+    size_t end;
+    char buffer[READ_BUFFER_SIZE];
+} reader_t;
+
+static unsigned long long now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+static int fill(reader_t *reader) {
+    if (reader->start == reader->end) {
+        reader->start = reader->end = 0;
+    } else if (reader->end == sizeof(reader->buffer)) {
+        memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+    ssize_t bytes_read;
+    do {
+        bytes_read = recv(reader->fd, reader->buffer + reader->end, sizeof(reader->buffer) - reader->end, 0);
+    } while (bytes_read < 0 && errno == EINTR);
+    if (bytes_read <= 0) {
+        return -1;
+    }
+    reader->end += bytes_read;
+    return 0;
+}
+
+// Read one CRLF-terminated line into line (without the CRLF)
+static int read_line(reader_t *reader, char *line, size_t line_size) {
+    while (1) {
+        char *newline = memchr(reader->buffer + reader->start, '\n', reader->end - reader->start);
+        if (newline) {
+            size_t length = newline - (reader->buffer + reader->start);
+            if (length > 0 && newline[-1] == '\r') {
+                length--;
+            }
+            if (length >= line_size) {
+                return -1;
+            }
+            memcpy(line, reader->buffer + reader->start, length);
+            line[length] = '\0';
+            reader->start = newline + 1 - reader->buffer;
+            return 0;
+        }
+        if (reader->end - reader->start == sizeof(reader->buffer) || fill(reader) != 0) {
+            return -1;
+        }
+    }
+}
+
+static int skip_bytes(reader_t *reader, size_t length) {
+    while (length > 0) {
+        if (reader->start == reader->end && fill(reader) != 0) {
+            return -1;
+        }
+        size_t available = reader->end - reader->start;
+        size_t amount = length < available ? length : available;
+        reader->start += amount;
+        length -= amount;
+    }
+    return 0;
+}
+
+// Read a whole response. Returns the body size, or -1 on a broken or
+// non-2xx response. *closing is set when the server ends the connection.
+static long long read_response(reader_t *reader, int *closing) {
+    char line[2048];
+    if (read_line(reader, line, sizeof(line)) != 0) {
+        return -1;
+    }
+    int status = 0;
+    if (sscanf(line, "HTTP/%*d.%*d %d", &status) != 1) {
+        return -1;
+    }
+
+    long long content_length = -1;
+    int chunked = 0;
+    *closing = 0;
+    while (1) {
+        if (read_line(reader, line, sizeof(line)) != 0) {
+            return -1;
+        }
+        if (line[0] == '\0') {
+            break;
+        }
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            content_length = atoll(line + 15);
+        } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0 && strstr(line, "chunked")) {
+            chunked = 1;
+        } else if (strncasecmp(line, "Connection:", 11) == 0 && strstr(line, "close")) {
+            *closing = 1;
+        }
+    }
+
+    long long body_size = 0;
+    if (chunked) {
+        while (1) {
+            if (read_line(reader, line, sizeof(line)) != 0) {
+                return -1;
+            }
+            long long chunk_size = strtoll(line, NULL, 16);
+            if (chunk_size == 0) {
+                break;
+            }
+            if (skip_bytes(reader, chunk_size + 2) != 0) {
+                return -1;
+            }
+            body_size += chunk_size;
+        }
+        // Trailers end with a blank line
+        do {
+            if (read_line(reader, line, sizeof(line)) != 0) {
+                return -1;
+            }
+        } while (line[0] != '\0');
+    } else if (content_length >= 0) {
+        if (skip_bytes(reader, content_length) != 0) {
+            return -1;
+        }
+        body_size = content_length;
+    } else {
+        // Body runs to the end of the connection
+        while (fill(reader) == 0) {
+            body_size += reader->end - reader->start;
+            reader->start = reader->end;
+        }
+        *closing = 1;
+    }
+
+    return status >= 200 && status < 300 ? body_size : -1;
+}
+
+static int send_request(int fd, const bench_config_t *config) {
+    size_t sent = 0;
+    while (sent < config->request_length) {
+        ssize_t written = send(fd, config->request + sent, config->request_length - sent, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return -1;
+        }
+        sent += written;
+    }
+    return 0;
+}
+
+// Connect, and with Fast Open send the request along with the SYN
+static int open_connection(const bench_config_t *config, int *request_sent) {
+    int fd = socket(config->address.ss_family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int on = 1;
+    if (config->nodelay && config->address.ss_family != AF_UNIX) {
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+
+    *request_sent = 0;
+    if (config->fastopen && config->address.ss_family != AF_UNIX) {
+        ssize_t written = sendto(fd, config->request, config->request_length, MSG_FASTOPEN | MSG_NOSIGNAL,
+                                 (const struct sockaddr *)&config->address, config->address_length);
+        if (written == (ssize_t)config->request_length) {
+            *request_sent = 1;
+            return fd;
+        }
+        if (written >= 0 || errno != EINPROGRESS) {
+            close(fd);
+            return -1;
+        }
+        return fd; // Connected without data in the SYN; send normally
+    }
+
+    if (connect(fd, (const struct sockaddr *)&config->address, config->address_length) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void *run_worker(void *arg) {
+    bench_worker_t *worker = arg;
+    const bench_config_t *config = worker->config;
+    reader_t *reader = malloc(sizeof(reader_t));
+    if (!reader) {
+        worker->failed = config->requests;
+        return NULL;
+    }
+    reader->fd = -1;
+
+    for (int i = 0; i < config->requests; i++) {
+        unsigned long long start = now_us();
+        int request_sent = 0;
+        if (reader->fd < 0) {
+            reader->fd = open_connection(config, &request_sent);
+            reader->start = reader->end = 0;
+            if (reader->fd < 0) {
+                worker->failed++;
+                continue;
+            }
+        }
+
+        int closing = 0;
+        long long body_size = -1;
+        if (request_sent || send_request(reader->fd, config) == 0) {
+            body_size = read_response(reader, &closing);
+        }
+        if (body_size < 0) {
+            worker->failed++;
+            closing = 1;
+        } else {
+            worker->latencies_us[worker->completed++] = now_us() - start;
+            worker->bytes += body_size;
+        }
+
+        if (closing || config->reconnect) {
+            close(reader->fd);
+            reader->fd = -1;
+        }
+    }
+
+    if (reader->fd >= 0) {
+        close(reader->fd);
+    }
+    free(reader);
+    return NULL;
+}
+
+static int compare_latency(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+// "host:port", "[v6host]:port", "port", "unix:/path" or "abstract:name"
+static int parse_target(const char *target, bench_config_t *config, char *host_header, size_t host_size) {
+    memset(&config->address, 0, sizeof(config->address));
+
+    if (strncmp(target, "unix:", 5) == 0 || strncmp(target, "abstract:", 9) == 0) {
+        struct sockaddr_un *address = (struct sockaddr_un *)&config->address;
+        int abstract = target[0] == 'a';
+        const char *path = strchr(target, ':') + 1;
+        size_t length = strlen(path);
+        if (length == 0 || length + abstract >= sizeof(address->sun_path)) {
+            return -1;
+        }
+        address->sun_family = AF_UNIX;
+        memcpy(address->sun_path + abstract, path, length);
+        config->address_length = abstract ? offsetof(struct sockaddr_un, sun_path) + 1 + length :
+                                            sizeof(struct sockaddr_un);
+        snprintf(host_header, host_size, "localhost");
+        return 0;
+    }
+
+    char host[128] = "127.0.0.1";
+    const char *port_text = target;
+    if (target[0] == '[') {
+        const char *close_bracket = strchr(target, ']');
+        if (!close_bracket || close_bracket[1] != ':' || (size_t)(close_bracket - target - 1) >= sizeof(host)) {
+            return -1;
+        }
+        memcpy(host, target + 1, close_bracket - target - 1);
+        host[close_bracket - target - 1] = '\0';
+        port_text = close_bracket + 2;
+    } else if (strchr(target, ':')) {
+        const char *colon = strrchr(target, ':');
+        if ((size_t)(colon - target) >= sizeof(host)) {
+            return -1;
+        }
+        memcpy(host, target, colon - target);
+        host[colon - target] = '\0';
+        port_text = colon + 1;
+    }
+
+    int port = atoi(port_text);
+    if (port <= 0 || port > 65535) {
+        return -1;
+    }
+    struct sockaddr_in *inet = (struct sockaddr_in *)&config->address;
+    struct sockaddr_in6 *inet6 = (struct sockaddr_in6 *)&config->address;
+    if (inet_pton(AF_INET, host, &inet->sin_addr) == 1) {
+        inet->sin_family = AF_INET;
+        inet->sin_port = htons(port);
+        config->address_length = sizeof(struct sockaddr_in);
+    } else if (inet_pton(AF_INET6, host, &inet6->sin6_addr) == 1) {
+        inet6->sin6_family = AF_INET6;
+        inet6->sin6_port = htons(port);
+        config->address_length = sizeof(struct sockaddr_in6);
+    } else {
+        return -1;
+    }
+    snprintf(host_header, host_size, "%s", host);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    bench_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.requests = DEFAULT_REQUESTS;
+    int connections = DEFAULT_CONNECTIONS;
+    int option;
+
+    while ((option = getopt(argc, argv, "c:n:CFD")) != -1) {
+        switch (option) {
+            case 'c':
+                connections = atoi(optarg);
+                break;
+            case 'n':
+                config.requests = atoi(optarg);
+                break;
+            case 'C':
+                config.reconnect = 1;
+                break;
+            case 'F':
+                config.fastopen = 1;
+                break;
+            case 'D':
+                config.nodelay = 1;
+                break;
+            default:
+                optind = argc + 1;
+                break;
+        }
+    }
+
+    char host_header[128];
+    if (optind + 2 != argc || connections <= 0 || config.requests <= 0 ||
+        parse_target(argv[optind], &config, host_header, sizeof(host_header)) != 0 || argv[optind + 1][0] != '/') {
+        fprintf(stderr, "Usage: %s [-c connections] [-n requests_per_connection] [-C] [-F] [-D]\n"
+                        "          [host:]port|[v6host]:port|unix:/path|abstract:name /path\n"
+                        "  -C  open a new connection for every request\n"
+                        "  -F  send each request in the SYN with TCP Fast Open (with -C)\n"
+                        "  -D  set TCP_NODELAY on the client sockets\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int request_length = snprintf(config.request, sizeof(config.request),
+                                  "GET %s HTTP/1.1\r\nHost: %s\r\n%s\r\n", argv[optind + 1], host_header,
+                                  config.reconnect ? "Connection: close\r\n" : "");
+    if (request_length <= 0 || (size_t)request_length >= sizeof(config.request)) {
+        fprintf(stderr, "Path too long\n");
+        return EXIT_FAILURE;
+    }
+    config.request_length = request_length;
+
+    bench_worker_t *workers = calloc(connections, sizeof(bench_worker_t));
+    if (!workers) {
+        perror("Failed to allocate memory");
+        return EXIT_FAILURE;
+    }
+
+    unsigned long long start = now_us();
+    int started = 0;
+    for (int i = 0; i < connections; i++) {
+        workers[i].config = &config;
+        workers[i].latencies_us = malloc(config.requests * sizeof(unsigned long long));
+        if (!workers[i].latencies_us || pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) != 0) {
+            perror("Failed to start worker");
+            break;
+        }
+        started++;
+    }
+
+    int completed = 0;
+    int failed = 0;
+    unsigned long long bytes = 0;
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        completed += workers[i].completed;
+        failed += workers[i].failed;
+        bytes += workers[i].bytes;
+    }
+    double elapsed = (now_us() - start) / 1e6;
+
+    // Merge the per-connection samples for percentiles
+    unsigned long long *latencies = malloc((completed > 0 ? completed : 1) * sizeof(unsigned long long));
+    if (!latencies) {
+        perror("Failed to allocate memory");
+        return EXIT_FAILURE;
+    }
+    size_t merged = 0;
+    for (int i = 0; i < started; i++) {
+        memcpy(latencies + merged, workers[i].latencies_us, workers[i].completed * sizeof(unsigned long long));
+        merged += workers[i].completed;
+        free(workers[i].latencies_us);
+    }
+    qsort(latencies, merged, sizeof(unsigned long long), compare_latency);
+
+    printf("%d connections x %d requests, %s%s%s\n", started, config.requests,
+           config.reconnect ? "new connection per request" : "keep-alive",
+           config.fastopen ? ", fast open" : "", config.nodelay ? ", client nodelay" : "");
+    printf("requests %d, failed %d, %.3f s, %.0f requests/s, %.1f MB/s\n",
+           completed, failed, elapsed, elapsed > 0 ? completed / elapsed : 0.0,
+           elapsed > 0 ? bytes / elapsed / 1e6 : 0.0);
+    if (merged > 0) {
+        printf("latency us: p50 %llu p90 %llu p99 %llu max %llu\n",
+               latencies[merged / 2], latencies[merged * 9 / 10], latencies[merged * 99 / 100],
+               latencies[merged - 1]);
+    }
+
+    free(latencies);
+    free(workers);
+    return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,420 @@
+#define _GNU_SOURCE // splice()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include "http_body.h"
+#include "http_response.h"
+#include "utils.h"
+#include "conn_manager.h"
+#include "tls.h"
+#include "capture.h"
+
+// Reader states
+#define BODY_DATA       0   // Inside the body (or the current chunk)
+#define BODY_CHUNK_SIZE 1   // Expecting a chunk-size line
+#define BODY_CHUNK_END  2   // Expecting the CRLF that ends a chunk
+#define BODY_TRAILERS   3   // Expecting trailer lines after the last chunk
+#define BODY_DONE       4
+#define BODY_ERROR      5
+
+#define BODY_COPY_SIZE 16384
+#define SPLICE_SIZE 65536
+
+void http_body_reader_init(http_body_reader_t *reader, int client_socket, const http_request_t *request,
+                           const char *buffered, size_t buffered_length, size_t max_size) {
+    memset(reader, 0, sizeof(http_body_reader_t));
+    reader->client_socket = client_socket;
+    reader->buffered = buffered;
+    reader->buffered_length = buffered_length;
+    reader->max_size = max_size;
+    reader->expect_continue = request->expect_continue;
+    reader->chunked = request->chunked;
+
+    if (reader->chunked) {
+        reader->state = BODY_CHUNK_SIZE;
+    } else if (request->content_length > 0) {
+        reader->state = BODY_DATA;
+        reader->remaining = request->content_length;
+        if (request->content_length > max_size) {
+            reader->state = BODY_ERROR;
+            reader->error_status = HTTP_STATUS_PAYLOAD_TOO_LARGE;
+        }
+    } else {
+        reader->state = BODY_DONE;
+    }
+}
+
+void http_body_reader_init_source(http_body_reader_t *reader, const http_request_t *request,
+                                  ssize_t (*source)(void *context, void *buffer, size_t length),
+                                  void *context, size_t max_size) {
+    http_body_reader_init(reader, -1, request, NULL, 0, max_size);
+    reader->source = source;
+    reader->source_context = context;
+    if (request->chunked) {
+        reader->chunked = 0;
+        reader->until_end = 1;
+        reader->state = BODY_DATA;
+        reader->remaining = (size_t)-1;
+    }
+}
+
+int http_body_present(const http_body_reader_t *reader) {
+    return reader && (reader->chunked || reader->remaining > 0 || reader->state == BODY_ERROR);
+}
+
+static void fail(http_body_reader_t *reader, int status) {
+    reader->state = BODY_ERROR;
+    reader->error_status = status;
+}
+
+// Tell a client that is waiting for permission to start sending the body
+static int send_continue(http_body_reader_t *reader) {
+    if (!reader->expect_continue) {
+        return 0;
+    }
+    reader->expect_continue = 0;
+    const char *interim = "HTTP/1.1 100 Continue\r\n\r\n";
+    return send_all(reader->client_socket, interim, strlen(interim));
+}
+
+// Read raw bytes: first those that arrived with the headers, then the socket
+static ssize_t read_raw(http_body_reader_t *reader, void *buffer, size_t length) {
+    if (reader->buffered_length > 0) {
+        size_t amount = length < reader->buffered_length ? length : reader->buffered_length;
+        memcpy(buffer, reader->buffered, amount);
+        reader->buffered += amount;
+        reader->buffered_length -= amount;
+        return amount;
+    }
+    if (reader->source) {
+        return reader->source(reader->source_context, buffer, length);
+    }
+
+    if (send_continue(reader) != 0) {
+        return -1;
+    }
+
+    if (reader->timer) {
+        conn_timer_set(reader->timer, CONN_PHASE_BODY);
+    }
+
+    ssize_t bytes_read;
+    do {
+        bytes_read = recv_some(reader->client_socket, buffer, length);
+    } while (bytes_read < 0 && errno == EINTR);
+    if (bytes_read > 0) {
+        capture_data(reader->capture, buffer, bytes_read);
+    }
+    return bytes_read;
+}
+
+// Read one CRLF-terminated framing line. Framing lines are tiny, so reading
+// them a byte at a time never reads past the body into a following request.
+static int read_line(http_body_reader_t *reader, char *line, size_t line_size) {
+    size_t length = 0;
+    while (1) {
+        char c;
+        if (read_raw(reader, &c, 1) != 1) {
+            return -1;
+        }
+        if (c == '\n') {
+            break;
+        }
+        if (length + 1 >= line_size) {
+            return -1; // Line too long
+        }
+        line[length++] = c;
+    }
+    if (length > 0 && line[length - 1] == '\r') {
+        length--;
+    }
+    line[length] = '\0';
+    return 0;
+}
+
+// Parse a chunk-size line, ignoring any chunk extensions
+static int parse_chunk_size(const char *line, size_t *size_out) {
+    size_t size = 0;
+    int digits = 0;
+    for (const char *p = line; *p && *p != ';' && *p != ' ' && *p != '\t'; p++) {
+        int value;
+        if (*p >= '0' && *p <= '9') {
+            value = *p - '0';
+        } else if (*p >= 'a' && *p <= 'f') {
+            value = *p - 'a' + 10;
+        } else if (*p >= 'A' && *p <= 'F') {
+            value = *p - 'A' + 10;
+        } else {
+            return -1;
+        }
+        if (size > ((size_t)-1 >> 4)) {
+            return -1; // Overflow
+        }
+        size = size * 16 + value;
+        digits++;
+    }
+    if (digits == 0) {
+        return -1;
+    }
+    *size_out = size;
+    return 0;
+}
+
+// Advance through chunk framing until there is data to read or the body ends
+static int advance_chunked(http_body_reader_t *reader) {
+    char line[256];
+    while (reader->state != BODY_DATA && reader->state != BODY_DONE) {
+        if (reader->state == BODY_ERROR || read_line(reader, line, sizeof(line)) != 0) {
+            fail(reader, HTTP_STATUS_BAD_REQUEST);
+            return -1;
+        }
+
+        if (reader->state == BODY_CHUNK_END) {
+            if (line[0] != '\0') {
+                fail(reader, HTTP_STATUS_BAD_REQUEST);
+                return -1;
+            }
+            reader->state = BODY_CHUNK_SIZE;
+        } else if (reader->state == BODY_CHUNK_SIZE) {
+            size_t chunk_size;
+            if (parse_chunk_size(line, &chunk_size) != 0) {
+                fail(reader, HTTP_STATUS_BAD_REQUEST);
+                return -1;
+            }
+            if (chunk_size == 0) {
+                reader->state = BODY_TRAILERS;
+            } else if (chunk_size > reader->max_size - reader->total_read) {
+                fail(reader, HTTP_STATUS_PAYLOAD_TOO_LARGE);
+                return -1;
+            } else {
+                reader->remaining = chunk_size;
+                reader->state = BODY_DATA;
+            }
+        } else if (reader->state == BODY_TRAILERS && line[0] == '\0') {
+            reader->state = BODY_DONE;
+        }
+    }
+    return 0;
+}
+
+ssize_t http_body_read(http_body_reader_t *reader, void *buffer, size_t length) {
+    if (!reader || !buffer) {
+        return -1;
+    }
+    if (reader->state == BODY_ERROR) {
+        return -1;
+    }
+
+    if (reader->chunked && advance_chunked(reader) != 0) {
+        return -1;
+    }
+    if (reader->state == BODY_DONE || length == 0) {
+        return 0;
+    }
+
+    size_t amount = length < reader->remaining ? length : reader->remaining;
+    ssize_t bytes_read = read_raw(reader, buffer, amount);
+    if (bytes_read == 0 && reader->until_end) {
+        reader->state = BODY_DONE;
+        return 0;
+    }
+    if (bytes_read > 0 && reader->until_end && (size_t)bytes_read > reader->max_size - reader->total_read) {
+        fail(reader, HTTP_STATUS_PAYLOAD_TOO_LARGE);
+        return -1;
+    }
+    if (bytes_read <= 0) {
+        // The client stopped before sending the whole body
+        fail(reader, HTTP_STATUS_BAD_REQUEST);
+        return -1;
+    }
+
+    reader->remaining -= bytes_read;
+    reader->total_read += bytes_read;
+    if (reader->remaining == 0) {
+        reader->state = reader->chunked ? BODY_CHUNK_END : BODY_DONE;
+    }
+    return bytes_read;
+}
+
+static int write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return -1;
+        }
+        data += written;
+        length -= written;
+    }
+    return 0;
+}
+
+// Copy length bytes out of a pipe into the file
+static int drain_pipe(int pipe_fd, int fd, size_t length) {
+    char buffer[4096];
+    while (length > 0) {
+        ssize_t bytes_read = read(pipe_fd, buffer, length < sizeof(buffer) ? length : sizeof(buffer));
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0 || write_all(fd, buffer, bytes_read) != 0) {
+            return -1;
+        }
+        length -= bytes_read;
+    }
+    return 0;
+}
+
+// Move the rest of a fixed-length body from the socket to the file through a
+// pipe, so the data never passes through user space. Fails with EINVAL when
+// either end cannot be spliced, having written everything it took from the
+// socket, so the caller can carry on copying.
+static int splice_remaining(http_body_reader_t *reader, int fd) {
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0) {
+        return -1;
+    }
+
+    int result = 0;
+    while (reader->remaining > 0) {
+        if (reader->timer) {
+            conn_timer_set(reader->timer, CONN_PHASE_BODY);
+        }
+        size_t amount = reader->remaining < SPLICE_SIZE ? reader->remaining : SPLICE_SIZE;
+        ssize_t in_pipe = splice(reader->client_socket, NULL, pipe_fds[1], NULL, amount,
+                                 SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (in_pipe < 0 && errno == EINTR) {
+            continue;
+        }
+        if (in_pipe <= 0) {
+            result = -1;
+            break;
+        }
+
+        ssize_t left = in_pipe;
+        int splice_error = 0;
+        while (left > 0) {
+            ssize_t out = splice(pipe_fds[0], NULL, fd, NULL, left, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (out < 0 && errno == EINTR) {
+                continue;
+            }
+            if (out <= 0) {
+                splice_error = out < 0 ? errno : EIO;
+                break;
+            }
+            left -= out;
+        }
+
+        // Bytes taken from the socket but left in the pipe are part of the
+        // body, so they are copied out before giving up on splicing
+        if (left > 0 && drain_pipe(pipe_fds[0], fd, left) != 0) {
+            errno = EIO; // Part of the body is lost, so the request fails
+            result = -1;
+            break;
+        }
+        reader->remaining -= in_pipe;
+        reader->total_read += in_pipe;
+        if (splice_error != 0) {
+            errno = splice_error;
+            result = -1;
+            break;
+        }
+    }
+
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    if (result == 0) {
+        reader->state = BODY_DONE;
+    }
+    return result;
+}
+
+int http_body_spool(http_body_reader_t *reader, int *fd_out, size_t *size_out) {
+    if (!reader || !fd_out || !size_out || reader->state == BODY_ERROR) {
+        return -1;
+    }
+
+    const char *temp_dir = getenv("TMPDIR");
+    char temp_path[1024];
+    snprintf(temp_path, sizeof(temp_path), "%s/http_body_XXXXXX", temp_dir ? temp_dir : "/tmp");
+    int fd = mkstemp(temp_path);
+    if (fd < 0) {
+        fail(reader, HTTP_STATUS_INTERNAL_ERROR);
+        return -1;
+    }
+    unlink(temp_path); // The file disappears once the descriptor is closed
+
+    size_t start_total = reader->total_read;
+    char *copy_buffer = malloc(BODY_COPY_SIZE);
+    if (!copy_buffer) {
+        close(fd);
+        fail(reader, HTTP_STATUS_INTERNAL_ERROR);
+        return -1;
+    }
+
+    int result = 0;
+    // Encrypted bodies have to pass through the TLS library, and captured
+    // ones through the capture
+    int try_splice = !reader->source && !tls_active(reader->client_socket) && !capture_enabled();
+    while (1) {
+        // Once only socket data is left of a fixed-length body, splice the rest
+        if (try_splice && !reader->chunked && reader->state == BODY_DATA && reader->buffered_length == 0) {
+            if (send_continue(reader) != 0) {
+                result = -1;
+                break;
+            }
+            if (splice_remaining(reader, fd) == 0) {
+                break;
+            }
+            if (errno == EINVAL) {
+                try_splice = 0; // Not spliceable here; copy the rest
+            } else {
+                fail(reader, HTTP_STATUS_BAD_REQUEST);
+                result = -1;
+                break;
+            }
+        }
+
+        ssize_t bytes_read = http_body_read(reader, copy_buffer, BODY_COPY_SIZE);
+        if (bytes_read < 0) {
+            result = -1;
+            break;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+        if (write_all(fd, copy_buffer, bytes_read) != 0) {
+            fail(reader, HTTP_STATUS_INTERNAL_ERROR);
+            result = -1;
+            break;
+        }
+    }
+    free(copy_buffer);
+
+    if (result != 0 || lseek(fd, 0, SEEK_SET) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    *fd_out = fd;
+    *size_out = reader->total_read - start_total;
+    return 0;
+}
+
+int http_body_discard(http_body_reader_t *reader) {
+    char buffer[1024];
+    ssize_t bytes_read;
+    while ((bytes_read = http_body_read(reader, buffer, sizeof(buffer))) > 0) {
+    }
+    return bytes_read == 0 ? 0 : -1;
+}
+
+int http_body_complete(const http_body_reader_t *reader) {
+    return reader && reader->state == BODY_DONE;
+}
@@ -0,0 +1,64 @@
+#ifndef HTTP_BODY_H
+#define HTTP_BODY_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "http_request.h"
+
+#define DEFAULT_MAX_BODY_SIZE (64 * 1024 * 1024)   // Largest request body accepted
+#define DEFAULT_SPOOL_THRESHOLD (1024 * 1024)      // Bodies past this are spooled to disk
+
+// Incremental reader for a request body. The body is pulled from the socket
+// only as the handler asks for it, so memory use does not depend on how
+// large the upload is.
+typedef struct http_body_reader {
+    int client_socket;
+    const char *buffered;       // Body bytes that arrived together with the headers
+    size_t buffered_length;
+    int chunked;                // Transfer-Encoding: chunked
+    int state;
+    size_t remaining;           // Bytes left in the body, or in the current chunk
+    size_t total_read;
+    size_t max_size;
+    int expect_continue;        // Client waits for "100 Continue" before sending
+    int error_status;           // HTTP status describing why reading failed
+    struct conn_timer *timer;   // Re-armed with the body deadline before every wait, may be NULL
+    struct capture_connection *capture; // Bytes read from the socket are captured here, may be NULL
+    ssize_t (*source)(void *context, void *buffer, size_t length); // Read instead of the socket when set
+    void *source_context;
+    int until_end;              // Length unknown: the body is whatever the source gives until it returns 0
+} http_body_reader_t;
+
+// Set up a reader for request's body. buffered holds the bytes already
+// received after the end of the headers.
+void http_body_reader_init(http_body_reader_t *reader, int client_socket, const http_request_t *request,
+                           const char *buffered, size_t buffered_length, size_t max_size);
+
+// Set up a reader that takes the body from source rather than a socket, as
+// HTTP/2 streams do. source returns the bytes read, 0 once the body has
+// ended or -1 on error. A chunked request here is one whose length is not
+// known in advance; the source delivers it without chunk framing.
+void http_body_reader_init_source(http_body_reader_t *reader, const http_request_t *request,
+                                  ssize_t (*source)(void *context, void *buffer, size_t length),
+                                  void *context, size_t max_size);
+
+// Whether the request has a body at all
+int http_body_present(const http_body_reader_t *reader);
+
+// Read up to length bytes of the body. Returns the number of bytes read,
+// 0 at the end of the body, or -1 on error (reader->error_status says why).
+ssize_t http_body_read(http_body_reader_t *reader, void *buffer, size_t length);
+
+// Write the rest of the body to an unlinked temporary file, splicing
+// straight from the socket when the body length is known. On success *fd_out
+// is positioned at the start of the file and *size_out holds its size.
+int http_body_spool(http_body_reader_t *reader, int *fd_out, size_t *size_out);
+
+// Read and drop whatever is left of the body
+int http_body_discard(http_body_reader_t *reader);
+
+// Whether the whole body has been read, so the connection is positioned at
+// the next request
+int http_body_complete(const http_body_reader_t *reader);
+
+#endif
@@ -0,0 +1,280 @@
+// http_pack.c - compile a static directory into a bundle for the HTTP server
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "static_bundle.h"
+#include "http_response.h"
+
+#define DEFAULT_STATIC_DIR "./static"
+#define DEFAULT_OUTPUT "static.pack"
+#define DATA_ALIGNMENT 16
+
+typedef struct {
+    char path[1024];       // Path below the static directory, starting with '/'
+    char full_path[2048];
+    char gzip_path[2048];  // Empty when there is no precompressed sibling
+    bundle_entry_t entry;
+} pack_file_t;
+
+static pack_file_t *files = NULL;
+static size_t file_count = 0;
+static size_t file_capacity = 0;
+
+static int has_suffix(const char *string, const char *suffix) {
+    size_t string_length = strlen(string);
+    size_t suffix_length = strlen(suffix);
+    return string_length > suffix_length &&
+           strcmp(string + string_length - suffix_length, suffix) == 0;
+}
+
+static int is_regular_file(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+static int add_file(const char *relative_path, const char *full_path) {
+    if (file_count == file_capacity) {
+        size_t new_capacity = file_capacity ? file_capacity * 2 : 64;
+        pack_file_t *new_files = realloc(files, new_capacity * sizeof(pack_file_t));
+        if (!new_files) {
+            perror("Failed to allocate memory");
+            return -1;
+        }
+        files = new_files;
+        file_capacity = new_capacity;
+    }
+
+    pack_file_t *file = &files[file_count++];
+    memset(file, 0, sizeof(pack_file_t));
+    snprintf(file->path, sizeof(file->path), "%s", relative_path);
+    snprintf(file->full_path, sizeof(file->full_path), "%s", full_path);
+
+    // Pick up a precompressed variant sitting next to the file
+    char gzip_path[2048];
+    snprintf(gzip_path, sizeof(gzip_path), "%s.gz", full_path);
+    if (is_regular_file(gzip_path)) {
+        snprintf(file->gzip_path, sizeof(file->gzip_path), "%s", gzip_path);
+    }
+    return 0;
+}
+
+// Recursively collect the regular files below a directory
+static int collect_files(const char *directory, const char *relative_prefix) {
+    DIR *dir = opendir(directory);
+    if (!dir) {
+        perror(directory);
+        return -1;
+    }
+
+    struct dirent *dirent;
+    while ((dirent = readdir(dir)) != NULL) {
+        if (dirent->d_name[0] == '.') {
+            continue; // Skip ".", ".." and hidden files
+        }
+
+        char full_path[2048];
+        char relative_path[1024];
+        snprintf(full_path, sizeof(full_path), "%s/%s", directory, dirent->d_name);
+        if (snprintf(relative_path, sizeof(relative_path), "%s/%s", relative_prefix, dirent->d_name) >=
+            (int)sizeof(relative_path)) {
+            fprintf(stderr, "Skipping %s: path too long\n", full_path);
+            continue;
+        }
+
+        struct stat st;
+        if (stat(full_path, &st) < 0) {
+            perror(full_path);
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            if (collect_files(full_path, relative_path) != 0) {
+                closedir(dir);
+                return -1;
+            }
+        } else if (S_ISREG(st.st_mode)) {
+            // foo.gz next to foo is stored as foo's variant, not as its own file
+            if (has_suffix(full_path, ".gz")) {
+                char original[2048];
+                snprintf(original, sizeof(original), "%.*s", (int)(strlen(full_path) - 3), full_path);
+                if (is_regular_file(original)) {
+                    continue;
+                }
+            }
+            if (add_file(relative_path, full_path) != 0) {
+                closedir(dir);
+                return -1;
+            }
+        }
+    }
+
+    closedir(dir);
+    return 0;
+}
+
+static int compare_files(const void *a, const void *b) {
+    return strcmp(((const pack_file_t *)a)->path, ((const pack_file_t *)b)->path);
+}
+
+// Pad the output up to the given alignment
+static int pad_output(FILE *output, size_t alignment) {
+    long position = ftell(output);
+    while (position >= 0 && position % alignment != 0) {
+        if (fputc(0, output) == EOF) {
+            return -1;
+        }
+        position++;
+    }
+    return position < 0 ? -1 : 0;
+}
+
+// Copy a file into the bundle, hashing it on the way for the ETag
+static int append_file(FILE *output, const char *path, uint64_t *offset, uint64_t *size, uint64_t *hash) {
+    FILE *input = fopen(path, "rb");
+    if (!input) {
+        perror(path);
+        return -1;
+    }
+
+    if (pad_output(output, DATA_ALIGNMENT) != 0) {
+        fclose(input);
+        return -1;
+    }
+
+    *offset = ftell(output);
+    *size = 0;
+    uint64_t fnv = 14695981039346656037ULL;
+
+    char buffer[65536];
+    size_t bytes_read;
+    while ((bytes_read = fread(buffer, 1, sizeof(buffer), input)) > 0) {
+        for (size_t i = 0; i < bytes_read; i++) {
+            fnv ^= (unsigned char)buffer[i];
+            fnv *= 1099511628211ULL;
+        }
+        if (fwrite(buffer, 1, bytes_read, output) != bytes_read) {
+            fclose(input);
+            return -1;
+        }
+        *size += bytes_read;
+    }
+
+    int failed = ferror(input);
+    fclose(input);
+    if (hash) {
+        *hash = fnv;
+    }
+    return failed ? -1 : 0;
+}
+
+static uint64_t append_string(FILE *output, const char *string) {
+    uint64_t offset = ftell(output);
+    fwrite(string, 1, strlen(string) + 1, output);
+    return offset;
+}
+
+static int write_bundle(const char *output_path) {
+    // Write to a temporary file and rename, so a running deploy never sees a partial bundle
+    char temp_path[2048];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", output_path);
+
+    FILE *output = fopen(temp_path, "wb");
+    if (!output) {
+        perror(temp_path);
+        return -1;
+    }
+
+    bundle_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC));
+    header.version = BUNDLE_VERSION;
+    header.entry_count = file_count;
+    fwrite(&header, sizeof(header), 1, output);
+
+    for (size_t i = 0; i < file_count; i++) {
+        pack_file_t *file = &files[i];
+        file->entry.path_offset = append_string(output, file->path);
+        file->entry.mime_offset = append_string(output, get_content_type_for_file(file->path));
+    }
+
+    for (size_t i = 0; i < file_count; i++) {
+        pack_file_t *file = &files[i];
+        uint64_t hash = 0;
+        if (append_file(output, file->full_path, &file->entry.data_offset, &file->entry.data_size, &hash) != 0) {
+            fprintf(stderr, "Failed to pack %s\n", file->full_path);
+            fclose(output);
+            unlink(temp_path);
+            return -1;
+        }
+        snprintf(file->entry.etag, sizeof(file->entry.etag), "\"%016llx\"", (unsigned long long)hash);
+
+        if (file->gzip_path[0] &&
+            append_file(output, file->gzip_path, &file->entry.gzip_offset, &file->entry.gzip_size, NULL) != 0) {
+            fprintf(stderr, "Failed to pack %s\n", file->gzip_path);
+            fclose(output);
+            unlink(temp_path);
+            return -1;
+        }
+    }
+
+    pad_output(output, sizeof(uint64_t));
+    header.index_offset = ftell(output);
+    for (size_t i = 0; i < file_count; i++) {
+        fwrite(&files[i].entry, sizeof(bundle_entry_t), 1, output);
+    }
+    header.total_size = ftell(output);
+
+    // Fill in the header now that the layout is known
+    fseek(output, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, output);
+
+    if (ferror(output) || fclose(output) != 0) {
+        fprintf(stderr, "Failed to write %s\n", temp_path);
+        unlink(temp_path);
+        return -1;
+    }
+
+    if (rename(temp_path, output_path) != 0) {
+        perror("Failed to rename bundle");
+        unlink(temp_path);
+        return -1;
+    }
+
+    printf("Packed %zu files into %s (%llu bytes)\n",
+           file_count, output_path, (unsigned long long)header.total_size);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *static_dir = DEFAULT_STATIC_DIR;
+    const char *output_path = DEFAULT_OUTPUT;
+    int option;
+
+    while ((option = getopt(argc, argv, "d:o:")) != -1) {
+        switch (option) {
+            case 'd':
+                static_dir = optarg;
+                break;
+            case 'o':
+                output_path = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-d static_dir] [-o output]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (collect_files(static_dir, "") != 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    qsort(files, file_count, sizeof(pack_file_t), compare_files);
+
+    int result = write_bundle(output_path);
+    free(files);
+    return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
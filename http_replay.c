@@ -0,0 +1,697 @@
+// http_replay.c - sends traffic recorded with "http_server --capture" to a server again
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <stddef.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "capture.h"
+
+#define DEFAULT_MAX_OPEN 256
+#define READ_BUFFER_SIZE 65536
+#define REPLAY_STACK_SIZE (256 * 1024)
+
+// Bytes the server read in one go, sent again in one go
+typedef struct {
+    unsigned long long time_us;    // On the capture's timeline
+    size_t offset;                 // Into the connection's bytes
+    size_t length;
+    int responses;                 // Requests the connection had been answered when the server read them
+} replay_chunk_t;
+
+typedef struct {
+    unsigned long long open_us;
+    int skipped;                   // Switched to HTTP/2, or its bytes are incomplete
+    char *bytes;
+    size_t length;
+    replay_chunk_t *chunks;
+    int chunk_count;
+    size_t *request_ends;          // Offset just past each answered request
+    int request_count;
+
+    // Filled in while replaying
+    pthread_t thread;
+    int fd;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    int responses;                 // Read so far
+    int broken;                    // The connection failed or the server closed it
+    unsigned long long *sent_us;   // When the bytes that complete each request were sent
+    unsigned long long *done_us;   // When its response was complete
+    int status_classes[6];         // Index status / 100; 0 for anything out of range
+} replay_connection_t;
+
+typedef struct {
+    struct sockaddr_storage address;
+    socklen_t address_length;
+    double speed;                  // Capture time is divided by this; 0 for as fast as possible
+    unsigned long long start_us;
+    int max_open;
+    int open;                      // Connections being replayed
+    pthread_mutex_t mutex;
+    pthread_cond_t closed;
+} replay_config_t;
+
+typedef struct {
+    replay_config_t *config;
+    replay_connection_t *connection;
+} replay_job_t;
+
+// Buffered reader over one connection
+typedef struct {
+    int fd;
+    size_t start;
+    size_t end;
+    char buffer[READ_BUFFER_SIZE];
+} reader_t;
+
+static unsigned long long now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+static void sleep_until_us(unsigned long long deadline) {
+    unsigned long long now = now_us();
+    if (deadline > now) {
+        struct timespec delay = { (deadline - now) / 1000000, ((deadline - now) % 1000000) * 1000 };
+        nanosleep(&delay, NULL);
+    }
+}
+
+static int grow(void **array, size_t count, size_t element_size) {
+    // Doubles at every power of two
+    if (count & (count - 1)) {
+        return 0;
+    }
+    void *larger = realloc(*array, (count ? count * 2 : 1) * element_size);
+    if (!larger) {
+        return -1;
+    }
+    *array = larger;
+    return 0;
+}
+
+static replay_connection_t *new_connection(replay_connection_t ***connections, int *count,
+                                           unsigned long long open_us) {
+    replay_connection_t *connection = calloc(1, sizeof(replay_connection_t));
+    if (!connection || grow((void **)connections, *count, sizeof(replay_connection_t *)) != 0) {
+        free(connection);
+        return NULL;
+    }
+    connection->open_us = open_us;
+    (*connections)[(*count)++] = connection;
+    return connection;
+}
+
+static int add_data(replay_connection_t *connection, const capture_record_t *record, unsigned long long time_us) {
+    if (record->offset != connection->length) {
+        connection->skipped = 1;  // Some bytes never made it into the file
+        return 0;
+    }
+    if (grow((void **)&connection->chunks, connection->chunk_count, sizeof(replay_chunk_t)) != 0) {
+        return -1;
+    }
+    char *bytes = realloc(connection->bytes, connection->length + record->length);
+    if (!bytes) {
+        return -1;
+    }
+    memcpy(bytes + connection->length, record->data, record->length);
+    connection->bytes = bytes;
+
+    replay_chunk_t *chunk = &connection->chunks[connection->chunk_count++];
+    chunk->time_us = time_us;
+    chunk->offset = connection->length;
+    chunk->length = record->length;
+    chunk->responses = connection->request_count;
+    connection->length += record->length;
+    return 0;
+}
+
+// Read every connection of a capture. Each START record begins a new run of
+// the server, whose times follow on from the previous one.
+static int load_capture(const char *path, replay_connection_t ***connections, int *count,
+                        unsigned long long *duration_us) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror("Failed to open the capture");
+        return -1;
+    }
+    if (capture_read_header(file) != 0) {
+        fprintf(stderr, "%s is not a capture file\n", path);
+        fclose(file);
+        return -1;
+    }
+
+    replay_connection_t **by_id = NULL;      // This run's connections, by number
+    size_t by_id_size = 0;
+    unsigned long long base_us = 0;
+    unsigned long long last_us = 0;
+    capture_record_t record;
+    int status;
+    int result = 0;
+    while (result == 0 && (status = capture_read_record(file, &record)) == 1) {
+        unsigned long long time_us = base_us + record.time_us;
+        last_us = time_us > last_us ? time_us : last_us;
+
+        if (record.kind == CAPTURE_START) {
+            base_us = last_us;
+            memset(by_id, 0, by_id_size * sizeof(replay_connection_t *));
+        } else if (record.kind == CAPTURE_OPEN) {
+            if (record.connection >= by_id_size) {
+                size_t size = record.connection * 2 + 64;
+                replay_connection_t **larger = realloc(by_id, size * sizeof(replay_connection_t *));
+                if (!larger) {
+                    result = -1;
+                    break;
+                }
+                memset(larger + by_id_size, 0, (size - by_id_size) * sizeof(replay_connection_t *));
+                by_id = larger;
+                by_id_size = size;
+            }
+            by_id[record.connection] = new_connection(connections, count, time_us);
+            if (!by_id[record.connection]) {
+                result = -1;
+            }
+        } else if (record.connection < by_id_size && by_id[record.connection]) {
+            replay_connection_t *connection = by_id[record.connection];
+            if (record.kind == CAPTURE_DATA) {
+                result = add_data(connection, &record, time_us);
+            } else if (record.kind == CAPTURE_REQUEST) {
+                if (grow((void **)&connection->request_ends, connection->request_count, sizeof(size_t)) != 0) {
+                    result = -1;
+                } else {
+                    connection->request_ends[connection->request_count++] = record.offset;
+                }
+            } else if (record.kind == CAPTURE_HTTP2) {
+                connection->skipped = 1;
+            } else if (record.kind == CAPTURE_CLOSE) {
+                by_id[record.connection] = NULL;
+            }
+        }
+        free(record.data);
+    }
+    free(by_id);
+    fclose(file);
+
+    if (result != 0) {
+        fprintf(stderr, "Failed to allocate memory for the capture\n");
+        return -1;
+    }
+    if (status < 0) {
+        // A server still writing leaves the last record cut short
+        fprintf(stderr, "Warning: %s ends in a damaged record; replaying what came before it\n", path);
+    }
+    *duration_us = last_us;
+    return 0;
+}
+
+static int fill(reader_t *reader) {
+    if (reader->start == reader->end) {
+        reader->start = reader->end = 0;
+    } else if (reader->end == sizeof(reader->buffer)) {
+        memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+    ssize_t bytes_read;
+    do {
+        bytes_read = recv(reader->fd, reader->buffer + reader->end, sizeof(reader->buffer) - reader->end, 0);
+    } while (bytes_read < 0 && errno == EINTR);
+    if (bytes_read <= 0) {
+        return -1;
+    }
+    reader->end += bytes_read;
+    return 0;
+}
+
+// Read one CRLF-terminated line into line (without the CRLF)
+static int read_line(reader_t *reader, char *line, size_t line_size) {
+    while (1) {
+        char *newline = memchr(reader->buffer + reader->start, '\n', reader->end - reader->start);
+        if (newline) {
+            size_t length = newline - (reader->buffer + reader->start);
+            if (length > 0 && newline[-1] == '\r') {
+                length--;
+            }
+            if (length >= line_size) {
+                return -1;
+            }
+            memcpy(line, reader->buffer + reader->start, length);
+            line[length] = '\0';
+            reader->start = newline + 1 - reader->buffer;
+            return 0;
+        }
+        if (reader->end - reader->start == sizeof(reader->buffer) || fill(reader) != 0) {
+            return -1;
+        }
+    }
+}
+
+static int skip_bytes(reader_t *reader, size_t length) {
+    while (length > 0) {
+        if (reader->start == reader->end && fill(reader) != 0) {
+            return -1;
+        }
+        size_t available = reader->end - reader->start;
+        size_t amount = length < available ? length : available;
+        reader->start += amount;
+        length -= amount;
+    }
+    return 0;
+}
+
+// Read a whole final response, skipping any 100 Continue before it.
+// Returns the status, or -1 on a broken response. *closing is set when
+// the server ends the connection.
+static int read_response(reader_t *reader, int head_only, int *closing) {
+    char line[2048];
+    int status = 0;
+    long long content_length = -1;
+    int chunked = 0;
+    do {
+        if (read_line(reader, line, sizeof(line)) != 0 || sscanf(line, "HTTP/%*d.%*d %d", &status) != 1) {
+            return -1;
+        }
+        content_length = -1;
+        chunked = 0;
+        *closing = 0;
+        while (1) {
+            if (read_line(reader, line, sizeof(line)) != 0) {
+                return -1;
+            }
+            if (line[0] == '\0') {
+                break;
+            }
+            if (strncasecmp(line, "Content-Length:", 15) == 0) {
+                content_length = atoll(line + 15);
+            } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0 && strstr(line, "chunked")) {
+                chunked = 1;
+            } else if (strncasecmp(line, "Connection:", 11) == 0 && strstr(line, "close")) {
+                *closing = 1;
+            }
+        }
+    } while (status >= 100 && status < 200);
+
+    // The server refuses HEAD with an ordinary 405, body included
+    if ((head_only && status < 400) || status == 204 || status == 304) {
+        return status;
+    }
+    if (chunked) {
+        while (1) {
+            if (read_line(reader, line, sizeof(line)) != 0) {
+                return -1;
+            }
+            long long chunk_size = strtoll(line, NULL, 16);
+            if (chunk_size == 0) {
+                break;
+            }
+            if (skip_bytes(reader, chunk_size + 2) != 0) {
+                return -1;
+            }
+        }
+        // Trailers end with a blank line
+        do {
+            if (read_line(reader, line, sizeof(line)) != 0) {
+                return -1;
+            }
+        } while (line[0] != '\0');
+    } else if (content_length >= 0) {
+        if (skip_bytes(reader, content_length) != 0) {
+            return -1;
+        }
+    } else {
+        // Body runs to the end of the connection
+        while (fill(reader) == 0) {
+            reader->start = reader->end;
+        }
+        *closing = 1;
+    }
+    return status;
+}
+
+static int send_bytes(int fd, const char *bytes, size_t length) {
+    size_t sent = 0;
+    while (sent < length) {
+        ssize_t written = send(fd, bytes + sent, length - sent, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return -1;
+        }
+        sent += written;
+    }
+    return 0;
+}
+
+// Read the responses to every answered request of a connection
+static void *read_responses(void *arg) {
+    replay_connection_t *connection = arg;
+    reader_t *reader = malloc(sizeof(reader_t));
+    int broken = !reader;
+    if (reader) {
+        reader->fd = connection->fd;
+        reader->start = reader->end = 0;
+    }
+
+    for (int i = 0; i < connection->request_count && !broken; i++) {
+        // A HEAD response announces a body it does not carry
+        size_t request_start = i > 0 ? connection->request_ends[i - 1] : 0;
+        int head_only = request_start + 5 <= connection->length &&
+                        memcmp(connection->bytes + request_start, "HEAD ", 5) == 0;
+        int closing = 0;
+        int status = read_response(reader, head_only, &closing);
+
+        pthread_mutex_lock(&connection->mutex);
+        if (status < 0) {
+            broken = 1;
+        } else {
+            connection->done_us[i] = now_us();
+            connection->status_classes[status / 100 >= 1 && status / 100 <= 5 ? status / 100 : 0]++;
+            connection->responses++;
+            broken = closing && i + 1 < connection->request_count;
+        }
+        connection->broken = broken;
+        pthread_cond_broadcast(&connection->changed);
+        pthread_mutex_unlock(&connection->mutex);
+    }
+    free(reader);
+    return NULL;
+}
+
+// Open a connection for the job's recording and send its bytes as the
+// server originally read them: not before the responses it had sent by
+// then, and at their original time scaled by the speed
+static void *replay_connection(void *arg) {
+    replay_job_t *job = arg;
+    replay_config_t *config = job->config;
+    replay_connection_t *connection = job->connection;
+    free(job);
+
+    connection->fd = socket(config->address.ss_family, SOCK_STREAM, 0);
+    int on = 1;
+    pthread_t reader_thread;
+    if (connection->fd < 0 ||
+        connect(connection->fd, (const struct sockaddr *)&config->address, config->address_length) != 0 ||
+        pthread_create(&reader_thread, NULL, read_responses, connection) != 0) {
+        connection->broken = 1;
+    } else {
+        if (config->address.ss_family != AF_UNIX) {
+            setsockopt(connection->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        }
+
+        int request = 0;
+        for (int i = 0; i < connection->chunk_count; i++) {
+            const replay_chunk_t *chunk = &connection->chunks[i];
+            pthread_mutex_lock(&connection->mutex);
+            while (connection->responses < chunk->responses && !connection->broken) {
+                pthread_cond_wait(&connection->changed, &connection->mutex);
+            }
+            int broken = connection->broken;
+            pthread_mutex_unlock(&connection->mutex);
+            if (broken) {
+                break;
+            }
+
+            if (config->speed > 0) {
+                sleep_until_us(config->start_us + (unsigned long long)(chunk->time_us / config->speed));
+            }
+            // Taken before sending, so a quick response cannot come in ahead of it
+            unsigned long long sent = now_us();
+            if (send_bytes(connection->fd, connection->bytes + chunk->offset, chunk->length) != 0) {
+                break;
+            }
+            while (request < connection->request_count &&
+                   connection->request_ends[request] <= chunk->offset + chunk->length) {
+                connection->sent_us[request++] = sent;
+            }
+        }
+        // Unblocks the reader if the server never answers
+        shutdown(connection->fd, SHUT_WR);
+        pthread_join(reader_thread, NULL);
+    }
+    if (connection->fd >= 0) {
+        close(connection->fd);
+    }
+
+    pthread_mutex_lock(&config->mutex);
+    config->open--;
+    pthread_cond_signal(&config->closed);
+    pthread_mutex_unlock(&config->mutex);
+    return NULL;
+}
+
+static int compare_latency(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int compare_open_time(const void *a, const void *b) {
+    const replay_connection_t *x = *(replay_connection_t *const *)a;
+    const replay_connection_t *y = *(replay_connection_t *const *)b;
+    return x->open_us < y->open_us ? -1 : x->open_us > y->open_us;
+}
+
+// "host:port", "[v6host]:port", "port", "unix:/path" or "abstract:name"
+static int parse_target(const char *target, replay_config_t *config) {
+    memset(&config->address, 0, sizeof(config->address));
+
+    if (strncmp(target, "unix:", 5) == 0 || strncmp(target, "abstract:", 9) == 0) {
+        struct sockaddr_un *address = (struct sockaddr_un *)&config->address;
+        int abstract = target[0] == 'a';
+        const char *path = strchr(target, ':') + 1;
+        size_t length = strlen(path);
+        if (length == 0 || length + abstract >= sizeof(address->sun_path)) {
+            return -1;
+        }
+        address->sun_family = AF_UNIX;
+        memcpy(address->sun_path + abstract, path, length);
+        config->address_length = abstract ? offsetof(struct sockaddr_un, sun_path) + 1 + length :
+                                            sizeof(struct sockaddr_un);
+        return 0;
+    }
+
+    char host[128] = "127.0.0.1";
+    const char *port_text = target;
+    if (target[0] == '[') {
+        const char *close_bracket = strchr(target, ']');
+        if (!close_bracket || close_bracket[1] != ':' || (size_t)(close_bracket - target - 1) >= sizeof(host)) {
+            return -1;
+        }
+        memcpy(host, target + 1, close_bracket - target - 1);
+        host[close_bracket - target - 1] = '\0';
+        port_text = close_bracket + 2;
+    } else if (strchr(target, ':')) {
+        const char *colon = strrchr(target, ':');
+        if ((size_t)(colon - target) >= sizeof(host)) {
+            return -1;
+        }
+        memcpy(host, target, colon - target);
+        host[colon - target] = '\0';
+        port_text = colon + 1;
+    }
+
+    int port = atoi(port_text);
+    if (port <= 0 || port > 65535) {
+        return -1;
+    }
+    struct sockaddr_in *inet = (struct sockaddr_in *)&config->address;
+    struct sockaddr_in6 *inet6 = (struct sockaddr_in6 *)&config->address;
+    if (inet_pton(AF_INET, host, &inet->sin_addr) == 1) {
+        inet->sin_family = AF_INET;
+        inet->sin_port = htons(port);
+        config->address_length = sizeof(struct sockaddr_in);
+    } else if (inet_pton(AF_INET6, host, &inet6->sin6_addr) == 1) {
+        inet6->sin6_family = AF_INET6;
+        inet6->sin6_port = htons(port);
+        config->address_length = sizeof(struct sockaddr_in6);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    replay_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.speed = 1.0;
+    config.max_open = DEFAULT_MAX_OPEN;
+    pthread_mutex_init(&config.mutex, NULL);
+    pthread_cond_init(&config.closed, NULL);
+    int option;
+
+    while ((option = getopt(argc, argv, "s:mc:")) != -1) {
+        switch (option) {
+            case 's':
+                config.speed = atof(optarg);
+                if (config.speed <= 0) {
+                    optind = argc + 1;
+                }
+                break;
+            case 'm':
+                config.speed = 0;
+                break;
+            case 'c':
+                config.max_open = atoi(optarg);
+                break;
+            default:
+                optind = argc + 1;
+                break;
+        }
+    }
+
+    if (optind + 2 != argc || config.max_open <= 0 || parse_target(argv[optind], &config) != 0) {
+        fprintf(stderr, "Usage: %s [-s speed | -m] [-c max_open_connections]\n"
+                        "          [host:]port|[v6host]:port|unix:/path|abstract:name capture_file\n"
+                        "  -s  scale the recorded timing: 2 replays twice as fast (default 1)\n"
+                        "  -m  send as fast as the server answers, keeping only the order\n"
+                        "  -c  connections replayed at once (default %d)\n", argv[0], DEFAULT_MAX_OPEN);
+        return EXIT_FAILURE;
+    }
+
+    replay_connection_t **connections = NULL;
+    int connection_count = 0;
+    unsigned long long capture_us = 0;
+    if (load_capture(argv[optind + 1], &connections, &connection_count, &capture_us) != 0) {
+        return EXIT_FAILURE;
+    }
+    // Several workers append to one file, so opens may be slightly out of order
+    if (connection_count > 0) {
+        qsort(connections, connection_count, sizeof(replay_connection_t *), compare_open_time);
+    }
+
+    int requests = 0;
+    int skipped = 0;
+    for (int i = 0; i < connection_count; i++) {
+        replay_connection_t *connection = connections[i];
+        connection->fd = -1;
+        connection->sent_us = calloc(connection->request_count + 1, sizeof(unsigned long long));
+        connection->done_us = calloc(connection->request_count + 1, sizeof(unsigned long long));
+        if (!connection->sent_us || !connection->done_us) {
+            perror("Failed to allocate memory");
+            return EXIT_FAILURE;
+        }
+        pthread_mutex_init(&connection->mutex, NULL);
+        pthread_cond_init(&connection->changed, NULL);
+        if (connection->skipped || connection->chunk_count == 0) {
+            skipped += connection->skipped;
+            connection->skipped = 1;
+        } else {
+            requests += connection->request_count;
+        }
+    }
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, REPLAY_STACK_SIZE);
+
+    config.start_us = now_us();
+    int started = 0;
+    for (int i = 0; i < connection_count; i++) {
+        replay_connection_t *connection = connections[i];
+        if (connection->skipped) {
+            continue;
+        }
+        if (config.speed > 0) {
+            sleep_until_us(config.start_us + (unsigned long long)(connection->open_us / config.speed));
+        }
+        pthread_mutex_lock(&config.mutex);
+        while (config.open >= config.max_open) {
+            pthread_cond_wait(&config.closed, &config.mutex);
+        }
+        config.open++;
+        pthread_mutex_unlock(&config.mutex);
+
+        replay_job_t *job = malloc(sizeof(replay_job_t));
+        if (job) {
+            job->config = &config;
+            job->connection = connection;
+        }
+        if (!job || pthread_create(&connection->thread, &attributes, replay_connection, job) != 0) {
+            perror("Failed to start a connection");
+            free(job);
+            connection->skipped = 1;
+            pthread_mutex_lock(&config.mutex);
+            config.open--;
+            pthread_mutex_unlock(&config.mutex);
+            continue;
+        }
+        started++;
+    }
+    pthread_attr_destroy(&attributes);
+
+    for (int i = 0; i < connection_count; i++) {
+        if (!connections[i]->skipped) {
+            pthread_join(connections[i]->thread, NULL);
+        }
+    }
+    double elapsed = (now_us() - config.start_us) / 1e6;
+
+    // Latency of a request: from the send of its last bytes to its response being in
+    unsigned long long *latencies = malloc((requests > 0 ? requests : 1) * sizeof(unsigned long long));
+    if (!latencies) {
+        perror("Failed to allocate memory");
+        return EXIT_FAILURE;
+    }
+    size_t merged = 0;
+    int status_classes[6] = {0};
+    int broken = 0;
+    for (int i = 0; i < connection_count; i++) {
+        replay_connection_t *connection = connections[i];
+        if (connection->skipped) {
+            continue;
+        }
+        for (int r = 0; r < connection->request_count; r++) {
+            if (connection->done_us[r] && connection->sent_us[r] && connection->done_us[r] >= connection->sent_us[r]) {
+                latencies[merged++] = connection->done_us[r] - connection->sent_us[r];
+            }
+        }
+        for (int c = 0; c < 6; c++) {
+            status_classes[c] += connection->status_classes[c];
+        }
+        broken += connection->broken || connection->responses < connection->request_count;
+    }
+    qsort(latencies, merged, sizeof(unsigned long long), compare_latency);
+
+    if (config.speed > 0) {
+        printf("%d connections, %d requests, at %gx the recorded speed\n", started, requests, config.speed);
+    } else {
+        printf("%d connections, %d requests, as fast as possible\n", started, requests);
+    }
+    printf("capture %.3f s, replay %.3f s, %.0f requests/s", capture_us / 1e6, elapsed,
+           elapsed > 0 ? merged / elapsed : 0.0);
+    if (skipped > 0) {
+        printf(", %d HTTP/2 or incomplete connections skipped", skipped);
+    }
+    printf("\nresponses 2xx %d 3xx %d 4xx %d 5xx %d other %d, unanswered %zu, broken connections %d\n",
+           status_classes[2], status_classes[3], status_classes[4], status_classes[5], status_classes[1] + status_classes[0],
+           (size_t)requests - merged, broken);
+    if (merged > 0) {
+        printf("latency us: p50 %llu p90 %llu p99 %llu p99.9 %llu max %llu\n",
+               latencies[merged / 2], latencies[merged * 9 / 10], latencies[merged * 99 / 100],
+               latencies[merged * 999 / 1000], latencies[merged - 1]);
+    }
+
+    free(latencies);
+    for (int i = 0; i < connection_count; i++) {
+        free(connections[i]->bytes);
+        free(connections[i]->chunks);
+        free(connections[i]->request_ends);
+        free(connections[i]->sent_us);
+        free(connections[i]->done_us);
+        free(connections[i]);
+    }
+    free(connections);
+    return broken > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -4,6 +4,7 @@
 #include <ctype.h>
 #include <strings.h>
 #include "http_request.h"
+#include "url_path.h"
 
 // Parse the request line
 static int parse_request_line(const char *line, size_t line_length, http_request_t *request) {
@@ -54,6 +55,11 @@ static int parse_request_line(const char *line, size_t line_length, http_request
     memcpy(request->path, line + path_start, path_length);
     request->path[path_length] = '\0';
     
+    // Route and cache lookups all key on the canonical form of the path
+    if (normalize_url_path(request->path, request->query, sizeof(request->query)) != 0) {
+        return -1; // Malformed path
+    }
+    
     // Skip whitespace between path and version
     while (pos < line_length && isspace(line[pos])) {
         pos++;
@@ -80,26 +86,63 @@ static int parse_request_line(const char *line, size_t line_length, http_request
     return 0;
 }
 
-//atoi implementation
-static int custom_atoi(const char *str) {
-    int result = 0;
-    int sign = 1;
+// Parse a Content-Length value, rejecting anything but plain digits
+static int parse_content_length(const char *value, size_t *length_out) {
+    size_t length = 0;
     
-    // Handle sign
-    if (*str == '-') {
-        sign = -1;
-        str++;
-    } else if (*str == '+') {
-        str++;
+    if (*value < '0' || *value > '9') {
+        return -1;
     }
     
-    // Process digits
-    while (*str >= '0' && *str <= '9') {
-        result = result * 10 + (*str - '0');
-        str++;
+    while (*value >= '0' && *value <= '9') {
+        if (length > ((size_t)-1 - 9) / 10) {
+            return -1; // Overflow
+        }
+        length = length * 10 + (*value - '0');
+        value++;
     }
     
-    return result * sign;
+    // Allow only trailing whitespace
+    while (isspace((unsigned char)*value)) {
+        value++;
+    }
+    if (*value != '\0') {
+        return -1;
+    }
+    
+    *length_out = length;
+    return 0;
+}
+
+// Apply a Transfer-Encoding value, token by token; repeated headers carry
+// on the same list. The body is chunked only when chunked is the last
+// coding, and no other coding is understood, so anything else cannot be
+// framed and is rejected.
+static int parse_transfer_encoding(const char *value, int *chunked) {
+    const char *token = value;
+    while (*token) {
+        const char *end = strchr(token, ',');
+        if (!end) {
+            end = token + strlen(token);
+        }
+        const char *start = token;
+        while (start < end && (*start == ' ' || *start == '\t')) {
+            start++;
+        }
+        const char *stop = end;
+        while (stop > start && (stop[-1] == ' ' || stop[-1] == '\t')) {
+            stop--;
+        }
+        if (stop > start) {
+            if (*chunked || (size_t)(stop - start) != strlen("chunked") ||
+                strncasecmp(start, "chunked", stop - start) != 0) {
+                return -1; // A coding after chunked, or one we cannot decode
+            }
+            *chunked = 1;
+        }
+        token = *end ? end + 1 : end;
+    }
+    return 0;
 }
 
 int parse_http_request(const char *buffer, size_t buffer_size, http_request_t *request) {
@@ -123,6 +166,12 @@ int parse_http_request(const char *buffer, size_t buffer_size, http_request_t *r
         return -1;
     }
     
+    // HTTP/1.1 connections persist unless the client says otherwise, HTTP/1.0 ones only on request
+    int connection_header = 0;
+    
+    // A second Content-Length could frame the body differently from the first
+    int has_content_length = 0;
+    
     // Process the headers
     const char *current_pos = end_of_line + 2;  // Skip \r\n
     while (current_pos < buffer + buffer_size) {
@@ -169,8 +218,37 @@ int parse_http_request(const char *buffer, size_t buffer_size, http_request_t *r
                     } else if (strcasecmp(header_name, "Content-Type") == 0) {
                         strncpy(request->content_type, header_value, sizeof(request->content_type) - 1);
                     } else if (strcasecmp(header_name, "Content-Length") == 0) {
-                        request->content_length = custom_atoi(header_value);
+                        if (has_content_length ||
+                            parse_content_length(header_value, &request->content_length) != 0) {
+                            return -1;
+                        }
+                        has_content_length = 1;
+                    } else if (strcasecmp(header_name, "Transfer-Encoding") == 0) {
+                        if (parse_transfer_encoding(header_value, &request->chunked) != 0) {
+                            return -1;
+                        }
+                    } else if (strcasecmp(header_name, "Connection") == 0) {
+                        if (strcasecmp(header_value, "close") == 0) {
+                            connection_header = -1;
+                        } else if (strcasecmp(header_value, "keep-alive") == 0) {
+                            connection_header = 1;
+                        }
+                    } else if (strcasecmp(header_name, "Expect") == 0) {
+                        request->expect_continue = strcasecmp(header_value, "100-continue") == 0;
+                    } else if (strcasecmp(header_name, "Accept-Encoding") == 0) {
+                        strncpy(request->accept_encoding, header_value, sizeof(request->accept_encoding) - 1);
+                    } else if (strcasecmp(header_name, "If-None-Match") == 0) {
+                        strncpy(request->if_none_match, header_value, sizeof(request->if_none_match) - 1);
+                    } else if (strcasecmp(header_name, "Upgrade") == 0) {
+                        request->upgrade_h2c = strcasecmp(header_value, "h2c") == 0;
+                    } else if (strcasecmp(header_name, "HTTP2-Settings") == 0) {
+                        strncpy(request->http2_settings, header_value, sizeof(request->http2_settings) - 1);
+                    } else if (strcasecmp(header_name, "X-Trace") == 0) {
+                        request->trace = strcmp(header_value, "1") == 0;
                     }
+                } else if (strcasecmp(header_name, "Content-Length") == 0 ||
+                           strcasecmp(header_name, "Transfer-Encoding") == 0) {
+                    return -1; // Too long to parse, and ignoring it would frame the body wrongly
                 }
             }
         }
@@ -179,26 +257,91 @@ int parse_http_request(const char *buffer, size_t buffer_size, http_request_t *r
         current_pos = header_end + 2;
     }
     
-    // Handle the body if present
-    if (request->content_length > 0) {
-        size_t body_size = buffer_size - (current_pos - buffer);
-        if (body_size >= request->content_length) {
-            request->body = malloc(request->content_length + 1);
-            if (!request->body) {
-                return -1;
-            }
-            
-            memcpy(request->body, current_pos, request->content_length);
-            request->body[request->content_length] = '\0';
+    // The body itself is streamed from the socket by the body reader
+    request->header_length = current_pos - buffer;
+    request->raw_head = buffer;
+    
+    if (connection_header != 0) {
+        request->keep_alive = connection_header > 0;
+    } else {
+        request->keep_alive = strcmp(request->version, "HTTP/1.0") != 0;
+    }
+    
+    // A chunked body's length comes from its framing, never from Content-Length.
+    // A request with both may be framed differently by a front end, so the
+    // connection is closed after it rather than trusting what follows.
+    if (request->chunked) {
+        if (has_content_length) {
+            request->keep_alive = 0;
         }
+        request->content_length = 0;
     }
     
     return 0;
 }
 
 void free_http_request(http_request_t *request) {
-    if (request && request->body) {
-        free(request->body);
-        request->body = NULL;
+    if (request) {
+        request->body_reader = NULL; // Owned by the connection
     }
-}
\ No newline at end of file
+}
+
+// Whether the parameters after a coding, such as ";q=0.5", give it a
+// q-value of 0, which refuses it
+static int coding_refused(const char *parameters, const char *end) {
+    const char *cursor = parameters;
+    while ((cursor = memchr(cursor, ';', end - cursor)) != NULL) {
+        cursor++;
+        while (cursor < end && (*cursor == ' ' || *cursor == '\t')) {
+            cursor++;
+        }
+        if (end - cursor < 2 || (cursor[0] != 'q' && cursor[0] != 'Q') || cursor[1] != '=') {
+            continue;
+        }
+        cursor += 2;
+        if (cursor == end || *cursor != '0') {
+            return 0;
+        }
+        cursor++;
+        if (cursor < end && *cursor == '.') {
+            cursor++;
+            while (cursor < end && *cursor == '0') {
+                cursor++;
+            }
+        }
+        while (cursor < end && (*cursor == ' ' || *cursor == '\t')) {
+            cursor++;
+        }
+        return cursor == end || *cursor == ';';
+    }
+    return 0;
+}
+
+int request_accepts_gzip(const http_request_t *request) {
+    int gzip = -1;          // Whether gzip itself is listed, and accepted
+    int any = -1;           // The same for "*"
+    const char *coding = request->accept_encoding;
+    while (*coding) {
+        const char *end = strchr(coding, ',');
+        if (!end) {
+            end = coding + strlen(coding);
+        }
+        while (coding < end && (*coding == ' ' || *coding == '\t')) {
+            coding++;
+        }
+        const char *name_end = coding;
+        while (name_end < end && *name_end != ';' && *name_end != ' ' && *name_end != '\t') {
+            name_end++;
+        }
+        size_t name_length = name_end - coding;
+        int accepted = !coding_refused(name_end, end);
+        if ((name_length == strlen("gzip") && strncasecmp(coding, "gzip", name_length) == 0) ||
+            (name_length == strlen("x-gzip") && strncasecmp(coding, "x-gzip", name_length) == 0)) {
+            gzip = accepted;
+        } else if (name_length == 1 && *coding == '*') {
+            any = accepted;
+        }
+        coding = *end ? end + 1 : end;
+    }
+    return gzip >= 0 ? gzip : any > 0;
+}
@@ -5,12 +5,24 @@
 
 typedef struct {
     char method[16];
-    char path[1024];
+    char path[1024];        // Decoded, normalized path without the query string
+    char query[1024];
     char version[16];
     char host[256];
     char content_type[128];
+    char accept_encoding[128];
+    char if_none_match[128];
     size_t content_length;
-    char *body;
+    int chunked;            // Transfer-Encoding: chunked, or an HTTP/2 body of unknown length
+    int expect_continue;    // Expect: 100-continue
+    int keep_alive;         // Client allows the connection to be reused
+    int upgrade_h2c;        // Upgrade: h2c
+    char http2_settings[128]; // HTTP2-Settings sent with an h2c upgrade
+    int trace;              // X-Trace: 1 asks for the request to be traced (see trace.h)
+    size_t header_length;   // Bytes up to and including the blank line after the headers
+    const char *raw_head;   // The head as received, header_length bytes; NULL for HTTP/2.
+                            // Only valid while the request is being handled.
+    struct http_body_reader *body_reader; // Streams the body to handlers, NULL when there is none
 } http_request_t;
 
 // Parse an HTTP request from a buffer
@@ -19,4 +31,8 @@ int parse_http_request(const char *buffer, size_t buffer_size, http_request_t *r
 // Free any allocated memory in the request
 void free_http_request(http_request_t *request);
 
+// Whether Accept-Encoding takes gzip: listed by name, or covered by "*",
+// and not refused with q=0
+int request_accepts_gzip(const http_request_t *request);
+
 #endif
\ No newline at end of file
@@ -1,22 +1,49 @@
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include "http_response.h"
 
 // Status code messages
-static const char *get_status_message(int status_code) {
+const char *get_status_message(int status_code) {
     switch (status_code) {
         case HTTP_STATUS_OK:
             return "OK";
+        case HTTP_STATUS_CREATED:
+            return "Created";
+        case HTTP_STATUS_NO_CONTENT:
+            return "No Content";
+        case HTTP_STATUS_MOVED_PERMANENTLY:
+            return "Moved Permanently";
+        case HTTP_STATUS_FOUND:
+            return "Found";
+        case HTTP_STATUS_NOT_MODIFIED:
+            return "Not Modified";
         case HTTP_STATUS_BAD_REQUEST:
             return "Bad Request";
+        case HTTP_STATUS_UNAUTHORIZED:
+            return "Unauthorized";
+        case HTTP_STATUS_FORBIDDEN:
+            return "Forbidden";
         case HTTP_STATUS_NOT_FOUND:
             return "Not Found";
         case HTTP_STATUS_METHOD_NOT_ALLOWED:
             return "Method Not Allowed";
+        case HTTP_STATUS_REQUEST_TIMEOUT:
+            return "Request Timeout";
+        case HTTP_STATUS_PAYLOAD_TOO_LARGE:
+            return "Payload Too Large";
+        case HTTP_STATUS_TOO_MANY_REQUESTS:
+            return "Too Many Requests";
         case HTTP_STATUS_INTERNAL_ERROR:
             return "Internal Server Error";
+        case HTTP_STATUS_BAD_GATEWAY:
+            return "Bad Gateway";
+        case HTTP_STATUS_SERVICE_UNAVAILABLE:
+            return "Service Unavailable";
+        case HTTP_STATUS_GATEWAY_TIMEOUT:
+            return "Gateway Timeout";
         default:
             return "Unknown";
     }
@@ -25,6 +52,8 @@ static const char *get_status_message(int status_code) {
 void init_http_response(http_response_t *response) {
     if (response) {
         memset(response, 0, sizeof(http_response_t));
+        response->headers = response->header_space;
+        response->headers_capacity = sizeof(response->header_space);
         response->status_code = HTTP_STATUS_OK;
         strcpy(response->content_type, "text/plain");
     }
@@ -33,26 +62,95 @@ void init_http_response(http_response_t *response) {
 void set_response_status(http_response_t *response, int status_code) {
     if (response) {
         response->status_code = status_code;
+        response->constant = NULL;
     }
 }
 
 void set_response_content_type(http_response_t *response, const char *content_type) {
     if (response && content_type) {
         strncpy(response->content_type, content_type, sizeof(response->content_type) - 1);
+        response->content_type_set = 1;
+        response->constant = NULL;
     }
 }
 
+int response_status_bodiless(const http_response_t *response) {
+    return response->status_code == HTTP_STATUS_NO_CONTENT || response->status_code == HTTP_STATUS_NOT_MODIFIED;
+}
+
+int add_response_header(http_response_t *response, const char *name, const char *value) {
+    if (!value) {
+        return -1;
+    }
+    return add_response_header_value(response, name, value, strlen(value));
+}
+
+int add_response_header_value(http_response_t *response, const char *name, const char *value,
+                              size_t value_length) {
+    if (!response || !name || !value) {
+        return -1;
+    }
+    
+    size_t name_length = strlen(name);
+    size_t needed = response->headers_length + name_length + value_length + 5; // ": ", "\r\n" and NUL
+    if (needed > RESPONSE_HEADERS_MAX_SIZE) {
+        return -1;
+    }
+    if (needed > response->headers_capacity) {
+        size_t capacity = response->headers_capacity * 2;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+        if (capacity > RESPONSE_HEADERS_MAX_SIZE) {
+            capacity = RESPONSE_HEADERS_MAX_SIZE;
+        }
+        char *headers;
+        if (response->headers == response->header_space) {
+            headers = malloc(capacity);
+            if (headers) {
+                memcpy(headers, response->header_space, response->headers_length + 1);
+            }
+        } else {
+            headers = realloc(response->headers, capacity);
+        }
+        if (!headers) {
+            return -1;
+        }
+        response->headers = headers;
+        response->headers_capacity = capacity;
+    }
+    
+    char *line = response->headers + response->headers_length;
+    memcpy(line, name, name_length);
+    memcpy(line + name_length, ": ", 2);
+    memcpy(line + name_length + 2, value, value_length);
+    memcpy(line + name_length + 2 + value_length, "\r\n", 3);
+    response->headers_length = needed - 1;
+    response->constant = NULL;
+    return 0;
+}
+
+// Release the current body, whether owned or borrowed
+static void clear_response_body(http_response_t *response) {
+    if (response->body_release) {
+        response->body_release(response->body_owner);
+    } else {
+        free(response->body);
+    }
+    response->body = NULL;
+    response->body_release = NULL;
+    response->body_owner = NULL;
+    response->content_length = 0;
+    response->constant = NULL;
+}
+
 int set_response_body(http_response_t *response, const void *body, size_t body_length) {
     if (!response) {
         return -1;
     }
     
     // Free any existing body
-    if (response->body) {
-        free(response->body);
-        response->body = NULL;
-        response->content_length = 0;
-    }
+    clear_response_body(response);
     
     // Handle empty body
     if (!body || body_length == 0) {
@@ -71,6 +169,65 @@ int set_response_body(http_response_t *response, const void *body, size_t body_l
     return 0;
 }
 
+int set_response_body_shared(http_response_t *response, const void *body, size_t body_length,
+                             void (*release)(void *owner), void *owner) {
+    if (!response || !release) {
+        return -1;
+    }
+    
+    clear_response_body(response);
+    
+    response->body = (void *)body;
+    response->content_length = body_length;
+    response->body_release = release;
+    response->body_owner = owner;
+    
+    return 0;
+}
+
+void *reserve_response_body(http_response_t *response, size_t capacity) {
+    if (!response || capacity == 0) {
+        return NULL;
+    }
+    
+    clear_response_body(response);
+    
+    response->body = malloc(capacity);
+    if (!response->body) {
+        return NULL;
+    }
+    response->content_length = capacity;
+    
+    return response->body;
+}
+
+int trim_response_body(http_response_t *response, size_t length) {
+    if (!response || (!response->body && length > 0) || length > response->content_length ||
+        response->stream_producer) {
+        return -1;
+    }
+    
+    response->content_length = length;
+    response->constant = NULL;
+    
+    return 0;
+}
+
+int set_response_stream(http_response_t *response, http_stream_producer_t producer, void *context,
+                        void (*context_free)(void *context)) {
+    if (!response || !producer) {
+        return -1;
+    }
+    
+    clear_response_body(response);
+    
+    response->stream_producer = producer;
+    response->stream_context = context;
+    response->stream_context_free = context_free;
+    
+    return 0;
+}
+
 int set_response_body_string(http_response_t *response, const char *body) {
     if (!response) {
         return -1;
@@ -78,54 +235,65 @@ int set_response_body_string(http_response_t *response, const char *body) {
     
     // Handle null or empty string
     if (!body || body[0] == '\0') {
-        if (response->body) {
-            free(response->body);
-            response->body = NULL;
-            response->content_length = 0;
-        }
+        clear_response_body(response);
         return 0;
     }
     
     return set_response_body(response, body, strlen(body));
 }
 
-size_t write_http_response(const http_response_t *response, char *buffer, size_t buffer_size) {
+// Append formatted text to a head being written. Returns -1, leaving
+// *length alone, when it does not fit.
+static int append_head(char *buffer, size_t buffer_size, size_t *length, const char *format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    int written = vsnprintf(buffer + *length, buffer_size - *length, format, arguments);
+    va_end(arguments);
+    if (written < 0 || (size_t)written >= buffer_size - *length) {
+        return -1;
+    }
+    *length += written;
+    return 0;
+}
+
+size_t write_http_response_head(const http_response_t *response, char *buffer, size_t buffer_size) {
     if (!response || !buffer || buffer_size == 0) {
         return 0;
     }
     
-    // Format the status line and headers into the buffer
-    int header_len = 0;
-    
-    // Start with the status line
-    header_len += snprintf(buffer + header_len, buffer_size - header_len,
-                         "HTTP/1.1 %d %s\r\n", 
-                         response->status_code, 
-                         get_status_message(response->status_code));
-    
-    // Add Content-Type header
-    header_len += snprintf(buffer + header_len, buffer_size - header_len,
-                         "Content-Type: %s\r\n", 
-                         response->content_type);
-    
-    // Add Content-Length header
-    header_len += snprintf(buffer + header_len, buffer_size - header_len,
-                         "Content-Length: %zu\r\n", 
-                         response->content_length);
-    
-    // Add Connection header
-    header_len += snprintf(buffer + header_len, buffer_size - header_len,
-                         "Connection: close\r\n");
-    
-    // End headers with an empty line
-    header_len += snprintf(buffer + header_len, buffer_size - header_len, "\r\n");
+    // Format the status line and headers into the buffer, giving up as soon
+    // as something does not fit
+    size_t header_len = 0;
+    int bodiless = response_status_bodiless(response);
+    if (append_head(buffer, buffer_size, &header_len, "HTTP/1.1 %d %s\r\n",
+                    response->status_code, get_status_message(response->status_code)) != 0) {
+        return 0;
+    }
+    if ((!bodiless || response->content_type_set) &&
+        append_head(buffer, buffer_size, &header_len, "Content-Type: %s\r\n", response->content_type) != 0) {
+        return 0;
+    }
+    if (!bodiless &&
+        append_head(buffer, buffer_size, &header_len, "Content-Length: %zu\r\n", response->content_length) != 0) {
+        return 0;
+    }
+    if (append_head(buffer, buffer_size, &header_len, "%s", response->headers_length > 0 ? response->headers : "") != 0 ||
+        append_head(buffer, buffer_size, &header_len, "Connection: %s\r\n\r\n",
+                    response->keep_alive ? "keep-alive" : "close") != 0) {
+        return 0;
+    }
     
-    if (header_len < 0 || (size_t)header_len >= buffer_size) {
+    return header_len;
+}
+
+size_t write_http_response(const http_response_t *response, char *buffer, size_t buffer_size) {
+    size_t header_len = write_http_response_head(response, buffer, buffer_size);
+    if (header_len == 0) {
         return 0;
     }
     
-    // Copy the body if there is one
-    if (response->body && response->content_length > 0) {
+    // Copy the body if there is one and the status allows it
+    if (response->body && response->content_length > 0 && !response_status_bodiless(response)) {
         size_t remaining_space = buffer_size - header_len;
         if (remaining_space >= response->content_length) {
             memcpy(buffer + header_len, response->body, response->content_length);
@@ -137,10 +305,21 @@ size_t write_http_response(const http_response_t *response, char *buffer, size_t
 }
 
 void free_http_response(http_response_t *response) {
-    if (response && response->body) {
-        free(response->body);
-        response->body = NULL;
-        response->content_length = 0;
+    if (response) {
+        clear_response_body(response);
+        if (response->headers != response->header_space) {
+            free(response->headers);
+            response->headers = response->header_space;
+            response->headers_capacity = sizeof(response->header_space);
+        }
+        response->headers_length = 0;
+        response->headers[0] = '\0';
+        if (response->stream_context_free) {
+            response->stream_context_free(response->stream_context);
+        }
+        response->stream_producer = NULL;
+        response->stream_context = NULL;
+        response->stream_context_free = NULL;
     }
 }
 
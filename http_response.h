@@ -5,17 +5,54 @@
 
 // HTTP response status codes
 #define HTTP_STATUS_OK               200
+#define HTTP_STATUS_CREATED          201
+#define HTTP_STATUS_NO_CONTENT       204
+#define HTTP_STATUS_MOVED_PERMANENTLY 301
+#define HTTP_STATUS_FOUND            302
+#define HTTP_STATUS_NOT_MODIFIED     304
 #define HTTP_STATUS_BAD_REQUEST      400
+#define HTTP_STATUS_UNAUTHORIZED     401
+#define HTTP_STATUS_FORBIDDEN        403
 #define HTTP_STATUS_NOT_FOUND        404
 #define HTTP_STATUS_METHOD_NOT_ALLOWED 405
+#define HTTP_STATUS_REQUEST_TIMEOUT  408
+#define HTTP_STATUS_PAYLOAD_TOO_LARGE 413
+#define HTTP_STATUS_TOO_MANY_REQUESTS 429
 #define HTTP_STATUS_INTERNAL_ERROR   500
+#define HTTP_STATUS_BAD_GATEWAY      502
+#define HTTP_STATUS_SERVICE_UNAVAILABLE 503
+#define HTTP_STATUS_GATEWAY_TIMEOUT  504
+
+// Extra header lines start out in the response itself and move to the heap
+// when they outgrow it, up to the largest head a proxied upstream may send
+#define RESPONSE_HEADERS_INLINE_SIZE 1024
+#define RESPONSE_HEADERS_MAX_SIZE    16384
+
+// Streamed bodies are produced incrementally by a callback (see http_stream.h)
+typedef struct http_stream http_stream_t;
+typedef int (*http_stream_producer_t)(http_stream_t *stream, void *context);
+
+// A response serialized at startup (see constant_response.h)
+struct constant_response;
 
 // HTTP response structure
 typedef struct {
     int status_code;
     char content_type[128];
+    int content_type_set;               // Set by the handler rather than left at the default
+    char *headers;                      // Additional "Name: value\r\n" header lines, terminated
+    size_t headers_length;
+    size_t headers_capacity;
+    char header_space[RESPONSE_HEADERS_INLINE_SIZE]; // Where headers points until they outgrow it
     size_t content_length;
     void *body;
+    void (*body_release)(void *owner);  // Set when the body is borrowed rather than owned
+    void *body_owner;
+    http_stream_producer_t stream_producer; // Set when the body is streamed instead of buffered
+    void *stream_context;
+    void (*stream_context_free)(void *context);
+    int keep_alive;                     // Keep the connection open after this response
+    const struct constant_response *constant; // Set while the response is still exactly a constant one
 } http_response_t;
 
 // Initialize a response structure
@@ -27,15 +64,51 @@ void set_response_status(http_response_t *response, int status_code);
 // Set response content type
 void set_response_content_type(http_response_t *response, const char *content_type);
 
+// Whether the status is one that never has a body (204, 304). Such a head
+// carries no Content-Length, and a Content-Type only when the handler set
+// one: a 304 describes the stored 200, and a length of 0 would replace it.
+int response_status_bodiless(const http_response_t *response);
+
+// Add a header line to the response. Returns -1, leaving the headers as
+// they were, when they would grow past RESPONSE_HEADERS_MAX_SIZE.
+int add_response_header(http_response_t *response, const char *name, const char *value);
+
+// The same for a value that is not NUL-terminated
+int add_response_header_value(http_response_t *response, const char *name, const char *value,
+                              size_t value_length);
+
 // Set response body
 int set_response_body(http_response_t *response, const void *body, size_t body_length);
 
+// Set response body to a buffer owned by someone else. The body is not copied;
+// release(owner) is called instead of free() once the response is done with it.
+int set_response_body_shared(http_response_t *response, const void *body, size_t body_length,
+                             void (*release)(void *owner), void *owner);
+
+// Replace the body with an uninitialized buffer of capacity bytes for the
+// caller to fill in place, then shorten it with trim_response_body() to the
+// bytes written. Returns the buffer, or NULL on failure.
+void *reserve_response_body(http_response_t *response, size_t capacity);
+int trim_response_body(http_response_t *response, size_t length);
+
+// Stream the body from a producer instead of buffering it. The producer is
+// called once the headers are sent and writes the body with http_stream_write().
+// context_free (optional) is called on context when the response is freed.
+int set_response_stream(http_response_t *response, http_stream_producer_t producer, void *context,
+                        void (*context_free)(void *context));
+
 // Set response body from a string
 int set_response_body_string(http_response_t *response, const char *body);
 
+// Get the reason phrase for a status code
+const char *get_status_message(int status_code);
+
 // Write response to a buffer
 size_t write_http_response(const http_response_t *response, char *buffer, size_t buffer_size);
 
+// Write only the status line and headers, for sending the body from where it is
+size_t write_http_response_head(const http_response_t *response, char *buffer, size_t buffer_size);
+
 // Free any allocated memory in the response
 void free_http_response(http_response_t *response);
 
@@ -0,0 +1,307 @@
+// http_server_top.c - live view of a running HTTP server, read from its
+// stats segment in /dev/shm. Nothing is sent to the server, so the view
+// keeps updating while the server is saturated and costs it nothing.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/types.h>
+#include "stats_segment.h"
+#include "supervisor.h"
+
+#define TOP_ROUTES 10   // Busiest routes listed
+
+typedef struct {
+    worker_stats_t workers[MAX_WORKER_PROCESSES];
+    worker_stats_t total;
+    pid_t pids[MAX_WORKER_PROCESSES];
+    int count;
+} sample_t;
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-i seconds] [-n updates] [pid | segment file]\n"
+                    "With no argument, the newest running server's segment in /dev/shm is shown.\n", program);
+    exit(EXIT_FAILURE);
+}
+
+// The segment of the most recently started server that is still running
+static int find_segment(char *path, size_t path_size) {
+    DIR *directory = opendir("/dev/shm");
+    if (!directory) {
+        return -1;
+    }
+    long long newest = -1;
+    struct dirent *entry;
+    while ((entry = readdir(directory)) != NULL) {
+        int pid;
+        char candidate[300];
+        if (sscanf(entry->d_name, "http_server.%d", &pid) != 1 || kill(pid, 0) != 0) {
+            continue;
+        }
+        snprintf(candidate, sizeof(candidate), "/dev/shm/%s", entry->d_name);
+        stats_segment_t *segment = stats_segment_open(candidate);
+        if (segment && segment->header.started > newest) {
+            newest = segment->header.started;
+            snprintf(path, path_size, "%s", candidate);
+        }
+        if (segment) {
+            stats_segment_close(segment);
+        }
+    }
+    closedir(directory);
+    return newest >= 0 ? 0 : -1;
+}
+
+static void take_sample(const stats_segment_t *segment, sample_t *sample) {
+    memset(&sample->total, 0, sizeof(sample->total));
+    sample->count = segment->header.slot_count < MAX_WORKER_PROCESSES ? segment->header.slot_count : MAX_WORKER_PROCESSES;
+    for (int i = 0; i < sample->count; i++) {
+        worker_stats_t *worker = &sample->workers[i];
+        worker_stats_t retired;
+        stats_slot_read(&segment->slots[i], worker, &retired);
+        sample->pids[i] = segment->slots[i].pid;
+        worker->restarts = segment->slots[i].restarts;
+        sample->total.restarts += worker->restarts;
+
+        // Exited workers still count towards the totals, which would go
+        // backwards on every restart otherwise
+        stats_add_counters(&sample->total, &retired);
+        if (sample->pids[i] == 0) {
+            continue;
+        }
+        sample->total.active_connections += worker->active_connections;
+        sample->total.rss_bytes += worker->rss_bytes;
+        sample->total.baseline_rss_bytes += worker->baseline_rss_bytes;
+        for (int c = 0; c < EXECUTOR_CLASS_COUNT; c++) {
+            executor_stats_t *sum = &sample->total.executors[c];
+            sum->workers += worker->executors[c].workers;
+            sum->queue_depth += worker->executors[c].queue_depth;
+            sum->queue_capacity += worker->executors[c].queue_capacity;
+        }
+        stats_add_counters(&sample->total, worker);
+    }
+}
+
+// A counter's rate between two samples. A restarted worker starts again
+// from zero, which shows as no progress rather than a huge negative rate.
+static double rate(unsigned long long now, unsigned long long before, double seconds) {
+    return now >= before ? (now - before) / seconds : 0.0;
+}
+
+// Upper bound of the latency bucket holding the given share of requests
+static const char *latency_percentile(const unsigned long long *now, const unsigned long long *before,
+                                      double share, char *text, size_t text_size) {
+    unsigned long long counts[LATENCY_BUCKETS];
+    unsigned long long total = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        counts[i] = now[i] >= before[i] ? now[i] - before[i] : 0;
+        total += counts[i];
+    }
+    if (total == 0) {
+        return "-";
+    }
+
+    unsigned long long target = (unsigned long long)(total * share);
+    unsigned long long seen = 0;
+    int bucket = 0;
+    for (; bucket < LATENCY_BUCKETS - 1; bucket++) {
+        seen += counts[bucket];
+        if (seen > target) {
+            break;
+        }
+    }
+    if (bucket == LATENCY_BUCKETS - 1) {
+        snprintf(text, text_size, ">%.0fms", (1ULL << (LATENCY_BUCKETS - 2)) / 1000.0);
+    } else if (bucket < 10) {
+        snprintf(text, text_size, "<%lluus", 1ULL << bucket);
+    } else {
+        snprintf(text, text_size, "<%.0fms", (1ULL << bucket) / 1000.0);
+    }
+    return text;
+}
+
+static void show(const stats_segment_t *segment, const sample_t *now, const sample_t *before, double seconds) {
+    const stats_header_t *header = &segment->header;
+    const request_metrics_t *requests = &now->total.requests;
+    const request_metrics_t *previous = &before->total.requests;
+
+    long long uptime = (long long)time(NULL) - header->started;
+    printf("http_server %d, %s, up %lld:%02lld:%02lld\n", (int)header->server_pid,
+           header->workers > 0 ? "pre-fork" : "single process",
+           uptime / 3600, uptime / 60 % 60, uptime % 60);
+    if (kill(header->server_pid, 0) != 0 && errno == ESRCH) {
+        printf("(server has exited; showing its last numbers)\n");
+    }
+    printf("\nconnections  active %d  accepted %.0f/s\n", now->total.active_connections,
+           rate(requests->connections_accepted, previous->connections_accepted, seconds));
+    unsigned long long growth = now->total.rss_bytes > now->total.baseline_rss_bytes ?
+                                now->total.rss_bytes - now->total.baseline_rss_bytes : 0;
+    printf("memory       rss %.1f MB  %.1f KB per connection\n", now->total.rss_bytes / 1e6,
+           now->total.active_connections > 0 ? growth / 1024.0 / now->total.active_connections : 0.0);
+    printf("requests     %.0f/s  in %.2f MB/s  out %.2f MB/s\n",
+           rate(requests->requests, previous->requests, seconds),
+           rate(requests->bytes_received, previous->bytes_received, seconds) / 1e6,
+           rate(requests->bytes_sent, previous->bytes_sent, seconds) / 1e6);
+    printf("status       2xx %.0f/s  3xx %.0f/s  4xx %.0f/s  5xx %.0f/s\n",
+           rate(requests->status_classes[2], previous->status_classes[2], seconds),
+           rate(requests->status_classes[3], previous->status_classes[3], seconds),
+           rate(requests->status_classes[4], previous->status_classes[4], seconds),
+           rate(requests->status_classes[5], previous->status_classes[5], seconds));
+
+    char p50[16], p90[16], p99[16];
+    printf("latency      p50 %s  p90 %s  p99 %s\n",
+           latency_percentile(requests->latency_buckets, previous->latency_buckets, 0.50, p50, sizeof(p50)),
+           latency_percentile(requests->latency_buckets, previous->latency_buckets, 0.90, p90, sizeof(p90)),
+           latency_percentile(requests->latency_buckets, previous->latency_buckets, 0.99, p99, sizeof(p99)));
+
+    static const char *const cache_labels[METRICS_CACHE_COUNT] = {
+        [METRICS_CACHE_FILE] = "file cache",
+        [METRICS_CACHE_RESPONSE] = "resp cache",
+    };
+    for (int c = 0; c < METRICS_CACHE_COUNT; c++) {
+        double hits = rate(requests->cache_hits[c], previous->cache_hits[c], seconds);
+        double misses = rate(requests->cache_misses[c], previous->cache_misses[c], seconds);
+        if (hits + misses > 0) {
+            printf("%-12s hit rate %.1f%%  (%.0f lookups/s)\n", cache_labels[c], 100.0 * hits / (hits + misses), hits + misses);
+        } else {
+            printf("%-12s idle\n", cache_labels[c]);
+        }
+    }
+    if (now->total.rate_limited > 0) {
+        printf("rate limited %.0f/s\n", rate(now->total.rate_limited, before->total.rate_limited, seconds));
+    }
+
+    printf("\n%-10s %8s %8s %12s %10s %8s\n", "executor", "workers", "queued", "submitted/s", "rejected/s", "shed/s");
+    for (int c = 0; c < EXECUTOR_CLASS_COUNT; c++) {
+        const executor_stats_t *stats = &now->total.executors[c];
+        const executor_stats_t *old = &before->total.executors[c];
+        printf("%-10s %8d %8zu %12.0f %10.0f %8.0f\n", header->executor_names[c], stats->workers, stats->queue_depth,
+               rate(stats->submitted, old->submitted, seconds), rate(stats->rejected, old->rejected, seconds),
+               rate(stats->shed, old->shed, seconds));
+    }
+
+    if (header->workers > 0) {
+        printf("\n%-6s %8s %8s %10s %9s\n", "worker", "pid", "active", "requests/s", "restarts");
+        for (int i = 0; i < now->count; i++) {
+            const worker_stats_t *worker = &now->workers[i];
+            if (now->pids[i] == 0) {
+                printf("%-6d %8s\n", i, "-");
+                continue;
+            }
+            double requests_per_second = now->pids[i] == before->pids[i] ?
+                rate(worker->requests.requests, before->workers[i].requests.requests, seconds) : 0.0;
+            printf("%-6d %8d %8d %10.0f %9llu\n", i, (int)now->pids[i], worker->active_connections,
+                   requests_per_second, worker->restarts);
+        }
+    }
+
+    // Busiest routes over the interval
+    int order[MAX_ROUTES + 1];
+    double route_rates[MAX_ROUTES + 1];
+    int route_total = header->route_count < MAX_ROUTES ? header->route_count : MAX_ROUTES;
+    int listed = 0;
+    for (int r = 0; r <= MAX_ROUTES; r++) {
+        if (r < route_total || r == METRICS_ROUTE_OTHER) {
+            route_rates[r] = rate(requests->route_requests[r], previous->route_requests[r], seconds);
+            order[listed++] = r;
+        }
+    }
+    // By rate, then by total so that a quiet server still lists its routes
+    for (int i = 1; i < listed; i++) {
+        int r = order[i];
+        int j = i;
+        for (; j > 0; j--) {
+            int above = order[j - 1];
+            if (route_rates[above] > route_rates[r] ||
+                (route_rates[above] == route_rates[r] && requests->route_requests[above] >= requests->route_requests[r])) {
+                break;
+            }
+            order[j] = above;
+        }
+        order[j] = r;
+    }
+    printf("\n%-32s %10s %12s\n", "route", "requests/s", "total");
+    for (int i = 0; i < listed && i < TOP_ROUTES; i++) {
+        int r = order[i];
+        if (requests->route_requests[r] == 0) {
+            break; // Everything below is unused too
+        }
+        printf("%-32s %10.0f %12llu\n", header->route_names[r], route_rates[r], requests->route_requests[r]);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    double interval = 1.0;
+    int updates = 0;   // 0 runs until interrupted
+    int option;
+
+    while ((option = getopt(argc, argv, "i:n:")) != -1) {
+        switch (option) {
+            case 'i':
+                interval = atof(optarg);
+                if (interval < 0.1) {
+                    usage(argv[0]);
+                }
+                break;
+            case 'n':
+                updates = atoi(optarg);
+                if (updates <= 0) {
+                    usage(argv[0]);
+                }
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (argc - optind > 1) {
+        usage(argv[0]);
+    }
+
+    char path[300];
+    if (optind < argc) {
+        const char *target = argv[optind];
+        char *end;
+        long pid = strtol(target, &end, 10);
+        if (*end == '\0' && pid > 0) {
+            snprintf(path, sizeof(path), STATS_SEGMENT_PATH_FORMAT, (int)pid);
+        } else {
+            snprintf(path, sizeof(path), "%s", target);
+        }
+    } else if (find_segment(path, sizeof(path)) != 0) {
+        fprintf(stderr, "No running http_server found in /dev/shm\n");
+        return EXIT_FAILURE;
+    }
+
+    stats_segment_t *segment = stats_segment_open(path);
+    if (!segment) {
+        fprintf(stderr, "Cannot read a stats segment from %s\n", path);
+        return EXIT_FAILURE;
+    }
+
+    // Every sample holds a copy of each slot; keep them off the stack
+    static sample_t samples[2];
+    int current = 0;
+    take_sample(segment, &samples[current]);
+    int clear_screen = isatty(STDOUT_FILENO);
+    struct timespec pause = { (time_t)interval, (long)((interval - (time_t)interval) * 1e9) };
+
+    for (int shown = 0; updates == 0 || shown < updates; shown++) {
+        nanosleep(&pause, NULL);
+        int previous = current;
+        current = 1 - current;
+        take_sample(segment, &samples[current]);
+
+        if (clear_screen) {
+            printf("\033[H\033[2J");
+        } else if (shown > 0) {
+            printf("\n");
+        }
+        show(segment, &samples[current], &samples[previous], interval);
+        fflush(stdout);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "http_stream.h"
+#include "utils.h"
+#include "conn_manager.h"
+#include "socket_options.h"
+
+struct http_stream {
+    int client_socket;
+    struct conn_timer *timer;
+    int chunked;            // Frame the body with chunked transfer-coding
+    int failed;             // The client went away; every later write fails
+    http_stream_sink_t sink; // Takes flushed data instead of the socket when set
+    void *sink_context;
+    size_t buffered;
+    char buffer[HTTP_STREAM_BUFFER_SIZE];
+};
+
+// Send the buffered bytes as one chunk (or as raw bytes for HTTP/1.0).
+// more_follows holds the end of the chunk back for what is sent next.
+static int flush_stream(http_stream_t *stream, int more_follows) {
+    if (!stream || stream->failed) {
+        return -1;
+    }
+    if (stream->buffered == 0) {
+        return 0;
+    }
+
+    if (stream->sink) {
+        if (stream->sink(stream->sink_context, stream->buffer, stream->buffered) != 0) {
+            stream->failed = 1;
+            return -1;
+        }
+        stream->buffered = 0;
+        return 0;
+    }
+
+    // The write deadline applies to each flush, not to the whole body
+    if (stream->timer) {
+        conn_timer_set(stream->timer, CONN_PHASE_WRITE);
+    }
+
+    // The chunk framing rides in the same segments as the data
+    int more = socket_options_more_flag();
+    if (stream->chunked) {
+        char size_line[32];
+        int size_length = snprintf(size_line, sizeof(size_line), "%zx\r\n", stream->buffered);
+        if (send_all_flags(stream->client_socket, size_line, size_length, more) != 0 ||
+            send_all_flags(stream->client_socket, stream->buffer, stream->buffered, more) != 0 ||
+            send_all_flags(stream->client_socket, "\r\n", 2, more_follows ? more : 0) != 0) {
+            stream->failed = 1;
+            return -1;
+        }
+    } else if (send_all_flags(stream->client_socket, stream->buffer, stream->buffered, more_follows ? more : 0) != 0) {
+        stream->failed = 1;
+        return -1;
+    }
+
+    stream->buffered = 0;
+    return 0;
+}
+
+int http_stream_flush(http_stream_t *stream) {
+    return flush_stream(stream, 0);
+}
+
+int http_stream_write(http_stream_t *stream, const void *data, size_t length) {
+    if (!stream || stream->failed) {
+        return -1;
+    }
+
+    const char *bytes = data;
+    while (length > 0) {
+        size_t space = sizeof(stream->buffer) - stream->buffered;
+        size_t amount = length < space ? length : space;
+        memcpy(stream->buffer + stream->buffered, bytes, amount);
+        stream->buffered += amount;
+        bytes += amount;
+        length -= amount;
+
+        // A full buffer goes out right away; send_all blocks while the socket is full
+        if (stream->buffered == sizeof(stream->buffer) && http_stream_flush(stream) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int http_stream_write_string(http_stream_t *stream, const char *string) {
+    return http_stream_write(stream, string, string ? strlen(string) : 0);
+}
+
+int http_stream_send_response(int client_socket, const char *http_version, http_response_t *response,
+                              struct conn_timer *timer) {
+    if (!response || !response->stream_producer) {
+        return -1;
+    }
+
+    http_stream_t *stream = malloc(sizeof(http_stream_t));
+    if (!stream) {
+        return -1;
+    }
+    stream->client_socket = client_socket;
+    stream->timer = timer;
+    stream->chunked = http_version && strcmp(http_version, "HTTP/1.0") != 0;
+    stream->failed = 0;
+    stream->sink = NULL;
+    stream->buffered = 0;
+
+    // Headers go out first so the client sees the response before the body
+    // exists. Unusually many of them, as a proxied upstream may send, take a
+    // buffer of their own.
+    char small_head[2048];
+    size_t head_size = response->headers_length + 512;
+    char *head = head_size <= sizeof(small_head) ? small_head : malloc(head_size);
+    if (!head) {
+        free(stream);
+        return -1;
+    }
+    if (head == small_head) {
+        head_size = sizeof(small_head);
+    }
+    int header_length = snprintf(head, head_size,
+                                 "HTTP/1.1 %d %s\r\n"
+                                 "Content-Type: %s\r\n"
+                                 "%s"
+                                 "%s"
+                                 "Connection: %s\r\n"
+                                 "\r\n",
+                                 response->status_code,
+                                 get_status_message(response->status_code),
+                                 response->content_type,
+                                 response->headers,
+                                 stream->chunked ? "Transfer-Encoding: chunked\r\n" : "",
+                                 stream->chunked && response->keep_alive ? "keep-alive" : "close");
+
+    int result = -1;
+    int head_sent = header_length > 0 && (size_t)header_length < head_size &&
+                    send_all(client_socket, head, header_length) == 0;
+    if (head != small_head) {
+        free(head);
+    }
+    if (head_sent) {
+        result = response->stream_producer(stream, response->stream_context);
+
+        // Send what is left, then the last-chunk marker. A producer that failed
+        // leaves the body unterminated so the client can tell it is incomplete.
+        if (result == 0 && flush_stream(stream, stream->chunked) != 0) {
+            result = -1;
+        }
+        if (result == 0 && stream->chunked && send_all(client_socket, "0\r\n\r\n", 5) != 0) {
+            result = -1;
+        }
+    }
+
+    free(stream);
+    return result;
+}
+
+int http_stream_run_producer(http_response_t *response, http_stream_sink_t sink, void *sink_context) {
+    if (!response || !response->stream_producer || !sink) {
+        return -1;
+    }
+
+    http_stream_t *stream = malloc(sizeof(http_stream_t));
+    if (!stream) {
+        return -1;
+    }
+    stream->client_socket = -1;
+    stream->timer = NULL;
+    stream->chunked = 0;
+    stream->failed = 0;
+    stream->sink = sink;
+    stream->sink_context = sink_context;
+    stream->buffered = 0;
+
+    int result = response->stream_producer(stream, response->stream_context);
+    if (result == 0 && http_stream_flush(stream) != 0) {
+        result = -1;
+    }
+
+    free(stream);
+    return result;
+}
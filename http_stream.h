@@ -0,0 +1,40 @@
+#ifndef HTTP_STREAM_H
+#define HTTP_STREAM_H
+
+#include <stddef.h>
+#include "http_response.h"
+
+struct conn_timer;
+
+#define HTTP_STREAM_BUFFER_SIZE 16384 // Writes are coalesced into chunks of up to this size
+
+// Destination for a streamed body on protocols that frame it themselves.
+// Returns 0 once the data is accepted or -1 to stop the producer.
+typedef int (*http_stream_sink_t)(void *context, const void *data, size_t length);
+
+// Write part of a streamed body. Blocks while the client is not keeping up,
+// so a producer can never run ahead of the socket. Returns 0 on success or
+// -1 once the client has gone away, after which the producer should stop.
+int http_stream_write(http_stream_t *stream, const void *data, size_t length);
+
+// Write a NUL-terminated string to a streamed body
+int http_stream_write_string(http_stream_t *stream, const char *string);
+
+// Push everything written so far to the client now instead of waiting for
+// the buffer to fill up
+int http_stream_flush(http_stream_t *stream);
+
+// Send a response whose body comes from its stream producer. HTTP/1.1
+// clients get Transfer-Encoding: chunked; HTTP/1.0 clients get a body that
+// ends when the connection closes, so the connection must not be reused.
+// Each wait for the client to take more data is bounded by timer's write
+// deadline when a timer is given. Returns 0 if the whole body was sent.
+int http_stream_send_response(int client_socket, const char *http_version, http_response_t *response,
+                              struct conn_timer *timer);
+
+// Run response's stream producer, handing each flushed block of the body to
+// sink instead of a socket. Headers and end-of-body framing are left to the
+// caller. Returns 0 if the producer finished and every block was accepted.
+int http_stream_run_producer(http_response_t *response, http_stream_sink_t sink, void *sink_context);
+
+#endif
@@ -0,0 +1,540 @@
+#define _GNU_SOURCE // SO_REUSEPORT
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "listener.h"
+#include "echo_server.h"
+#include "utils.h"
+
+static listener_t listeners[MAX_LISTENERS];
+static int count = 0;
+static int next_listener = 0;   // Where the next accept scan starts, so no endpoint is starved
+static int owns_paths = 1;      // Whether closing removes Unix socket files
+
+// Listening sockets passed on by the process this one is upgrading
+static int inherited[MAX_LISTENERS];
+static int inherited_count = 0;
+
+// Written to by listener_interrupt() so a signal wakes the accept loop
+// whichever thread the signal was delivered to
+static int wake_pipe[2] = {-1, -1};
+
+static const char *kind_names[] = {
+    [LISTENER_TCP4] = "tcp4",
+    [LISTENER_TCP6] = "tcp6",
+    [LISTENER_UNIX] = "unix",
+    [LISTENER_ABSTRACT] = "abstract",
+};
+
+static int parse_port(const char *text) {
+    int port = string_to_int(text);
+    return port > 0 && port <= 65535 ? port : -1;
+}
+
+// "[host:]port" for tcp4 and "[[host]:]port" for tcp6
+static int parse_inet_address(listener_t *listener, char *text) {
+    char *host = NULL;
+    char *port_text = text;
+
+    if (listener->kind == LISTENER_TCP6 && text[0] == '[') {
+        char *close_bracket = strchr(text, ']');
+        if (!close_bracket || close_bracket[1] != ':') {
+            return -1;
+        }
+        *close_bracket = '\0';
+        host = text + 1;
+        port_text = close_bracket + 2;
+    } else if (listener->kind == LISTENER_TCP4) {
+        char *colon = strrchr(text, ':');
+        if (colon) {
+            *colon = '\0';
+            host = text;
+            port_text = colon + 1;
+        }
+    }
+
+    int port = parse_port(port_text);
+    if (port < 0) {
+        return -1;
+    }
+
+    if (listener->kind == LISTENER_TCP4) {
+        struct sockaddr_in *address = (struct sockaddr_in *)&listener->address;
+        address->sin_family = AF_INET;
+        address->sin_port = htons(port);
+        address->sin_addr.s_addr = htonl(INADDR_ANY);
+        if (host && inet_pton(AF_INET, host, &address->sin_addr) != 1) {
+            return -1;
+        }
+        listener->address_length = sizeof(struct sockaddr_in);
+    } else {
+        struct sockaddr_in6 *address = (struct sockaddr_in6 *)&listener->address;
+        address->sin6_family = AF_INET6;
+        address->sin6_port = htons(port);
+        address->sin6_addr = in6addr_any;
+        if (host && inet_pton(AF_INET6, host, &address->sin6_addr) != 1) {
+            return -1;
+        }
+        listener->address_length = sizeof(struct sockaddr_in6);
+    }
+    return 0;
+}
+
+// A filesystem path, or a name in the abstract namespace (leading NUL byte)
+static int parse_unix_address(listener_t *listener, const char *text) {
+    struct sockaddr_un *address = (struct sockaddr_un *)&listener->address;
+    size_t length = strlen(text);
+    size_t offset = listener->kind == LISTENER_ABSTRACT ? 1 : 0;
+    if (length == 0 || length + offset >= sizeof(address->sun_path)) {
+        return -1;
+    }
+
+    address->sun_family = AF_UNIX;
+    memcpy(address->sun_path + offset, text, length);
+    if (listener->kind == LISTENER_ABSTRACT) {
+        // Abstract names are exactly as long as the address says, with no terminator
+        listener->address_length = offsetof(struct sockaddr_un, sun_path) + 1 + length;
+    } else {
+        listener->address_length = sizeof(struct sockaddr_un);
+    }
+    return 0;
+}
+
+// Split "kind:address" at the colon; returns the LISTENER_ kind or -1
+static int parse_kind(char *text, char **address_text) {
+    char *colon = strchr(text, ':');
+    if (!colon) {
+        return -1;
+    }
+    *colon = '\0';
+    *address_text = colon + 1;
+    for (int kind = LISTENER_TCP4; kind <= LISTENER_ABSTRACT; kind++) {
+        if (strcmp(text, kind_names[kind]) == 0) {
+            return kind;
+        }
+    }
+    return -1;
+}
+
+static int parse_listener_option(listener_t *listener, const char *option) {
+    if (strncmp(option, "backlog=", 8) == 0) {
+        listener->backlog = string_to_int(option + 8);
+        return listener->backlog > 0 ? 0 : -1;
+    }
+    if (strncmp(option, "mode=", 5) == 0 && listener->kind == LISTENER_UNIX) {
+        char *end;
+        long mode = strtol(option + 5, &end, 8);
+        if (option[5] == '\0' || *end != '\0' || mode < 0 || mode > 0777) {
+            return -1;
+        }
+        listener->mode = (int)mode;
+        return 0;
+    }
+    if (strcmp(option, "v6only") == 0 && listener->kind == LISTENER_TCP6) {
+        listener->v6only = 1;
+        return 0;
+    }
+    if (strcmp(option, "reuseport") == 0 && listener->kind <= LISTENER_TCP6) {
+        listener->reuseport = 1;
+        return 0;
+    }
+    // Coalescing applies to all connections, so it can only be set with -O
+    if (strncmp(option, "cork", 4) == 0) {
+        return -1;
+    }
+    return socket_options_parse(&listener->options, option);
+}
+
+int listener_add(const char *specification) {
+    if (count >= MAX_LISTENERS) {
+        return -1;
+    }
+
+    char text[256];
+    if (strlen(specification) >= sizeof(text)) {
+        return -1;
+    }
+    strcpy(text, specification);
+
+    listener_t listener;
+    memset(&listener, 0, sizeof(listener));
+    listener.backlog = MAX_PENDING_CONNECTIONS;
+    listener.mode = -1;
+    listener.socket = -1;
+    socket_options_init(&listener.options);
+
+    char *address_text;
+    listener.kind = parse_kind(text, &address_text);
+    if (listener.kind < 0) {
+        return -1;
+    }
+
+    // Options follow the address, separated by commas
+    char *options = strchr(address_text, ',');
+    if (options) {
+        *options++ = '\0';
+    }
+
+    int result = listener.kind <= LISTENER_TCP6 ? parse_inet_address(&listener, address_text) :
+                                                  parse_unix_address(&listener, address_text);
+    if (result != 0) {
+        return -1;
+    }
+
+    while (options) {
+        char *option = options;
+        options = strchr(options, ',');
+        if (options) {
+            *options++ = '\0';
+        }
+        if (parse_listener_option(&listener, option) != 0) {
+            return -1;
+        }
+    }
+
+    listeners[count++] = listener;
+    return 0;
+}
+
+int socket_address_parse(const char *text, struct sockaddr_storage *address, socklen_t *address_length) {
+    char copy[256];
+    if (strlen(text) >= sizeof(copy)) {
+        return -1;
+    }
+    strcpy(copy, text);
+
+    listener_t parsed;
+    memset(&parsed, 0, sizeof(parsed));
+    char *address_text;
+    parsed.kind = parse_kind(copy, &address_text);
+    if (parsed.kind < 0) {
+        return -1;
+    }
+    int result = parsed.kind <= LISTENER_TCP6 ? parse_inet_address(&parsed, address_text) :
+                                                parse_unix_address(&parsed, address_text);
+    if (result != 0) {
+        return -1;
+    }
+    memcpy(address, &parsed.address, sizeof(parsed.address));
+    *address_length = parsed.address_length;
+    return parsed.kind;
+}
+
+int listener_add_port(int port) {
+    char specification[32];
+    int probe = socket(AF_INET6, SOCK_STREAM, 0);
+    if (probe >= 0) {
+        close(probe);
+        snprintf(specification, sizeof(specification), "tcp6:%d", port);
+    } else {
+        snprintf(specification, sizeof(specification), "tcp4:%d", port);
+    }
+    return listener_add(specification);
+}
+
+int listener_count(void) {
+    return count;
+}
+
+void listener_inherit(const int *sockets, int socket_count) {
+    for (int i = 0; i < socket_count && inherited_count < MAX_LISTENERS; i++) {
+        inherited[inherited_count++] = sockets[i];
+    }
+}
+
+// Whether a bound socket is the endpoint a listener describes
+static int same_address(const listener_t *listener, const struct sockaddr_storage *bound, socklen_t bound_length) {
+    if (bound->ss_family != listener->address.ss_family) {
+        return 0;
+    }
+    if (bound->ss_family == AF_INET) {
+        const struct sockaddr_in *a = (const struct sockaddr_in *)bound;
+        const struct sockaddr_in *b = (const struct sockaddr_in *)&listener->address;
+        return a->sin_port == b->sin_port && a->sin_addr.s_addr == b->sin_addr.s_addr;
+    }
+    if (bound->ss_family == AF_INET6) {
+        const struct sockaddr_in6 *a = (const struct sockaddr_in6 *)bound;
+        const struct sockaddr_in6 *b = (const struct sockaddr_in6 *)&listener->address;
+        return a->sin6_port == b->sin6_port && memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr)) == 0;
+    }
+    // The kernel reports a path without the padding the listener was bound with
+    const char *a = ((const struct sockaddr_un *)bound)->sun_path;
+    const char *b = ((const struct sockaddr_un *)&listener->address)->sun_path;
+    size_t path_offset = offsetof(struct sockaddr_un, sun_path);
+    if (listener->kind == LISTENER_ABSTRACT) {
+        return bound_length == listener->address_length && memcmp(a, b, bound_length - path_offset) == 0;
+    }
+    return bound_length > path_offset && a[0] != '\0' &&
+           strncmp(a, b, sizeof(((struct sockaddr_un *)0)->sun_path)) == 0;
+}
+
+// Take an inherited socket bound to this listener's address, or -1
+static int claim_inherited(const listener_t *listener) {
+    for (int i = 0; i < inherited_count; i++) {
+        struct sockaddr_storage bound;
+        socklen_t bound_length = sizeof(bound);
+        if (inherited[i] < 0 || getsockname(inherited[i], (struct sockaddr *)&bound, &bound_length) < 0) {
+            continue;
+        }
+        if (same_address(listener, &bound, bound_length)) {
+            int fd = inherited[i];
+            inherited[i] = -1;
+            return fd;
+        }
+    }
+    return -1;
+}
+
+// Adopt an inherited socket: it is already bound and listening, and
+// connections queued on it while the old process handed over stay there
+static int adopt_listener(listener_t *listener, int fd, const socket_options_t *defaults, const char *name) {
+    char tuning[512];
+    socket_options_merge(&listener->options, defaults);
+    if (socket_options_apply(fd, listener->address.ss_family, &listener->options, tuning, sizeof(tuning)) > 0) {
+        fprintf(stderr, "Warning: some socket options for %s were refused\n", name);
+    }
+    // Calling listen() again only updates the backlog
+    if (listen(fd, listener->backlog) < 0) {
+        fprintf(stderr, "Failed to listen on %s: %s\n", name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    listener->socket = fd;
+
+    printf("HTTP server listening on %s (inherited, backlog %d%s)\n", name, listener->backlog,
+           listener->kind == LISTENER_TCP6 && !listener->v6only ? ", dual-stack" : "");
+    printf("  socket options: %s\n", tuning[0] ? tuning : "kernel defaults");
+    return 0;
+}
+
+static int open_listener(listener_t *listener, const socket_options_t *defaults) {
+    char name[SOCKET_ADDRESS_TEXT_SIZE];
+    socket_address_format((struct sockaddr *)&listener->address, listener->address_length, name, sizeof(name));
+
+    int inherited_socket = claim_inherited(listener);
+    if (inherited_socket >= 0) {
+        return adopt_listener(listener, inherited_socket, defaults, name);
+    }
+
+    // Close-on-exec, so a binary started by an upgrade only gets the
+    // listeners it is handed explicitly
+    int fd = socket(listener->address.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to create socket for %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+
+    int on = 1;
+    if (listener->kind <= LISTENER_TCP6 &&
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
+        fprintf(stderr, "Failed to set socket options for %s: %s\n", name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if (listener->reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+        fprintf(stderr, "Failed to enable SO_REUSEPORT for %s: %s\n", name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    // Set explicitly: the system default (net.ipv6.bindv6only) varies
+    if (listener->kind == LISTENER_TCP6 &&
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &listener->v6only, sizeof(listener->v6only)) < 0) {
+        fprintf(stderr, "Failed to set IPV6_V6ONLY for %s: %s\n", name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    // A socket file left behind by a server that did not shut down cleanly
+    // would make bind() fail; anything that is not a socket is left alone
+    const char *path = ((struct sockaddr_un *)&listener->address)->sun_path;
+    struct stat file_status;
+    if (listener->kind == LISTENER_UNIX && lstat(path, &file_status) == 0 && S_ISSOCK(file_status.st_mode)) {
+        unlink(path);
+    }
+
+    if (bind(fd, (struct sockaddr *)&listener->address, listener->address_length) < 0) {
+        fprintf(stderr, "Failed to bind %s: %s\n", name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if (listener->kind == LISTENER_UNIX && listener->mode >= 0 && chmod(path, listener->mode) < 0) {
+        fprintf(stderr, "Failed to set permissions of %s: %s\n", name, strerror(errno));
+        unlink(path);
+        close(fd);
+        return -1;
+    }
+    // Set before listen() so the buffer sizes shape the advertised window
+    // scale and Fast Open has its queue from the first SYN
+    char tuning[512];
+    socket_options_merge(&listener->options, defaults);
+    if (socket_options_apply(fd, listener->address.ss_family, &listener->options, tuning, sizeof(tuning)) > 0) {
+        fprintf(stderr, "Warning: some socket options for %s were refused\n", name);
+    }
+
+    if (listen(fd, listener->backlog) < 0) {
+        fprintf(stderr, "Failed to listen on %s: %s\n", name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    // Accepting never blocks; the accept loop waits in poll() across all endpoints
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    listener->socket = fd;
+
+    printf("HTTP server listening on %s (backlog %d%s)\n", name, listener->backlog,
+           listener->kind == LISTENER_TCP6 && !listener->v6only ? ", dual-stack" : "");
+    printf("  socket options: %s\n", tuning[0] ? tuning : "kernel defaults");
+    return 0;
+}
+
+int listener_open_all(const socket_options_t *defaults) {
+    int result = 0;
+    for (int i = 0; i < count && result == 0; i++) {
+        if (open_listener(&listeners[i], defaults) != 0) {
+            listener_close_all();
+            result = -1;
+        }
+    }
+
+    // Endpoints the old process had but the new configuration dropped
+    for (int i = 0; i < inherited_count; i++) {
+        if (inherited[i] >= 0) {
+            close(inherited[i]);
+        }
+    }
+    inherited_count = 0;
+    return result;
+}
+
+int listener_sockets(int *sockets, int max_sockets) {
+    int found = 0;
+    for (int i = 0; i < count && found < max_sockets; i++) {
+        if (listeners[i].socket >= 0) {
+            sockets[found++] = listeners[i].socket;
+        }
+    }
+    return found;
+}
+
+int listener_wakeup_init(void) {
+    if (wake_pipe[0] >= 0) {
+        // Inherited from the master; each worker needs its own
+        close(wake_pipe[0]);
+        close(wake_pipe[1]);
+    }
+    if (pipe2(wake_pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+        wake_pipe[0] = wake_pipe[1] = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void listener_interrupt(void) {
+    if (wake_pipe[1] >= 0) {
+        int saved_errno = errno;
+        char wake = 1;
+        ssize_t ignored = write(wake_pipe[1], &wake, 1); // A full pipe already wakes the loop
+        (void)ignored;
+        errno = saved_errno;
+    }
+}
+
+int listener_accept(struct sockaddr_storage *client_address, socklen_t *client_address_length) {
+    struct pollfd poll_fds[MAX_LISTENERS + 1];
+
+    while (1) {
+        // Try every endpoint before sleeping, so a busy server rarely polls
+        for (int n = 0; n < count; n++) {
+            int i = (next_listener + n) % count;
+            *client_address_length = sizeof(struct sockaddr_storage);
+            int client_socket = accept4(listeners[i].socket, (struct sockaddr *)client_address,
+                                        client_address_length, SOCK_CLOEXEC);
+            if (client_socket >= 0) {
+                next_listener = (i + 1) % count;
+                return client_socket;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED) {
+                return -1;
+            }
+        }
+
+        for (int i = 0; i < count; i++) {
+            poll_fds[i].fd = listeners[i].socket;
+            poll_fds[i].events = POLLIN;
+            poll_fds[i].revents = 0;
+        }
+        poll_fds[count].fd = wake_pipe[0]; // Ignored by poll() while negative
+        poll_fds[count].events = POLLIN;
+        poll_fds[count].revents = 0;
+        if (poll(poll_fds, count + 1, -1) < 0) {
+            return -1;
+        }
+        if (poll_fds[count].revents & POLLIN) {
+            char drained[64];
+            while (read(wake_pipe[0], drained, sizeof(drained)) > 0) {
+            }
+            errno = EINTR;
+            return -1;
+        }
+    }
+}
+
+void listener_detach(void) {
+    owns_paths = 0;
+}
+
+void listener_close_all(void) {
+    for (int i = 0; i < count; i++) {
+        if (listeners[i].socket < 0) {
+            continue;
+        }
+        close(listeners[i].socket);
+        listeners[i].socket = -1;
+        if (listeners[i].kind == LISTENER_UNIX && owns_paths) {
+            unlink(((struct sockaddr_un *)&listeners[i].address)->sun_path);
+        }
+    }
+}
+
+void socket_address_format(const struct sockaddr *address, socklen_t address_length, char *text, size_t text_size) {
+    char host[INET6_ADDRSTRLEN];
+
+    if (address->sa_family == AF_INET) {
+        const struct sockaddr_in *inet = (const struct sockaddr_in *)address;
+        inet_ntop(AF_INET, &inet->sin_addr, host, sizeof(host));
+        snprintf(text, text_size, "%s:%d", host, ntohs(inet->sin_port));
+    } else if (address->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *inet6 = (const struct sockaddr_in6 *)address;
+        if (IN6_IS_ADDR_V4MAPPED(&inet6->sin6_addr)) {
+            // An IPv4 client of a dual-stack listener
+            inet_ntop(AF_INET, &inet6->sin6_addr.s6_addr[12], host, sizeof(host));
+            snprintf(text, text_size, "%s:%d", host, ntohs(inet6->sin6_port));
+        } else {
+            inet_ntop(AF_INET6, &inet6->sin6_addr, host, sizeof(host));
+            snprintf(text, text_size, "[%s]:%d", host, ntohs(inet6->sin6_port));
+        }
+    } else if (address->sa_family == AF_UNIX) {
+        const struct sockaddr_un *local = (const struct sockaddr_un *)address;
+        size_t path_offset = offsetof(struct sockaddr_un, sun_path);
+        if (address_length <= path_offset) {
+            snprintf(text, text_size, "unix"); // Unnamed peer
+        } else if (local->sun_path[0] == '\0') {
+            snprintf(text, text_size, "abstract:%.*s", (int)(address_length - path_offset - 1), local->sun_path + 1);
+        } else {
+            snprintf(text, text_size, "unix:%.*s", (int)(address_length - path_offset), local->sun_path);
+        }
+    } else {
+        snprintf(text, text_size, "unknown");
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include <stddef.h>
+#include <sys/socket.h>
+#include "socket_options.h"
+
+#define MAX_LISTENERS 16
+#define SOCKET_ADDRESS_TEXT_SIZE 128   // Fits any address socket_address_format() writes
+
+// Kinds of endpoint the server can accept connections on
+#define LISTENER_TCP4     0
+#define LISTENER_TCP6     1   // Dual-stack unless v6only is given
+#define LISTENER_UNIX     2   // Filesystem path
+#define LISTENER_ABSTRACT 3   // Linux abstract namespace, no file
+
+typedef struct {
+    int kind;
+    struct sockaddr_storage address;
+    socklen_t address_length;
+    int backlog;
+    int mode;               // Permissions of a Unix socket file, -1 leaves them to the umask
+    int v6only;             // Accept IPv6 only on a tcp6 listener
+    int reuseport;          // SO_REUSEPORT
+    socket_options_t options; // Tuning; unset ones come from the -O defaults
+    int socket;             // -1 until opened
+} listener_t;
+
+// Add an endpoint from a --listen specification:
+//   tcp4:[host:]port   tcp6:[[host]:]port   unix:/path   abstract:name
+// followed by any of ",backlog=N", ",mode=0660", ",v6only", ",reuseport"
+// and the socket options ",nodelay", ",defer_accept=S", ",fastopen=N",
+// ",rcvbuf=B", ",sndbuf=B", ",busy_poll=US".
+// Hosts are numeric addresses; tcp4 defaults to 0.0.0.0 and tcp6 to [::].
+int listener_add(const char *specification);
+
+// Add the default endpoint for -p: all addresses on the port, dual-stack
+// when the host has IPv6 and plain IPv4 otherwise
+int listener_add_port(int port);
+
+// Number of endpoints added
+int listener_count(void);
+
+// Hand over listening sockets received from the process being upgraded.
+// listener_open_all() adopts the one bound to each endpoint's address
+// rather than binding again, and closes any no endpoint asks for.
+void listener_inherit(const int *sockets, int socket_count);
+
+// Bind and listen on every endpoint, tuned with its own socket options
+// and the defaults for the rest. Returns 0, or -1 after closing any that
+// were opened when one of them fails.
+int listener_open_all(const socket_options_t *defaults);
+
+// Copy the open listening sockets into sockets; returns how many
+int listener_sockets(int *sockets, int max_sockets);
+
+// Set up the pipe listener_interrupt() writes to. Called by every process
+// that runs the accept loop, after any fork.
+int listener_wakeup_init(void);
+
+// Make a waiting listener_accept() return -1 with errno EINTR. Only uses
+// async-signal-safe calls, so a signal handler can stop the accept loop.
+void listener_interrupt(void);
+
+// Wait until a connection arrives on any endpoint and accept it. Returns
+// the client socket, or -1 with errno set (EINTR when a signal arrived).
+int listener_accept(struct sockaddr_storage *client_address, socklen_t *client_address_length);
+
+// In a forked worker, or after handing the endpoints to an upgraded
+// binary: they stay owned by another process, so closing them here leaves
+// Unix socket files in place
+void listener_detach(void);
+
+// Close every endpoint and remove Unix socket files. Only uses
+// async-signal-safe calls, so it can run in a signal handler.
+void listener_close_all(void);
+
+// Parse an address in the --listen forms, without options, for connecting
+// to rather than listening on. Returns its LISTENER_ kind, or -1.
+int socket_address_parse(const char *text, struct sockaddr_storage *address, socklen_t *address_length);
+
+// Write "host:port", "[v6host]:port" or "unix:path" for an address
+void socket_address_format(const struct sockaddr *address, socklen_t address_length, char *text, size_t text_size);
+
+#endif
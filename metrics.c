@@ -0,0 +1,79 @@
+#include <string.h>
+#include <time.h>
+#include "metrics.h"
+
+// Each stripe starts on its own cache line. A thread keeps the stripe it
+// was first given, so increments are uncontended unless more than
+// METRICS_STRIPES threads are busy at once, and they stay relaxed atomics.
+typedef struct {
+    request_metrics_t counts;
+} __attribute__((aligned(64))) metrics_stripe_t;
+
+static metrics_stripe_t stripes[METRICS_STRIPES];
+static unsigned int next_stripe = 0;
+static __thread request_metrics_t *thread_stripe = NULL;
+
+static request_metrics_t *stripe(void) {
+    if (!thread_stripe) {
+        unsigned int index = __atomic_fetch_add(&next_stripe, 1, __ATOMIC_RELAXED) % METRICS_STRIPES;
+        thread_stripe = &stripes[index].counts;
+    }
+    return thread_stripe;
+}
+
+static void add(unsigned long long *counter, unsigned long long amount) {
+    __atomic_fetch_add(counter, amount, __ATOMIC_RELAXED);
+}
+
+unsigned long long metrics_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void metrics_count_connection(void) {
+    add(&stripe()->connections_accepted, 1);
+}
+
+void metrics_count_route(int route_index) {
+    if (route_index < 0 || route_index > METRICS_ROUTE_OTHER) {
+        route_index = METRICS_ROUTE_OTHER;
+    }
+    add(&stripe()->route_requests[route_index], 1);
+}
+
+void metrics_count_request(int status_code, size_t bytes_received, size_t bytes_sent,
+                           unsigned long long latency_ns) {
+    request_metrics_t *counts = stripe();
+    add(&counts->requests, 1);
+    add(&counts->bytes_received, bytes_received);
+    add(&counts->bytes_sent, bytes_sent);
+
+    int status_class = status_code / 100;
+    add(&counts->status_classes[status_class >= 1 && status_class <= 5 ? status_class : 0], 1);
+
+    unsigned long long microseconds = latency_ns / 1000;
+    int bucket = microseconds ? 64 - __builtin_clzll(microseconds) : 0;
+    add(&counts->latency_buckets[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1], 1);
+}
+
+void metrics_count_cache(int cache, int hit) {
+    if (cache < 0 || cache >= METRICS_CACHE_COUNT) {
+        return;
+    }
+    add(hit ? &stripe()->cache_hits[cache] : &stripe()->cache_misses[cache], 1);
+}
+
+void metrics_get(request_metrics_t *metrics) {
+    // Every field is an unsigned long long, so the stripes add up word by word
+    unsigned long long *sum = (unsigned long long *)metrics;
+    size_t words = sizeof(request_metrics_t) / sizeof(unsigned long long);
+
+    memset(metrics, 0, sizeof(request_metrics_t));
+    for (int s = 0; s < METRICS_STRIPES; s++) {
+        const unsigned long long *part = (const unsigned long long *)&stripes[s].counts;
+        for (size_t i = 0; i < words; i++) {
+            sum[i] += __atomic_load_n(&part[i], __ATOMIC_RELAXED);
+        }
+    }
+}
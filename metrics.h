@@ -0,0 +1,53 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include "route_handler.h"
+
+// Counter copies spread over threads, so the request path never fights
+// over one cache line
+#define METRICS_STRIPES 16
+
+// Bucket 0 is under 1us, bucket i (i >= 1) is [2^(i-1), 2^i) microseconds;
+// the last one also takes everything slower
+#define LATENCY_BUCKETS 24
+
+// Caches whose hit rate is tracked
+#define METRICS_CACHE_FILE     0
+#define METRICS_CACHE_RESPONSE 1
+#define METRICS_CACHE_COUNT    2
+
+// Requests that matched no route are counted here
+#define METRICS_ROUTE_OTHER MAX_ROUTES
+
+typedef struct {
+    unsigned long long connections_accepted;
+    unsigned long long requests;
+    unsigned long long bytes_received;               // Request bodies
+    unsigned long long bytes_sent;                   // Responses, heads included
+    unsigned long long status_classes[6];            // Index status / 100; 0 for anything out of range
+    unsigned long long route_requests[MAX_ROUTES + 1];
+    unsigned long long latency_buckets[LATENCY_BUCKETS];
+    unsigned long long cache_hits[METRICS_CACHE_COUNT];
+    unsigned long long cache_misses[METRICS_CACHE_COUNT];
+} request_metrics_t;
+
+// Monotonic clock for timing a request
+unsigned long long metrics_now_ns(void);
+
+void metrics_count_connection(void);
+
+// A request routed to routes[route_index], or METRICS_ROUTE_OTHER
+void metrics_count_route(int route_index);
+
+// A finished request: its status, sizes and time from the end of its head
+// to the last byte of the response
+void metrics_count_request(int status_code, size_t bytes_received, size_t bytes_sent,
+                           unsigned long long latency_ns);
+
+void metrics_count_cache(int cache, int hit);
+
+// Sum over every stripe
+void metrics_get(request_metrics_t *metrics);
+
+#endif
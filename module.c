@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dlfcn.h>
+#include "module.h"
+#include "module_api.h"
+#include "route_handler.h"
+#include "executor.h"
+#include "http_body.h"
+
+typedef struct {
+    char prefix[128];
+    int module;                        // Index of the module that registered it
+    http_module_handler_t handler;
+    void *context;
+} module_route_t;
+
+typedef struct {
+    char name[64];
+    void *handle;
+    int route_count;
+} module_t;
+
+static module_t modules[MAX_MODULES];
+static int loaded_count = 0;
+static module_route_t routes[MODULE_MAX_ROUTES];
+static int route_count = 0;
+static int initializing = -1;          // Module whose init is running, the only time routes can be added
+
+static int api_register_route(const char *pattern, int methods, int run, http_module_handler_t handler,
+                              void *context) {
+    static const int executor_classes[] = { EXECUTOR_INLINE, EXECUTOR_BLOCKING, EXECUTOR_CPU };
+    static const int known_methods = HTTP_MODULE_METHOD_GET | HTTP_MODULE_METHOD_POST | HTTP_MODULE_METHOD_PUT;
+    if (initializing < 0 || !pattern || !handler || route_count >= MODULE_MAX_ROUTES ||
+        methods == 0 || (methods & ~known_methods) ||
+        strlen(pattern) >= sizeof(routes[0].prefix) || pattern[0] != '/' ||
+        run < 0 || run >= (int)(sizeof(executor_classes) / sizeof(executor_classes[0]))) {
+        return -1;
+    }
+
+    // A second route with the same pattern would never be matched
+    const route_t *existing = find_route(pattern);
+    if (existing && strcmp(existing->prefix, pattern) == 0) {
+        return -1;
+    }
+
+    int route_methods = 0;
+    route_methods |= (methods & HTTP_MODULE_METHOD_GET) ? ROUTE_METHOD_GET : 0;
+    route_methods |= (methods & HTTP_MODULE_METHOD_POST) ? ROUTE_METHOD_POST : 0;
+    route_methods |= (methods & HTTP_MODULE_METHOD_PUT) ? ROUTE_METHOD_PUT : 0;
+    if (register_route(pattern, route_methods, executor_classes[run], handle_module) != 0) {
+        return -1;
+    }
+
+    module_route_t *route = &routes[route_count++];
+    strcpy(route->prefix, pattern);
+    route->module = initializing;
+    route->handler = handler;
+    route->context = context;
+    modules[initializing].route_count++;
+    return 0;
+}
+
+static int names_equal(const char *name, size_t name_length, const char *wanted) {
+    return strlen(wanted) == name_length && strncasecmp(name, wanted, name_length) == 0;
+}
+
+static int string_view(const char *text, http_module_string_t *value) {
+    if (!text[0]) {
+        return 0;
+    }
+    value->data = text;
+    value->length = strlen(text);
+    return 1;
+}
+
+static int api_header(const http_module_request_t *module_request, const char *name, http_module_string_t *value) {
+    const http_request_t *request = module_request->server_request;
+    if (!name || !value) {
+        return 0;
+    }
+
+    if (!request->raw_head) {
+        // HTTP/2 requests only keep the fields the server itself uses
+        if (strcasecmp(name, "Host") == 0) {
+            return string_view(request->host, value);
+        } else if (strcasecmp(name, "Content-Type") == 0) {
+            return string_view(request->content_type, value);
+        } else if (strcasecmp(name, "Accept-Encoding") == 0) {
+            return string_view(request->accept_encoding, value);
+        } else if (strcasecmp(name, "If-None-Match") == 0) {
+            return string_view(request->if_none_match, value);
+        }
+        return 0;
+    }
+
+    // Scan the head as received, after the request line
+    const char *end = request->raw_head + request->header_length;
+    const char *line = memchr(request->raw_head, '\n', request->header_length);
+    while (line && ++line < end) {
+        const char *line_end = memchr(line, '\n', end - line);
+        if (!line_end) {
+            break;
+        }
+        const char *colon = memchr(line, ':', line_end - line);
+        if (colon && names_equal(line, colon - line, name)) {
+            const char *start = colon + 1;
+            const char *stop = line_end;
+            while (start < stop && (*start == ' ' || *start == '\t')) {
+                start++;
+            }
+            while (stop > start && (stop[-1] == '\r' || stop[-1] == ' ' || stop[-1] == '\t')) {
+                stop--;
+            }
+            value->data = start;
+            value->length = stop - start;
+            return 1;
+        }
+        line = line_end;
+    }
+    return 0;
+}
+
+static int api_param(const http_module_request_t *request, const char *name, http_module_string_t *value) {
+    if (!name || !value) {
+        return 0;
+    }
+    size_t name_length = strlen(name);
+    const char *cursor = request->query.data;
+    const char *end = cursor + request->query.length;
+    while (cursor < end) {
+        const char *pair_end = memchr(cursor, '&', end - cursor);
+        if (!pair_end) {
+            pair_end = end;
+        }
+        const char *equals = memchr(cursor, '=', pair_end - cursor);
+        const char *name_end = equals ? equals : pair_end;
+        if ((size_t)(name_end - cursor) == name_length && memcmp(cursor, name, name_length) == 0) {
+            value->data = equals ? equals + 1 : pair_end;
+            value->length = pair_end - value->data;
+            return 1;
+        }
+        cursor = pair_end + 1;
+    }
+    return 0;
+}
+
+static ssize_t api_read_body(const http_module_request_t *module_request, void *buffer, size_t length) {
+    const http_request_t *request = module_request->server_request;
+    if (!request->body_reader) {
+        return 0;
+    }
+    return http_body_read(request->body_reader, buffer, length);
+}
+
+static void api_set_status(http_module_response_t *response, int status_code) {
+    set_response_status((http_response_t *)response, status_code);
+}
+
+static int api_set_content_type(http_module_response_t *response, const char *content_type) {
+    http_response_t *server_response = (http_response_t *)response;
+    if (!content_type || strlen(content_type) >= sizeof(server_response->content_type)) {
+        return -1;
+    }
+    set_response_content_type(server_response, content_type);
+    return 0;
+}
+
+static int api_add_header(http_module_response_t *response, const char *name, const char *value) {
+    return add_response_header((http_response_t *)response, name, value);
+}
+
+static char *api_body_buffer(http_module_response_t *response, size_t capacity) {
+    return reserve_response_body((http_response_t *)response, capacity);
+}
+
+static int api_commit_body(http_module_response_t *response, size_t length) {
+    return trim_response_body((http_response_t *)response, length);
+}
+
+// Module data lives until the server exits, so there is nothing to release
+static void keep_module_data(void *owner) {
+    (void)owner;
+}
+
+static int api_static_body(http_module_response_t *response, const void *data, size_t length) {
+    return set_response_body_shared((http_response_t *)response, data, length, keep_module_data, NULL);
+}
+
+static const http_module_api_t api = {
+    sizeof(http_module_api_t),
+    api_register_route,
+    api_header,
+    api_param,
+    api_read_body,
+    api_set_status,
+    api_set_content_type,
+    api_add_header,
+    api_body_buffer,
+    api_commit_body,
+    api_static_body
+};
+
+int module_load(const char *specification) {
+    if (loaded_count >= MAX_MODULES) {
+        fprintf(stderr, "Too many modules, at most %d can be loaded\n", MAX_MODULES);
+        return -1;
+    }
+
+    char path[1024];
+    const char *equals = strchr(specification, '=');
+    size_t path_length = equals ? (size_t)(equals - specification) : strlen(specification);
+    if (path_length == 0 || path_length >= sizeof(path)) {
+        fprintf(stderr, "Invalid module path '%s'\n", specification);
+        return -1;
+    }
+    memcpy(path, specification, path_length);
+    path[path_length] = '\0';
+
+    // Resolve every symbol now, so a module missing one fails at startup
+    // rather than on its first request
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        fprintf(stderr, "Failed to load module: %s\n", dlerror());
+        return -1;
+    }
+    const http_module_t *definition = dlsym(handle, HTTP_MODULE_SYMBOL);
+    if (!definition || !definition->init) {
+        fprintf(stderr, "Module %s does not export %s\n", path, HTTP_MODULE_SYMBOL);
+        dlclose(handle);
+        return -1;
+    }
+    if (definition->abi_version != HTTP_MODULE_ABI_VERSION) {
+        fprintf(stderr, "Module %s was built for handler ABI version %u, not %d\n",
+                path, definition->abi_version, HTTP_MODULE_ABI_VERSION);
+        dlclose(handle);
+        return -1;
+    }
+
+    module_t *module = &modules[loaded_count];
+    memset(module, 0, sizeof(module_t));
+    snprintf(module->name, sizeof(module->name), "%.63s", definition->name ? definition->name : path);
+    module->handle = handle;
+
+    // Routes it registered stay behind if init then fails, so the module is
+    // kept loaded and the server gives up instead
+    initializing = loaded_count;
+    int result = definition->init(&api, equals ? equals + 1 : "");
+    initializing = -1;
+    loaded_count++;
+    if (result != 0) {
+        fprintf(stderr, "Module %s failed to initialize\n", module->name);
+        return -1;
+    }
+    return 0;
+}
+
+int module_count(void) {
+    return loaded_count;
+}
+
+const char *module_name(int index) {
+    return index >= 0 && index < loaded_count ? modules[index].name : NULL;
+}
+
+int module_route_count(int index) {
+    return index >= 0 && index < loaded_count ? modules[index].route_count : 0;
+}
+
+static const module_route_t *find_module_route(const char *path) {
+    const route_t *matched = find_route(path);
+    for (int i = 0; matched && i < route_count; i++) {
+        if (strcmp(routes[i].prefix, matched->prefix) == 0) {
+            return &routes[i];
+        }
+    }
+    return NULL;
+}
+
+void handle_module(const http_request_t *request, http_response_t *response) {
+    const module_route_t *route = find_module_route(request->path);
+    if (!route) {
+        set_response_status(response, HTTP_STATUS_INTERNAL_ERROR);
+        set_response_body_string(response, "Server error: No module handles this route");
+        return;
+    }
+
+    // Views into the parsed request, which outlives the handler call
+    http_module_request_t module_request;
+    module_request.method.data = request->method;
+    module_request.method.length = strlen(request->method);
+    module_request.path.data = request->path;
+    module_request.path.length = strlen(request->path);
+    module_request.query.data = request->query;
+    module_request.query.length = strlen(request->query);
+    module_request.content_length = request->chunked ? 0 : request->content_length;
+    module_request.server_request = request;
+
+    route->handler(&module_request, (http_module_response_t *)response, route->context);
+}
@@ -0,0 +1,27 @@
+#ifndef MODULE_H
+#define MODULE_H
+
+#include "http_request.h"
+#include "http_response.h"
+
+// Handler modules (--module path.so[=arguments]), shared objects built
+// against module_api.h that add routes served in-process. Modules are
+// loaded while the options are parsed, so -R and --cache apply to their
+// routes like any other, and they stay loaded until the server exits.
+#define MAX_MODULES 16
+#define MODULE_MAX_ROUTES 32           // Over every module
+
+// Load a module and let it register its routes. Prints why and returns -1
+// if it cannot be loaded, was built for another ABI version or fails to
+// initialize.
+int module_load(const char *specification);
+
+// Loaded modules and how many routes each registered, for reporting
+int module_count(void);
+const char *module_name(int index);
+int module_route_count(int index);
+
+// Pass a request to the module handler of the route it matched
+void handle_module(const http_request_t *request, http_response_t *response);
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef MODULE_API_H
+#define MODULE_API_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// The interface between the server and handler modules loaded with
+// --module. A module is a shared object built against this header alone; it
+// exports a http_module_t named "http_module" whose init function registers
+// routes through the api it is handed.
+//
+// Requests are passed as read-only views into the server's own parsed
+// request, and bodies are written straight into buffers the server sends
+// from, so nothing is copied on the way in or out. Views are only valid
+// while the handler runs.
+//
+// HTTP_MODULE_ABI_VERSION changes whenever an existing type or function
+// changes; the server refuses modules built for another version. Functions
+// are only ever appended to http_module_api_t, so a module can check
+// api->size to use one added after it was written.
+#define HTTP_MODULE_ABI_VERSION 1
+#define HTTP_MODULE_SYMBOL "http_module"
+
+// Methods a route accepts
+#define HTTP_MODULE_METHOD_GET  0x1
+#define HTTP_MODULE_METHOD_POST 0x2
+#define HTTP_MODULE_METHOD_PUT  0x4
+
+// Where handlers run: on the connection thread, or queued to the pool for
+// handlers that wait on I/O or burn CPU. Operators can still move a route
+// with -R.
+#define HTTP_MODULE_RUN_INLINE   0
+#define HTTP_MODULE_RUN_BLOCKING 1
+#define HTTP_MODULE_RUN_CPU      2
+
+// Bytes owned by the server, not terminated
+typedef struct {
+    const char *data;
+    size_t length;
+} http_module_string_t;
+
+typedef struct {
+    http_module_string_t method;
+    http_module_string_t path;      // Decoded and normalized, without the query string
+    http_module_string_t query;     // As sent, still percent-encoded
+    size_t content_length;          // 0 when there is no body or it is chunked
+    const void *server_request;     // For the server's use
+} http_module_request_t;
+
+typedef struct http_module_response http_module_response_t;
+
+typedef void (*http_module_handler_t)(const http_module_request_t *request,
+                                      http_module_response_t *response, void *context);
+
+typedef struct {
+    size_t size;                    // sizeof(http_module_api_t) in the server
+
+    // Route requests to handler with context. A pattern ending in '/'
+    // matches every path below it, any other only itself; the longest
+    // match over all routes wins. methods is one or more HTTP_MODULE_METHOD_
+    // flags. Only valid during init. Returns 0, or -1 if the pattern is
+    // taken, methods is empty or unknown, or there are too many routes.
+    int (*register_route)(const char *pattern, int methods, int run, http_module_handler_t handler,
+                          void *context);
+
+    // Find a request header by name, ignoring case. HTTP/2 requests only
+    // keep Host, Content-Type, Accept-Encoding and If-None-Match. Returns
+    // 1 and sets *value when the header is present, 0 otherwise.
+    int (*header)(const http_module_request_t *request, const char *name, http_module_string_t *value);
+
+    // Find a query parameter by name; the value is still percent-encoded.
+    // Returns 1 and sets *value when present, 0 otherwise.
+    int (*param)(const http_module_request_t *request, const char *name, http_module_string_t *value);
+
+    // Read up to length bytes of the request body. Returns the number of
+    // bytes read, 0 at its end, or -1 on error.
+    ssize_t (*read_body)(const http_module_request_t *request, void *buffer, size_t length);
+
+    // The response starts as 200 text/plain with an empty body
+    void (*set_status)(http_module_response_t *response, int status_code);
+    int (*set_content_type)(http_module_response_t *response, const char *content_type);
+    int (*add_header)(http_module_response_t *response, const char *name, const char *value);
+
+    // Replace the body with a buffer of capacity bytes to write in place.
+    // The body is the whole buffer until commit_body trims it to the bytes
+    // actually written. Returns NULL if it cannot be allocated.
+    char *(*body_buffer)(http_module_response_t *response, size_t capacity);
+    int (*commit_body)(http_module_response_t *response, size_t length);
+
+    // Send data the module keeps for as long as it is loaded, such as a
+    // constant page, without copying it
+    int (*static_body)(http_module_response_t *response, const void *data, size_t length);
+} http_module_api_t;
+
+typedef struct {
+    unsigned int abi_version;       // HTTP_MODULE_ABI_VERSION
+    const char *name;
+
+    // Called once at startup, before any worker processes are forked, with
+    // the text after '=' in --module or "". Start threads lazily, from a
+    // handler, since they would not survive the fork. Returns 0 or -1.
+    int (*init)(const http_module_api_t *api, const char *arguments);
+} http_module_t;
+
+#endif
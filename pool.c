@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "pool.h"
+
+// A free object holds the link to the next free one in its first bytes
+typedef struct free_object {
+    struct free_object *next;
+} free_object_t;
+
+struct pool {
+    int id;
+    const char *name;
+    size_t object_size;
+    pthread_mutex_t mutex;
+    free_object_t *reserve;        // Shared free list, guarded by mutex
+    size_t reserved;
+    char *slab;                    // Rest of the slab being carved, guarded by mutex
+    size_t slab_objects_left;
+    size_t allocated_bytes;
+    size_t in_use;
+    unsigned long long created;
+    unsigned long long reused;
+};
+
+// Free objects this thread took back, per pool. Taking from and giving to
+// these needs no lock.
+typedef struct {
+    free_object_t *head;
+    int count;
+} thread_cache_t;
+
+static struct pool pools[MAX_POOLS];
+static int pool_total = 0;
+
+static __thread thread_cache_t thread_caches[MAX_POOLS];
+static __thread int thread_registered = 0;
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+// Must be called with the pool's mutex held
+static void push_reserve(struct pool *pool, free_object_t *object) {
+    object->next = pool->reserve;
+    pool->reserve = object;
+    pool->reserved++;
+}
+
+// Thread exit: hand everything this thread cached back to the reserves
+static void flush_thread_caches(void *unused) {
+    (void)unused;
+    for (int i = 0; i < pool_total; i++) {
+        thread_cache_t *cache = &thread_caches[i];
+        if (!cache->head) {
+            continue;
+        }
+        pthread_mutex_lock(&pools[i].mutex);
+        while (cache->head) {
+            free_object_t *object = cache->head;
+            cache->head = object->next;
+            push_reserve(&pools[i], object);
+        }
+        pthread_mutex_unlock(&pools[i].mutex);
+        cache->count = 0;
+    }
+}
+
+static void create_cache_key(void) {
+    pthread_key_create(&cache_key, flush_thread_caches);
+}
+
+// The key's destructor only runs for threads that set a value
+static void register_thread(void) {
+    if (!thread_registered) {
+        pthread_once(&cache_key_once, create_cache_key);
+        pthread_setspecific(cache_key, thread_caches);
+        thread_registered = 1;
+    }
+}
+
+pool_t *pool_create(const char *name, size_t object_size) {
+    if (pool_total >= MAX_POOLS || object_size == 0) {
+        return NULL;
+    }
+    struct pool *pool = &pools[pool_total];
+    memset(pool, 0, sizeof(struct pool));
+    pool->id = pool_total;
+    pool->name = name;
+    // Room for the free-list link, and aligned for any type
+    size_t size = object_size < sizeof(free_object_t) ? sizeof(free_object_t) : object_size;
+    pool->object_size = (size + 15) & ~(size_t)15;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pool_total++;
+    return pool;
+}
+
+void *pool_get(pool_t *pool) {
+    thread_cache_t *cache = &thread_caches[pool->id];
+    free_object_t *object = cache->head;
+    if (object) {
+        cache->head = object->next;
+        cache->count--;
+        __atomic_fetch_add(&pool->reused, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&pool->in_use, 1, __ATOMIC_RELAXED);
+        return object;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    object = pool->reserve;
+    if (object) {
+        pool->reserve = object->next;
+        pool->reserved--;
+        __atomic_fetch_add(&pool->reused, 1, __ATOMIC_RELAXED);
+    } else {
+        if (pool->slab_objects_left == 0) {
+            // One malloc per slab keeps small objects dense and saves a
+            // malloc header each; large objects get a slab to themselves
+            size_t objects = POOL_SLAB_BYTES / pool->object_size;
+            if (objects == 0) {
+                objects = 1;
+            }
+            pool->slab = malloc(objects * pool->object_size);
+            if (!pool->slab) {
+                pthread_mutex_unlock(&pool->mutex);
+                return NULL;
+            }
+            pool->slab_objects_left = objects;
+            pool->allocated_bytes += objects * pool->object_size;
+        }
+        object = (free_object_t *)pool->slab;
+        pool->slab += pool->object_size;
+        pool->slab_objects_left--;
+        __atomic_fetch_add(&pool->created, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    __atomic_fetch_add(&pool->in_use, 1, __ATOMIC_RELAXED);
+    return object;
+}
+
+void pool_put(pool_t *pool, void *object) {
+    if (!object) {
+        return;
+    }
+    __atomic_fetch_sub(&pool->in_use, 1, __ATOMIC_RELAXED);
+
+    thread_cache_t *cache = &thread_caches[pool->id];
+    free_object_t *free_object = object;
+    if (cache->count < POOL_THREAD_CACHE) {
+        register_thread();
+        free_object->next = cache->head;
+        cache->head = free_object;
+        cache->count++;
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    push_reserve(pool, free_object);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void pool_flush_thread(void) {
+    flush_thread_caches(NULL);
+}
+
+int pool_count(void) {
+    return pool_total;
+}
+
+void pool_get_stats(int index, pool_stats_t *stats) {
+    memset(stats, 0, sizeof(pool_stats_t));
+    if (index < 0 || index >= pool_total) {
+        return;
+    }
+    struct pool *pool = &pools[index];
+    stats->name = pool->name;
+    stats->object_size = pool->object_size;
+    stats->in_use = __atomic_load_n(&pool->in_use, __ATOMIC_RELAXED);
+    stats->created = __atomic_load_n(&pool->created, __ATOMIC_RELAXED);
+    stats->reused = __atomic_load_n(&pool->reused, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&pool->mutex);
+    stats->reserved = pool->reserved;
+    stats->allocated_bytes = pool->allocated_bytes;
+    pthread_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,45 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+#define MAX_POOLS 8
+#define POOL_THREAD_CACHE 8          // Objects a thread keeps for itself before using the reserve
+#define POOL_SLAB_BYTES (64 * 1024)  // Small objects are carved out of slabs this large
+
+typedef struct pool pool_t;
+
+// Counters of one pool
+typedef struct {
+    const char *name;
+    size_t object_size;
+    size_t in_use;                   // Handed out and not yet returned
+    size_t reserved;                 // Free in the global reserve (thread caches not counted)
+    size_t allocated_bytes;          // Memory taken from malloc for this pool so far
+    unsigned long long created;      // Objects carved from new memory
+    unsigned long long reused;       // Objects handed out again after being returned
+} pool_stats_t;
+
+// Create a pool of fixed-size objects; call before any thread uses it.
+// Objects are recycled rather than freed, so the memory a pool holds
+// follows the peak number in use at once.
+pool_t *pool_create(const char *name, size_t object_size);
+
+// Take an object, from this thread's cache when it has one, else from the
+// shared reserve, else from a new slab. Returns NULL when out of memory.
+// The contents are whatever the previous user left.
+void *pool_get(pool_t *pool);
+
+// Give an object back. A thread's cache spills to the reserve when full
+// and is emptied into it when the thread exits.
+void pool_put(pool_t *pool, void *object);
+
+// Hand this thread's cached objects of every pool back to the reserves,
+// for a thread about to sit idle for a while
+void pool_flush_thread(void);
+
+// Number of pools created, and their counters
+int pool_count(void);
+void pool_get_stats(int index, pool_stats_t *stats);
+
+#endif
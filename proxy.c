@@ -0,0 +1,945 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "proxy.h"
+#include "route_handler.h"
+#include "executor.h"
+#include "http_body.h"
+#include "http_stream.h"
+#include "metrics.h"
+#include "utils.h"
+#include "url_path.h"
+
+#define PROXY_MAX_ATTEMPTS 3      // Connections tried for one request
+#define PROXY_LINE_SIZE 1024      // Longest chunk size or trailer line in a chunked response
+
+// How a body is framed on the upstream connection
+#define FRAMING_NONE    0
+#define FRAMING_LENGTH  1
+#define FRAMING_CHUNKED 2
+#define FRAMING_CLOSE   3         // The body ends when the upstream closes the connection
+
+// How forwarding a request over one connection went
+#define FORWARD_OK            0
+#define FORWARD_NO_RESPONSE   1   // Failed before the upstream sent anything
+#define FORWARD_BAD_RESPONSE  2   // The response was cut short, malformed or too large
+#define FORWARD_CLIENT_FAILED 3   // Reading the request body from the client failed
+
+typedef struct proxy_connection {
+    int fd;
+    struct proxy_connection *next;   // Next idle connection in the pool
+    size_t start;                    // Response bytes not yet used are buffer[start, end)
+    size_t end;
+    char buffer[PROXY_BUFFER_SIZE];
+} proxy_connection_t;
+
+typedef struct {
+    char name[SOCKET_ADDRESS_TEXT_SIZE];
+    int kind;                        // LISTENER_ kind of the address
+    struct sockaddr_storage address;
+    socklen_t address_length;
+    pthread_mutex_t lock;            // Guards the idle pool
+    proxy_connection_t *idle;
+    int idle_count;
+    int outstanding;                 // This and the rest are updated atomically
+    int consecutive_failures;
+    unsigned long long down_until_ns;
+    unsigned long long requests;
+    unsigned long long failures;
+} upstream_t;
+
+typedef struct {
+    char prefix[128];
+    upstream_t upstreams[PROXY_MAX_UPSTREAMS];
+    int upstream_count;
+    unsigned int next;               // Rotates the first pick among equally busy upstreams
+} proxy_route_t;
+
+// A response on its way back from an upstream. Once the head is in, the
+// body is relayed by a stream producer that owns this.
+typedef struct {
+    upstream_t *upstream;
+    proxy_connection_t *connection;
+    int framing;
+    size_t remaining;                // FRAMING_LENGTH: body bytes still to come
+    int reusable;                    // The upstream keeps the connection open after the response
+    int complete;                    // The whole body was relayed
+} proxy_exchange_t;
+
+// One header line of a head, pointing into it
+typedef struct {
+    const char *name;
+    size_t name_length;
+    const char *value;               // Without surrounding whitespace
+    size_t value_length;
+} header_line_t;
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t size;
+    int overflow;
+} head_builder_t;
+
+static proxy_route_t routes[PROXY_MAX_ROUTES];
+static int route_count = 0;
+
+// Headers that only concern one connection, and are never forwarded in
+// either direction, along with any the Connection header names
+static const char *hop_by_hop_headers[] = {
+    "Connection", "Keep-Alive", "Proxy-Connection", "Proxy-Authenticate", "Proxy-Authorization",
+    "TE", "Trailer", "Transfer-Encoding", "Upgrade", NULL
+};
+
+int proxy_add(const char *specification) {
+    const char *equals = strchr(specification, '=');
+    if (!equals || route_count >= PROXY_MAX_ROUTES) {
+        return -1;
+    }
+
+    proxy_route_t *route = &routes[route_count];
+    memset(route, 0, sizeof(proxy_route_t));
+    size_t prefix_length = equals - specification;
+    if (prefix_length == 0 || prefix_length >= sizeof(route->prefix) || specification[0] != '/') {
+        return -1;
+    }
+    memcpy(route->prefix, specification, prefix_length);
+    route->prefix[prefix_length] = '\0';
+
+    // A second route with the same pattern would never be matched
+    const route_t *existing = find_route(route->prefix);
+    if (existing && strcmp(existing->prefix, route->prefix) == 0) {
+        return -1;
+    }
+
+    char list[1024];
+    if (strlen(equals + 1) >= sizeof(list)) {
+        return -1;
+    }
+    strcpy(list, equals + 1);
+    for (char *address = strtok(list, ","); address; address = strtok(NULL, ",")) {
+        if (route->upstream_count >= PROXY_MAX_UPSTREAMS) {
+            return -1;
+        }
+        upstream_t *upstream = &route->upstreams[route->upstream_count];
+        upstream->kind = socket_address_parse(address, &upstream->address, &upstream->address_length);
+        if (upstream->kind < 0) {
+            return -1;
+        }
+        socket_address_format((struct sockaddr *)&upstream->address, upstream->address_length,
+                              upstream->name, sizeof(upstream->name));
+        pthread_mutex_init(&upstream->lock, NULL);
+        route->upstream_count++;
+    }
+    if (route->upstream_count == 0) {
+        return -1;
+    }
+
+    // Handlers run on the connection thread by default: forwarding mostly
+    // waits on the upstream, which a thread per connection can afford
+    if (register_route(route->prefix, ROUTE_METHOD_GET | ROUTE_METHOD_POST | ROUTE_METHOD_PUT,
+                       EXECUTOR_INLINE, handle_proxy) != 0) {
+        return -1;
+    }
+    route_count++;
+    return 0;
+}
+
+int proxy_upstream_count(void) {
+    int count = 0;
+    for (int i = 0; i < route_count; i++) {
+        count += routes[i].upstream_count;
+    }
+    return count;
+}
+
+void proxy_get_upstream_stats(int index, proxy_upstream_stats_t *stats) {
+    memset(stats, 0, sizeof(proxy_upstream_stats_t));
+    for (int i = 0; i < route_count; i++) {
+        if (index >= routes[i].upstream_count) {
+            index -= routes[i].upstream_count;
+            continue;
+        }
+        upstream_t *upstream = &routes[i].upstreams[index];
+        strcpy(stats->route, routes[i].prefix);
+        strcpy(stats->address, upstream->name);
+        stats->outstanding = __atomic_load_n(&upstream->outstanding, __ATOMIC_RELAXED);
+        stats->requests = __atomic_load_n(&upstream->requests, __ATOMIC_RELAXED);
+        stats->failures = __atomic_load_n(&upstream->failures, __ATOMIC_RELAXED);
+        stats->down = __atomic_load_n(&upstream->down_until_ns, __ATOMIC_RELAXED) > metrics_now_ns();
+        pthread_mutex_lock(&upstream->lock);
+        stats->idle = upstream->idle_count;
+        pthread_mutex_unlock(&upstream->lock);
+        return;
+    }
+}
+
+static proxy_route_t *find_proxy_route(const char *path) {
+    const route_t *matched = find_route(path);
+    for (int i = 0; matched && i < route_count; i++) {
+        if (strcmp(routes[i].prefix, matched->prefix) == 0) {
+            return &routes[i];
+        }
+    }
+    return NULL;
+}
+
+// The live upstream with the fewest requests in flight, or NULL when every
+// one not in excluded (a bit per upstream) is down
+static upstream_t *choose_upstream(proxy_route_t *route, unsigned int excluded) {
+    unsigned long long now = metrics_now_ns();
+    unsigned int first = __atomic_fetch_add(&route->next, 1, __ATOMIC_RELAXED);
+    upstream_t *best = NULL;
+    int best_outstanding = 0;
+    for (int i = 0; i < route->upstream_count; i++) {
+        int index = (first + i) % route->upstream_count;
+        upstream_t *upstream = &route->upstreams[index];
+        if ((excluded & (1u << index)) || __atomic_load_n(&upstream->down_until_ns, __ATOMIC_RELAXED) > now) {
+            continue;
+        }
+        int outstanding = __atomic_load_n(&upstream->outstanding, __ATOMIC_RELAXED);
+        if (!best || outstanding < best_outstanding) {
+            best = upstream;
+            best_outstanding = outstanding;
+        }
+    }
+    return best;
+}
+
+// Past PROXY_MAX_FAILURES in a row the upstream is left out for a while.
+// The count is kept, so one more failure after that takes it out again.
+static void upstream_failed(upstream_t *upstream) {
+    __atomic_add_fetch(&upstream->failures, 1, __ATOMIC_RELAXED);
+    if (__atomic_add_fetch(&upstream->consecutive_failures, 1, __ATOMIC_RELAXED) >= PROXY_MAX_FAILURES) {
+        __atomic_store_n(&upstream->down_until_ns, metrics_now_ns() + PROXY_FAIL_TIMEOUT_MS * 1000000ULL,
+                         __ATOMIC_RELAXED);
+    }
+}
+
+static void upstream_succeeded(upstream_t *upstream) {
+    if (__atomic_load_n(&upstream->consecutive_failures, __ATOMIC_RELAXED) != 0) {
+        __atomic_store_n(&upstream->consecutive_failures, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&upstream->down_until_ns, 0, __ATOMIC_RELAXED);
+    }
+}
+
+static proxy_connection_t *connect_upstream(upstream_t *upstream) {
+    proxy_connection_t *connection = malloc(sizeof(proxy_connection_t));
+    if (!connection) {
+        return NULL;
+    }
+    int fd = socket(upstream->address.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        free(connection);
+        return NULL;
+    }
+
+    // Bounds connect() as well as every later send and receive
+    struct timeval timeout = { PROXY_IO_TIMEOUT_MS / 1000, (PROXY_IO_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (upstream->kind == LISTENER_TCP4 || upstream->kind == LISTENER_TCP6) {
+        int enable = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    }
+
+    if (connect(fd, (struct sockaddr *)&upstream->address, upstream->address_length) != 0) {
+        close(fd);
+        free(connection);
+        return NULL;
+    }
+    connection->fd = fd;
+    connection->next = NULL;
+    connection->start = 0;
+    connection->end = 0;
+    return connection;
+}
+
+static void close_connection(proxy_connection_t *connection) {
+    close(connection->fd);
+    free(connection);
+}
+
+// An idle connection from the pool, or a new one. *reused tells which.
+static proxy_connection_t *acquire_connection(upstream_t *upstream, int *reused) {
+    for (;;) {
+        pthread_mutex_lock(&upstream->lock);
+        proxy_connection_t *connection = upstream->idle;
+        if (connection) {
+            upstream->idle = connection->next;
+            upstream->idle_count--;
+        }
+        pthread_mutex_unlock(&upstream->lock);
+        if (!connection) {
+            break;
+        }
+
+        // An idle connection has nothing to read unless the upstream closed it
+        struct pollfd poll_fd = { connection->fd, POLLIN, 0 };
+        if (poll(&poll_fd, 1, 0) == 0) {
+            *reused = 1;
+            return connection;
+        }
+        close_connection(connection);
+    }
+    *reused = 0;
+    return connect_upstream(upstream);
+}
+
+static void release_connection(upstream_t *upstream, proxy_connection_t *connection) {
+    connection->start = 0;
+    connection->end = 0;
+    pthread_mutex_lock(&upstream->lock);
+    if (upstream->idle_count < PROXY_MAX_IDLE) {
+        connection->next = upstream->idle;
+        upstream->idle = connection;
+        upstream->idle_count++;
+        connection = NULL;
+    }
+    pthread_mutex_unlock(&upstream->lock);
+    if (connection) {
+        close_connection(connection);
+    }
+}
+
+// The connection goes back to the pool only after a complete response the
+// upstream did not mean to be the last one
+static void finish_exchange(proxy_exchange_t *exchange) {
+    proxy_connection_t *connection = exchange->connection;
+    if (exchange->complete && exchange->reusable && connection->start == connection->end) {
+        release_connection(exchange->upstream, connection);
+    } else {
+        close_connection(connection);
+    }
+    __atomic_sub_fetch(&exchange->upstream->outstanding, 1, __ATOMIC_RELAXED);
+}
+
+static void free_exchange(void *context) {
+    finish_exchange(context);
+    free(context);
+}
+
+static void append_bytes(head_builder_t *head, const char *data, size_t length) {
+    if (head->overflow || length > head->size - head->length) {
+        head->overflow = 1;
+        return;
+    }
+    memcpy(head->data + head->length, data, length);
+    head->length += length;
+}
+
+static void append_format(head_builder_t *head, const char *format, ...) {
+    if (head->overflow) {
+        return;
+    }
+    va_list arguments;
+    va_start(arguments, format);
+    int written = vsnprintf(head->data + head->length, head->size - head->length, format, arguments);
+    va_end(arguments);
+    if (written < 0 || (size_t)written >= head->size - head->length) {
+        head->overflow = 1;
+        return;
+    }
+    head->length += written;
+}
+
+// Take the next header line of a head, moving *cursor past it. Returns 0 at
+// the blank line that ends the head. A line without a colon gets a NULL name.
+static int next_header(const char **cursor, const char *end, header_line_t *header) {
+    const char *line = *cursor;
+    const char *newline = memchr(line, '\n', end - line);
+    if (!newline) {
+        return 0;
+    }
+    const char *line_end = newline > line && newline[-1] == '\r' ? newline - 1 : newline;
+    *cursor = newline + 1;
+    if (line_end == line) {
+        return 0;
+    }
+
+    const char *colon = memchr(line, ':', line_end - line);
+    header->name = colon ? line : NULL;
+    header->name_length = colon ? (size_t)(colon - line) : 0;
+    const char *value = colon ? colon + 1 : line_end;
+    while (value < line_end && (*value == ' ' || *value == '\t')) {
+        value++;
+    }
+    const char *value_end = line_end;
+    while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t')) {
+        value_end--;
+    }
+    header->value = value;
+    header->value_length = value_end - value;
+    return 1;
+}
+
+static int header_is(const header_line_t *header, const char *name) {
+    return header->name && header->name_length == strlen(name) &&
+           strncasecmp(header->name, name, header->name_length) == 0;
+}
+
+// Whether name is among the comma-separated tokens of list
+static int token_listed(const char *list, size_t list_length, const char *name, size_t name_length) {
+    const char *end = list + list_length;
+    const char *token = list;
+    while (token < end) {
+        while (token < end && (*token == ' ' || *token == '\t' || *token == ',')) {
+            token++;
+        }
+        const char *token_end = token;
+        while (token_end < end && *token_end != ',' && *token_end != ' ' && *token_end != '\t') {
+            token_end++;
+        }
+        if (token_end > token && (size_t)(token_end - token) == name_length &&
+            strncasecmp(token, name, name_length) == 0) {
+            return 1;
+        }
+        token = token_end;
+    }
+    return 0;
+}
+
+// The value of the Connection header of the head after its first line
+static void find_connection_header(const char *cursor, const char *end, header_line_t *connection) {
+    memset(connection, 0, sizeof(header_line_t));
+    header_line_t header;
+    while (next_header(&cursor, end, &header)) {
+        if (header_is(&header, "Connection")) {
+            *connection = header;
+        }
+    }
+}
+
+static int is_hop_by_hop(const header_line_t *header, const header_line_t *connection) {
+    for (int i = 0; hop_by_hop_headers[i]; i++) {
+        if (header_is(header, hop_by_hop_headers[i])) {
+            return 1;
+        }
+    }
+    return connection->value &&
+           token_listed(connection->value, connection->value_length, header->name, header->name_length);
+}
+
+// The request line and headers sent upstream. The path is the normalized
+// one the route matched, so the upstream cannot resolve the target to
+// somewhere outside the prefix. Returns the length, or -1 if it does not fit.
+static int build_request_head(const http_request_t *request, const upstream_t *upstream, int framing,
+                              char *data, size_t size) {
+    head_builder_t head = { data, 0, size, 0 };
+    append_format(&head, "%s ", request->method);
+    // The path was decoded, so it is escaped again
+    int path_length = head.overflow ? -1 : encode_url_path(request->path, head.data + head.length, head.size - head.length);
+    if (path_length < 0) {
+        head.overflow = 1;
+    } else {
+        head.length += path_length;
+    }
+    if (request->query[0]) {
+        append_format(&head, "?%s", request->query);
+    }
+    append_format(&head, " HTTP/1.1\r\n");
+
+    const char *raw_end = request->raw_head ? request->raw_head + request->header_length : NULL;
+    const char *cursor = request->raw_head ? memchr(request->raw_head, '\n', request->header_length) : NULL;
+    if (cursor) {
+        // End-to-end headers are passed on as the client sent them; the body
+        // is framed again and any Expect was already answered by the body reader
+        cursor++;
+        header_line_t connection;
+        find_connection_header(cursor, raw_end, &connection);
+        header_line_t header;
+        while (next_header(&cursor, raw_end, &header)) {
+            if (!header.name || is_hop_by_hop(&header, &connection) || header_is(&header, "Content-Length") ||
+                header_is(&header, "Expect") || header_is(&header, "HTTP2-Settings")) {
+                continue;
+            }
+            append_bytes(&head, header.name, header.value + header.value_length - header.name);
+            append_bytes(&head, "\r\n", 2);
+        }
+        if (!request->host[0]) {
+            append_format(&head, "Host: %s\r\n", upstream->name);
+        }
+    } else {
+        // HTTP/2 requests only keep the fields the server itself uses
+        append_format(&head, "Host: %s\r\n", request->host[0] ? request->host : upstream->name);
+        if (request->content_type[0]) {
+            append_format(&head, "Content-Type: %s\r\n", request->content_type);
+        }
+        if (request->accept_encoding[0]) {
+            append_format(&head, "Accept-Encoding: %s\r\n", request->accept_encoding);
+        }
+        if (request->if_none_match[0]) {
+            append_format(&head, "If-None-Match: %s\r\n", request->if_none_match);
+        }
+    }
+
+    if (framing == FRAMING_LENGTH) {
+        append_format(&head, "Content-Length: %zu\r\n", request->content_length);
+    } else if (framing == FRAMING_CHUNKED) {
+        append_format(&head, "Transfer-Encoding: chunked\r\n");
+    }
+    append_bytes(&head, "\r\n", 2);
+    return head.overflow ? -1 : (int)head.length;
+}
+
+// Relay the request body as it is read from the client, using the
+// connection's buffer, which is empty until the response arrives
+static int send_body(const http_request_t *request, int framing, proxy_connection_t *connection) {
+    http_body_reader_t *reader = request->body_reader;
+    for (;;) {
+        ssize_t length = http_body_read(reader, connection->buffer, sizeof(connection->buffer));
+        if (length < 0) {
+            return FORWARD_CLIENT_FAILED;
+        }
+        if (length == 0) {
+            break;
+        }
+        if (framing == FRAMING_CHUNKED) {
+            char size_line[32];
+            int size_length = snprintf(size_line, sizeof(size_line), "%zx\r\n", (size_t)length);
+            if (send_all_flags(connection->fd, size_line, size_length, MSG_MORE) != 0 ||
+                send_all_flags(connection->fd, connection->buffer, length, MSG_MORE) != 0 ||
+                send_all(connection->fd, "\r\n", 2) != 0) {
+                return FORWARD_NO_RESPONSE;
+            }
+        } else if (send_all(connection->fd, connection->buffer, length) != 0) {
+            return FORWARD_NO_RESPONSE;
+        }
+    }
+    if (framing == FRAMING_CHUNKED && send_all(connection->fd, "0\r\n\r\n", 5) != 0) {
+        return FORWARD_NO_RESPONSE;
+    }
+    return FORWARD_OK;
+}
+
+static ssize_t receive(proxy_connection_t *connection) {
+    ssize_t received;
+    do {
+        received = recv(connection->fd, connection->buffer + connection->end,
+                        sizeof(connection->buffer) - connection->end, 0);
+    } while (received < 0 && errno == EINTR);
+    if (received > 0) {
+        connection->end += received;
+    }
+    return received;
+}
+
+// Length of the head at the start of data, including its blank line, or 0
+static size_t find_head_end(const char *data, size_t length) {
+    for (size_t i = 0; i + 1 < length; i++) {
+        if (data[i] != '\n') {
+            continue;
+        }
+        if (data[i + 1] == '\n') {
+            return i + 2;
+        }
+        if (data[i + 1] == '\r' && i + 2 < length && data[i + 2] == '\n') {
+            return i + 3;
+        }
+    }
+    return 0;
+}
+
+// Read until a whole response head is buffered at buffer + start.
+// Returns its length, or 0 when the upstream failed or the head is too large.
+static size_t read_response_head(proxy_connection_t *connection) {
+    for (;;) {
+        size_t head_length = find_head_end(connection->buffer + connection->start,
+                                           connection->end - connection->start);
+        if (head_length > 0) {
+            return head_length;
+        }
+        if (connection->end == sizeof(connection->buffer)) {
+            if (connection->start == 0) {
+                return 0;
+            }
+            memmove(connection->buffer, connection->buffer + connection->start, connection->end - connection->start);
+            connection->end -= connection->start;
+            connection->start = 0;
+        }
+        if (receive(connection) <= 0) {
+            return 0;
+        }
+    }
+}
+
+// Copy a header value out so it can be used as a string
+static int copy_value(char *destination, size_t size, const header_line_t *header) {
+    if (header->value_length >= size) {
+        return -1;
+    }
+    memcpy(destination, header->value, header->value_length);
+    destination[header->value_length] = '\0';
+    return 0;
+}
+
+// Take the status, end-to-end headers and body framing of a response head.
+// Interim (1xx) responses only set *status. Returns -1 when the head is
+// malformed or its headers do not fit in the response.
+static int parse_response_head(const char *head, size_t length, http_response_t *response,
+                               proxy_exchange_t *exchange, int *status) {
+    // "HTTP/1.x NNN reason"
+    if (length < 12 || strncmp(head, "HTTP/1.", 7) != 0 || !isdigit((unsigned char)head[7]) || head[8] != ' ' ||
+        !isdigit((unsigned char)head[9]) || !isdigit((unsigned char)head[10]) || !isdigit((unsigned char)head[11])) {
+        return -1;
+    }
+    *status = (head[9] - '0') * 100 + (head[10] - '0') * 10 + (head[11] - '0');
+    if (*status < 100) {
+        return -1;
+    }
+    if (*status < 200) {
+        return 0;
+    }
+
+    const char *end = head + length;
+    const char *cursor = memchr(head, '\n', length) + 1;
+    header_line_t connection;
+    find_connection_header(cursor, end, &connection);
+    int minor_version = head[7] - '0';
+    exchange->reusable = connection.value ?
+                         !token_listed(connection.value, connection.value_length, "close", 5) &&
+                         (minor_version > 0 || token_listed(connection.value, connection.value_length, "keep-alive", 10)) :
+                         minor_version > 0;
+
+    int has_transfer_encoding = 0;
+    int chunked = 0;
+    int has_length = 0;
+    size_t content_length = 0;
+    header_line_t header;
+    while (next_header(&cursor, end, &header)) {
+        char name[128];
+        char value[128];
+        if (!header.name) {
+            return -1;
+        }
+        if (header_is(&header, "Transfer-Encoding")) {
+            // Only chunked can be the last coding of a response with a length
+            has_transfer_encoding = 1;
+            chunked = token_listed(header.value, header.value_length, "chunked", 7);
+        } else if (header_is(&header, "Content-Length")) {
+            char *number_end;
+            if (copy_value(value, sizeof(value), &header) != 0 || !isdigit((unsigned char)value[0])) {
+                return -1;
+            }
+            errno = 0;
+            unsigned long long parsed = strtoull(value, &number_end, 10);
+            if (*number_end != '\0' || errno != 0 || (has_length && parsed != content_length)) {
+                return -1;
+            }
+            content_length = (size_t)parsed;
+            has_length = 1;
+        } else if (is_hop_by_hop(&header, &connection)) {
+            continue;
+        } else if (header_is(&header, "Content-Type")) {
+            if (copy_value(value, sizeof(response->content_type), &header) != 0) {
+                return -1;
+            }
+            set_response_content_type(response, value);
+        } else {
+            if (header.name_length >= sizeof(name)) {
+                return -1;
+            }
+            memcpy(name, header.name, header.name_length);
+            name[header.name_length] = '\0';
+            if (add_response_header_value(response, name, header.value, header.value_length) != 0) {
+                return -1;
+            }
+        }
+    }
+
+    // Transfer-Encoding overrides Content-Length. A response carrying both
+    // may be an attempt at smuggling, so whatever follows it on the
+    // connection is not trusted to be the next response.
+    if (has_transfer_encoding && has_length) {
+        exchange->reusable = 0;
+    }
+
+    set_response_status(response, *status);
+    if (*status == HTTP_STATUS_NO_CONTENT || *status == HTTP_STATUS_NOT_MODIFIED) {
+        exchange->framing = FRAMING_NONE;
+    } else if (chunked) {
+        exchange->framing = FRAMING_CHUNKED;
+    } else if (has_transfer_encoding) {
+        // Codings other than chunked leave the body to end with the connection
+        exchange->framing = FRAMING_CLOSE;
+        exchange->reusable = 0;
+    } else if (has_length) {
+        exchange->framing = content_length > 0 ? FRAMING_LENGTH : FRAMING_NONE;
+        exchange->remaining = content_length;
+    } else {
+        exchange->framing = FRAMING_CLOSE;
+        exchange->reusable = 0;
+    }
+    return 0;
+}
+
+// Relay length body bytes, pushing each batch to the client before
+// waiting for the next one so slow upstreams stream rather than stall
+static int relay_bytes(http_stream_t *stream, proxy_connection_t *connection, size_t length) {
+    while (length > 0) {
+        if (connection->start == connection->end) {
+            connection->start = 0;
+            connection->end = 0;
+            if (receive(connection) <= 0) {
+                return -1;
+            }
+        }
+        size_t available = connection->end - connection->start;
+        size_t amount = available < length ? available : length;
+        if (http_stream_write(stream, connection->buffer + connection->start, amount) != 0) {
+            return -1;
+        }
+        connection->start += amount;
+        length -= amount;
+        if (connection->start == connection->end && http_stream_flush(stream) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Take one line of chunked framing, without its line ending
+static int read_line(proxy_connection_t *connection, char *line, size_t size) {
+    for (;;) {
+        char *data = connection->buffer + connection->start;
+        size_t available = connection->end - connection->start;
+        char *newline = memchr(data, '\n', available);
+        if (newline) {
+            size_t length = newline - data;
+            if (length > 0 && data[length - 1] == '\r') {
+                length--;
+            }
+            if (length >= size) {
+                return -1;
+            }
+            memcpy(line, data, length);
+            line[length] = '\0';
+            connection->start += newline + 1 - data;
+            return 0;
+        }
+        if (available >= size) {
+            return -1;
+        }
+
+        // Keep the partial line and read the rest after it
+        memmove(connection->buffer, data, available);
+        connection->start = 0;
+        connection->end = available;
+        if (receive(connection) <= 0) {
+            return -1;
+        }
+    }
+}
+
+// Decode the upstream's chunks; the stream frames the body again for the
+// client. Trailers are read and dropped.
+static int relay_chunks(http_stream_t *stream, proxy_connection_t *connection) {
+    char line[PROXY_LINE_SIZE];
+    for (;;) {
+        if (read_line(connection, line, sizeof(line)) != 0 || !isxdigit((unsigned char)line[0])) {
+            return -1;
+        }
+        char *size_end;
+        errno = 0;
+        unsigned long long size = strtoull(line, &size_end, 16);
+        if (errno != 0 || (*size_end != '\0' && *size_end != ';' && *size_end != ' ' && *size_end != '\t')) {
+            return -1;
+        }
+        if (size == 0) {
+            break;
+        }
+        if (relay_bytes(stream, connection, (size_t)size) != 0 ||
+            read_line(connection, line, sizeof(line)) != 0 || line[0] != '\0') {
+            return -1;
+        }
+        // The chunk's line ending may have come after its data was sent on
+        if (connection->start == connection->end && http_stream_flush(stream) != 0) {
+            return -1;
+        }
+    }
+    do {
+        if (read_line(connection, line, sizeof(line)) != 0) {
+            return -1;
+        }
+    } while (line[0] != '\0');
+    return 0;
+}
+
+static int relay_body(http_stream_t *stream, void *context) {
+    proxy_exchange_t *exchange = context;
+    proxy_connection_t *connection = exchange->connection;
+    int result = 0;
+    if (exchange->framing == FRAMING_LENGTH) {
+        result = relay_bytes(stream, connection, exchange->remaining);
+    } else if (exchange->framing == FRAMING_CHUNKED) {
+        result = relay_chunks(stream, connection);
+    } else {
+        for (;;) {
+            if (connection->start == connection->end) {
+                connection->start = 0;
+                connection->end = 0;
+                ssize_t received = receive(connection);
+                if (received <= 0) {
+                    result = received == 0 ? 0 : -1;
+                    break;
+                }
+            }
+            if (relay_bytes(stream, connection, connection->end - connection->start) != 0) {
+                result = -1;
+                break;
+            }
+        }
+    }
+    exchange->complete = result == 0;
+    return result;
+}
+
+// Send the request over exchange's connection and read the response head.
+// The body, if any, is left for relay_body to stream.
+static int forward(const http_request_t *request, int framing, const char *head, size_t head_length,
+                   proxy_exchange_t *exchange, http_response_t *response) {
+    proxy_connection_t *connection = exchange->connection;
+    int flags = framing == FRAMING_NONE ? 0 : MSG_MORE;
+    if (send_all_flags(connection->fd, head, head_length, flags) != 0) {
+        return FORWARD_NO_RESPONSE;
+    }
+    if (framing != FRAMING_NONE) {
+        int result = send_body(request, framing, connection);
+        if (result != FORWARD_OK) {
+            return result;
+        }
+    }
+
+    // Interim responses such as 103 Early Hints are skipped
+    int status;
+    do {
+        size_t response_head_length = read_response_head(connection);
+        if (response_head_length == 0) {
+            return connection->end > 0 ? FORWARD_BAD_RESPONSE : FORWARD_NO_RESPONSE;
+        }
+        if (parse_response_head(connection->buffer + connection->start, response_head_length,
+                                response, exchange, &status) != 0) {
+            return FORWARD_BAD_RESPONSE;
+        }
+        connection->start += response_head_length;
+    } while (status < 200);
+    return FORWARD_OK;
+}
+
+// Undo what a failed attempt put in the response
+static void reset_response(http_response_t *response) {
+    response->headers_length = 0;
+    response->headers[0] = '\0';
+    set_response_content_type(response, "text/plain");
+}
+
+void handle_proxy(const http_request_t *request, http_response_t *response) {
+    proxy_route_t *route = find_proxy_route(request->path);
+    char *head = malloc(PROXY_BUFFER_SIZE);
+    if (!route || !head) {
+        free(head);
+        set_response_status(response, HTTP_STATUS_INTERNAL_ERROR);
+        set_response_body_string(response, "Server error: Failed to forward the request");
+        return;
+    }
+
+    int framing = FRAMING_NONE;
+    if (request->body_reader && request->chunked) {
+        framing = FRAMING_CHUNKED;
+    } else if (request->body_reader && request->content_length > 0) {
+        framing = FRAMING_LENGTH;
+    }
+    // Once the upstream may have acted on a request, only a GET without a
+    // body is sent again, and only when no response had started
+    int replayable = framing == FRAMING_NONE && strcmp(request->method, "GET") == 0;
+
+    int status = HTTP_STATUS_BAD_GATEWAY;
+    const char *message = "Bad Gateway: No upstream is available";
+    unsigned int excluded = 0;
+    for (int attempt = 0; attempt < PROXY_MAX_ATTEMPTS; attempt++) {
+        upstream_t *upstream = choose_upstream(route, excluded);
+        if (!upstream) {
+            break;
+        }
+        unsigned int upstream_bit = 1u << (upstream - route->upstreams);
+        int head_length = build_request_head(request, upstream, framing, head, PROXY_BUFFER_SIZE);
+        if (head_length < 0) {
+            message = "Bad Gateway: The request head is too large to forward";
+            break;
+        }
+
+        __atomic_add_fetch(&upstream->outstanding, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&upstream->requests, 1, __ATOMIC_RELAXED);
+        int reused = 0;
+        proxy_exchange_t exchange = { upstream, acquire_connection(upstream, &reused), FRAMING_NONE, 0, 0, 0 };
+        if (!exchange.connection) {
+            // Nothing was sent, so any request can go to another upstream
+            __atomic_sub_fetch(&upstream->outstanding, 1, __ATOMIC_RELAXED);
+            upstream_failed(upstream);
+            excluded |= upstream_bit;
+            message = "Bad Gateway: The upstream refused the connection";
+            continue;
+        }
+
+        errno = 0;
+        int result = forward(request, framing, head, head_length, &exchange, response);
+        if (result == FORWARD_OK) {
+            upstream_succeeded(upstream);
+            free(head);
+            if (exchange.framing == FRAMING_NONE) {
+                exchange.complete = 1;
+                finish_exchange(&exchange);
+                return;
+            }
+            proxy_exchange_t *streamed = malloc(sizeof(proxy_exchange_t));
+            if (streamed) {
+                *streamed = exchange;
+                set_response_stream(response, relay_body, streamed, free_exchange);
+                return;
+            }
+            finish_exchange(&exchange);
+            reset_response(response);
+            set_response_status(response, HTTP_STATUS_INTERNAL_ERROR);
+            set_response_body_string(response, "Server error: Failed to allocate memory");
+            return;
+        }
+
+        int timed_out = errno == EAGAIN || errno == EWOULDBLOCK;
+        finish_exchange(&exchange);
+        reset_response(response);
+        if (result == FORWARD_CLIENT_FAILED) {
+            status = request->body_reader->error_status ? request->body_reader->error_status : HTTP_STATUS_BAD_REQUEST;
+            message = "Failed to read the request body";
+            break;
+        }
+
+        // A pooled connection may have been closed by the upstream just as
+        // it was picked; that says nothing about the upstream's health
+        if (!reused || result == FORWARD_BAD_RESPONSE) {
+            upstream_failed(upstream);
+            excluded |= upstream_bit;
+        }
+        status = timed_out ? HTTP_STATUS_GATEWAY_TIMEOUT : HTTP_STATUS_BAD_GATEWAY;
+        message = timed_out ? "Gateway Timeout: The upstream did not answer in time" :
+                  result == FORWARD_BAD_RESPONSE ? "Bad Gateway: The upstream sent an invalid response" :
+                                                   "Bad Gateway: The upstream closed the connection";
+        if (!replayable || result != FORWARD_NO_RESPONSE) {
+            break;
+        }
+    }
+
+    free(head);
+    set_response_status(response, status);
+    set_response_body_string(response, message);
+}
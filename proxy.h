@@ -0,0 +1,48 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include "http_request.h"
+#include "http_response.h"
+#include "listener.h"
+
+// Reverse proxy routes (--proxy). Requests below a prefix are forwarded,
+// target unchanged, to one of a group of upstream HTTP/1.1 servers over TCP
+// or Unix sockets, and the response body is streamed back as it arrives.
+//
+// Every upstream keeps a pool of idle keep-alive connections. A request
+// goes to the live upstream with the fewest requests in flight. Health is
+// checked passively: an upstream that refuses PROXY_MAX_FAILURES connections
+// or requests in a row is left out for PROXY_FAIL_TIMEOUT_MS, after which
+// live traffic tries it again.
+#define PROXY_MAX_ROUTES 8
+#define PROXY_MAX_UPSTREAMS 8          // Per route
+#define PROXY_MAX_IDLE 32              // Idle connections kept per upstream
+#define PROXY_MAX_FAILURES 3
+#define PROXY_FAIL_TIMEOUT_MS 10000
+#define PROXY_IO_TIMEOUT_MS 30000      // Longest wait for an upstream to connect, take or send data
+#define PROXY_BUFFER_SIZE 16384        // Also the largest request or response head forwarded
+
+typedef struct {
+    char route[128];
+    char address[SOCKET_ADDRESS_TEXT_SIZE];
+    int outstanding;                   // Requests in flight, including bodies still streaming
+    int idle;                          // Pooled connections
+    unsigned long long requests;
+    unsigned long long failures;       // Connections refused or broken before a response
+    int down;                          // Left out after failing
+} proxy_upstream_stats_t;
+
+// Add a route from "/prefix/=upstream[,upstream...]" where each upstream is
+// written like a --listen address: tcp4:host:port, tcp6:[host]:port,
+// unix:/path or abstract:name. Returns -1 if it is malformed, too large or
+// the prefix is already routed.
+int proxy_add(const char *specification);
+
+// Upstreams over every route, for reporting. Counts are this process's own.
+int proxy_upstream_count(void);
+void proxy_get_upstream_stats(int index, proxy_upstream_stats_t *stats);
+
+// Forward a request to an upstream of the proxy route it matched
+void handle_proxy(const http_request_t *request, http_response_t *response);
+
+#endif
@@ -0,0 +1,308 @@
+#define _GNU_SOURCE // MAP_ANONYMOUS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include "rate_limiter.h"
+#include "url_path.h"
+#include "utils.h"
+
+// Token counts are fixed point with this many fractions per token
+#define TOKEN_SCALE 1024ULL
+// Slots examined for a key before one is evicted
+#define PROBE_LIMIT 16
+// Key held by a slot while its bucket is reset for a new client. Real keys
+// are odd, so no client ever matches it.
+#define SLOT_CLAIMED 2
+
+typedef struct {
+    char prefix[128];
+    size_t prefix_length;
+    unsigned int rate;      // Tokens added per second
+    unsigned int burst;     // Bucket capacity
+} rate_rule_t;
+
+// One token bucket. key identifies (client address, rule), is 0 for an
+// empty slot and SLOT_CLAIMED while the slot changes hands. state packs the fixed-point token count in the high 32 bits
+// and the millisecond timestamp of the last refill in the low 32 bits, so
+// a whole bucket update is a single 64-bit compare-and-swap.
+typedef struct {
+    uint64_t key;
+    uint64_t state;
+    uint8_t referenced;     // CLOCK bit, set on use and cleared by eviction scans
+} rate_slot_t;
+
+static rate_rule_t rules[MAX_RATE_LIMIT_RULES];
+static int rule_count = 0;
+static rate_slot_t *slots = NULL;
+static unsigned long long refused_count = 0;
+
+static uint32_t now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    // Wraps every ~49 days; only differences between timestamps are used
+    return (uint32_t)((uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+static uint64_t pack_state(uint64_t tokens, uint32_t stamp) {
+    return (tokens << 32) | stamp;
+}
+
+int rate_limiter_add_rule(const char *prefix, unsigned int rate, unsigned int burst) {
+    if (!prefix || rule_count >= MAX_RATE_LIMIT_RULES || strlen(prefix) >= sizeof(rules[0].prefix) ||
+        rate == 0 || burst == 0 || (uint64_t)burst * TOKEN_SCALE > UINT32_MAX) {
+        return -1;
+    }
+
+    // A shared mapping, so worker processes forked later (--workers) enforce
+    // one limit per client together. Buckets are only ever updated with
+    // atomic operations, which work across processes as well as threads.
+    if (!slots) {
+        void *table = mmap(NULL, RATE_LIMITER_SLOTS * sizeof(rate_slot_t), PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (table == MAP_FAILED) {
+            return -1;
+        }
+        slots = table;
+    }
+
+    rate_rule_t *rule = &rules[rule_count++];
+    strcpy(rule->prefix, prefix);
+    rule->prefix_length = strlen(prefix);
+    rule->rate = rate;
+    rule->burst = burst;
+    printf("Rate limit: %s to %u requests/s per client (burst %u)\n", prefix, rate, burst);
+    return 0;
+}
+
+int rate_limiter_parse_rule(const char *option) {
+    char prefix[128];
+    const char *equals = strchr(option, '=');
+    if (!equals || equals == option || (size_t)(equals - option) >= sizeof(prefix)) {
+        return -1;
+    }
+    memcpy(prefix, option, equals - option);
+    prefix[equals - option] = '\0';
+
+    char rate_text[16];
+    const char *colon = strchr(equals + 1, ':');
+    size_t rate_length = colon ? (size_t)(colon - (equals + 1)) : strlen(equals + 1);
+    if (rate_length == 0 || rate_length >= sizeof(rate_text)) {
+        return -1;
+    }
+    memcpy(rate_text, equals + 1, rate_length);
+    rate_text[rate_length] = '\0';
+
+    int rate = string_to_int(rate_text);
+    int burst = colon ? string_to_int(colon + 1) : rate;
+    if (rate <= 0 || burst <= 0) {
+        return -1;
+    }
+    return rate_limiter_add_rule(prefix, rate, burst);
+}
+
+int rate_limiter_enabled(void) {
+    return rule_count > 0;
+}
+
+unsigned long long rate_limiter_refused(void) {
+    return __atomic_load_n(&refused_count, __ATOMIC_RELAXED);
+}
+
+static const rate_rule_t *find_rule(const char *path) {
+    const rate_rule_t *best = NULL;
+    for (int i = 0; i < rule_count; i++) {
+        if (strncmp(path, rules[i].prefix, rules[i].prefix_length) == 0 &&
+            (!best || rules[i].prefix_length > best->prefix_length)) {
+            best = &rules[i];
+        }
+    }
+    return best;
+}
+
+// Hash the client address (IPv4 as v4-mapped IPv6) together with the rule
+static uint64_t bucket_key(const struct sockaddr *address, const rate_rule_t *rule) {
+    unsigned char bytes[16];
+    memset(bytes, 0, sizeof(bytes));
+
+    if (address->sa_family == AF_INET6) {
+        memcpy(bytes, &((const struct sockaddr_in6 *)address)->sin6_addr, 16);
+    } else if (address->sa_family == AF_INET) {
+        bytes[10] = 0xff;
+        bytes[11] = 0xff;
+        memcpy(bytes + 12, &((const struct sockaddr_in *)address)->sin_addr, 4);
+    }
+    // Other families (e.g. Unix sockets) share a single bucket per rule
+
+    uint64_t hash = 14695981039346656037ULL ^ (uint64_t)(rule - rules);
+    for (size_t i = 0; i < sizeof(bytes); i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 29;
+    return hash | 1; // 0 and SLOT_CLAIMED are never a client's key
+}
+
+// Fixed-point tokens a bucket gains over elapsed milliseconds. Anything
+// past the time a full refill takes adds nothing, so elapsed is clamped to
+// that first and the product cannot overflow however long a bucket idled.
+static uint64_t refill_tokens(const rate_rule_t *rule, uint32_t elapsed) {
+    uint64_t refill_ms = (uint64_t)rule->burst * 1000 / rule->rate + 1;
+    if (elapsed > refill_ms) {
+        elapsed = (uint32_t)refill_ms;
+    }
+    return (uint64_t)elapsed * rule->rate * TOKEN_SCALE / 1000;
+}
+
+// Whether a bucket has refilled completely, in which case forgetting it
+// changes nothing and its slot can be reused
+static int bucket_is_full(const rate_slot_t *slot, const rate_rule_t *rule, uint32_t now) {
+    uint64_t state = __atomic_load_n(&slot->state, __ATOMIC_RELAXED);
+    uint64_t tokens = state >> 32;
+    uint32_t elapsed = now - (uint32_t)state;
+    if (elapsed > 0x80000000u) {
+        elapsed = 0; // Refilled with a slightly later clock reading than ours
+    }
+    return tokens + refill_tokens(rule, elapsed) >= (uint64_t)rule->burst * TOKEN_SCALE;
+}
+
+// Hand a slot whose key was expected to key. The slot holds SLOT_CLAIMED
+// while its bucket is reset, so nobody looking up key can spend the previous
+// client's tokens before the fresh bucket is in place.
+static int claim_slot(rate_slot_t *slot, uint64_t *expected, uint64_t key, uint64_t fresh_state) {
+    if (!__atomic_compare_exchange_n(&slot->key, expected, SLOT_CLAIMED, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+    __atomic_store_n(&slot->state, fresh_state, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->key, key, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Find or claim the slot for key without taking any lock
+static rate_slot_t *find_slot(uint64_t key, const rate_rule_t *rule, uint32_t now) {
+    size_t start = key & (RATE_LIMITER_SLOTS - 1);
+    uint64_t fresh_state = pack_state((uint64_t)rule->burst * TOKEN_SCALE, now);
+
+    for (size_t i = 0; i < PROBE_LIMIT; i++) {
+        rate_slot_t *slot = &slots[(start + i) & (RATE_LIMITER_SLOTS - 1)];
+        uint64_t slot_key;
+        while ((slot_key = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE)) == SLOT_CLAIMED) {
+            // Changing hands, possibly to this client; the key follows two stores later
+        }
+        if (slot_key == key) {
+            return slot;
+        }
+        if (slot_key == 0) {
+            uint64_t expected = 0;
+            if (claim_slot(slot, &expected, key, fresh_state) == 0) {
+                return slot;
+            }
+            while (expected == SLOT_CLAIMED) {
+                expected = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE);
+            }
+            if (expected == key) {
+                return slot; // Another thread claimed it for the same client
+            }
+        }
+    }
+
+    // Window full: CLOCK over the probe window. Recently used slots get a
+    // second chance; stale ones (unreferenced or fully refilled) are replaced.
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < PROBE_LIMIT; i++) {
+            rate_slot_t *slot = &slots[(start + i) & (RATE_LIMITER_SLOTS - 1)];
+            if (__atomic_exchange_n(&slot->referenced, 0, __ATOMIC_RELAXED) && pass == 0 &&
+                !bucket_is_full(slot, rule, now)) {
+                continue;
+            }
+            uint64_t expected = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE);
+            if (expected != SLOT_CLAIMED && claim_slot(slot, &expected, key, fresh_state) == 0) {
+                return slot;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// Take a token from the bucket. Returns 0 on success, otherwise the
+// seconds until a token will be available.
+static int take_token(rate_slot_t *slot, const rate_rule_t *rule, uint32_t now) {
+    uint64_t capacity = (uint64_t)rule->burst * TOKEN_SCALE;
+    uint64_t old_state = __atomic_load_n(&slot->state, __ATOMIC_RELAXED);
+
+    while (1) {
+        uint64_t tokens = old_state >> 32;
+        uint32_t elapsed = now - (uint32_t)old_state;
+        if (elapsed > 0x80000000u) {
+            elapsed = 0; // Another thread refilled with a slightly later clock reading
+        }
+
+        tokens += refill_tokens(rule, elapsed);
+        if (tokens > capacity) {
+            tokens = capacity;
+        }
+
+        int allowed = tokens >= TOKEN_SCALE;
+        if (allowed) {
+            tokens -= TOKEN_SCALE;
+        }
+
+        uint64_t new_state = pack_state(tokens, elapsed > 0 ? now : (uint32_t)old_state);
+        if (__atomic_compare_exchange_n(&slot->state, &old_state, new_state, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            if (allowed) {
+                return 0;
+            }
+            uint64_t missing_ms = (TOKEN_SCALE - tokens) * 1000 / ((uint64_t)rule->rate * TOKEN_SCALE);
+            return (int)(missing_ms / 1000) + 1;
+        }
+        // Lost the race; old_state now holds the current value
+    }
+}
+
+int rate_limiter_check(const struct sockaddr *client_address, const char *request_line, size_t line_length) {
+    if (rule_count == 0 || !client_address || !request_line) {
+        return 0;
+    }
+
+    // The path is the second field of the request line
+    const char *path_start = memchr(request_line, ' ', line_length);
+    if (!path_start) {
+        return 0; // Malformed; the parser will reject it
+    }
+    path_start++;
+    const char *path_end = memchr(path_start, ' ', line_length - (path_start - request_line));
+    size_t path_length = path_end ? (size_t)(path_end - path_start) : line_length - (path_start - request_line);
+
+    // Match on the canonical path so "//calc" or "%2Fcalc" cannot dodge a rule
+    char path[1024];
+    if (path_length >= sizeof(path)) {
+        return 0;
+    }
+    memcpy(path, path_start, path_length);
+    path[path_length] = '\0';
+    if (normalize_url_path(path, NULL, 0) != 0) {
+        return 0;
+    }
+
+    const rate_rule_t *rule = find_rule(path);
+    if (!rule) {
+        return 0;
+    }
+
+    uint32_t now = now_ms();
+    rate_slot_t *slot = find_slot(bucket_key(client_address, rule), rule, now);
+    if (!slot) {
+        return 0; // Table contended; fail open rather than block legitimate clients
+    }
+    __atomic_store_n(&slot->referenced, 1, __ATOMIC_RELAXED);
+
+    int retry_after = take_token(slot, rule, now);
+    if (retry_after > 0) {
+        __atomic_fetch_add(&refused_count, 1, __ATOMIC_RELAXED);
+    }
+    return retry_after;
+}
@@ -0,0 +1,29 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <stddef.h>
+#include <sys/socket.h>
+
+#define MAX_RATE_LIMIT_RULES 16
+#define RATE_LIMITER_SLOTS 65536   // Token buckets tracked at once, a power of two
+
+// Add a limit for paths starting with prefix: rate requests per second per
+// client address, with bursts of up to burst requests. The longest matching
+// prefix applies; paths matching no rule are not limited.
+int rate_limiter_add_rule(const char *prefix, unsigned int rate, unsigned int burst);
+
+// Parse "prefix=rate[:burst]" and add it as a rule
+int rate_limiter_parse_rule(const char *option);
+
+// Whether any rule is configured
+int rate_limiter_enabled(void);
+
+// Check a request against the limits using only its request line. Returns
+// 0 when the request may proceed, otherwise the number of seconds the
+// client should wait before retrying.
+int rate_limiter_check(const struct sockaddr *client_address, const char *request_line, size_t line_length);
+
+// Number of requests refused so far
+unsigned long long rate_limiter_refused(void);
+
+#endif
@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "response_cache.h"
+#include "route_handler.h"
+#include "metrics.h"
+#include "socket_options.h"
+#include "utils.h"
+
+// Longest key: path, query and the encoding flag
+#define RESPONSE_CACHE_KEY_SIZE 2100
+
+// Room for the head of a stored response (see client_handler.c)
+#define RESPONSE_CACHE_HEAD_SIZE 2048
+
+static const char keep_alive_line[] = "Connection: keep-alive\r\n\r\n";
+static const char close_line[] = "Connection: close\r\n\r\n";
+
+struct response_cache_entry {
+    unsigned long long hash;
+    unsigned long long expires_ns;
+    int shard;
+    int refcount;              // The table's reference plus one per response being sent
+    size_t size;               // Bytes of wire, head and body
+    size_t connection_offset;  // Where the Connection header starts in wire
+    size_t body_offset;
+    struct response_cache_entry *next;       // Hash bucket chain
+    struct response_cache_entry *lru_prev;   // Toward the most recently used
+    struct response_cache_entry *lru_next;
+    char *key;
+    char *wire;                // Stored as sent to a keep-alive client
+};
+
+typedef struct {
+    pthread_mutex_t mutex;
+    response_cache_entry_t *buckets[RESPONSE_CACHE_BUCKETS];
+    response_cache_entry_t *lru_head;
+    response_cache_entry_t *lru_tail;
+    size_t entries;
+    size_t bytes;
+    unsigned long long evictions;
+    unsigned long long expirations;
+} __attribute__((aligned(64))) cache_shard_t;
+
+static cache_shard_t shards[RESPONSE_CACHE_SHARDS];
+static size_t max_bytes = 0;   // Nothing is cached until configured
+
+void response_cache_configure(size_t bytes) {
+    for (int i = 0; i < RESPONSE_CACHE_SHARDS; i++) {
+        pthread_mutex_init(&shards[i].mutex, NULL);
+    }
+    max_bytes = bytes;
+}
+
+static unsigned long long hash_key(const char *key, size_t length) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Responses only vary on whether the client takes gzip, so that is the
+// one request header in the key
+static int build_key(const http_request_t *request, char *key, size_t key_size) {
+    int length = snprintf(key, key_size, "%s?%s\n%d", request->path, request->query,
+                          request_accepts_gzip(request));
+    return length < 0 || (size_t)length >= key_size ? -1 : length;
+}
+
+// The route's TTL when the request is a plain GET the cache may answer
+static unsigned int request_ttl_ms(const http_request_t *request) {
+    if (max_bytes == 0 || strcmp(request->method, "GET") != 0 || request->chunked ||
+        request->content_length > 0 || request->if_none_match[0] != '\0') {
+        return 0;
+    }
+    const route_t *route = find_route(request->path);
+    return route && (route->methods & ROUTE_METHOD_GET) ? route->cache_ttl_ms : 0;
+}
+
+// Must be called with the shard's mutex held; returns whether the caller
+// now has to free the entry
+static int drop_reference(response_cache_entry_t *entry) {
+    return --entry->refcount == 0;
+}
+
+// Take an entry out of the table and LRU list. Must be called with the
+// shard's mutex held; returns whether the caller now has to free it.
+static int unlink_entry(cache_shard_t *shard, response_cache_entry_t *entry) {
+    response_cache_entry_t **link = &shard->buckets[entry->hash % RESPONSE_CACHE_BUCKETS];
+    while (*link && *link != entry) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = entry->next;
+    }
+    if (entry->lru_prev) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        shard->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        shard->lru_tail = entry->lru_prev;
+    }
+    shard->entries--;
+    shard->bytes -= entry->size;
+    return drop_reference(entry);
+}
+
+// Must be called with the shard's mutex held
+static void push_lru_head(cache_shard_t *shard, response_cache_entry_t *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = shard->lru_head;
+    if (shard->lru_head) {
+        shard->lru_head->lru_prev = entry;
+    } else {
+        shard->lru_tail = entry;
+    }
+    shard->lru_head = entry;
+}
+
+// Must be called with the shard's mutex held
+static response_cache_entry_t *find_entry(cache_shard_t *shard, unsigned long long hash, const char *key) {
+    response_cache_entry_t *entry = shard->buckets[hash % RESPONSE_CACHE_BUCKETS];
+    while (entry && (entry->hash != hash || strcmp(entry->key, key) != 0)) {
+        entry = entry->next;
+    }
+    return entry;
+}
+
+int response_cache_lookup(const http_request_t *request, response_cache_entry_t **entry) {
+    *entry = NULL;
+    char key[RESPONSE_CACHE_KEY_SIZE];
+    int key_length;
+    if (request_ttl_ms(request) == 0 || (key_length = build_key(request, key, sizeof(key))) < 0) {
+        return RESPONSE_CACHE_BYPASS;
+    }
+
+    unsigned long long hash = hash_key(key, key_length);
+    cache_shard_t *shard = &shards[hash % RESPONSE_CACHE_SHARDS];
+    response_cache_entry_t *expired = NULL;
+
+    pthread_mutex_lock(&shard->mutex);
+    response_cache_entry_t *found = find_entry(shard, hash, key);
+    if (found && found->expires_ns <= metrics_now_ns()) {
+        shard->expirations++;
+        if (unlink_entry(shard, found)) {
+            expired = found;
+        }
+        found = NULL;
+    }
+    if (found) {
+        // Most recently used goes to the front of the list
+        if (found != shard->lru_head) {
+            found->lru_prev->lru_next = found->lru_next;
+            if (found->lru_next) {
+                found->lru_next->lru_prev = found->lru_prev;
+            } else {
+                shard->lru_tail = found->lru_prev;
+            }
+            push_lru_head(shard, found);
+        }
+        found->refcount++;
+    }
+    pthread_mutex_unlock(&shard->mutex);
+
+    if (expired) {
+        free(expired);
+    }
+    metrics_count_cache(METRICS_CACHE_RESPONSE, found != NULL);
+    if (!found) {
+        return RESPONSE_CACHE_MISS;
+    }
+
+    // The handler does not run, so the route is counted here instead
+    const route_t *route = find_route(request->path);
+    metrics_count_route(route ? get_route_index(route) : METRICS_ROUTE_OTHER);
+    *entry = found;
+    return RESPONSE_CACHE_HIT;
+}
+
+// Whether a response's extra headers allow sharing it with other clients
+static int headers_allow_caching(const char *headers) {
+    if (strstr(headers, "Set-Cookie:") || strstr(headers, "no-store") || strstr(headers, "private")) {
+        return 0;
+    }
+    // The key only tells encodings apart
+    const char *vary = strstr(headers, "Vary: ");
+    return !vary || strncmp(vary + 6, "Accept-Encoding\r\n", 17) == 0;
+}
+
+void response_cache_store(const http_request_t *request, const http_response_t *response) {
+    unsigned int ttl_ms = request_ttl_ms(request);
+    if (ttl_ms == 0 || response->status_code != HTTP_STATUS_OK || response->stream_producer ||
+        (!response->body && response->content_length > 0) || !headers_allow_caching(response->headers)) {
+        return;
+    }
+    char key[RESPONSE_CACHE_KEY_SIZE];
+    int key_length = build_key(request, key, sizeof(key));
+    if (key_length < 0) {
+        return;
+    }
+
+    // The head as a kept-alive connection gets it; other clients have the
+    // Connection line swapped when it is sent
+    http_response_t head = *response;
+    head.keep_alive = 1;
+
+    // Heads with more headers than the stack buffer holds, such as some
+    // proxied ones, are written on the heap
+    char small_head[RESPONSE_CACHE_HEAD_SIZE];
+    size_t head_size = response->headers_length + RESPONSE_CACHE_HEAD_SIZE / 2;
+    char *head_text = head_size <= sizeof(small_head) ? small_head : malloc(head_size);
+    if (!head_text) {
+        return;
+    }
+    if (head_text == small_head) {
+        head_size = sizeof(small_head);
+    }
+    size_t head_length = write_http_response_head(&head, head_text, head_size);
+    size_t size = head_length + response->content_length;
+    response_cache_entry_t *entry = NULL;
+    if (head_length >= sizeof(keep_alive_line) - 1 && size <= max_bytes / RESPONSE_CACHE_SHARDS) {
+        entry = malloc(sizeof(response_cache_entry_t) + key_length + 1 + size);
+    }
+    if (!entry) {
+        if (head_text != small_head) {
+            free(head_text);
+        }
+        return;
+    }
+    memset(entry, 0, sizeof(response_cache_entry_t));
+    entry->key = (char *)(entry + 1);
+    entry->wire = entry->key + key_length + 1;
+    memcpy(entry->key, key, key_length + 1);
+    memcpy(entry->wire, head_text, head_length);
+    if (head_text != small_head) {
+        free(head_text);
+    }
+    if (response->content_length > 0) {
+        memcpy(entry->wire + head_length, response->body, response->content_length);
+    }
+    entry->size = size;
+    entry->connection_offset = head_length - (sizeof(keep_alive_line) - 1);
+    entry->body_offset = head_length;
+    entry->hash = hash_key(key, key_length);
+    entry->expires_ns = metrics_now_ns() + (unsigned long long)ttl_ms * 1000000ULL;
+    entry->shard = (int)(entry->hash % RESPONSE_CACHE_SHARDS);
+    entry->refcount = 1;
+
+    cache_shard_t *shard = &shards[entry->shard];
+    response_cache_entry_t *replaced = NULL;
+
+    pthread_mutex_lock(&shard->mutex);
+    // A concurrent miss on the same key may have stored it first; the newer one wins
+    response_cache_entry_t *existing = find_entry(shard, entry->hash, key);
+    if (existing && unlink_entry(shard, existing)) {
+        replaced = existing;
+    }
+    response_cache_entry_t **bucket = &shard->buckets[entry->hash % RESPONSE_CACHE_BUCKETS];
+    entry->next = *bucket;
+    *bucket = entry;
+    push_lru_head(shard, entry);
+    shard->entries++;
+    shard->bytes += size;
+
+    // Evict from the cold end until the shard is back under its share.
+    // Entries being sent stay alive until their last reference is dropped.
+    response_cache_entry_t *evicted = NULL;
+    while (shard->bytes > max_bytes / RESPONSE_CACHE_SHARDS && shard->lru_tail != entry) {
+        response_cache_entry_t *victim = shard->lru_tail;
+        shard->evictions++;
+        if (unlink_entry(shard, victim)) {
+            victim->next = evicted;
+            evicted = victim;
+        }
+    }
+    pthread_mutex_unlock(&shard->mutex);
+
+    free(replaced);
+    while (evicted) {
+        response_cache_entry_t *next = evicted->next;
+        free(evicted);
+        evicted = next;
+    }
+}
+
+int response_cache_send(int socket, const response_cache_entry_t *entry, int keep_alive) {
+    if (keep_alive) {
+        return send_all(socket, entry->wire, entry->size);
+    }
+    // Held back with MSG_MORE so the pieces still go out as full segments
+    int more = socket_options_more_flag();
+    if (send_all_flags(socket, entry->wire, entry->connection_offset, more) != 0 ||
+        send_all_flags(socket, close_line, sizeof(close_line) - 1, more) != 0) {
+        return -1;
+    }
+    return send_all(socket, entry->wire + entry->body_offset, entry->size - entry->body_offset);
+}
+
+size_t response_cache_entry_size(const response_cache_entry_t *entry) {
+    return entry->size;
+}
+
+void response_cache_release(response_cache_entry_t *entry) {
+    if (!entry) {
+        return;
+    }
+    cache_shard_t *shard = &shards[entry->shard];
+    pthread_mutex_lock(&shard->mutex);
+    int last = drop_reference(entry);
+    pthread_mutex_unlock(&shard->mutex);
+    if (last) {
+        free(entry);
+    }
+}
+
+void response_cache_get_stats(response_cache_stats_t *stats) {
+    memset(stats, 0, sizeof(response_cache_stats_t));
+    stats->max_bytes = max_bytes;
+    for (int i = 0; i < RESPONSE_CACHE_SHARDS; i++) {
+        pthread_mutex_lock(&shards[i].mutex);
+        stats->entries += shards[i].entries;
+        stats->bytes += shards[i].bytes;
+        stats->evictions += shards[i].evictions;
+        stats->expirations += shards[i].expirations;
+        pthread_mutex_unlock(&shards[i].mutex);
+    }
+}
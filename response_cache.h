@@ -0,0 +1,51 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <stddef.h>
+#include "http_request.h"
+#include "http_response.h"
+
+// A micro-cache of whole HTTP/1.1 responses for GET routes given a TTL
+// (--cache /route/=ms). Hits are sent as stored, without running the handler.
+#define RESPONSE_CACHE_SHARDS 16                             // Each with its own lock, table and LRU list
+#define RESPONSE_CACHE_BUCKETS 256                           // Hash buckets per shard
+#define DEFAULT_RESPONSE_CACHE_BYTES (16 * 1024 * 1024)      // Memory cap over all shards
+
+// Outcome of a lookup
+#define RESPONSE_CACHE_BYPASS 0   // The request is not one the cache answers
+#define RESPONSE_CACHE_MISS   1   // Cacheable: store the response once it is built
+#define RESPONSE_CACHE_HIT    2   // Send the entry instead of running the handler
+
+typedef struct response_cache_entry response_cache_entry_t;
+
+typedef struct {
+    size_t entries;
+    size_t bytes;
+    size_t max_bytes;
+    unsigned long long evictions;        // Entries dropped to stay under the cap
+    unsigned long long expirations;      // Entries dropped when found past their TTL
+} response_cache_stats_t;
+
+// Set the memory cap; call before serving
+void response_cache_configure(size_t max_bytes);
+
+// Look a request up. On a hit *entry holds a reference that must be given
+// back with response_cache_release().
+int response_cache_lookup(const http_request_t *request, response_cache_entry_t **entry);
+
+// Keep the response to a request that missed, if it is one that may be
+// reused: a complete 200 without cookies or no-store
+void response_cache_store(const http_request_t *request, const http_response_t *response);
+
+// Send a cached response, saying whether the connection stays open.
+// Returns 0 on success.
+int response_cache_send(int socket, const response_cache_entry_t *entry, int keep_alive);
+
+// Bytes of the stored response, head included
+size_t response_cache_entry_size(const response_cache_entry_t *entry);
+
+void response_cache_release(response_cache_entry_t *entry);
+
+void response_cache_get_stats(response_cache_stats_t *stats);
+
+#endif
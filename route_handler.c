@@ -6,10 +6,27 @@
 #include <fcntl.h>
 #include <ctype.h>
 #include "route_handler.h"
+#include "file_cache.h"
+#include "static_bundle.h"
+#include "http_stream.h"
+#include "http_body.h"
+#include "echo_server.h"
+#include "executor.h"
+#include "rate_limiter.h"
+#include "tls.h"
+#include "worker_stats.h"
+#include "metrics.h"
+#include "pool.h"
+#include "calc.h"
+#include "response_cache.h"
+#include "constant_response.h"
+#include "trace.h"
+#include "proxy.h"
+#include "asset_manifest.h"
+#include "capture.h"
 
-// Base directory for static files
-#define STATIC_DIR "./static"
-#define MAX_FILE_SIZE (10 * 1024 * 1024) // 10MB max
+#define MAX_STREAM_LINES 10000000
+#define UPLOAD_CHUNK_SIZE 16384
 
 // Custom atoi implementation
 static int custom_atoi(const char *str) {
@@ -101,6 +118,99 @@ static int extract_path_components(const char *path, char **components, int max_
     return count;
 }
 
+// Registered routes, matched by longest prefix
+static route_t routes[MAX_ROUTES];
+static int route_count = 0;
+
+int register_route(const char *pattern, int methods, int executor_class, route_handler_t handler) {
+    if (!pattern || !handler || route_count >= MAX_ROUTES ||
+        strlen(pattern) >= sizeof(routes[0].prefix) || executor_class < 0 || executor_class >= EXECUTOR_CLASS_COUNT) {
+        return -1;
+    }
+    
+    route_t *route = &routes[route_count++];
+    strcpy(route->prefix, pattern);
+    route->prefix_length = strlen(pattern);
+    route->exact = route->prefix_length == 1 || pattern[route->prefix_length - 1] != '/';
+    route->methods = methods;
+    route->executor_class = executor_class;
+    route->cache_ttl_ms = 0;
+    route->handler = handler;
+    return 0;
+}
+
+int set_route_class(const char *pattern, int executor_class) {
+    if (executor_class < 0 || executor_class >= EXECUTOR_CLASS_COUNT) {
+        return -1;
+    }
+    for (int i = 0; i < route_count; i++) {
+        if (strcmp(routes[i].prefix, pattern) == 0) {
+            routes[i].executor_class = executor_class;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int set_route_cache_ttl(const char *pattern, unsigned int ttl_ms) {
+    for (int i = 0; i < route_count; i++) {
+        if (strcmp(routes[i].prefix, pattern) == 0) {
+            routes[i].cache_ttl_ms = ttl_ms;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int get_route_count(void) {
+    return route_count;
+}
+
+const route_t *get_route(int index) {
+    return index >= 0 && index < route_count ? &routes[index] : NULL;
+}
+
+int get_route_index(const route_t *route) {
+    return (int)(route - routes);
+}
+
+const route_t *find_route(const char *path) {
+    const route_t *best = NULL;
+    for (int i = 0; i < route_count; i++) {
+        const route_t *route = &routes[i];
+        int matches = route->exact ? strcmp(path, route->prefix) == 0 :
+                                     strncmp(path, route->prefix, route->prefix_length) == 0;
+        if (matches && (!best || route->prefix_length > best->prefix_length)) {
+            best = route;
+        }
+    }
+    return best;
+}
+
+// Map a request method to its ROUTE_METHOD_ flag, or 0 if unsupported
+static int method_flag(const char *method) {
+    if (strcmp(method, "GET") == 0) {
+        return ROUTE_METHOD_GET;
+    } else if (strcmp(method, "POST") == 0) {
+        return ROUTE_METHOD_POST;
+    } else if (strcmp(method, "PUT") == 0) {
+        return ROUTE_METHOD_PUT;
+    }
+    return 0;
+}
+
+// A request handed to an executor
+typedef struct {
+    const route_t *route;
+    const http_request_t *request;
+    http_response_t *response;
+} route_job_t;
+
+static void run_route_job(void *arg) {
+    route_job_t *job = arg;
+    job->route->handler(job->request, job->response);
+}
+
 // Handler for incoming requests
 void handle_request(const http_request_t *request, http_response_t *response) {
     if (!request || !response) {
@@ -109,55 +219,325 @@ void handle_request(const http_request_t *request, http_response_t *response) {
         return;
     }
     
-    // Check if the method is GET
-    if (strcmp(request->method, "GET") != 0) {
-        set_response_status(response, HTTP_STATUS_METHOD_NOT_ALLOWED);
-        set_response_body_string(response, "Method Not Allowed. Only GET is supported.");
+    int method = method_flag(request->method);
+    if (!method) {
+        set_response_constant(response, CONSTANT_RESPONSE_METHOD_UNSUPPORTED);
         return;
     }
     
     // Route based on the path
-    if (strncmp(request->path, "/static/", 8) == 0) {
-        handle_static_file(request->path + 7, response); // +7 to skip "/static"
-    } else if (strncmp(request->path, "/calc/", 6) == 0) {
-        handle_calc(request->path, response);
-    } else if (strncmp(request->path, "/sleep/", 7) == 0) {
-        handle_sleep(request->path, response);
-    } else if (strcmp(request->path, "/") == 0 || strcmp(request->path, "/index.html") == 0) {
-        //simple welcome page
-        set_response_content_type(response, "text/html");
-        set_response_body_string(response, 
-            "<html>"
-            "<head><title>HTTP Server</title></head>"
-            "<body>"
-            "<h1>Welcome to the HTTP Server</h1>"
-            "<p>Available routes:</p>"
-            "<ul>"
-            "<li>/static/[filename] - Serves static files</li>"
-            "<li>/calc/add/[num1]/[num2] - Addition</li>"
-            "<li>/calc/mul/[num1]/[num2] - Multiplication</li>"
-            "<li>/calc/div/[num1]/[num2] - Division</li>"
-            "<li>/sleep/[seconds] - Sleep for testing pipelining</li>"
-            "</ul>"
-            "</body>"
-            "</html>"
-        );
-    } else {
+    const route_t *route = find_route(request->path);
+    metrics_count_route(route ? get_route_index(route) : METRICS_ROUTE_OTHER);
+    if (!route) {
+        handle_not_found(request, response);
+        return;
+    }
+    
+    if (!(route->methods & method)) {
+        set_response_constant(response, CONSTANT_RESPONSE_NOT_ALLOWED_FOR(route->methods));
+        return;
+    }
+    
+    // Run the handler on the executor for its class, so slow routes queue
+    // separately from fast ones
+    route_job_t job = { route, request, response };
+    if (executor_run(route->executor_class, run_route_job, &job) != 0) {
+        set_response_constant(response, CONSTANT_RESPONSE_OVERLOADED);
+    }
+}
+
+void handle_index(const http_request_t *request, http_response_t *response) {
+    (void)request;
+    
+    //simple welcome page, rendered once at startup
+    set_response_constant(response, CONSTANT_RESPONSE_INDEX);
+}
+
+void handle_not_found(const http_request_t *request, http_response_t *response) {
+    (void)request;
+    
+    set_response_constant(response, CONSTANT_RESPONSE_NOT_FOUND);
+}
+
+void handle_stats(const http_request_t *request, http_response_t *response) {
+    (void)request;
+    
+    char stats_text[4096];
+    size_t length = 0;
+    
+    // Under --workers every number is summed over the worker processes
+    worker_stats_t total;
+    worker_stats_total(&total);
+    
+    int workers = worker_stats_workers();
+    if (workers > 0) {
+        length += snprintf(stats_text + length, sizeof(stats_text) - length,
+                           "workers %d restarts %llu\n# worker index pid active_connections completed\n",
+                           workers, total.restarts);
+        for (int i = 0; i < workers && length < sizeof(stats_text); i++) {
+            worker_stats_t worker;
+            worker_stats_get(i, &worker);
+            unsigned long long completed = 0;
+            for (int c = 0; c < EXECUTOR_CLASS_COUNT; c++) {
+                completed += worker.executors[c].completed;
+            }
+            length += snprintf(stats_text + length, sizeof(stats_text) - length,
+                               "worker %d %d %d %llu\n", i, (int)worker.pid, worker.active_connections, completed);
+        }
+    }
+    
+    if (length < sizeof(stats_text)) {
+        length += snprintf(stats_text + length, sizeof(stats_text) - length,
+                           "# executor workers queue_depth queue_capacity submitted completed rejected shed "
+                           "avg_queue_wait_us max_queue_wait_us\n");
+    }
+    for (int i = 0; i < EXECUTOR_CLASS_COUNT && length < sizeof(stats_text); i++) {
+        const executor_stats_t *stats = &total.executors[i];
+        // Jobs a worker has taken off the queue, the ones total_wait_ns covers
+        unsigned long long started = stats->submitted > stats->queue_depth ?
+                                     stats->submitted - stats->queue_depth : 0;
+        length += snprintf(stats_text + length, sizeof(stats_text) - length,
+                           "executor %s %d %zu %zu %llu %llu %llu %llu %.1f %.1f\n",
+                           stats->name, stats->workers, stats->queue_depth, stats->queue_capacity,
+                           stats->submitted, stats->completed, stats->rejected, stats->shed,
+                           started > 0 ? stats->total_wait_ns / 1000.0 / started : 0.0,
+                           stats->max_wait_ns / 1000.0);
+    }
+    if (length < sizeof(stats_text)) {
+        const request_metrics_t *requests = &total.requests;
+        length += snprintf(stats_text + length, sizeof(stats_text) - length,
+                           "connections accepted %llu active %d\n"
+                           "requests %llu bytes_received %llu bytes_sent %llu\n"
+                           "file_cache hits %llu misses %llu\n",
+                           requests->connections_accepted, total.active_connections,
+                           requests->requests, requests->bytes_received, requests->bytes_sent,
+                           requests->cache_hits[METRICS_CACHE_FILE], requests->cache_misses[METRICS_CACHE_FILE]);
+    }
+    if (length < sizeof(stats_text)) {
+        // Hits and misses are summed over workers, the contents are this process's own
+        response_cache_stats_t cache;
+        response_cache_get_stats(&cache);
+        length += snprintf(stats_text + length, sizeof(stats_text) - length,
+                           "response_cache hits %llu misses %llu entries %zu bytes %zu max_bytes %zu "
+                           "evictions %llu expirations %llu\n",
+                           total.requests.cache_hits[METRICS_CACHE_RESPONSE],
+                           total.requests.cache_misses[METRICS_CACHE_RESPONSE],
+                           cache.entries, cache.bytes, cache.max_bytes, cache.evictions, cache.expirations);
+    }
+    if (length < sizeof(stats_text)) {
+        // What each open connection costs on top of the memory of an idle server
+        unsigned long long growth = total.rss_bytes > total.baseline_rss_bytes ?
+                                    total.rss_bytes - total.baseline_rss_bytes : 0;
+        length += snprintf(stats_text + length, sizeof(stats_text) - length,
+                           "memory rss_kb %llu baseline_kb %llu per_connection_kb %.1f\n"
+                           "# pool name object_size in_use reserved allocated_kb created reused (this process)\n",
+                           total.rss_bytes / 1024, total.baseline_rss_bytes / 1024,
+                           total.active_connections > 0 ? growth / 1024.0 / total.active_connections : 0.0);
+    }
+    for (int i = 0; i < pool_count() && length < sizeof(stats_text); i++) {
+        pool_stats_t pool;
+        pool_get_stats(i, &pool);
+        length += snprintf(stats_text + length, sizeof(stats_text) - length,
+                           "pool %s %zu %zu %zu %zu %llu %llu\n",
+                           pool.name, pool.object_size, pool.in_use, pool.reserved,
+                           pool.allocated_bytes / 1024, pool.created, pool.reused);
+    }
+    if (rate_limiter_enabled() && length < sizeof(stats_text)) {
+        length += snprintf(stats_text + length, sizeof(stats_text) - length,
+                           "rate_limited %llu\n", total.rate_limited);
+    }
+    if (tls_enabled() && length < sizeof(stats_text)) {
+        length += snprintf(stats_text + length, sizeof(stats_text) - length,
+                           "tls handshakes %llu resumed %llu failed %llu ktls_send %llu ktls_receive %llu\n",
+                           total.tls.handshakes, total.tls.resumed, total.tls.failed,
+                           total.tls.ktls_send, total.tls.ktls_receive);
+    }
+    if (capture_enabled() && length < sizeof(stats_text)) {
+        length += snprintf(stats_text + length, sizeof(stats_text) - length,
+                           "capture dropped_records %llu\n", capture_dropped());
+    }
+    if (proxy_upstream_count() > 0 && length < sizeof(stats_text)) {
+        length += snprintf(stats_text + length, sizeof(stats_text) - length,
+                           "# upstream route address outstanding idle requests failures state (this process)\n");
+    }
+    for (int i = 0; i < proxy_upstream_count() && length < sizeof(stats_text); i++) {
+        proxy_upstream_stats_t upstream;
+        proxy_get_upstream_stats(i, &upstream);
+        length += snprintf(stats_text + length, sizeof(stats_text) - length,
+                           "upstream %s %s %d %d %llu %llu %s\n",
+                           upstream.route, upstream.address, upstream.outstanding, upstream.idle,
+                           upstream.requests, upstream.failures, upstream.down ? "down" : "up");
+    }
+    
+    set_response_body_string(response, stats_text);
+}
+
+void handle_debug_trace(const http_request_t *request, http_response_t *response) {
+    (void)request;
+    
+    // Only this process's requests: under --workers each worker keeps its own
+    size_t length;
+    char *json = trace_export_json(&length);
+    if (!json) {
+        set_response_status(response, HTTP_STATUS_INTERNAL_ERROR);
+        set_response_content_type(response, "text/plain");
+        set_response_body_string(response, "Server error: Failed to allocate memory");
+        return;
+    }
+    set_response_content_type(response, "application/json");
+    add_response_header(response, "Cache-Control", "no-store");
+    set_response_body_shared(response, json, length, free, json);
+}
+
+void handle_asset_manifest(const http_request_t *request, http_response_t *response) {
+    size_t length;
+    const char *etag;
+    void *owner;
+    const char *json = asset_manifest_acquire(&length, &etag, &owner);
+    if (!json) {
         set_response_status(response, HTTP_STATUS_NOT_FOUND);
-        set_response_content_type(response, "text/html");
-        set_response_body_string(response, 
-            "<html>"
-            "<head><title>404 Not Found</title></head>"
-            "<body>"
-            "<h1>404 Not Found</h1>"
-            "<p>The requested resource was not found on this server.</p>"
-            "</body>"
-            "</html>"
-        );
+        set_response_body_string(response, "No asset manifest");
+        return;
+    }
+    
+    // Clients check back every time, which costs a 304 until something changes
+    add_response_header(response, "Cache-Control", "no-cache");
+    add_response_header(response, "ETag", etag);
+    if (request && request->if_none_match[0] && strstr(request->if_none_match, etag)) {
+        asset_manifest_release(owner);
+        set_response_status(response, HTTP_STATUS_NOT_MODIFIED);
+        return;
     }
+    set_response_content_type(response, "application/json");
+    set_response_body_shared(response, json, length, asset_manifest_release, owner);
+}
+
+// Adapters from the route signature to the path-based handlers
+static void route_static_file(const http_request_t *request, http_response_t *response) {
+    handle_static_file(request, request->path + 7, response); // +7 to skip "/static"
 }
 
-void handle_static_file(const char *path, http_response_t *response) {
+static void route_calc(const http_request_t *request, http_response_t *response) {
+    handle_calc(request->path, response);
+}
+
+static void route_sleep(const http_request_t *request, http_response_t *response) {
+    handle_sleep(request->path, response);
+}
+
+static void route_stream(const http_request_t *request, http_response_t *response) {
+    handle_stream(request->path, response);
+}
+
+void register_default_routes(void) {
+    register_route("/", ROUTE_METHOD_GET, EXECUTOR_INLINE, handle_index);
+    register_route("/index.html", ROUTE_METHOD_GET, EXECUTOR_INLINE, handle_index);
+    register_route("/static/", ROUTE_METHOD_GET, EXECUTOR_INLINE, route_static_file);
+    register_route("/calc/", ROUTE_METHOD_GET, EXECUTOR_INLINE, route_calc);
+    register_route("/calc/batch", ROUTE_METHOD_POST, EXECUTOR_CPU, handle_calc_batch);
+    register_route("/sleep/", ROUTE_METHOD_GET, EXECUTOR_BLOCKING, route_sleep);
+    register_route("/stream/", ROUTE_METHOD_GET, EXECUTOR_INLINE, route_stream);
+    register_route("/upload", ROUTE_METHOD_POST | ROUTE_METHOD_PUT, EXECUTOR_BLOCKING, handle_upload);
+    register_route("/stats", ROUTE_METHOD_GET, EXECUTOR_INLINE, handle_stats);
+    register_route("/debug/trace", ROUTE_METHOD_GET, EXECUTOR_CPU, handle_debug_trace);
+    register_route(ASSET_MANIFEST_PATH, ROUTE_METHOD_GET, EXECUTOR_INLINE, handle_asset_manifest);
+}
+
+// Serve a file straight out of the mapped static bundle
+static void serve_bundled_asset(const http_request_t *request, const static_asset_t *asset,
+                                http_response_t *response) {
+    // The compressed variant is other bytes, so it needs an ETag of its own:
+    // the file's with "-gz" added inside the quotes
+    int gzip = asset->gzip_data && request && request_accepts_gzip(request);
+    char etag[BUNDLE_ETAG_SIZE + 8];
+    size_t etag_length = strlen(asset->etag);
+    if (gzip && etag_length >= 2) {
+        snprintf(etag, sizeof(etag), "%.*s-gz\"", (int)(etag_length - 1), asset->etag);
+    } else {
+        snprintf(etag, sizeof(etag), "%s", asset->etag);
+    }
+    add_response_header(response, "ETag", etag);
+    if (asset->gzip_data) {
+        add_response_header(response, "Vary", "Accept-Encoding");
+    }
+    
+    // Let the client reuse its copy when the ETag still matches
+    if (request && request->if_none_match[0] && strstr(request->if_none_match, etag)) {
+        set_response_status(response, HTTP_STATUS_NOT_MODIFIED);
+        return;
+    }
+    
+    set_response_content_type(response, asset->content_type);
+    if (gzip) {
+        add_response_header(response, "Content-Encoding", "gzip");
+        set_response_body_shared(response, asset->gzip_data, asset->gzip_size,
+                                 static_bundle_release_body, NULL);
+    } else {
+        set_response_body_shared(response, asset->data, asset->data_size,
+                                 static_bundle_release_body, NULL);
+    }
+}
+
+// Serve a file out of the file cache, handing the cache's reference to the response
+static void serve_cached_file(const http_request_t *request, const char *full_path, file_cache_entry_t *entry,
+                              http_response_t *response) {
+    char etag[32];
+    snprintf(etag, sizeof(etag), "\"%016llx\"", file_cache_entry_hash(entry));
+    add_response_header(response, "ETag", etag);
+    
+    // Let the client reuse its copy when the ETag still matches
+    if (request && request->if_none_match[0] && strstr(request->if_none_match, etag)) {
+        file_cache_release(entry);
+        set_response_status(response, HTTP_STATUS_NOT_MODIFIED);
+        return;
+    }
+    
+    // Set the content type based on file extension
+    set_response_content_type(response, get_content_type_for_file(full_path));
+    
+    // Share the cached buffer with the response; the reference is dropped when the response is freed
+    set_response_body_shared(response, file_cache_entry_data(entry), file_cache_entry_size(entry),
+                             file_cache_release_body, entry);
+}
+
+// Serve "/name.<fingerprint>.ext" as "/name.ext", but only while the file's
+// whole hash is still the fingerprint, since clients keep it for a year.
+// Returns 0 if it was served, or -1 to treat the path as a plain file name.
+static int serve_fingerprinted_file(const http_request_t *request, const char *path, http_response_t *response) {
+    char logical[1024];
+    char fingerprint[ASSET_FINGERPRINT_LENGTH + 1];
+    if (asset_fingerprint_split(path, logical, sizeof(logical), fingerprint) != 0) {
+        return -1;
+    }
+    
+    if (static_bundle_loaded()) {
+        static_asset_t asset;
+        if (static_bundle_find(logical, &asset) != 0 || !asset_fingerprint_matches(asset.etag, fingerprint)) {
+            return -1;
+        }
+        add_response_header(response, "Cache-Control", ASSET_IMMUTABLE_CACHE_CONTROL);
+        serve_bundled_asset(request, &asset, response);
+        return 0;
+    }
+    
+    char full_path[1024];
+    file_cache_entry_t *entry = NULL;
+    if ((size_t)snprintf(full_path, sizeof(full_path), "%s%s", STATIC_DIR, logical) >= sizeof(full_path) ||
+        file_cache_acquire(full_path, MAX_FILE_SIZE, &entry) != FILE_CACHE_OK) {
+        return -1;
+    }
+    char etag[32];
+    snprintf(etag, sizeof(etag), "\"%016llx\"", file_cache_entry_hash(entry));
+    if (!asset_fingerprint_matches(etag, fingerprint)) {
+        file_cache_release(entry);
+        return -1;
+    }
+    add_response_header(response, "Cache-Control", ASSET_IMMUTABLE_CACHE_CONTROL);
+    serve_cached_file(request, full_path, entry, response);
+    return 0;
+}
+
+void handle_static_file(const http_request_t *request, const char *path, http_response_t *response) {
     if (!path || !response) {
         set_response_status(response, HTTP_STATUS_INTERNAL_ERROR);
         return;
@@ -170,62 +550,49 @@ void handle_static_file(const char *path, http_response_t *response) {
         return;
     }
     
+    // Fingerprinted names take precedence; nothing else is looked up for them
+    if (serve_fingerprinted_file(request, path, response) == 0) {
+        return;
+    }
+    
+    // A loaded bundle is the complete set of static files, so the disk is never consulted
+    if (static_bundle_loaded()) {
+        static_asset_t asset;
+        if (static_bundle_find(path, &asset) == 0) {
+            serve_bundled_asset(request, &asset, response);
+        } else {
+            set_response_status(response, HTTP_STATUS_NOT_FOUND);
+            set_response_body_string(response, "File not found");
+        }
+        return;
+    }
+    
     // Construct the full path
     char full_path[1024];
     snprintf(full_path, sizeof(full_path), "%s%s", STATIC_DIR, path);
     
-    // Open the file
-    int fd = open(full_path, O_RDONLY);
-    if (fd < 0) {
+    // Load the file through the shared cache so concurrent misses read it only once
+    file_cache_entry_t *entry = NULL;
+    int result = file_cache_acquire(full_path, MAX_FILE_SIZE, &entry);
+    if (result == FILE_CACHE_NOT_FOUND) {
         set_response_status(response, HTTP_STATUS_NOT_FOUND);
         set_response_body_string(response, "File not found");
         return;
-    }
-    
-    // Get file size
-    struct stat st;
-    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
-        close(fd);
+    } else if (result == FILE_CACHE_NOT_REGULAR) {
         set_response_status(response, HTTP_STATUS_NOT_FOUND);
         set_response_body_string(response, "Not a regular file");
         return;
-    }
-    
-    // Check if file is too large
-    if (st.st_size > MAX_FILE_SIZE) {
-        close(fd);
+    } else if (result == FILE_CACHE_TOO_LARGE) {
         set_response_status(response, HTTP_STATUS_INTERNAL_ERROR);
         set_response_body_string(response, "File too large");
         return;
-    }
-    
-    // Read the file
-    void *file_buffer = malloc(st.st_size);
-    if (!file_buffer) {
-        close(fd);
-        set_response_status(response, HTTP_STATUS_INTERNAL_ERROR);
-        set_response_body_string(response, "Server error: Failed to allocate memory");
-        return;
-    }
-    
-    ssize_t bytes_read = read(fd, file_buffer, st.st_size);
-    close(fd);
-    
-    if (bytes_read != st.st_size) {
-        free(file_buffer);
+    } else if (result != FILE_CACHE_OK) {
         set_response_status(response, HTTP_STATUS_INTERNAL_ERROR);
         set_response_body_string(response, "Server error: Failed to read file");
         return;
     }
     
-    // Set the content type based on file extension
-    set_response_content_type(response, get_content_type_for_file(full_path));
-    
-    // Set the response body
-    set_response_body(response, file_buffer, bytes_read);
-    
-    // Free the file buffer (now copied to response)
-    free(file_buffer);
+    serve_cached_file(request, full_path, entry, response);
 }
 
 void handle_calc(const char *path, http_response_t *response) {
@@ -257,27 +624,38 @@ void handle_calc(const char *path, http_response_t *response) {
         goto cleanup;
     }
     
-    int num1 = custom_atoi(num1_str);
-    int num2 = custom_atoi(num2_str);
+    long long num1, num2;
+    if (calc_parse_operand(num1_str, strlen(num1_str), &num1) != 0 ||
+        calc_parse_operand(num2_str, strlen(num2_str), &num2) != 0) {
+        set_response_status(response, HTTP_STATUS_BAD_REQUEST);
+        set_response_body_string(response, "Bad Request: Number out of range");
+        goto cleanup;
+    }
     
-    // Perform the calculation
-    char result_buffer[256];
-    if (strcmp(operation, "add") == 0) {
-        snprintf(result_buffer, sizeof(result_buffer), "%d + %d = %d", num1, num2, num1 + num2);
-    } else if (strcmp(operation, "mul") == 0) {
-        snprintf(result_buffer, sizeof(result_buffer), "%d * %d = %d", num1, num2, num1 * num2);
-    } else if (strcmp(operation, "div") == 0) {
-        if (num2 == 0) {
-            set_response_status(response, HTTP_STATUS_BAD_REQUEST);
-            set_response_body_string(response, "Error: Division by zero");
-            goto cleanup;
-        }
-        snprintf(result_buffer, sizeof(result_buffer), "%d / %d = %d", num1, num2, num1 / num2);
-    } else {
+    // Perform the calculation on 64-bit integers, refusing results that do not fit
+    int calc_operation = calc_operation_from_name(operation, strlen(operation));
+    if (calc_operation < 0) {
         set_response_status(response, HTTP_STATUS_BAD_REQUEST);
         set_response_body_string(response, "Bad Request: Unknown operation");
         goto cleanup;
     }
+    long long result;
+    int flags = calc_evaluate(calc_operation, num1, num2, &result);
+    if (flags & CALC_FLAG_DIVIDE_BY_ZERO) {
+        set_response_status(response, HTTP_STATUS_BAD_REQUEST);
+        set_response_body_string(response, "Error: Division by zero");
+        goto cleanup;
+    }
+    if (flags & CALC_FLAG_OVERFLOW) {
+        set_response_status(response, HTTP_STATUS_BAD_REQUEST);
+        set_response_body_string(response, "Error: Result out of range");
+        goto cleanup;
+    }
+    
+    static const char operator_symbols[CALC_OPERATION_COUNT] = { '+', '-', '*', '/' };
+    char result_buffer[256];
+    snprintf(result_buffer, sizeof(result_buffer), "%lld %c %lld = %lld",
+             num1, operator_symbols[calc_operation], num2, result);
     
     // Set the response
     set_response_content_type(response, "text/html");
@@ -304,6 +682,89 @@ cleanup:
     }
 }
 
+void handle_calc_batch(const http_request_t *request, http_response_t *response) {
+    if (!request || !response || !request->body_reader) {
+        set_response_status(response, HTTP_STATUS_INTERNAL_ERROR);
+        return;
+    }
+    
+    http_body_reader_t *reader = request->body_reader;
+    if (!request->chunked && request->content_length > CALC_BATCH_MAX_BODY) {
+        set_response_status(response, HTTP_STATUS_PAYLOAD_TOO_LARGE);
+        set_response_body_string(response, "Payload Too Large");
+        return;
+    }
+    
+    // The whole batch is parsed at once, so the body is read into one buffer
+    size_t capacity = request->chunked || request->content_length == 0 ? UPLOAD_CHUNK_SIZE : request->content_length;
+    size_t length = 0;
+    char *body = malloc(capacity);
+    while (body && reader->error_status == 0) {
+        if (length == capacity) {
+            if (http_body_complete(reader)) {
+                break;
+            }
+            if (capacity >= CALC_BATCH_MAX_BODY) {
+                // A chunked body of exactly the limit still has its last chunk
+                // unread, so one more byte tells it apart from a larger one
+                char probe;
+                http_body_read(reader, &probe, 1);
+                break;
+            }
+            char *grown = realloc(body, capacity * 2);
+            if (!grown) {
+                break;
+            }
+            body = grown;
+            capacity *= 2;
+        }
+        ssize_t bytes_read = http_body_read(reader, body + length, capacity - length);
+        if (bytes_read <= 0) {
+            break;
+        }
+        length += bytes_read;
+    }
+    
+    if (!body || reader->error_status != 0 || !http_body_complete(reader)) {
+        int too_large = reader->error_status == HTTP_STATUS_PAYLOAD_TOO_LARGE || (body && length == capacity);
+        set_response_status(response, too_large ? HTTP_STATUS_PAYLOAD_TOO_LARGE :
+                                      !body ? HTTP_STATUS_INTERNAL_ERROR : HTTP_STATUS_BAD_REQUEST);
+        set_response_body_string(response, too_large ? "Payload Too Large" :
+                                           !body ? "Server error: Failed to allocate memory" :
+                                                   "Bad Request: Incomplete request body");
+        free(body);
+        return;
+    }
+    
+    calc_batch_t batch;
+    calc_batch_init(&batch);
+    char error[256];
+    if (calc_batch_parse(&batch, body, length, error, sizeof(error)) != 0) {
+        char message[300];
+        snprintf(message, sizeof(message), "Bad Request: %s\n", error);
+        set_response_status(response, HTTP_STATUS_BAD_REQUEST);
+        set_response_body_string(response, message);
+        calc_batch_free(&batch);
+        free(body);
+        return;
+    }
+    free(body);
+    
+    calc_batch_evaluate(&batch);
+    
+    size_t result_length;
+    char *results = calc_batch_format(&batch, &result_length);
+    if (!results) {
+        set_response_status(response, HTTP_STATUS_INTERNAL_ERROR);
+        set_response_body_string(response, "Server error: Failed to allocate memory");
+    } else {
+        set_response_content_type(response, batch.format == CALC_FORMAT_JSON ? "application/json" : "text/plain");
+        // The formatted results become the body as they are
+        set_response_body_shared(response, results, result_length, free, results);
+    }
+    calc_batch_free(&batch);
+}
+
 void handle_sleep(const char *path, http_response_t *response) {
     if (!path || !response) {
         set_response_status(response, HTTP_STATUS_INTERNAL_ERROR);
@@ -364,4 +825,136 @@ cleanup:
     for (int i = 0; i < component_count; i++) {
         free(components[i]);
     }
-}
\ No newline at end of file
+}
+
+// Producer for /stream: writes one line at a time, so memory stays constant
+// however many lines are requested
+static int produce_stream_lines(http_stream_t *stream, void *context) {
+    int line_count = *(int *)context;
+    char line[64];
+    
+    for (int i = 1; i <= line_count; i++) {
+        snprintf(line, sizeof(line), "Line %d of %d\n", i, line_count);
+        if (http_stream_write_string(stream, line) != 0) {
+            return -1; // Client went away
+        }
+    }
+    
+    return 0;
+}
+
+void handle_stream(const char *path, http_response_t *response) {
+    if (!path || !response) {
+        set_response_status(response, HTTP_STATUS_INTERNAL_ERROR);
+        return;
+    }
+    
+    // Parse the path components
+    // Expected format: /stream/lines
+    char *components[10] = {0};
+    int component_count = extract_path_components(path, components, 10);
+    
+    if (component_count < 2 || strcmp(components[0], "stream") != 0) {
+        set_response_status(response, HTTP_STATUS_BAD_REQUEST);
+        set_response_body_string(response, "Bad Request: Invalid stream path");
+        goto cleanup;
+    }
+    
+    // Validate the number
+    if (!is_number(components[1])) {
+        set_response_status(response, HTTP_STATUS_BAD_REQUEST);
+        set_response_body_string(response, "Bad Request: Invalid number format");
+        goto cleanup;
+    }
+    
+    int *line_count = malloc(sizeof(int));
+    if (!line_count) {
+        set_response_status(response, HTTP_STATUS_INTERNAL_ERROR);
+        set_response_body_string(response, "Server error: Failed to allocate memory");
+        goto cleanup;
+    }
+    
+    // Limit the number of lines to a reasonable value
+    *line_count = custom_atoi(components[1]);
+    if (*line_count < 0) {
+        *line_count = 0;
+    } else if (*line_count > MAX_STREAM_LINES) {
+        *line_count = MAX_STREAM_LINES;
+    }
+    
+    set_response_content_type(response, "text/plain");
+    set_response_stream(response, produce_stream_lines, line_count, free);
+    
+cleanup:
+    // Free the components
+    for (int i = 0; i < component_count; i++) {
+        free(components[i]);
+    }
+}
+
+// FNV-1a over a block of data, continuing from hash
+static unsigned long long hash_bytes(unsigned long long hash, const char *data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+void handle_upload(const http_request_t *request, http_response_t *response) {
+    if (!request || !response || !request->body_reader) {
+        set_response_status(response, HTTP_STATUS_INTERNAL_ERROR);
+        return;
+    }
+    
+    http_body_reader_t *reader = request->body_reader;
+    unsigned long long hash = 14695981039346656037ULL;
+    size_t total = 0;
+    int spooled = 0;
+    
+    char *chunk = malloc(UPLOAD_CHUNK_SIZE);
+    if (!chunk) {
+        set_response_status(response, HTTP_STATUS_INTERNAL_ERROR);
+        set_response_body_string(response, "Server error: Failed to allocate memory");
+        return;
+    }
+    
+    // Large or unknown-length bodies go to a temp file first, small ones are hashed as they arrive
+    int input_fd = -1;
+    if (request->chunked || request->content_length > spool_threshold) {
+        size_t spooled_size;
+        if (http_body_spool(reader, &input_fd, &spooled_size) == 0) {
+            spooled = 1;
+        }
+    }
+    
+    while (reader->error_status == 0) {
+        ssize_t bytes_read = spooled ? read(input_fd, chunk, UPLOAD_CHUNK_SIZE) :
+                                       http_body_read(reader, chunk, UPLOAD_CHUNK_SIZE);
+        if (bytes_read <= 0) {
+            if (bytes_read < 0 && spooled) {
+                reader->error_status = HTTP_STATUS_INTERNAL_ERROR;
+            }
+            break;
+        }
+        hash = hash_bytes(hash, chunk, bytes_read);
+        total += bytes_read;
+    }
+    
+    free(chunk);
+    if (input_fd >= 0) {
+        close(input_fd);
+    }
+    
+    if (reader->error_status != 0) {
+        set_response_status(response, reader->error_status);
+        set_response_body_string(response, reader->error_status == HTTP_STATUS_PAYLOAD_TOO_LARGE ?
+                                 "Payload Too Large" : "Bad Request: Incomplete request body");
+        return;
+    }
+    
+    char result[256];
+    snprintf(result, sizeof(result), "Received %zu bytes (fnv1a64 %016llx%s)\n",
+             total, hash, spooled ? ", spooled to disk" : "");
+    set_response_body_string(response, result);
+}
@@ -4,16 +4,84 @@
 #include "http_request.h"
 #include "http_response.h"
 
+#define MAX_ROUTES 64
+
+// Base directory for static files
+#define STATIC_DIR "./static"
+#define MAX_FILE_SIZE (10 * 1024 * 1024) // 10MB max
+
+// Methods a route accepts
+#define ROUTE_METHOD_GET  0x1
+#define ROUTE_METHOD_POST 0x2
+#define ROUTE_METHOD_PUT  0x4
+
+typedef void (*route_handler_t)(const http_request_t *request, http_response_t *response);
+
+typedef struct {
+    char prefix[128];
+    size_t prefix_length;
+    int exact;             // Match the whole path instead of a prefix
+    int methods;           // ROUTE_METHOD_ flags
+    int executor_class;    // EXECUTOR_ class the handler runs on
+    unsigned int cache_ttl_ms; // How long GET responses are reused (see response_cache.h), 0 for never
+    route_handler_t handler;
+} route_t;
+
+// Register a route. A pattern ending in '/' matches every path below it,
+// any other pattern (and "/" itself) matches only itself; the longest match wins.
+int register_route(const char *pattern, int methods, int executor_class, route_handler_t handler);
+
+// Register the built-in routes
+void register_default_routes(void);
+
+// Change the executor class of a registered route
+int set_route_class(const char *pattern, int executor_class);
+
+// Reuse a route's GET responses for ttl_ms, or stop caching them with 0
+int set_route_cache_ttl(const char *pattern, unsigned int ttl_ms);
+
+// Registered routes in registration order, for reporting
+int get_route_count(void);
+const route_t *get_route(int index);
+int get_route_index(const route_t *route);
+
+// Find the route for a path, or NULL
+const route_t *find_route(const char *path);
+
 // Handle the incoming request and generate a response
 void handle_request(const http_request_t *request, http_response_t *response);
 
+// Handle the home page
+void handle_index(const http_request_t *request, http_response_t *response);
+
+// Handle paths without a route
+void handle_not_found(const http_request_t *request, http_response_t *response);
+
+// Handle the statistics page
+void handle_stats(const http_request_t *request, http_response_t *response);
+
+// Handle the export of traced requests (see trace.h)
+void handle_debug_trace(const http_request_t *request, http_response_t *response);
+
+// Handle the map of static files to their fingerprinted URLs (see asset_manifest.h)
+void handle_asset_manifest(const http_request_t *request, http_response_t *response);
+
 // Handle static file requests
-void handle_static_file(const char *path, http_response_t *response);
+void handle_static_file(const http_request_t *request, const char *path, http_response_t *response);
 
 // Handle calculator requests
 void handle_calc(const char *path, http_response_t *response);
 
+// Handle a batch of calculations sent as the request body
+void handle_calc_batch(const http_request_t *request, http_response_t *response);
+
 // Handle sleep requests for pipeline testing
 void handle_sleep(const char *path, http_response_t *response);
 
+// Handle uploads, reading the request body in bounded chunks
+void handle_upload(const http_request_t *request, http_response_t *response);
+
+// Handle streaming requests that generate a body incrementally
+void handle_stream(const char *path, http_response_t *response);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,146 @@
+#define _GNU_SOURCE // SO_BUSY_POLL
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "socket_options.h"
+#include "utils.h"
+
+static int cork_enabled = 1;
+
+typedef struct {
+    const char *name;
+    size_t offset;      // Of the field in socket_options_t
+    int level;
+    int option;
+    int tcp_only;
+} option_info_t;
+
+static const option_info_t option_table[] = {
+    {"defer_accept", offsetof(socket_options_t, defer_accept), IPPROTO_TCP, TCP_DEFER_ACCEPT, 1},
+    {"fastopen", offsetof(socket_options_t, fastopen), IPPROTO_TCP, TCP_FASTOPEN, 1},
+    {"nodelay", offsetof(socket_options_t, nodelay), IPPROTO_TCP, TCP_NODELAY, 1},
+    {"rcvbuf", offsetof(socket_options_t, rcvbuf), SOL_SOCKET, SO_RCVBUF, 0},
+    {"sndbuf", offsetof(socket_options_t, sndbuf), SOL_SOCKET, SO_SNDBUF, 0},
+    {"busy_poll", offsetof(socket_options_t, busy_poll), SOL_SOCKET, SO_BUSY_POLL, 0},
+};
+#define OPTION_COUNT (sizeof(option_table) / sizeof(option_table[0]))
+
+static int *field(socket_options_t *options, size_t offset) {
+    return (int *)((char *)options + offset);
+}
+
+static int value_of(const socket_options_t *options, size_t offset) {
+    return *(const int *)((const char *)options + offset);
+}
+
+void socket_options_init(socket_options_t *options) {
+    for (size_t i = 0; i < OPTION_COUNT; i++) {
+        *field(options, option_table[i].offset) = SOCKET_OPTION_UNSET;
+    }
+    options->cork = SOCKET_OPTION_UNSET;
+}
+
+int socket_options_parse(socket_options_t *options, const char *option) {
+    const char *equals = strchr(option, '=');
+    size_t name_length = equals ? (size_t)(equals - option) : strlen(option);
+
+    // A bare name switches a flag on; everything else needs a value
+    int value = 1;
+    if (equals) {
+        value = string_to_int(equals + 1);
+        if (value < 0 || (value == 0 && strcmp(equals + 1, "0") != 0)) {
+            return -1;
+        }
+    }
+
+    if (name_length == 4 && strncmp(option, "cork", 4) == 0) {
+        options->cork = value != 0;
+        return 0;
+    }
+    for (size_t i = 0; i < OPTION_COUNT; i++) {
+        const option_info_t *info = &option_table[i];
+        if (strlen(info->name) == name_length && strncmp(option, info->name, name_length) == 0) {
+            if (!equals && strcmp(info->name, "nodelay") != 0) {
+                return -1;
+            }
+            *field(options, info->offset) = value;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void socket_options_merge(socket_options_t *options, const socket_options_t *defaults) {
+    for (size_t i = 0; i < OPTION_COUNT; i++) {
+        int *value = field(options, option_table[i].offset);
+        if (*value == SOCKET_OPTION_UNSET) {
+            *value = value_of(defaults, option_table[i].offset);
+        }
+    }
+    if (options->cork == SOCKET_OPTION_UNSET) {
+        options->cork = defaults->cork;
+    }
+}
+
+// Fast Open only takes effect on the server side when the sysctl allows it
+static int fastopen_server_enabled(void) {
+    FILE *file = fopen("/proc/sys/net/ipv4/tcp_fastopen", "r");
+    int mode = 0;
+    if (file) {
+        if (fscanf(file, "%d", &mode) != 1) {
+            mode = 0;
+        }
+        fclose(file);
+    }
+    return (mode & 2) != 0;
+}
+
+int socket_options_apply(int listen_socket, int family, const socket_options_t *options,
+                         char *report, size_t report_size) {
+    int failures = 0;
+    size_t length = 0;
+    report[0] = '\0';
+
+    for (size_t i = 0; i < OPTION_COUNT; i++) {
+        const option_info_t *info = &option_table[i];
+        int value = value_of(options, info->offset);
+        if (value == SOCKET_OPTION_UNSET || (info->tcp_only && family == AF_UNIX)) {
+            continue;
+        }
+
+        char result[96];
+        if (setsockopt(listen_socket, info->level, info->option, &value, sizeof(value)) != 0) {
+            snprintf(result, sizeof(result), " (failed: %s)", strerror(errno));
+            failures++;
+        } else if (info->offset == offsetof(socket_options_t, rcvbuf) ||
+                   info->offset == offsetof(socket_options_t, sndbuf)) {
+            // The kernel doubles buffer sizes and clamps them to net.core.[rw]mem_max
+            int actual = 0;
+            socklen_t actual_length = sizeof(actual);
+            getsockopt(listen_socket, info->level, info->option, &actual, &actual_length);
+            snprintf(result, sizeof(result), " (kernel %d)", actual);
+        } else if (info->offset == offsetof(socket_options_t, fastopen) && !fastopen_server_enabled()) {
+            snprintf(result, sizeof(result), " (inactive: net.ipv4.tcp_fastopen lacks 2)");
+        } else {
+            result[0] = '\0';
+        }
+
+        if (length < report_size) {
+            length += snprintf(report + length, report_size - length, "%s%s=%d%s",
+                               length > 0 ? " " : "", info->name, value, result);
+        }
+    }
+    return failures;
+}
+
+void socket_options_set_cork(int enabled) {
+    cork_enabled = enabled;
+}
+
+int socket_options_more_flag(void) {
+    return cork_enabled ? MSG_MORE : 0;
+}
@@ -0,0 +1,44 @@
+#ifndef SOCKET_OPTIONS_H
+#define SOCKET_OPTIONS_H
+
+#include <stddef.h>
+
+#define SOCKET_OPTION_UNSET -1   // Leave the kernel default alone
+
+// Tuning for a listening socket. Linux copies these into every connection
+// accepted from it, so none of them costs a system call per connection.
+typedef struct {
+    int defer_accept;   // TCP_DEFER_ACCEPT: seconds accept() waits for the first request bytes
+    int fastopen;       // TCP_FASTOPEN: pending Fast Open handshakes allowed
+    int nodelay;        // TCP_NODELAY: 1 turns off Nagle's algorithm
+    int rcvbuf;         // SO_RCVBUF in bytes
+    int sndbuf;         // SO_SNDBUF in bytes
+    int busy_poll;      // SO_BUSY_POLL: microseconds a blocking read busy-polls the device
+    int cork;           // Hold a response head back until its body is written (-O only)
+} socket_options_t;
+
+// Mark every option unset
+void socket_options_init(socket_options_t *options);
+
+// Parse one "name=value" option (or "nodelay"/"cork", meaning =1).
+// Returns 0, or -1 for an unknown name or a bad value.
+int socket_options_parse(socket_options_t *options, const char *option);
+
+// Take the default for every option left unset
+void socket_options_merge(socket_options_t *options, const socket_options_t *defaults);
+
+// Apply the options to a bound socket before listen(). TCP-only options
+// are skipped for Unix sockets. A description of what took effect is
+// written to report; returns the number of options the kernel refused.
+int socket_options_apply(int listen_socket, int family, const socket_options_t *options,
+                         char *report, size_t report_size);
+
+// Whether to coalesce a response head with the body written right after
+// it. On by default.
+void socket_options_set_cork(int enabled);
+
+// Flags for a send() that is immediately followed by more of the same
+// response: MSG_MORE while coalescing, otherwise 0
+int socket_options_more_flag(void);
+
+#endif
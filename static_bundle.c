@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "static_bundle.h"
+
+// The bundle stays mapped for the lifetime of the process
+static const unsigned char *bundle_base = NULL;
+static size_t bundle_size = 0;
+static const bundle_entry_t *bundle_index = NULL;
+static uint32_t bundle_entry_count = 0;
+
+// Check that a NUL-terminated string starts inside the bundle and ends before its end
+static int valid_string(const unsigned char *base, size_t size, uint64_t offset) {
+    if (offset >= size) {
+        return 0;
+    }
+    return memchr(base + offset, '\0', size - offset) != NULL;
+}
+
+static int valid_range(size_t size, uint64_t offset, uint64_t length) {
+    return offset <= size && length <= size - offset;
+}
+
+// Validate every offset up front so lookups never touch memory outside the mapping
+static int validate_bundle(const unsigned char *base, size_t size) {
+    if (size < sizeof(bundle_header_t)) {
+        return -1;
+    }
+
+    const bundle_header_t *header = (const bundle_header_t *)base;
+    if (memcmp(header->magic, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC)) != 0 ||
+        header->version != BUNDLE_VERSION ||
+        header->total_size != size) {
+        return -1;
+    }
+
+    if (header->index_offset % sizeof(uint64_t) != 0 ||
+        !valid_range(size, header->index_offset, (uint64_t)header->entry_count * sizeof(bundle_entry_t))) {
+        return -1;
+    }
+
+    const bundle_entry_t *entries = (const bundle_entry_t *)(base + header->index_offset);
+    for (uint32_t i = 0; i < header->entry_count; i++) {
+        const bundle_entry_t *entry = &entries[i];
+        if (!valid_string(base, size, entry->path_offset) ||
+            !valid_string(base, size, entry->mime_offset) ||
+            !valid_range(size, entry->data_offset, entry->data_size) ||
+            !valid_range(size, entry->gzip_offset, entry->gzip_size) ||
+            memchr(entry->etag, '\0', sizeof(entry->etag)) == NULL) {
+            return -1;
+        }
+
+        // Binary search relies on the index being sorted
+        if (i > 0 && strcmp((const char *)base + entries[i - 1].path_offset,
+                            (const char *)base + entry->path_offset) >= 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int static_bundle_open(const char *bundle_path) {
+    int fd = open(bundle_path, O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open static bundle");
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+        fprintf(stderr, "Failed to read static bundle %s\n", bundle_path);
+        close(fd);
+        return -1;
+    }
+
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        perror("Failed to map static bundle");
+        return -1;
+    }
+
+    if (validate_bundle(mapping, st.st_size) != 0) {
+        fprintf(stderr, "Invalid static bundle %s\n", bundle_path);
+        munmap(mapping, st.st_size);
+        return -1;
+    }
+
+    // Ask the kernel to start paging the bundle in before the first request
+    posix_madvise(mapping, st.st_size, POSIX_MADV_WILLNEED);
+
+    const bundle_header_t *header = mapping;
+    bundle_base = mapping;
+    bundle_size = st.st_size;
+    bundle_index = (const bundle_entry_t *)(bundle_base + header->index_offset);
+    bundle_entry_count = header->entry_count;
+
+    printf("Serving %u static files from bundle %s (%zu bytes)\n",
+           bundle_entry_count, bundle_path, bundle_size);
+    return 0;
+}
+
+int static_bundle_loaded(void) {
+    return bundle_base != NULL;
+}
+
+static void fill_asset(const bundle_entry_t *entry, static_asset_t *asset) {
+    asset->path = (const char *)bundle_base + entry->path_offset;
+    asset->content_type = (const char *)bundle_base + entry->mime_offset;
+    asset->etag = entry->etag;
+    asset->data = bundle_base + entry->data_offset;
+    asset->data_size = entry->data_size;
+    asset->gzip_data = entry->gzip_size > 0 ? bundle_base + entry->gzip_offset : NULL;
+    asset->gzip_size = entry->gzip_size;
+}
+
+int static_bundle_count(void) {
+    return bundle_base ? (int)bundle_entry_count : 0;
+}
+
+int static_bundle_get(int index, static_asset_t *asset) {
+    if (!bundle_base || index < 0 || (uint32_t)index >= bundle_entry_count || !asset) {
+        return -1;
+    }
+    fill_asset(&bundle_index[index], asset);
+    return 0;
+}
+
+int static_bundle_find(const char *path, static_asset_t *asset) {
+    if (!bundle_base || !path || !asset) {
+        return -1;
+    }
+
+    // Binary search over the sorted index
+    uint32_t low = 0;
+    uint32_t high = bundle_entry_count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        const bundle_entry_t *entry = &bundle_index[mid];
+        int cmp = strcmp(path, (const char *)bundle_base + entry->path_offset);
+        if (cmp == 0) {
+            fill_asset(entry, asset);
+            return 0;
+        } else if (cmp < 0) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+
+    return -1;
+}
+
+void static_bundle_release_body(void *owner) {
+    (void)owner; // The mapping outlives every response
+}
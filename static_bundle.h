@@ -0,0 +1,62 @@
+#ifndef STATIC_BUNDLE_H
+#define STATIC_BUNDLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// On-disk layout of a static asset bundle produced by http_pack.
+// All offsets are relative to the start of the file and all integers are
+// stored in host byte order, since bundles are built on the machine they
+// are deployed to.
+#define BUNDLE_MAGIC "SRVPACK"
+#define BUNDLE_VERSION 1
+#define BUNDLE_ETAG_SIZE 24
+
+typedef struct {
+    char magic[8];           // BUNDLE_MAGIC, NUL-terminated
+    uint32_t version;
+    uint32_t entry_count;
+    uint64_t index_offset;   // Array of bundle_entry_t sorted by path
+    uint64_t total_size;     // Size of the whole bundle file
+} bundle_header_t;
+
+typedef struct {
+    uint64_t path_offset;    // NUL-terminated path below the static directory, e.g. "/app.js"
+    uint64_t mime_offset;    // NUL-terminated Content-Type
+    uint64_t data_offset;
+    uint64_t data_size;
+    uint64_t gzip_offset;    // Precompressed variant, 0 when there is none
+    uint64_t gzip_size;
+    char etag[BUNDLE_ETAG_SIZE]; // Quoted strong ETag, NUL-terminated
+} bundle_entry_t;
+
+// A file served out of the mapped bundle
+typedef struct {
+    const char *path;
+    const char *content_type;
+    const char *etag;
+    const void *data;
+    size_t data_size;
+    const void *gzip_data;   // NULL when there is no precompressed variant
+    size_t gzip_size;
+} static_asset_t;
+
+// Map a bundle file into memory and make it the source for static files
+int static_bundle_open(const char *bundle_path);
+
+// Whether a bundle is loaded
+int static_bundle_loaded(void);
+
+// Look up a path (relative to the static directory, starting with '/').
+// Returns 0 and fills asset when found.
+int static_bundle_find(const char *path, static_asset_t *asset);
+
+// Number of files in the loaded bundle, and the file at an index of the
+// path-sorted index, for listing them
+int static_bundle_count(void);
+int static_bundle_get(int index, static_asset_t *asset);
+
+// No-op release callback for response bodies pointing into the mapping
+void static_bundle_release_body(void *owner);
+
+#endif
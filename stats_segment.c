@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "stats_segment.h"
+
+#define STATS_READ_ATTEMPTS 100000
+
+size_t stats_segment_size(int slot_count) {
+    return sizeof(stats_segment_t) + (size_t)slot_count * sizeof(stats_slot_t);
+}
+
+stats_segment_t *stats_segment_create(const char *path, int slot_count) {
+    // A file left by a server that died with the same pid is stale
+    unlink(path);
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to create stats segment %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    size_t size = stats_segment_size(slot_count);
+    if (ftruncate(fd, size) < 0) {
+        fprintf(stderr, "Failed to size stats segment %s: %s\n", path, strerror(errno));
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
+    void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Failed to map stats segment %s: %s\n", path, strerror(errno));
+        unlink(path);
+        return NULL;
+    }
+
+    // A freshly truncated file reads as zeros
+    stats_segment_t *segment = mapping;
+    segment->header.magic = STATS_SEGMENT_MAGIC;
+    segment->header.version = STATS_SEGMENT_VERSION;
+    segment->header.slot_size = sizeof(stats_slot_t);
+    segment->header.slot_count = slot_count;
+    return segment;
+}
+
+stats_segment_t *stats_segment_open(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat file_status;
+    if (fstat(fd, &file_status) < 0 || (size_t)file_status.st_size < sizeof(stats_header_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    void *mapping = mmap(NULL, file_status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+    stats_segment_t *segment = mapping;
+    if (segment->header.magic != STATS_SEGMENT_MAGIC || segment->header.version != STATS_SEGMENT_VERSION ||
+        segment->header.slot_size != sizeof(stats_slot_t) || segment->header.slot_count < 0 ||
+        stats_segment_size(segment->header.slot_count) > (size_t)file_status.st_size) {
+        munmap(mapping, file_status.st_size);
+        return NULL;
+    }
+    return segment;
+}
+
+void stats_segment_close(stats_segment_t *segment) {
+    munmap(segment, stats_segment_size(segment->header.slot_count));
+}
+
+void stats_slot_write(stats_slot_t *slot, const worker_stats_t *counters) {
+    // Forced odd: a worker killed mid-update leaves the count odd for its
+    // replacement
+    unsigned int writing = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) | 1;
+    __atomic_store_n(&slot->sequence, writing, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&slot->counters, counters, sizeof(worker_stats_t));
+    __atomic_store_n(&slot->sequence, writing + 1, __ATOMIC_RELEASE);
+}
+
+void stats_slot_read(const stats_slot_t *slot, worker_stats_t *counters, worker_stats_t *retired) {
+    // A writer finishes in well under a microsecond; one that keeps the
+    // slot odd this long was killed part way, and its last copy is final
+    for (int attempt = 0; ; attempt++) {
+        unsigned int before = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        int settled = attempt >= STATS_READ_ATTEMPTS;
+        if ((before & 1) && !settled) {
+            continue;
+        }
+        memcpy(counters, &slot->counters, sizeof(worker_stats_t));
+        if (retired) {
+            memcpy(retired, &slot->retired, sizeof(worker_stats_t));
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (settled || __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == before) {
+            return;
+        }
+    }
+}
+
+void stats_slot_retire(stats_slot_t *slot) {
+    unsigned int writing = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) | 1;
+    __atomic_store_n(&slot->sequence, writing, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    stats_add_counters(&slot->retired, &slot->counters);
+    memset(&slot->counters, 0, sizeof(worker_stats_t));
+    __atomic_store_n(&slot->sequence, writing + 1, __ATOMIC_RELEASE);
+}
+
+void stats_add_counters(worker_stats_t *sum, const worker_stats_t *part) {
+    sum->rate_limited += part->rate_limited;
+    sum->tls.handshakes += part->tls.handshakes;
+    sum->tls.resumed += part->tls.resumed;
+    sum->tls.failed += part->tls.failed;
+    sum->tls.ktls_send += part->tls.ktls_send;
+    sum->tls.ktls_receive += part->tls.ktls_receive;
+    for (int c = 0; c < EXECUTOR_CLASS_COUNT; c++) {
+        executor_stats_t *to = &sum->executors[c];
+        const executor_stats_t *from = &part->executors[c];
+        to->submitted += from->submitted;
+        to->completed += from->completed;
+        to->rejected += from->rejected;
+        to->shed += from->shed;
+        to->total_wait_ns += from->total_wait_ns;
+        if (from->max_wait_ns > to->max_wait_ns) {
+            to->max_wait_ns = from->max_wait_ns;
+        }
+    }
+
+    // Every request counter is an unsigned long long, so they add up word by word
+    unsigned long long *to = (unsigned long long *)&sum->requests;
+    const unsigned long long *from = (const unsigned long long *)&part->requests;
+    for (size_t w = 0; w < sizeof(request_metrics_t) / sizeof(unsigned long long); w++) {
+        to[w] += from[w];
+    }
+}
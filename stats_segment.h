@@ -0,0 +1,78 @@
+#ifndef STATS_SEGMENT_H
+#define STATS_SEGMENT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "worker_stats.h"
+
+// The counters are published in a file under /dev/shm so that tools such
+// as http_server_top can read a live server without sending it requests
+#define STATS_SEGMENT_PATH_FORMAT "/dev/shm/http_server.%d"   // Filled in with the server's pid
+#define STATS_SEGMENT_MAGIC       0x53535448u                 // "HTSS"
+#define STATS_SEGMENT_VERSION     4
+#define STATS_NAME_SIZE           128
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int slot_size;           // sizeof(stats_slot_t), to catch a mismatched reader
+    pid_t server_pid;                 // The master, or the only process
+    int workers;                      // 0 when the server runs as a single process
+    int slot_count;
+    long long started;                // Wall-clock seconds
+    int route_count;
+    char executor_names[EXECUTOR_CLASS_COUNT][STATS_NAME_SIZE];
+    char route_names[MAX_ROUTES + 1][STATS_NAME_SIZE];
+} stats_header_t;
+
+// One process's counters. A worker rewrites its own slot under a seqlock:
+// sequence is odd while an update is in progress, so a reader retries
+// rather than take a torn copy, and the writer never waits on readers.
+// When a worker exits, the supervisor moves what it counted into retired
+// under the same seqlock, so totals carry on across restarts instead of
+// dropping back to what the replacement has counted.
+typedef struct {
+    pid_t pid;                        // Written by the supervisor; 0 while not running
+    unsigned long long restarts;      // Written by the supervisor
+    unsigned int sequence;
+    worker_stats_t counters;          // Pointer fields (executor names) are not meaningful here
+    worker_stats_t retired;           // Running counters of the slot's exited workers, added up
+} __attribute__((aligned(64))) stats_slot_t;
+
+typedef struct {
+    stats_header_t header;
+    stats_slot_t slots[];
+} stats_segment_t;
+
+// Create and map the segment file with room for slot_count slots; the
+// header is zeroed apart from the magic, version and sizes. Returns NULL
+// after printing why on failure.
+stats_segment_t *stats_segment_create(const char *path, int slot_count);
+
+// Map an existing segment read-only. Returns NULL if it is missing or not
+// a segment of this layout.
+stats_segment_t *stats_segment_open(const char *path);
+
+// Unmap a segment from stats_segment_open()
+void stats_segment_close(stats_segment_t *segment);
+
+// Bytes mapped for a segment with slot_count slots
+size_t stats_segment_size(int slot_count);
+
+// Publish a slot's counters (only ever called by the slot's own process)
+void stats_slot_write(stats_slot_t *slot, const worker_stats_t *counters);
+
+// Take a consistent copy of a slot's counters, and of its retired ones
+// unless retired is NULL
+void stats_slot_read(const stats_slot_t *slot, worker_stats_t *counters, worker_stats_t *retired);
+
+// Move the counters of a slot whose worker has exited into its retired
+// ones (only ever called by the supervisor, once the worker is gone)
+void stats_slot_retire(stats_slot_t *slot);
+
+// Add the counters that only ever grow (requests, bytes, executor jobs,
+// TLS handshakes and so on) of part to sum; gauges such as connections,
+// queue depths and memory are left alone
+void stats_add_counters(worker_stats_t *sum, const worker_stats_t *part);
+
+#endif
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include "supervisor.h"
+#include "listener.h"
+#include "worker_stats.h"
+#include "upgrade.h"
+
+static volatile sig_atomic_t stopping = 0;
+static volatile sig_atomic_t upgrading = 0;
+static volatile sig_atomic_t dumping = 0;
+
+static void handle_stop_signal(int signal_number) {
+    (void)signal_number;
+    stopping = 1;
+}
+
+static void handle_upgrade_signal(int signal_number) {
+    (void)signal_number;
+    upgrading = 1;
+}
+
+// Traces are kept per worker, so a dump request is passed on to each
+static void handle_dump_signal(int signal_number) {
+    (void)signal_number;
+    dumping = 1;
+}
+
+// Handlers the workers run with, saved before the master installs its own
+static struct sigaction worker_interrupt_action;
+static struct sigaction worker_terminate_action;
+static struct sigaction worker_dump_action;
+
+static time_t now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+// Fork the worker for a slot. Returns the child's pid in the master, 0 in
+// the new worker, or -1 when fork() failed.
+static pid_t spawn_worker(int index, pid_t master_pid) {
+    // Anything still buffered would otherwise be written once per process
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("Failed to fork a worker");
+    }
+    if (pid != 0) {
+        return pid;
+    }
+
+    sigaction(SIGINT, &worker_interrupt_action, NULL);
+    sigaction(SIGTERM, &worker_terminate_action, NULL);
+    sigaction(SIGUSR1, &worker_dump_action, NULL);
+    signal(SIGUSR2, SIG_IGN); // Upgrades are run by the master
+
+    // Do not outlive a master that was killed outright
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() != master_pid) {
+        _exit(EXIT_FAILURE);
+    }
+
+    // The listeners (and any Unix socket files) belong to the master
+    listener_detach();
+    if (worker_stats_attach(index) != 0) {
+        fprintf(stderr, "Worker %d: failed to start publishing stats\n", index);
+    }
+    return 0;
+}
+
+static void report_exit(int index, pid_t pid, int status) {
+    if (WIFSIGNALED(status)) {
+        fprintf(stderr, "Worker %d (pid %d) killed by signal %d\n", index, (int)pid, WTERMSIG(status));
+    } else {
+        fprintf(stderr, "Worker %d (pid %d) exited with status %d\n", index, (int)pid, WEXITSTATUS(status));
+    }
+}
+
+int supervisor_run(int workers) {
+    if (worker_stats_create(workers) != 0) {
+        return -1;
+    }
+
+    pid_t master_pid = getpid();
+    pid_t pids[MAX_WORKER_PROCESSES];
+    time_t started[MAX_WORKER_PROCESSES];
+
+    // Without SA_RESTART, so a stop request interrupts waitpid()
+    struct sigaction stop_action;
+    memset(&stop_action, 0, sizeof(stop_action));
+    stop_action.sa_handler = handle_stop_signal;
+    sigemptyset(&stop_action.sa_mask);
+    sigaction(SIGINT, &stop_action, &worker_interrupt_action);
+    sigaction(SIGTERM, &stop_action, &worker_terminate_action);
+    stop_action.sa_handler = handle_upgrade_signal;
+    sigaction(SIGUSR2, &stop_action, NULL);
+    stop_action.sa_handler = handle_dump_signal;
+    sigaction(SIGUSR1, &stop_action, &worker_dump_action);
+
+    // The listeners are open, so a binary being upgraded can stop
+    // accepting; connections queue until the workers are up
+    upgrade_ready();
+
+    for (int i = 0; i < workers; i++) {
+        pids[i] = spawn_worker(i, master_pid);
+        if (pids[i] == 0) {
+            return 0;
+        }
+        started[i] = now_seconds();
+        worker_stats_set_pid(i, pids[i] > 0 ? pids[i] : 0);
+    }
+    printf("Supervisor %d running %d worker processes\n", (int)master_pid, workers);
+    fflush(stdout);
+
+    while (!stopping) {
+        if (dumping) {
+            dumping = 0;
+            for (int i = 0; i < workers; i++) {
+                if (pids[i] > 0) {
+                    kill(pids[i], SIGUSR1);
+                }
+            }
+        }
+        if (upgrading) {
+            upgrading = 0;
+            if (upgrade_handoff() == 0) {
+                // The new master accepts from now on and keeps the socket files
+                listener_detach();
+                break;
+            }
+        }
+
+        // Replace any worker that could not be started or has exited
+        for (int i = 0; i < workers && !stopping; i++) {
+            if (pids[i] > 0) {
+                continue;
+            }
+            if (now_seconds() - started[i] < 1) {
+                // It died straight away; do not spin forking a broken worker
+                struct timespec delay = {WORKER_RESTART_DELAY_MS / 1000, (WORKER_RESTART_DELAY_MS % 1000) * 1000000L};
+                nanosleep(&delay, NULL);
+                if (stopping) {
+                    break;
+                }
+            }
+            pids[i] = spawn_worker(i, master_pid);
+            if (pids[i] == 0) {
+                return 0;
+            }
+            started[i] = now_seconds();
+            worker_stats_set_pid(i, pids[i] > 0 ? pids[i] : 0);
+            worker_stats_count_restart(i);
+        }
+
+        // With a slot still empty after a failed fork, only poll for exits
+        int vacant = 0;
+        for (int i = 0; i < workers; i++) {
+            vacant |= pids[i] <= 0;
+        }
+
+        int status;
+        pid_t pid = waitpid(-1, &status, vacant ? WNOHANG : 0);
+        if (pid == 0) {
+            struct timespec delay = {WORKER_RESTART_DELAY_MS / 1000, (WORKER_RESTART_DELAY_MS % 1000) * 1000000L};
+            nanosleep(&delay, NULL);
+            continue;
+        }
+        if (pid < 0) {
+            if (errno != EINTR && errno != ECHILD) {
+                perror("waitpid");
+            }
+            continue;
+        }
+        for (int i = 0; i < workers; i++) {
+            if (pids[i] == pid) {
+                report_exit(i, pid, status);
+                pids[i] = 0;
+                worker_stats_retire(i);
+                worker_stats_set_pid(i, 0);
+            }
+        }
+    }
+
+    // Take the listeners down, then let every worker drain and exit. Only
+    // the workers are waited for: after an upgrade the new master is a
+    // child of this process too.
+    listener_close_all();
+    for (int i = 0; i < workers; i++) {
+        if (pids[i] > 0) {
+            kill(pids[i], SIGTERM);
+        }
+    }
+    for (int i = 0; i < workers; i++) {
+        while (pids[i] > 0 && waitpid(pids[i], NULL, 0) < 0 && errno == EINTR) {
+        }
+    }
+    worker_stats_remove();
+    printf("\nServer shutting down...\n");
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,15 @@
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#define MAX_WORKER_PROCESSES 256
+#define WORKER_RESTART_DELAY_MS 1000   // Pause before replacing a worker that died right after starting
+
+// Fork worker processes that share the already-open listeners, each with
+// its own threads, allocator and counters slot, and keep them running.
+// Returns 0 in every worker process, which then starts its pools and runs
+// the accept loop. The master stays in here replacing workers that exit
+// and ends the process when it is told to stop; it only returns -1 if
+// the shared stats segment cannot be set up.
+int supervisor_run(int workers);
+
+#endif
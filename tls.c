@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tls.h"
+
+#ifdef HAVE_OPENSSL
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+typedef struct {
+    SSL *ssl;
+    pthread_mutex_t mutex;  // An SSL object must not be used by two threads at once
+} tls_session_t;
+
+static SSL_CTX *tls_context = NULL;
+static tls_session_t **sessions = NULL;    // Indexed by socket; a slot is only touched by its connection
+static size_t session_capacity = 0;
+static tls_stats_t counters;
+
+// Offer HTTP/2 first, then HTTP/1.1
+static int select_alpn(SSL *ssl, const unsigned char **out, unsigned char *out_length,
+                       const unsigned char *in, unsigned int in_length, void *arg) {
+    static const unsigned char supported[] = "\x02h2\x08http/1.1";
+    (void)ssl;
+    (void)arg;
+    if (SSL_select_next_proto((unsigned char **)out, out_length, supported, sizeof(supported) - 1,
+                              in, in_length) != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK; // Carry on without ALPN; HTTP/1.1 is assumed
+    }
+    return SSL_TLSEXT_ERR_OK;
+}
+
+int tls_configure(const char *certificate_file, const char *key_file) {
+    SSL_CTX *context = SSL_CTX_new(TLS_server_method());
+    if (!context) {
+        ERR_print_errors_fp(stderr);
+        return -1;
+    }
+
+    SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+    SSL_CTX_set_options(context, SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE);
+#ifdef SSL_OP_ENABLE_KTLS
+    // Hand record encryption to the kernel when it supports the cipher
+    SSL_CTX_set_options(context, SSL_OP_ENABLE_KTLS);
+#endif
+    SSL_CTX_set_mode(context, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    if (SSL_CTX_use_certificate_chain_file(context, certificate_file) != 1 ||
+        SSL_CTX_use_PrivateKey_file(context, key_file, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(context) != 1) {
+        fprintf(stderr, "Failed to load TLS certificate %s and key %s\n", certificate_file, key_file);
+        ERR_print_errors_fp(stderr);
+        SSL_CTX_free(context);
+        return -1;
+    }
+
+    // Resumption: a server-side cache shared by all connections for session
+    // IDs, plus stateless tickets (TLS 1.3 clients get two per handshake)
+    static const unsigned char session_context[] = "http_server";
+    SSL_CTX_set_session_id_context(context, session_context, sizeof(session_context) - 1);
+    SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(context, TLS_SESSION_CACHE_SIZE);
+    SSL_CTX_set_timeout(context, TLS_SESSION_LIFETIME);
+    SSL_CTX_set_num_tickets(context, 2);
+
+    SSL_CTX_set_alpn_select_cb(context, select_alpn, NULL);
+
+    struct rlimit limit;
+    session_capacity = getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY ?
+                       limit.rlim_cur : 65536;
+    sessions = calloc(session_capacity, sizeof(tls_session_t *));
+    if (!sessions) {
+        SSL_CTX_free(context);
+        return -1;
+    }
+
+    tls_context = context;
+#ifdef SSL_OP_ENABLE_KTLS
+    const char *ktls = "requested";
+#else
+    const char *ktls = "unavailable in this OpenSSL";
+#endif
+    printf("TLS: %s, ALPN h2 and http/1.1, session cache %d, tickets on, kTLS %s\n",
+           certificate_file, TLS_SESSION_CACHE_SIZE, ktls);
+    return 0;
+}
+
+int tls_enabled(void) {
+    return tls_context != NULL;
+}
+
+static tls_session_t *session_for(int client_socket) {
+    if (!sessions || client_socket < 0 || (size_t)client_socket >= session_capacity) {
+        return NULL;
+    }
+    return sessions[client_socket];
+}
+
+int tls_active(int client_socket) {
+    return session_for(client_socket) != NULL;
+}
+
+// Wait until the socket is ready for what OpenSSL asked for. The connection
+// timer shuts the socket down on a deadline, which ends the wait.
+static int wait_for(int client_socket, int ssl_error) {
+    struct pollfd poll_fd;
+    poll_fd.fd = client_socket;
+    poll_fd.events = ssl_error == SSL_ERROR_WANT_WRITE ? POLLOUT : POLLIN;
+    poll_fd.revents = 0;
+
+    int ready;
+    do {
+        ready = poll(&poll_fd, 1, -1);
+    } while (ready < 0 && errno == EINTR);
+    return ready > 0 ? 0 : -1;
+}
+
+int tls_accept(int client_socket) {
+    if (!tls_context || client_socket < 0 || (size_t)client_socket >= session_capacity) {
+        return -1;
+    }
+
+    tls_session_t *session = malloc(sizeof(tls_session_t));
+    if (!session) {
+        return -1;
+    }
+    session->ssl = SSL_new(tls_context);
+    if (!session->ssl) {
+        free(session);
+        return -1;
+    }
+    pthread_mutex_init(&session->mutex, NULL);
+
+    // Non-blocking, so a thread waiting to read never holds the session
+    // lock while another thread of the connection (HTTP/2) wants to write
+    int flags = fcntl(client_socket, F_GETFL, 0);
+    fcntl(client_socket, F_SETFL, flags | O_NONBLOCK);
+    SSL_set_fd(session->ssl, client_socket);
+
+    while (1) {
+        ERR_clear_error();
+        int result = SSL_accept(session->ssl);
+        if (result == 1) {
+            break;
+        }
+        int error = SSL_get_error(session->ssl, result);
+        if ((error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) ||
+            wait_for(client_socket, error) != 0) {
+            __atomic_fetch_add(&counters.failed, 1, __ATOMIC_RELAXED);
+            SSL_free(session->ssl);
+            pthread_mutex_destroy(&session->mutex);
+            free(session);
+            return -1;
+        }
+    }
+
+    __atomic_fetch_add(&counters.handshakes, 1, __ATOMIC_RELAXED);
+    if (SSL_session_reused(session->ssl)) {
+        __atomic_fetch_add(&counters.resumed, 1, __ATOMIC_RELAXED);
+    }
+    if (BIO_get_ktls_send(SSL_get_wbio(session->ssl))) {
+        __atomic_fetch_add(&counters.ktls_send, 1, __ATOMIC_RELAXED);
+    }
+    if (BIO_get_ktls_recv(SSL_get_rbio(session->ssl))) {
+        __atomic_fetch_add(&counters.ktls_receive, 1, __ATOMIC_RELAXED);
+    }
+
+    sessions[client_socket] = session;
+    return 0;
+}
+
+int tls_negotiated_h2(int client_socket) {
+    tls_session_t *session = session_for(client_socket);
+    if (!session) {
+        return 0;
+    }
+    const unsigned char *protocol;
+    unsigned int length;
+    SSL_get0_alpn_selected(session->ssl, &protocol, &length);
+    return length == 2 && memcmp(protocol, "h2", 2) == 0;
+}
+
+ssize_t tls_recv(int client_socket, void *buffer, size_t length) {
+    tls_session_t *session = session_for(client_socket);
+    if (!session) {
+        errno = EBADF;
+        return -1;
+    }
+
+    while (1) {
+        size_t bytes_read = 0;
+        pthread_mutex_lock(&session->mutex);
+        ERR_clear_error();
+        // A SSL_ERROR_SYSCALL with errno still 0 is the peer closing without
+        // close_notify, so clear whatever an earlier call left there
+        errno = 0;
+        int result = SSL_read_ex(session->ssl, buffer, length, &bytes_read);
+        int error = result == 1 ? SSL_ERROR_NONE : SSL_get_error(session->ssl, result);
+        int read_errno = errno;
+        pthread_mutex_unlock(&session->mutex);
+
+        if (error == SSL_ERROR_NONE) {
+            return bytes_read;
+        }
+        if (error == SSL_ERROR_ZERO_RETURN || (error == SSL_ERROR_SYSCALL && read_errno == 0)) {
+            return 0; // close_notify, or the client just hung up
+        }
+        if ((error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) ||
+            wait_for(client_socket, error) != 0) {
+            errno = ECONNRESET;
+            return -1;
+        }
+    }
+}
+
+ssize_t tls_send(int client_socket, const void *data, size_t length) {
+    tls_session_t *session = session_for(client_socket);
+    if (!session) {
+        errno = EBADF;
+        return -1;
+    }
+
+    while (1) {
+        size_t written = 0;
+        pthread_mutex_lock(&session->mutex);
+        ERR_clear_error();
+        int result = SSL_write_ex(session->ssl, data, length, &written);
+        int error = result == 1 ? SSL_ERROR_NONE : SSL_get_error(session->ssl, result);
+        pthread_mutex_unlock(&session->mutex);
+
+        if (error == SSL_ERROR_NONE) {
+            return written;
+        }
+        if ((error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) ||
+            wait_for(client_socket, error) != 0) {
+            errno = EPIPE;
+            return -1;
+        }
+    }
+}
+
+void tls_close(int client_socket) {
+    tls_session_t *session = session_for(client_socket);
+    if (!session) {
+        return;
+    }
+    sessions[client_socket] = NULL;
+
+    // One attempt only: the socket is non-blocking and about to be closed
+    ERR_clear_error();
+    SSL_shutdown(session->ssl);
+    SSL_free(session->ssl);
+    pthread_mutex_destroy(&session->mutex);
+    free(session);
+}
+
+void tls_get_stats(tls_stats_t *stats) {
+    stats->handshakes = __atomic_load_n(&counters.handshakes, __ATOMIC_RELAXED);
+    stats->resumed = __atomic_load_n(&counters.resumed, __ATOMIC_RELAXED);
+    stats->failed = __atomic_load_n(&counters.failed, __ATOMIC_RELAXED);
+    stats->ktls_send = __atomic_load_n(&counters.ktls_send, __ATOMIC_RELAXED);
+    stats->ktls_receive = __atomic_load_n(&counters.ktls_receive, __ATOMIC_RELAXED);
+}
+
+#else // Built without OpenSSL
+
+#include <errno.h>
+
+int tls_configure(const char *certificate_file, const char *key_file) {
+    (void)certificate_file;
+    (void)key_file;
+    fprintf(stderr, "TLS support is not compiled in; rebuild with \"make TLS=1\"\n");
+    return -1;
+}
+
+int tls_enabled(void) {
+    return 0;
+}
+
+int tls_accept(int client_socket) {
+    (void)client_socket;
+    return -1;
+}
+
+int tls_negotiated_h2(int client_socket) {
+    (void)client_socket;
+    return 0;
+}
+
+int tls_active(int client_socket) {
+    (void)client_socket;
+    return 0;
+}
+
+ssize_t tls_recv(int client_socket, void *buffer, size_t length) {
+    (void)client_socket;
+    (void)buffer;
+    (void)length;
+    errno = EBADF;
+    return -1;
+}
+
+ssize_t tls_send(int client_socket, const void *data, size_t length) {
+    (void)client_socket;
+    (void)data;
+    (void)length;
+    errno = EBADF;
+    return -1;
+}
+
+void tls_close(int client_socket) {
+    (void)client_socket;
+}
+
+void tls_get_stats(tls_stats_t *stats) {
+    memset(stats, 0, sizeof(tls_stats_t));
+}
+
+#endif
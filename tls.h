@@ -0,0 +1,47 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define TLS_SESSION_CACHE_SIZE 20480    // Sessions kept for ID-based resumption
+#define TLS_SESSION_LIFETIME   7200     // Seconds a session (or ticket) can be resumed for
+
+// Handshake counters
+typedef struct {
+    unsigned long long handshakes;
+    unsigned long long resumed;         // Abbreviated handshakes from a cached session or ticket
+    unsigned long long failed;
+    unsigned long long ktls_send;       // Connections whose writes the kernel encrypts
+    unsigned long long ktls_receive;    // Connections whose reads the kernel decrypts
+} tls_stats_t;
+
+// Terminate TLS on every accepted connection using the given PEM
+// certificate chain and private key. Only available when built with
+// "make TLS=1"; otherwise this reports the problem and returns -1.
+int tls_configure(const char *certificate_file, const char *key_file);
+
+// Whether connections are TLS
+int tls_enabled(void);
+
+// Run the server side of the handshake on a new connection. The socket is
+// switched to non-blocking mode. Returns 0 once the handshake completed;
+// from then on send_all() and recv_some() on the socket go through TLS.
+int tls_accept(int client_socket);
+
+// Whether the client picked HTTP/2 ("h2") through ALPN
+int tls_negotiated_h2(int client_socket);
+
+// Whether the socket has a TLS session
+int tls_active(int client_socket);
+
+// Read or write application data; same results as recv()/send()
+ssize_t tls_recv(int client_socket, void *buffer, size_t length);
+ssize_t tls_send(int client_socket, const void *data, size_t length);
+
+// Send close_notify and drop the session. The caller still closes the socket.
+void tls_close(int client_socket);
+
+void tls_get_stats(tls_stats_t *stats);
+
+#endif
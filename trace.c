@@ -0,0 +1,341 @@
+#define _GNU_SOURCE // struct tcp_info
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "trace.h"
+#include "metrics.h"
+
+#define TRACE_RECORD_REQUEST 0
+#define TRACE_RECORD_CLOSE   1
+
+typedef struct {
+    unsigned long long sequence;         // Odd while the record is being written, 0 before first use
+    int kind;
+    int status_code;
+    unsigned long long connection_id;
+    unsigned long long marks[TRACE_MARK_COUNT];   // A close keeps its time in marks[0]
+    char method[16];
+    char path[TRACE_PATH_SIZE];
+    unsigned int rtt_us;                 // TCP_INFO of a close
+    unsigned int rttvar_us;
+    unsigned int total_retrans;
+    unsigned int snd_cwnd;
+} trace_record_t;
+
+// Writers on one ring claim slots with an atomic increment, so a ring is
+// shared by threads the same way a metrics stripe is
+typedef struct {
+    unsigned long long claimed;
+    trace_record_t records[TRACE_RING_SIZE];
+} __attribute__((aligned(64))) trace_ring_t;
+
+static const char *phase_names[TRACE_MARK_COUNT - 1] = { "queue", "read", "parse", "handle", "send" };
+
+static trace_ring_t rings[TRACE_RINGS];
+static unsigned int next_ring = 0;
+static __thread trace_ring_t *thread_ring = NULL;
+static __thread unsigned long long sample_state = 0;
+
+static int enabled = 0;
+static unsigned int sample_every = 0;
+static unsigned long long next_connection_id = 0;
+
+void trace_configure(unsigned int every) {
+    sample_every = every;
+    enabled = 1;
+}
+
+int trace_enabled(void) {
+    return enabled;
+}
+
+static trace_ring_t *ring(void) {
+    if (!thread_ring) {
+        unsigned int index = __atomic_fetch_add(&next_ring, 1, __ATOMIC_RELAXED) % TRACE_RINGS;
+        thread_ring = &rings[index];
+    }
+    return thread_ring;
+}
+
+// Random rather than every Nth, so requests that arrive in a fixed
+// pattern are not always or never picked
+static int sample(void) {
+    if (sample_every <= 1) {
+        return sample_every == 1;
+    }
+    if (sample_state == 0) {
+        sample_state = (metrics_now_ns() ^ (unsigned long long)(size_t)&sample_state) | 1;
+    }
+    sample_state ^= sample_state << 13;
+    sample_state ^= sample_state >> 7;
+    sample_state ^= sample_state << 17;
+    return sample_state % sample_every == 0;
+}
+
+// Take the next slot of this thread's ring and mark it as being written
+static trace_record_t *claim_record(unsigned long long *sequence) {
+    trace_ring_t *target = ring();
+    unsigned long long slot = __atomic_fetch_add(&target->claimed, 1, __ATOMIC_RELAXED);
+    trace_record_t *record = &target->records[slot % TRACE_RING_SIZE];
+    *sequence = slot * 2 + 1;
+    __atomic_store_n(&record->sequence, *sequence, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return record;
+}
+
+static void publish_record(trace_record_t *record, unsigned long long sequence) {
+    __atomic_store_n(&record->sequence, sequence + 1, __ATOMIC_RELEASE);
+}
+
+static void copy_text(char *destination, size_t size, const char *source) {
+    size_t length = strnlen(source, size - 1);
+    memcpy(destination, source, length);
+    destination[length] = '\0';
+}
+
+void trace_connection_begin(trace_connection_t *connection, unsigned long long accepted_ns) {
+    memset(connection, 0, sizeof(trace_connection_t));
+    if (enabled) {
+        connection->id = __atomic_add_fetch(&next_connection_id, 1, __ATOMIC_RELAXED);
+        connection->accepted_ns = accepted_ns;
+    }
+}
+
+void trace_connection_end(trace_connection_t *connection, int socket) {
+    if (!connection->traced) {
+        return;
+    }
+    // Unix sockets have no TCP_INFO
+    struct tcp_info info;
+    socklen_t length = sizeof(info);
+    memset(&info, 0, sizeof(info));
+    if (getsockopt(socket, IPPROTO_TCP, TCP_INFO, &info, &length) != 0) {
+        return;
+    }
+
+    unsigned long long sequence;
+    trace_record_t *record = claim_record(&sequence);
+    memset(record->marks, 0, sizeof(record->marks));
+    record->kind = TRACE_RECORD_CLOSE;
+    record->connection_id = connection->id;
+    record->marks[0] = metrics_now_ns();
+    record->rtt_us = info.tcpi_rtt;
+    record->rttvar_us = info.tcpi_rttvar;
+    record->total_retrans = info.tcpi_total_retrans;
+    record->snd_cwnd = info.tcpi_snd_cwnd;
+    publish_record(record, sequence);
+}
+
+void trace_request_begin(trace_connection_t *connection, trace_request_t *trace) {
+    memset(trace, 0, sizeof(trace_request_t));
+    trace->active = enabled;
+    // Kept-alive requests have no accept queue to wait in
+    if (enabled && connection->requests == 0) {
+        trace->marks[TRACE_MARK_ACCEPTED] = connection->accepted_ns;
+    }
+}
+
+void trace_mark(trace_request_t *trace, int mark) {
+    if (trace->active) {
+        trace->marks[mark] = metrics_now_ns();
+    }
+}
+
+void trace_request_end(trace_connection_t *connection, trace_request_t *trace,
+                       const http_request_t *request, int status_code) {
+    if (!trace->active) {
+        return;
+    }
+    connection->requests++;
+    if (!request->trace && !sample()) {
+        return;
+    }
+    connection->traced = 1;
+
+    unsigned long long sequence;
+    trace_record_t *record = claim_record(&sequence);
+    record->kind = TRACE_RECORD_REQUEST;
+    record->status_code = status_code;
+    record->connection_id = connection->id;
+    memcpy(record->marks, trace->marks, sizeof(record->marks));
+    copy_text(record->method, sizeof(record->method), request->method);
+    copy_text(record->path, sizeof(record->path), request->path);
+    publish_record(record, sequence);
+}
+
+// Copy out every record that is not being written; returns how many
+static size_t snapshot_records(trace_record_t *copies) {
+    size_t count = 0;
+    for (int r = 0; r < TRACE_RINGS; r++) {
+        for (int i = 0; i < TRACE_RING_SIZE; i++) {
+            const trace_record_t *record = &rings[r].records[i];
+            unsigned long long before = __atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE);
+            if (before == 0 || (before & 1)) {
+                continue;
+            }
+            memcpy(&copies[count], record, sizeof(trace_record_t));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&record->sequence, __ATOMIC_RELAXED) == before) {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+    int failed;
+} json_buffer_t;
+
+static void append(json_buffer_t *json, const char *format, ...) {
+    while (!json->failed) {
+        va_list arguments;
+        va_start(arguments, format);
+        int written = vsnprintf(json->data + json->length, json->capacity - json->length, format, arguments);
+        va_end(arguments);
+        if (written < 0) {
+            json->failed = 1;
+        } else if ((size_t)written < json->capacity - json->length) {
+            json->length += written;
+            return;
+        } else {
+            size_t capacity = json->capacity * 2 + written;
+            char *data = realloc(json->data, capacity);
+            if (!data) {
+                json->failed = 1;
+            } else {
+                json->data = data;
+                json->capacity = capacity;
+            }
+        }
+    }
+}
+
+// Paths are decoded, so anything may be in them
+static void append_escaped(json_buffer_t *json, const char *text) {
+    for (const unsigned char *c = (const unsigned char *)text; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            append(json, "\\%c", *c);
+        } else if (*c < 0x20 || *c >= 0x7f) {
+            append(json, "\\u%04x", *c);
+        } else {
+            append(json, "%c", *c);
+        }
+    }
+}
+
+static void append_request(json_buffer_t *json, const trace_record_t *record, int pid) {
+    int first = 0;
+    int last = TRACE_MARK_COUNT - 1;
+    while (first < TRACE_MARK_COUNT && record->marks[first] == 0) {
+        first++;
+    }
+    while (last > first && record->marks[last] == 0) {
+        last--;
+    }
+    if (first == TRACE_MARK_COUNT) {
+        return;
+    }
+
+    // The whole request, with its phases nested under it
+    append(json, "{\"name\":\"");
+    append_escaped(json, record->method);
+    append(json, " ");
+    append_escaped(json, record->path);
+    append(json, "\",\"cat\":\"request\",\"ph\":\"X\",\"pid\":%d,\"tid\":%llu,\"ts\":%.3f,\"dur\":%.3f,"
+                 "\"args\":{\"status\":%d}},\n",
+           pid, record->connection_id, record->marks[first] / 1000.0,
+           (record->marks[last] - record->marks[first]) / 1000.0, record->status_code);
+    for (int phase = 0; phase < TRACE_MARK_COUNT - 1; phase++) {
+        if (record->marks[phase] == 0 || record->marks[phase + 1] == 0) {
+            continue;
+        }
+        append(json, "{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"pid\":%d,\"tid\":%llu,"
+                     "\"ts\":%.3f,\"dur\":%.3f},\n",
+               phase_names[phase], pid, record->connection_id, record->marks[phase] / 1000.0,
+               (record->marks[phase + 1] - record->marks[phase]) / 1000.0);
+    }
+}
+
+static void append_close(json_buffer_t *json, const trace_record_t *record, int pid) {
+    append(json, "{\"name\":\"close\",\"cat\":\"connection\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%llu,"
+                 "\"ts\":%.3f,\"args\":{\"rtt_us\":%u,\"rttvar_us\":%u,\"total_retrans\":%u,\"snd_cwnd\":%u}},\n",
+           pid, record->connection_id, record->marks[0] / 1000.0,
+           record->rtt_us, record->rttvar_us, record->total_retrans, record->snd_cwnd);
+}
+
+char *trace_export_json(size_t *length) {
+    trace_record_t *records = malloc(sizeof(trace_record_t) * TRACE_RINGS * TRACE_RING_SIZE);
+    json_buffer_t json = { malloc(64 * 1024), 0, 64 * 1024, 0 };
+    if (!records || !json.data) {
+        free(records);
+        free(json.data);
+        return NULL;
+    }
+
+    int pid = (int)getpid();
+    size_t count = snapshot_records(records);
+    append(&json, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (size_t i = 0; i < count; i++) {
+        if (records[i].kind == TRACE_RECORD_CLOSE) {
+            append_close(&json, &records[i], pid);
+        } else {
+            append_request(&json, &records[i], pid);
+        }
+    }
+    // Closes the list without a trailing comma
+    append(&json, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"http_server %d\"}}\n]}\n",
+           pid, pid);
+    free(records);
+
+    if (json.failed) {
+        free(json.data);
+        return NULL;
+    }
+    *length = json.length;
+    return json.data;
+}
+
+int trace_dump(void) {
+    // Each dump gets a file of its own, since an old one is not replaced
+    static unsigned int dump_count = 0;
+    char path[64];
+    snprintf(path, sizeof(path), TRACE_DUMP_PATH_FORMAT, (int)getpid(), ++dump_count);
+
+    size_t length;
+    char *json = trace_export_json(&length);
+    if (!json) {
+        fprintf(stderr, "Failed to export the trace: out of memory\n");
+        return -1;
+    }
+    // /tmp is shared, so create the file rather than open whatever is there
+    FILE *file = NULL;
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd >= 0) {
+        file = fdopen(fd, "w");
+        if (!file) {
+            close(fd);
+        }
+    }
+    int failed = !file || fwrite(json, 1, length, file) != length;
+    if (file && fclose(file) != 0) {
+        failed = 1;
+    }
+    free(json);
+    if (failed) {
+        perror("Failed to write the trace");
+        return -1;
+    }
+    printf("Trace written to %s\n", path);
+    fflush(stdout);
+    return 0;
+}
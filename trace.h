@@ -0,0 +1,66 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include "http_request.h"
+
+// Per-request phase tracing for HTTP/1.1 connections. With --trace N every
+// request gets a monotonic timestamp at each phase boundary, and one in N
+// of them (plus any sent with "X-Trace: 1") is kept in a ring. A traced
+// connection also records its TCP_INFO when it closes. GET /debug/trace
+// and SIGUSR1 export the rings as Chrome trace-event JSON.
+#define TRACE_RINGS 16                  // Stripes, handed to threads like the metrics ones
+#define TRACE_RING_SIZE 256             // Records per ring; the oldest is overwritten
+#define TRACE_PATH_SIZE 64              // Leading bytes of the path kept with a request
+#define TRACE_DUMP_PATH_FORMAT "/tmp/http_server.%d.%u.trace.json" // Filled in with the pid and dump number
+
+// Phase boundaries of a request, in order. A phase runs from one mark to
+// the next: queue, read, parse, handle and send.
+#define TRACE_MARK_ACCEPTED 0   // accept() returned; only set for a connection's first request
+#define TRACE_MARK_READ     1   // The connection thread waits for the head, or its first byte arrived
+#define TRACE_MARK_HEAD     2   // The head is complete
+#define TRACE_MARK_PARSED   3
+#define TRACE_MARK_HANDLED  4   // The response is built (or found in the cache)
+#define TRACE_MARK_SENT     5
+#define TRACE_MARK_COUNT    6
+
+typedef struct {
+    unsigned long long id;           // Becomes the tid of the connection's events
+    unsigned long long accepted_ns;
+    int requests;
+    int traced;                      // A request was kept, so TCP_INFO is wanted at close
+} trace_connection_t;
+
+typedef struct {
+    int active;                      // Tracing is on; marks are being taken
+    unsigned long long marks[TRACE_MARK_COUNT];
+} trace_request_t;
+
+// Sample one request in sample_every; 0 keeps only requests that ask with
+// X-Trace. Tracing stays off unless this is called.
+void trace_configure(unsigned int sample_every);
+
+int trace_enabled(void);
+
+void trace_connection_begin(trace_connection_t *connection, unsigned long long accepted_ns);
+
+// Record TCP_INFO for a traced connection; call before closing the socket
+void trace_connection_end(trace_connection_t *connection, int socket);
+
+void trace_request_begin(trace_connection_t *connection, trace_request_t *trace);
+
+void trace_mark(trace_request_t *trace, int mark);
+
+// Keep the request's marks if it is sampled
+void trace_request_end(trace_connection_t *connection, trace_request_t *trace,
+                       const http_request_t *request, int status_code);
+
+// The kept records as Chrome trace-event JSON, in a buffer to free(), or NULL
+char *trace_export_json(size_t *length);
+
+// Write the JSON to a new TRACE_DUMP_PATH_FORMAT file, readable only by
+// the server's user. An existing file or symlink there is never followed
+// or overwritten. Returns 0 on success.
+int trace_dump(void);
+
+#endif
@@ -0,0 +1,258 @@
+#define _GNU_SOURCE // close_range(), MSG_CMSG_CLOEXEC
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "upgrade.h"
+#include "listener.h"
+#include "utils.h"
+
+#define UPGRADE_CHANNEL_FD 3   // Where the new binary finds its end of the socket pair
+#define UPGRADE_READY 'R'      // Sent by the new binary once it owns the listeners
+
+extern char **environ;
+
+static char executable[PATH_MAX];
+static char **arguments = NULL;
+static int channel = -1;        // To the process being upgraded, until upgrade_ready()
+
+// Read the listening sockets sent with SCM_RIGHTS. Returns how many
+// arrived, or -1.
+static int receive_sockets(int fd, int *sockets, int max_sockets) {
+    union {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int) * MAX_LISTENERS)];
+    } control;
+    unsigned char count;
+    struct iovec data = { &count, 1 };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    ssize_t received;
+    do {
+        received = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+    if (received != 1 || (message.msg_flags & MSG_CTRUNC)) {
+        return -1;
+    }
+
+    int found = 0;
+    for (struct cmsghdr *header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+        if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        int n = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int i = 0; i < n; i++) {
+            int socket_fd;
+            memcpy(&socket_fd, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+            if (found < max_sockets) {
+                sockets[found++] = socket_fd;
+            } else {
+                close(socket_fd);
+            }
+        }
+    }
+    return found == count ? found : -1;
+}
+
+static int send_sockets(int fd, const int *sockets, int socket_count) {
+    union {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int) * MAX_LISTENERS)];
+    } control;
+    memset(&control, 0, sizeof(control));
+    unsigned char count = (unsigned char)socket_count;
+    struct iovec data = { &count, 1 };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = CMSG_SPACE(sizeof(int) * socket_count);
+
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int) * socket_count);
+    memcpy(CMSG_DATA(header), sockets, sizeof(int) * socket_count);
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    return sent == 1 ? 0 : -1;
+}
+
+// Wait for the new binary to report that it owns the listeners. Returns 0,
+// or -1 when it exited or took too long.
+static int wait_ready(int fd) {
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (1) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long waited_ms = (now.tv_sec - start.tv_sec) * 1000L + (now.tv_nsec - start.tv_nsec) / 1000000L;
+        if (waited_ms >= UPGRADE_READY_TIMEOUT_MS) {
+            return -1;
+        }
+
+        struct pollfd poll_fd = { fd, POLLIN, 0 };
+        int ready = poll(&poll_fd, 1, UPGRADE_READY_TIMEOUT_MS - waited_ms);
+        if (ready < 0 && errno == EINTR) {
+            continue; // Another signal; keep waiting out the same deadline
+        }
+        if (ready <= 0) {
+            return -1;
+        }
+
+        char reply;
+        return read(fd, &reply, 1) == 1 && reply == UPGRADE_READY ? 0 : -1;
+    }
+}
+
+// The current environment with the channel variable set
+static char **upgrade_environment(void) {
+    static char variable[64];
+    snprintf(variable, sizeof(variable), "%s=%d", UPGRADE_FD_ENV, UPGRADE_CHANNEL_FD);
+    size_t name_length = strlen(UPGRADE_FD_ENV);
+
+    size_t count = 0;
+    while (environ[count]) {
+        count++;
+    }
+    char **environment = malloc((count + 2) * sizeof(char *));
+    if (!environment) {
+        return NULL;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (strncmp(environ[i], UPGRADE_FD_ENV, name_length) != 0 || environ[i][name_length] != '=') {
+            environment[n++] = environ[i];
+        }
+    }
+    environment[n++] = variable;
+    environment[n] = NULL;
+    return environment;
+}
+
+int upgrade_init(char *argv[]) {
+    // Resolved now: a deploy that renames a new binary over this path
+    // makes /proc/self/exe point at the deleted old one
+    ssize_t length = readlink("/proc/self/exe", executable, sizeof(executable) - 1);
+    if (length > 0) {
+        executable[length] = '\0';
+    } else {
+        snprintf(executable, sizeof(executable), "%s", argv[0]);
+    }
+    arguments = argv;
+
+    const char *channel_text = getenv(UPGRADE_FD_ENV);
+    if (!channel_text) {
+        return 0;
+    }
+    int fd = string_to_int(channel_text);
+    unsetenv(UPGRADE_FD_ENV); // Not passed on to anything this process starts
+    if (fd < 0) {
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    int sockets[MAX_LISTENERS];
+    int received = receive_sockets(fd, sockets, MAX_LISTENERS);
+    if (received < 0) {
+        fprintf(stderr, "Failed to receive the listening sockets from process %d\n", (int)getppid());
+        close(fd);
+        return -1;
+    }
+    listener_inherit(sockets, received);
+    channel = fd;
+    printf("Taking over %d listening sockets from process %d\n", received, (int)getppid());
+    return 0;
+}
+
+void upgrade_ready(void) {
+    if (channel < 0) {
+        return;
+    }
+    char ready = UPGRADE_READY;
+    if (send(channel, &ready, 1, MSG_NOSIGNAL) != 1) {
+        perror("Failed to tell the old process to stop accepting");
+    }
+    close(channel);
+    channel = -1;
+}
+
+int upgrade_handoff(void) {
+    int sockets[MAX_LISTENERS];
+    int socket_count = listener_sockets(sockets, MAX_LISTENERS);
+    if (!arguments || socket_count == 0) {
+        return -1;
+    }
+
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0) {
+        perror("Upgrade failed: socketpair");
+        return -1;
+    }
+    char **environment = upgrade_environment();
+    if (!environment) {
+        close(pair[0]);
+        close(pair[1]);
+        return -1;
+    }
+
+    // Anything still buffered would otherwise be written twice
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Only async-signal-safe calls between fork() and exec in a threaded process
+        if (pair[1] == UPGRADE_CHANNEL_FD) {
+            fcntl(pair[1], F_SETFD, 0);
+        } else {
+            dup2(pair[1], UPGRADE_CHANNEL_FD); // The duplicate is not close-on-exec
+        }
+        close_range(UPGRADE_CHANNEL_FD + 1, ~0U, 0);
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        execve(executable, arguments, environment);
+        _exit(127);
+    }
+    free(environment);
+    close(pair[1]);
+    if (pid < 0) {
+        perror("Upgrade failed: fork");
+        close(pair[0]);
+        return -1;
+    }
+    printf("Upgrading: started %s as process %d\n", executable, (int)pid);
+    fflush(stdout);
+
+    if (send_sockets(pair[0], sockets, socket_count) != 0 || wait_ready(pair[0]) != 0) {
+        fprintf(stderr, "Upgrade failed: process %d did not take over the listeners; still serving\n", (int)pid);
+        close(pair[0]);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    close(pair[0]);
+    printf("Process %d took over %d listening sockets; no longer accepting\n", (int)pid, socket_count);
+    fflush(stdout);
+    return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#define UPGRADE_FD_ENV "HTTP_SERVER_UPGRADE_FD"   // Set for a binary started by a hot upgrade
+#define UPGRADE_READY_TIMEOUT_MS 10000           // How long the new binary has to take over
+
+// Remember how this binary was started so that it can be run again on an
+// upgrade. When this process is itself the result of an upgrade, also
+// receive the listening sockets the old process passed on; the listeners
+// then adopt them instead of binding. Call before opening the listeners.
+int upgrade_init(char *argv[]);
+
+// In a process started by an upgrade: tell the old process that the
+// listeners are taken over, so it can stop accepting and drain
+void upgrade_ready(void);
+
+// Start a fresh copy of the binary (with the same arguments) and hand it
+// every listening socket over a Unix socket pair (SCM_RIGHTS). Returns 0
+// once the new process has the listeners; the caller then stops
+// accepting and drains. Returns -1 if the new process failed to start,
+// in which case this one keeps serving.
+int upgrade_handoff(void);
+
+#endif
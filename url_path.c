@@ -0,0 +1,208 @@
+#include <stdint.h>
+#include <string.h>
+#include "url_path.h"
+
+#define ONES  0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+// Non-zero when any byte of word equals the byte replicated in pattern
+static inline uint64_t has_byte(uint64_t word, uint64_t pattern) {
+    uint64_t x = word ^ pattern;
+    return (x - ONES) & ~x & HIGHS;
+}
+
+// Non-zero when any byte of word is below 0x20, a control character
+static inline uint64_t has_control(uint64_t word) {
+    return (word - 0x20 * ONES) & ~word & HIGHS;
+}
+
+static inline int is_control(char c) {
+    return (unsigned char)c < 0x20 || c == 0x7f;
+}
+
+// Check eight bytes at a time whether the path can be used as is. Most
+// request paths contain no escapes, query, dot segments, double slashes or
+// control characters, so they skip the rewriting pass entirely.
+static int is_canonical(const char *path, size_t length) {
+    if (length == 0 || path[0] != '/') {
+        return 0;
+    }
+
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, path + i, sizeof(word));
+        if (has_byte(word, '%' * ONES) | has_byte(word, '?' * ONES) | has_byte(word, '#' * ONES) |
+            has_byte(word, '/' * ONES) | has_byte(word, 0x7f * ONES) | has_control(word)) {
+            // Only look closer at words that contain something interesting
+            for (size_t j = i; j < i + 8; j++) {
+                char c = path[j];
+                if (c == '%' || c == '?' || c == '#' || is_control(c)) {
+                    return 0;
+                }
+                if (c == '/' && (path[j + 1] == '/' || path[j + 1] == '.')) {
+                    return 0;
+                }
+            }
+        }
+    }
+    for (; i < length; i++) {
+        char c = path[i];
+        if (c == '%' || c == '?' || c == '#' || is_control(c)) {
+            return 0;
+        }
+        if (c == '/' && (path[i + 1] == '/' || path[i + 1] == '.')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Finish the segment that starts at segment_start in the output: drop it if
+// it is empty or ".", and drop it together with its parent if it is "..".
+// Returns the new output length.
+static size_t close_segment(char *path, size_t segment_start, size_t out) {
+    size_t segment_length = out - segment_start;
+
+    if (segment_length == 0 || (segment_length == 1 && path[segment_start] == '.')) {
+        return segment_start;
+    }
+
+    if (segment_length == 2 && path[segment_start] == '.' && path[segment_start + 1] == '.') {
+        // segment_start - 1 is the slash before "..", back up to the slash before that
+        size_t parent = segment_start - 1;
+        while (parent > 0 && path[parent - 1] != '/') {
+            parent--;
+        }
+        return parent > 0 ? parent : 1;
+    }
+
+    // Keep the segment and start the next one after a slash
+    path[out] = '/';
+    return out + 1;
+}
+
+int normalize_url_path(char *path, char *query, size_t query_size) {
+    if (!path) {
+        return -1;
+    }
+    if (query && query_size > 0) {
+        query[0] = '\0';
+    }
+
+    size_t length = strlen(path);
+    if (is_canonical(path, length)) {
+        return 0;
+    }
+
+    size_t in = 0;
+
+    // Absolute-form targets ("http://host/path") carry the path after the authority
+    if (strncmp(path, "http://", 7) == 0 || strncmp(path, "https://", 8) == 0) {
+        const char *authority_end = strchr(path + (path[4] == 's' ? 8 : 7), '/');
+        if (!authority_end) {
+            strcpy(path, "/");
+            return 0;
+        }
+        in = authority_end - path;
+    }
+
+    if (path[in] != '/') {
+        return -1;
+    }
+    path[0] = '/';
+
+    // The output never grows past the input, so the rewrite happens in place.
+    // out always points just past a slash, at the start of the current segment.
+    size_t out = 1;
+    size_t segment_start = 1;
+    in++;
+
+    while (in < length) {
+        char c = path[in];
+
+        if (c == '?' || c == '#') {
+            if (c == '?' && query && query_size > 0) {
+                // Copy the query out before the output could overwrite it
+                size_t query_length = strcspn(path + in + 1, "#");
+                if (query_length >= query_size) {
+                    query_length = query_size - 1;
+                }
+                memmove(query, path + in + 1, query_length);
+                query[query_length] = '\0';
+            }
+            break;
+        }
+
+        if (c == '%') {
+            int high = hex_value(path[in + 1]);
+            int low = high >= 0 ? hex_value(path[in + 2]) : -1;
+            if (high < 0 || low < 0) {
+                return -1;
+            }
+            c = (char)(high * 16 + low);
+            in += 3;
+        } else {
+            in++;
+        }
+
+        // Control characters, decoded or not, have no place in a path and
+        // would end up in file names and logs
+        if (is_control(c)) {
+            return -1;
+        }
+
+        if (c == '/') {
+            out = close_segment(path, segment_start, out);
+            segment_start = out;
+        } else {
+            path[out++] = c;
+        }
+    }
+
+    // A trailing "." or ".." resolves to a directory and keeps its slash
+    size_t last_length = out - segment_start;
+    if ((last_length == 1 && path[segment_start] == '.') ||
+        (last_length == 2 && path[segment_start] == '.' && path[segment_start + 1] == '.')) {
+        out = close_segment(path, segment_start, out);
+    }
+
+    path[out] = '\0';
+    return 0;
+}
+
+int encode_url_path(const char *path, char *out, size_t out_size) {
+    static const char hex[] = "0123456789ABCDEF";
+    size_t length = 0;
+    for (const unsigned char *c = (const unsigned char *)path; *c; c++) {
+        int plain = (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') ||
+                    strchr("/-._~!$&'()*+,;=:@", *c) != NULL;
+        size_t needed = plain ? 1 : 3;
+        if (length + needed >= out_size) {
+            return -1;
+        }
+        if (plain) {
+            out[length++] = (char)*c;
+        } else {
+            out[length++] = '%';
+            out[length++] = hex[*c >> 4];
+            out[length++] = hex[*c & 0xf];
+        }
+    }
+    if (out_size == 0) {
+        return -1;
+    }
+    out[length] = '\0';
+    return (int)length;
+}
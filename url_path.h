@@ -0,0 +1,19 @@
+#ifndef URL_PATH_H
+#define URL_PATH_H
+
+#include <stddef.h>
+
+// Turn a request target into its canonical path, in place and without
+// allocating: the query string is split off into query, %xx escapes are
+// decoded, "." and ".." segments are resolved (never above the root) and
+// repeated slashes are collapsed. Returns 0 on success or -1 when the
+// target is malformed (bad escape, a control character such as an encoded
+// NUL or CR, not a path).
+int normalize_url_path(char *path, char *query, size_t query_size);
+
+// The reverse for a canonical path: escape every byte a path cannot hold
+// as it is. Returns the length written, or -1 when it does not fit in
+// out_size with its NUL.
+int encode_url_path(const char *path, char *out, size_t out_size);
+
+#endif
@@ -3,7 +3,10 @@
 #include <limits.h>
 #include <ctype.h>
 #include <sys/stat.h>
+#include <pthread.h>
+#include <sys/socket.h>
 #include "utils.h"
+#include "tls.h"
 
 int string_to_int(const char *string) {
     // Check for null pointer
@@ -57,4 +60,49 @@ int string_to_int(const char *string) {
     }
     
     return (int)(value * sign);
-}
\ No newline at end of file
+}
+
+int send_all(int socket, const void *data, size_t length) {
+    return send_all_flags(socket, data, length, 0);
+}
+
+int send_all_flags(int socket, const void *data, size_t length, int flags) {
+    const char *bytes = data;
+    int encrypted = tls_active(socket);
+    while (length > 0) {
+        // MSG_NOSIGNAL: a client that hung up is an error, not a SIGPIPE
+        ssize_t sent = encrypted ? tls_send(socket, bytes, length) : send(socket, bytes, length, MSG_NOSIGNAL | flags);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bytes += sent;
+        length -= sent;
+    }
+    return 0;
+}
+ssize_t recv_some(int socket, void *buffer, size_t length) {
+    if (tls_active(socket)) {
+        return tls_recv(socket, buffer, length);
+    }
+    return recv(socket, buffer, length, 0);
+}
+
+int start_detached_thread(void *(*start)(void *), void *arg, size_t stack_size) {
+    pthread_attr_t attributes;
+    if (pthread_attr_init(&attributes) != 0) {
+        return -1;
+    }
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    // A size the system refuses leaves its default in place
+    if (stack_size > 0) {
+        pthread_attr_setstacksize(&attributes, stack_size);
+    }
+    
+    pthread_t thread_id;
+    int result = pthread_create(&thread_id, &attributes, start, arg);
+    pthread_attr_destroy(&attributes);
+    return result == 0 ? 0 : -1;
+}
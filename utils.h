@@ -1,6 +1,24 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stddef.h>
+#include <sys/types.h>
+
 int string_to_int(const char *string);
 
+// Send the whole buffer, retrying on short writes. Returns 0 on success.
+int send_all(int socket, const void *data, size_t length);
+
+// send_all() with extra send() flags such as MSG_MORE. TLS connections
+// ignore them; each write becomes its own record.
+int send_all_flags(int socket, const void *data, size_t length, int flags);
+
+// Receive whatever is available, like recv(), decrypting when the
+// connection is TLS. Returns the bytes read, 0 at end of stream or -1.
+ssize_t recv_some(int socket, void *buffer, size_t length);
+
+// Start a detached thread with the given stack size (0 for the system
+// default). Returns 0 on success.
+int start_detached_thread(void *(*start)(void *), void *arg, size_t stack_size);
+
 #endif
\ No newline at end of file
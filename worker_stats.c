@@ -0,0 +1,221 @@
+#define _GNU_SOURCE // MAP_ANONYMOUS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "worker_stats.h"
+#include "stats_segment.h"
+#include "conn_manager.h"
+#include "rate_limiter.h"
+#include "route_handler.h"
+
+static stats_segment_t *segment = NULL;   // Shared by the master and every worker process
+static char segment_path[64] = "";        // Empty when the segment is anonymous
+static int own_slot = -1;
+static unsigned long long baseline_rss = 0;
+
+// Request threads publish fresh numbers for /stats while the publisher
+// thread runs, and a slot must only ever have one writer at a time
+static pthread_mutex_t publish_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Resident set size from /proc, 0 where it cannot be read
+static unsigned long long resident_bytes(void) {
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (!statm) {
+        return 0;
+    }
+    unsigned long long size_pages = 0;
+    unsigned long long resident_pages = 0;
+    if (fscanf(statm, "%llu %llu", &size_pages, &resident_pages) != 2) {
+        resident_pages = 0;
+    }
+    fclose(statm);
+    return resident_pages * (unsigned long long)sysconf(_SC_PAGESIZE);
+}
+
+// Counters of this process, read from the modules that keep them
+static void snapshot(worker_stats_t *stats) {
+    memset(stats, 0, sizeof(worker_stats_t));
+    stats->pid = getpid();
+    stats->active_connections = conn_manager_active();
+    for (int i = 0; i < EXECUTOR_CLASS_COUNT; i++) {
+        executor_get_stats(i, &stats->executors[i]);
+    }
+    stats->rate_limited = rate_limiter_refused();
+    tls_get_stats(&stats->tls);
+    metrics_get(&stats->requests);
+    stats->rss_bytes = resident_bytes();
+    stats->baseline_rss_bytes = baseline_rss;
+}
+
+// Copy this process's counters into its slot. Readers in other processes
+// never block the writer; the slot's seqlock makes them retry instead.
+static void publish(void) {
+    worker_stats_t local;
+    snapshot(&local);
+
+    pthread_mutex_lock(&publish_mutex);
+    stats_slot_write(&segment->slots[own_slot], &local);
+    pthread_mutex_unlock(&publish_mutex);
+}
+
+static void *publish_loop(void *arg) {
+    (void)arg;
+    struct timespec interval = {0, STATS_PUBLISH_INTERVAL_MS * 1000000L};
+    while (1) {
+        publish();
+        nanosleep(&interval, NULL);
+    }
+    return NULL;
+}
+
+// Names readers outside the server need to label the counters
+static void describe(stats_header_t *header, int workers) {
+    header->server_pid = getpid();
+    header->workers = workers;
+    header->started = (long long)time(NULL);
+
+    for (int i = 0; i < EXECUTOR_CLASS_COUNT; i++) {
+        executor_stats_t stats;
+        executor_get_stats(i, &stats);
+        snprintf(header->executor_names[i], STATS_NAME_SIZE, "%s", stats.name ? stats.name : "");
+    }
+    header->route_count = get_route_count();
+    for (int i = 0; i < header->route_count; i++) {
+        snprintf(header->route_names[i], STATS_NAME_SIZE, "%s", get_route(i)->prefix);
+    }
+    snprintf(header->route_names[METRICS_ROUTE_OTHER], STATS_NAME_SIZE, "(no route)");
+}
+
+int worker_stats_create(int workers) {
+    int slot_count = workers > 0 ? workers : 1;
+
+    snprintf(segment_path, sizeof(segment_path), STATS_SEGMENT_PATH_FORMAT, (int)getpid());
+    segment = stats_segment_create(segment_path, slot_count);
+    if (!segment) {
+        // Still shared with the workers, just not visible to other tools
+        segment_path[0] = '\0';
+        void *mapping = mmap(NULL, stats_segment_size(slot_count), PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED) {
+            perror("Failed to map the shared stats segment");
+            return -1;
+        }
+        segment = mapping; // Pages of an anonymous mapping start zeroed
+        segment->header.slot_count = slot_count;
+    }
+    describe(&segment->header, workers);
+
+    if (segment_path[0]) {
+        printf("Publishing stats in %s\n", segment_path);
+    }
+    return 0;
+}
+
+void worker_stats_remove(void) {
+    if (segment && segment_path[0] && segment->header.server_pid == getpid()) {
+        unlink(segment_path);
+    }
+}
+
+int worker_stats_workers(void) {
+    return segment ? segment->header.workers : 0;
+}
+
+int worker_stats_attach(int index) {
+    if (!segment || index < 0 || index >= segment->header.slot_count) {
+        return -1;
+    }
+    own_slot = index;
+    segment->slots[index].pid = getpid();
+    baseline_rss = resident_bytes();
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, publish_loop, NULL) != 0) {
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+void worker_stats_set_pid(int index, pid_t pid) {
+    if (segment && index >= 0 && index < segment->header.slot_count) {
+        segment->slots[index].pid = pid;
+    }
+}
+
+void worker_stats_count_restart(int index) {
+    if (segment && index >= 0 && index < segment->header.slot_count) {
+        segment->slots[index].restarts++;
+    }
+}
+
+void worker_stats_retire(int index) {
+    if (segment && index >= 0 && index < segment->header.slot_count) {
+        stats_slot_retire(&segment->slots[index]);
+    }
+}
+
+// A slot's counters as last published, and optionally its retired ones
+static void read_slot(int index, worker_stats_t *stats, worker_stats_t *retired) {
+    if (index == own_slot) {
+        publish(); // Our own numbers can be fresh rather than up to an interval old
+    }
+    stats_slot_read(&segment->slots[index], stats, retired);
+    stats->pid = segment->slots[index].pid;
+    stats->restarts = segment->slots[index].restarts;
+}
+
+void worker_stats_get(int index, worker_stats_t *stats) {
+    if (!segment || index < 0 || index >= segment->header.slot_count) {
+        memset(stats, 0, sizeof(worker_stats_t));
+        return;
+    }
+    read_slot(index, stats, NULL);
+}
+
+void worker_stats_total(worker_stats_t *total) {
+    snapshot(total);
+    int workers = worker_stats_workers();
+    if (workers == 0) {
+        return;
+    }
+
+    // Start the sums from zero, keeping the executor names of the local snapshot
+    total->pid = 0;
+    total->active_connections = 0;
+    total->rate_limited = 0;
+    memset(&total->tls, 0, sizeof(total->tls));
+    memset(&total->requests, 0, sizeof(total->requests));
+    total->rss_bytes = 0;
+    total->baseline_rss_bytes = 0;
+    for (int c = 0; c < EXECUTOR_CLASS_COUNT; c++) {
+        const char *name = total->executors[c].name;
+        memset(&total->executors[c], 0, sizeof(executor_stats_t));
+        total->executors[c].name = name;
+    }
+
+    for (int i = 0; i < workers; i++) {
+        // Read together, so a worker retired in between is counted once
+        worker_stats_t worker;
+        worker_stats_t retired;
+        read_slot(i, &worker, &retired);
+        total->restarts += worker.restarts;
+        stats_add_counters(total, &retired);
+        if (worker.pid == 0) {
+            continue;
+        }
+        total->active_connections += worker.active_connections;
+        total->rss_bytes += worker.rss_bytes;
+        total->baseline_rss_bytes += worker.baseline_rss_bytes;
+        for (int c = 0; c < EXECUTOR_CLASS_COUNT; c++) {
+            total->executors[c].workers += worker.executors[c].workers;
+            total->executors[c].queue_capacity += worker.executors[c].queue_capacity;
+            total->executors[c].queue_depth += worker.executors[c].queue_depth;
+        }
+        stats_add_counters(total, &worker);
+    }
+}
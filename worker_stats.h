@@ -0,0 +1,57 @@
+#ifndef WORKER_STATS_H
+#define WORKER_STATS_H
+
+#include <sys/types.h>
+#include "executor.h"
+#include "tls.h"
+#include "metrics.h"
+
+#define STATS_PUBLISH_INTERVAL_MS 250   // How often a worker process refreshes its slot
+
+// Counters of one worker process, or the sum over all of them
+typedef struct {
+    pid_t pid;                      // 0 for a slot whose worker is not running
+    unsigned long long restarts;    // Times the supervisor replaced this worker
+    int active_connections;
+    executor_stats_t executors[EXECUTOR_CLASS_COUNT];
+    unsigned long long rate_limited;
+    tls_stats_t tls;
+    request_metrics_t requests;
+    unsigned long long rss_bytes;            // Resident memory of the process
+    unsigned long long baseline_rss_bytes;   // Resident memory once started, before any connection
+} worker_stats_t;
+
+// Create the shared stats segment (see stats_segment.h) with one slot per
+// worker process, or a single slot when workers is 0. Called by the master
+// before forking so every worker maps the same pages. Falls back to an
+// anonymous mapping, which only the server itself can read, when the
+// segment file cannot be created.
+int worker_stats_create(int workers);
+
+// Remove the segment file; only the process that created it does so
+void worker_stats_remove(void);
+
+// Number of worker processes, 0 when the server runs as a single process
+int worker_stats_workers(void);
+
+// In a worker (or the only process): take over slot index and start
+// publishing this process's counters into it
+int worker_stats_attach(int index);
+
+// Supervisor bookkeeping for a slot
+void worker_stats_set_pid(int index, pid_t pid);
+void worker_stats_count_restart(int index);
+
+// Once the slot's worker has exited, keep its final counters in the slot's
+// totals so they do not start again from zero with its replacement
+void worker_stats_retire(int index);
+
+// Copy one worker's slot as last published
+void worker_stats_get(int index, worker_stats_t *stats);
+
+// This process's counters, or the sum over every worker process (with
+// executor sizes added up and maximums kept) when there are several,
+// including what exited workers counted
+void worker_stats_total(worker_stats_t *total);
+
+#endif